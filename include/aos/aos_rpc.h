@@ -16,6 +16,7 @@
 #define _LIB_BARRELFISH_AOS_MESSAGES_H
 
 #include <aos/aos.h>
+#include <aos/spawn_trace.h>
 
 #define LMP_MessageType_ProcessDeregister          URPC_MessageType_User0
 #define LMP_MessageType_ProcessDeregisterNotify    URPC_MessageType_User0
@@ -55,6 +56,22 @@ errval_t aos_rpc_serial_getchar(struct aos_rpc *chan, char *retc);
  */
 errval_t aos_rpc_serial_putchar(struct aos_rpc *chan, char c);
 
+/**
+ * \brief send a string of at most TERMINAL_WRITE_MAX bytes to the serial
+ * port in a single exchange
+ */
+errval_t aos_rpc_serial_write(struct aos_rpc *chan, const char *buf, size_t len);
+
+/**
+ * \brief read up to `len` characters from the serial port in a single
+ * exchange. A bulk read returns whatever is buffered once at least one
+ * character arrived, a line read blocks until a line was entered (echo and
+ * line editing happen in the terminal). `end` (optional) returns the
+ * character that ended the line.
+ */
+errval_t aos_rpc_serial_read(struct aos_rpc *chan, char *buf, size_t len,
+                             bool line, size_t *ret_len, char *end);
+
 /**
  * \brief Request process manager to start a new process
  * \arg name the name of the process that needs to be spawned (without a
@@ -78,6 +95,39 @@ errval_t aos_rpc_process_spawn_with_terminal(struct aos_rpc *chan,
                                              domainid_t terminal_pid,
                                              domainid_t *newpid);
 
+/**
+ * \brief Request process manager to start `count` instances of a process in
+ * a single exchange
+ * \arg name the name of the process that needs to be spawned (without a
+ *           path prefix)
+ * \arg pids array of `count` entries for the process ids of the new processes
+ * \arg ret_count the number of processes actually spawned
+ */
+errval_t aos_rpc_process_spawn_batch(struct aos_rpc *chan, char *name,
+                                     coreid_t core, size_t count,
+                                     domainid_t *pids, size_t *ret_count);
+
+/**
+ * \brief Request process manager to start a new process from a file on this
+ * core. The ELF segments are streamed from the file into the new process.
+ * \arg cmd the path of the binary followed by the arguments
+ * \arg terminal_pid the process id of the terminal process to be used by the
+                     new process
+ * \arg version the version of the file from stat(), init caches the image by
+                path, size and version (0 if unknown, the image is not cached)
+ * \arg newpid the process id of the newly spawned process
+ */
+errval_t aos_rpc_process_spawn_file(struct aos_rpc *chan, char *cmd,
+                                    domainid_t terminal_pid, uint32_t version,
+                                    domainid_t *newpid);
+
+/**
+ * \brief Get the spawn phase histograms of this core's init
+ * \arg msg a newly allocated struct spawn_trace_msg (free with free())
+ */
+errval_t aos_rpc_get_spawn_stats(struct aos_rpc *chan,
+                                 struct spawn_trace_msg **msg);
+
 /**
  * \brief Get name of process with id pid.
  * \arg pid the process id to lookup
@@ -123,10 +173,23 @@ errval_t aos_rpc_get_module_list(struct aos_rpc *chan,
 
 /**
  * \brief Returns the frame and module size of module "name".
+ *
+ * The module list and frames are cached by the client, only the first
+ * lookup of a module asks init. The returned frame is a copy owned by the
+ * caller.
  */
 errval_t aos_rpc_get_module_frame(struct aos_rpc *chan, char *name,
                                   struct capref *frame, size_t *ret_bytes);
 
+/**
+ * \brief Returns a read-only mapping and the size of module "name".
+ *
+ * The mapping is shared by all callers and stays valid for the lifetime of
+ * the process, it must not be unmapped.
+ */
+errval_t aos_rpc_map_module(struct aos_rpc *chan, const char *name,
+                            void **buf, size_t *ret_bytes);
+
 
 /**
  * \brief Deregister process with init. Will not return;
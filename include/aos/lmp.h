@@ -53,7 +53,21 @@
  *
  * arg0: enum lmp_request_type RequestType = LMP_RequestType_Spawn
  * arg1: coreid_t Core ID
- * arg2-8: char[] Name
+ * arg2: domainid_t Terminal PID
+ * arg3: size_t Number of instances
+ * arg4: size_t File size (0 to spawn from the boot image)
+ * arg5: uint32_t File version (0 if unknown)
+ * arg6-8: char[] Name
+ *
+ * cap: NULL_CAP
+ *
+ * A non-zero file size in the header requests a spawn from a file of the
+ * client (first word of the name is the path, only on the client's core).
+ *
+ * ==== SpawnFileRead ====
+ *
+ * arg0: enum lmp_request_type RequestType = LMP_RequestType_SpawnFileRead
+ * arg1: errval_t Status code
  *
  * cap: NULL_CAP
  *
@@ -127,14 +141,28 @@
  *
  * cap: NULL_CAP
  *
+ * ==== SpawnFileRead (sent by init while handling a file spawn) ====
+ *
+ * arg0: enum lmp_request_type RequestType = LMP_RequestType_SpawnFileRead
+ * arg1: size_t Offset in the frame
+ * arg2: size_t Offset in the file
+ * arg3: size_t Number of bytes to copy
+ *
+ * cap: Frame to copy the file data into
+ *
  * ==== Spawn ====
  *
  * arg0: enum lmp_request_type RequestType = LMP_RequestType_Spawn
  * arg1: errval_t Status code
  * arg2: domainid_t Process ID of new process
+ * arg3: size_t Number of processes spawned
  *
  * cap:
  *
+ * A request for other than one instance is answered with a buffer of type
+ * LMP_RequestType_Spawn instead: struct lmp_spawn_batch_reply with the PIDs
+ * of all new processes.
+ *
  * ==== PidDiscover ====
  *
  * arg0: enum lmp_request_type RequestType = LMP_RequestType_PidDiscover
@@ -164,6 +192,19 @@
  *
  * cap: Frame capability to device
  *
+ * ==== ModuleList (sent as buffer) ====
+ *
+ * uint32_t Number of modules
+ * char[] Null-terminated module names
+ *
+ * ==== ModuleFrame ====
+ *
+ * arg0: enum lmp_request_type RequestType = LMP_RequestType_ModuleFrame
+ * arg1: errval_t Error
+ * arg2: size_t Module size
+ *
+ * cap: Frame capability to the module
+ *
  */
 
 extern unsigned serial_console_port;
@@ -198,7 +239,9 @@ enum lmp_request_type {
     LMP_RequestType_LmpBind,
 
     LMP_RequestType_ProcessDeregister,
-    LMP_RequestType_ProcessDeregisterNotify
+    LMP_RequestType_ProcessDeregisterNotify,
+    LMP_RequestType_SpawnStats,     // 25
+    LMP_RequestType_SpawnFileRead
 };
 
 typedef errval_t (*lmp_server_spawn_handler)(char *name,
@@ -206,6 +249,35 @@ typedef errval_t (*lmp_server_spawn_handler)(char *name,
                                              domainid_t terminal_pid,
                                              domainid_t *pid);
 
+// Reply to a spawn request for other than one instance
+struct lmp_spawn_batch_reply {
+    errval_t err;
+    uint32_t count;
+    domainid_t pids[];
+};
+
+// Completion of an asynchronous spawn with the PIDs of all new processes
+typedef void (*lmp_server_spawn_callback)(void *arg, errval_t err,
+                                          domainid_t *pids, size_t count);
+
+typedef errval_t (*lmp_server_spawn_async_handler)(char *name,
+                                                   coreid_t coreid,
+                                                   domainid_t terminal_pid,
+                                                   size_t count,
+                                                   lmp_server_spawn_callback callback,
+                                                   void *arg);
+
+// Spawn `cmd` from a file of the client on lc (see lmp_server_spawn_file_fill)
+typedef errval_t (*lmp_server_spawn_file_handler)(char *cmd,
+                                                  domainid_t terminal_pid,
+                                                  size_t file_size,
+                                                  uint32_t file_version,
+                                                  struct lmp_chan *lc,
+                                                  domainid_t *pid);
+
+// Returns a newly allocated struct spawn_trace_msg
+typedef errval_t (*lmp_server_spawn_stats_handler)(void **buf, size_t *size);
+
 typedef errval_t (*ram_free_handler_t)(struct capref);
 
 
@@ -219,6 +291,8 @@ errval_t lmp_server_memory_free(struct lmp_chan *lc, struct capref cap);
 errval_t lmp_server_pid_discovery(struct lmp_chan *lc);
 errval_t lmp_server_process_deregister(struct lmp_chan *lc);
 errval_t lmp_server_process_deregister_notify(struct lmp_chan *lc, domainid_t pid);
+void lmp_server_spawn_stats_register_handler(lmp_server_spawn_stats_handler handler);
+errval_t lmp_server_spawn_stats(struct lmp_chan *lc);
 
 errval_t lmp_server_device_cap(struct lmp_chan *lc, lpaddr_t paddr, size_t bytes);
 
@@ -268,11 +342,29 @@ errval_t lmp_recv_buffer_from_msg(struct lmp_chan *lc, struct capref cap,
 /* MARK: - ========== Spawn ========== */
 
 void lmp_server_spawn_register_handler(lmp_server_spawn_handler handler);
+void lmp_server_spawn_register_async_handler(lmp_server_spawn_async_handler handler);
+void lmp_server_spawn_register_file_handler(lmp_server_spawn_file_handler handler);
+
+// Let the client of a file spawn copy part of the image into a frame
+errval_t lmp_server_spawn_file_fill(struct lmp_chan *lc, struct capref frame,
+                                    size_t frame_offset, size_t file_offset,
+                                    size_t bytes);
 
 // Send a name on a specific channel (automatically select protocol)
 errval_t lmp_send_spawn(struct lmp_chan *lc, const char *name, coreid_t core,
                         domainid_t terminal_pid);
 
+// Send a request for `count` instances of a process (automatically select protocol)
+errval_t lmp_send_spawn_batch(struct lmp_chan *lc, const char *name, coreid_t core,
+                              domainid_t terminal_pid, size_t count);
+
+// Send a request to spawn `cmd` from a file of `file_size` bytes on this core
+// (init caches the image by path, size and `file_version` unless it is 0),
+// the client then has to serve LMP_RequestType_SpawnFileRead until the reply
+errval_t lmp_send_spawn_file(struct lmp_chan *lc, const char *cmd,
+                             domainid_t terminal_pid, size_t file_size,
+                             uint32_t file_version);
+
 // Blocking call to receive a spawn process name on a channel (automatically select protocol)
 errval_t lmp_recv_spawn(struct lmp_chan *lc, char **name);
 
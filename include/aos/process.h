@@ -3,8 +3,22 @@
 
 #include "aos/lmp_chan.h"
 
+// PIDs carry the core that assigned them in their upper bits, so every core
+// allocates PIDs from its own range without asking the others
+#define PROCESS_PID_CORE_SHIFT  16
+#define PROCESS_PID(core, n)    (((domainid_t) (core) << PROCESS_PID_CORE_SHIFT) | (n))
+#define PROCESS_PID_CORE(pid)   ((coreid_t) ((pid) >> PROCESS_PID_CORE_SHIFT))
+#define PROCESS_PID_N_MAX       ((1 << PROCESS_PID_CORE_SHIFT) - 1)
+
+// Number of buckets of each registry index (must be a power of two)
+#define PROCESS_HASH_BUCKETS    256
+
 struct process_info {
-    struct process_info *next;
+    struct process_info *next;      // Insertion order
+    struct process_info *prev;
+    struct process_info *pid_next;  // Chain in the PID index
+    struct process_info *lc_next;   // Chain in the LMP channel index
+    struct process_info *name_next; // Chain in the name index
     domainid_t pid;
     coreid_t core_id;
     char *name;
@@ -13,6 +27,7 @@ struct process_info {
 };
 
 void process_register(struct process_info *pi);
+void process_deregister(domainid_t pid);
 
 struct process_info *process_info_for_pid(domainid_t pid);
 domainid_t process_pid_for_lmp_chan(struct lmp_chan *lc);
@@ -0,0 +1,64 @@
+//
+//  spawn_trace.h
+//  DoritOS
+//
+//  Per-phase cycle histograms of spawn_load_by_name(), aggregated per binary
+//  by each core's init and available over RPC.
+//
+
+#ifndef spawn_trace_h
+#define spawn_trace_h
+
+#include <stdint.h>
+#include <barrelfish_kpi/types.h>
+
+#define SPAWN_TRACE_NAME_LEN    32
+#define SPAWN_TRACE_BUCKETS     32      // Bucket i counts [2^i, 2^(i+1)) cycles
+
+// Phases of spawn_load_by_name()
+enum spawn_phase {
+    SpawnPhase_MapElf,
+    SpawnPhase_Cspace,
+    SpawnPhase_LmpChannel,
+    SpawnPhase_Vspace,
+    SpawnPhase_ParseElf,
+    SpawnPhase_Dispatcher,
+    SpawnPhase_Args,
+    SpawnPhase_Invoke,
+    SpawnPhase_Cleanup,
+    SpawnPhase_Total,
+    SpawnPhase_Count
+};
+
+// Cycle histogram of one phase
+struct spawn_trace_hist {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[SPAWN_TRACE_BUCKETS];
+};
+
+// All phase histograms of one binary
+struct spawn_trace_stats {
+    char name[SPAWN_TRACE_NAME_LEN];
+    struct spawn_trace_hist phases[SpawnPhase_Count];
+};
+
+// Reply to LMP_RequestType_SpawnStats
+struct spawn_trace_msg {
+    coreid_t core_id;
+    uint32_t count;
+    struct spawn_trace_stats stats[];
+};
+
+// Human readable name of a phase
+static inline const char *spawn_phase_name(enum spawn_phase phase) {
+    static const char *names[SpawnPhase_Count] = {
+        "map elf", "cspace", "lmp chan", "vspace", "parse elf",
+        "dispatcher", "args", "invoke", "cleanup", "total"
+    };
+    return phase < SpawnPhase_Count ? names[phase] : "?";
+}
+
+#endif /* spawn_trace_h */
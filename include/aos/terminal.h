@@ -9,19 +9,54 @@
 #define URPC_MessageType_TerminalReadLock           URPC_MessageType_User4
 #define URPC_MessageType_TerminalReadUnlock         URPC_MessageType_User5
 #define URPC_MessageType_TerminalDeregister         URPC_MessageType_User6
+#define URPC_MessageType_TerminalWriteString        URPC_MessageType_User7
+#define URPC_MessageType_TerminalReadBulk           URPC_MessageType_User8
+#define URPC_MessageType_TerminalReadLine           URPC_MessageType_User9
+
+// Maximum number of bytes sent in one TerminalWriteString message
+#define TERMINAL_WRITE_MAX      4096
+
+// Maximum number of bytes returned by one TerminalReadBulk/ReadLine
+#define TERMINAL_READ_MAX       1024
 
 struct terminal_msg {
     errval_t err;
     char c;
 };
 
+// Request of TerminalWriteString, followed by `len` bytes (the received size
+// of a UMP message is rounded up to whole slots)
+struct terminal_write_req {
+    size_t len;
+};
+
+// Request of TerminalReadBulk and TerminalReadLine
+struct terminal_read_req {
+    size_t len;         // Maximum number of bytes to return
+};
+
+// Reply of TerminalReadBulk and TerminalReadLine, followed by `len` bytes
+struct terminal_read_reply {
+    errval_t err;
+    size_t len;
+    char end;           // Character that ended a line (0 for bulk reads)
+};
+
 enum Terminal_IO {
     Terminal_Read,
     Terminal_Write
 };
 
+// Buffering modes of stdout
+enum Terminal_Buffering {
+    Terminal_Unbuffered,        // Every write goes to the terminal
+    Terminal_LineBuffered,      // Flush on newline or when the buffer is full
+    Terminal_FullyBuffered      // Flush only when the buffer is full
+};
+
 errval_t lock_terminal(struct aos_rpc *chan, enum Terminal_IO, bool lock);
 size_t terminal_write(const char* buf, size_t len);
 size_t terminal_read(char *buf, size_t len);
+errval_t terminal_set_buffering(enum Terminal_Buffering mode);
 
 #endif
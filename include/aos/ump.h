@@ -34,6 +34,9 @@
 #define UMP_MessageType_UrpcBindRequest     9
 #define UMP_MessageType_UrpcBindAck         10
 #define UMP_MessageType_DeregisterForward   11
+#define UMP_MessageType_MpscBind            12
+#define UMP_MessageType_MpscBindAck         13
+#define UMP_MessageType_DeregisterQuery     14
 
 #define UMP_MessageType_User0  32
 #define UMP_MessageType_User1  33
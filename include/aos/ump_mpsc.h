@@ -0,0 +1,63 @@
+//
+//  ump_mpsc.h
+//  DoritOS
+//
+
+#ifndef ump_mpsc_h
+#define ump_mpsc_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <aos/aos.h>
+#include <aos/ump.h>
+
+#define UMP_MPSC_NUM_SLOTS          256     // Must be a power of two
+#define UMP_MPSC_SLOT_DATA_BYTES    56
+
+// Identifies the producer of a message on a shared request ring
+typedef uint16_t ump_mpsc_client_t;
+
+
+struct ump_mpsc_buf_header {
+    volatile uint32_t head;     // Next ticket to be reserved by a producer
+    char RESERVED[60];          // Make sure the size of the struct is 64 bytes
+};
+
+struct ump_mpsc_slot {
+    volatile uint32_t seq;      // Ticket + 1 if valid, ticket of next lap if free
+    ump_mpsc_client_t client_id;
+    ump_msg_type_t msg_type;
+    uint8_t last;
+    char data[UMP_MPSC_SLOT_DATA_BYTES];
+};
+
+struct ump_mpsc_buf {
+    struct ump_mpsc_buf_header header;
+    struct ump_mpsc_slot slots[UMP_MPSC_NUM_SLOTS];
+};
+
+#define UMP_MPSC_BUF_SIZE      sizeof(struct ump_mpsc_buf)
+
+// Consumer side of a shared request ring (only one per ring)
+struct ump_mpsc_chan {
+    struct frame_identity fi;
+    struct ump_mpsc_buf *buf;
+    uint32_t tail;              // Next ticket to be consumed
+};
+
+
+// Initialize a freshly mapped shared request ring
+void ump_mpsc_buf_init(struct ump_mpsc_buf *buf);
+
+// Initialize the consumer state of a shared request ring
+void ump_mpsc_chan_init(struct ump_mpsc_chan *chan, struct ump_mpsc_buf *buf);
+
+// Send a buffer on a shared request ring (any number of concurrent producers)
+errval_t ump_mpsc_send(struct ump_mpsc_buf *buf, ump_mpsc_client_t client_id,
+                       const void *data, size_t size, ump_msg_type_t msg_type);
+
+// Receive a buffer on a shared request ring (single consumer only)
+errval_t ump_mpsc_recv(struct ump_mpsc_chan *chan, ump_mpsc_client_t *client_id,
+                       void **data, size_t *size, ump_msg_type_t *msg_type);
+
+#endif /* ump_mpsc_h */
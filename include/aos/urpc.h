@@ -10,12 +10,15 @@
 #define urpc_h
 
 #include <aos/ump.h>
+#include <aos/ump_mpsc.h>
 #include <aos/process.h>
 
 #include <stdbool.h>
 
 
 #define URPC_MessageType_UrpcBindAck            UMP_MessageType_UrpcBindAck
+#define URPC_MessageType_MpscBind               UMP_MessageType_MpscBind
+#define URPC_MessageType_MpscBindAck            UMP_MessageType_MpscBindAck
 
 #define URPC_MessageType_User0  UMP_MessageType_User0
 #define URPC_MessageType_User1  UMP_MessageType_User1
@@ -37,16 +40,38 @@
 // UMP message types type
 typedef ump_msg_type_t urpc_msg_type_t;
 
+// Client side of a shared (MPSC) request ring
+struct urpc_mpsc {
+    struct ump_mpsc_buf *buf;
+    ump_mpsc_client_t client_id;
+};
+
 // URPC channel
 struct urpc_chan {
     bool use_lmp;
     struct ump_chan *ump;
     struct lmp_chan *lmp;
+    struct urpc_mpsc *mpsc;     // Requests go to a shared ring if set
+};
+
+// Server side of a shared (MPSC) request ring
+struct urpc_mpsc_server {
+    struct capref frame;
+    struct ump_mpsc_chan chan;
+    struct urpc_chan **clients;     // Response channels by client ID (NULL if free)
+    size_t num_clients;
 };
 
 
+// Handler for spawn responses of the other core
+typedef void (*urpc_spawn_ack_handler)(void *msg, size_t size);
+
+
 // MARK: - Init URPC Server
 
+// Register the handler for UMP_MessageType_SpawnAck
+void urpc_register_spawn_ack_handler(urpc_spawn_ack_handler handler);
+
 // Handler for init URPC server:
 void urpc_init_server_handler(struct ump_chan *chan, void *msg, size_t size,
                               ump_msg_type_t msg_type);
@@ -57,9 +82,12 @@ void urpc_register_process_handler(struct ump_chan *chan, void *msg,
 
 // MARK: - Init URPC Client
 
-// RPC for registering a process
+// Queue a process registration for the other core
 void urpc_process_register(struct process_info *pi);
 
+// Send all queued process registrations to the other core
+void urpc_process_register_flush(void);
+
 
 // MARK: - Generic Server
 
@@ -70,11 +98,40 @@ errval_t urpc_accept(struct urpc_chan *chan);
 errval_t urpc_accept_blocking(struct urpc_chan *chan);
 
 
+// MARK: - Frame Sharing
+
+// Send a frame capability to a process (init forwards it across cores)
+errval_t urpc_share_frame(domainid_t pid, struct capref frame);
+
+// Wait for a frame capability shared with us and map it
+errval_t urpc_map_shared_frame(void **ret_buf, size_t *ret_bytes);
+
+
+// MARK: - Shared Request Ring Server
+
+// Allocate and map a shared request ring
+errval_t urpc_mpsc_server_init(struct urpc_mpsc_server *srv);
+
+// Attach a freshly accepted UMP channel to the shared request ring
+errval_t urpc_mpsc_accept(struct urpc_mpsc_server *srv, struct urpc_chan *chan);
+
+// Receive the next request on the shared ring and the channel to reply on
+errval_t urpc_mpsc_recv(struct urpc_mpsc_server *srv, struct urpc_chan **chan,
+                        void **buf, size_t *size, urpc_msg_type_t *msg_type);
+
+// Detach a client that sends no more requests and free its channel, the
+// client ID goes to the next client
+void urpc_mpsc_release(struct urpc_mpsc_server *srv, struct urpc_chan *chan);
+
+
 // MARK: - Generic Client
 
 // Bind to a URPC server with a specific PID
 errval_t urpc_bind(domainid_t pid, struct urpc_chan *chan, bool use_lmp);
 
+// Bind to a URPC server which serves all clients through a shared request ring
+errval_t urpc_bind_mpsc(domainid_t pid, struct urpc_chan *chan);
+
 
 // MARK: - Generic Send & Receive
 
@@ -106,4 +163,8 @@ void urpc_handle_ump_bind_request(struct ump_chan *chan, void *msg, size_t size,
 void urpc_handle_deregister_forward(struct ump_chan *chan, void *msg, size_t size,
                                   ump_msg_type_t msg_type);
 
+// Handle a query whether a process of this core is gone
+void urpc_handle_deregister_query(struct ump_chan *chan, void *msg, size_t size,
+                                  ump_msg_type_t msg_type);
+
 #endif /* urpc_h */
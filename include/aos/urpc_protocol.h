@@ -22,9 +22,18 @@ struct urpc_bi_caps {
     struct module_frame_identity modules[];
 };
 
+struct urpc_spawn_request {
+    uint32_t id;                // Echoed in the response
+    domainid_t terminal_pid;
+    uint32_t count;             // Number of instances
+    char name[];
+};
+
 struct urpc_spaw_response {
+    uint32_t id;
     errval_t err;
-    domainid_t pid;
+    uint32_t count;             // Number of instances spawned
+    domainid_t pids[];
 };
 
 struct urpc_process_register {
@@ -33,6 +42,15 @@ struct urpc_process_register {
     char name[];
 };
 
+// Maximum number of registrations queued before they are sent
+#define URPC_REGISTER_BATCH_MAX 8
+
+// Batch of registrations, each padded to a word boundary
+struct urpc_process_register_batch {
+    uint32_t count;
+    char entries[];
+};
+
 struct urpc_bind_request {
     struct frame_identity fi;
     domainid_t pid;
@@ -26,6 +26,7 @@ enum fs_filetype {
 struct fs_fileinfo {
     enum fs_filetype type;  ///< Type of the object
     size_t size;            ///< Size of the object (in bytes, for a regular file)
+    uint32_t version;       ///< Changes with every modification (0 if unknown)
 };
 
 /*
@@ -60,6 +61,42 @@ errval_t filesystem_init(void);
  */
 errval_t filesystem_mount(const char *path, const char *uri);
 
+/**
+ * @brief maps a file read-only into the address space without copying it
+ *
+ * @param path   path of the file
+ * @param buffer returns the mapping
+ * @param bytes  returns the size of the file
+ *
+ * @return SYS_ERR_OK on success
+ *         VFS_ERR_NOT_SUPPORTED if the file system cannot map files
+ *
+ * Only files on the multiboot file system can be mapped. The mapping stays
+ * valid for the lifetime of the process and must not be written.
+ */
+errval_t filesystem_mmap(const char *path, void **buffer, size_t *bytes);
+
+/**
+ * @brief obtains the type, size and version of a file
+ *
+ * @param path   path of the file
+ * @param info   returns the file information
+ *
+ * @return SYS_ERR_OK on success
+ *         FS_ERR_NOTFOUND if there is no such file
+ */
+errval_t filesystem_stat(const char *path, struct fs_fileinfo *info);
+
+/**
+ * @brief writes the cached data of all open files back to their file systems
+ *
+ * @return SYS_ERR_OK on success
+ *         errval of the first file that failed otherwise
+ *
+ * This also happens on exit, even for files that were not closed.
+ */
+errval_t filesystem_sync(void);
+
 
 /*
  * ===========================================================================
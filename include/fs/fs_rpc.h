@@ -26,6 +26,19 @@
 #define URPC_MessageType_MakeDir   URPC_MessageType_User10
 #define URPC_MessageType_RemoveDir URPC_MessageType_User11
 
+#define URPC_MessageType_Sync      URPC_MessageType_User12
+
+#define URPC_MessageType_MapBuffer URPC_MessageType_User13
+#define URPC_MessageType_Stat      URPC_MessageType_User14
+#define URPC_MessageType_Batch     URPC_MessageType_User15
+
+// Sync argument of a client that exits, the server releases its handles
+// and shared buffer
+#define FS_RPC_SYNC_DETACH         1
+
+// Size of the buffer shared by client and server for file data
+#define FS_RPC_BUF_SIZE            (64 * 1024)
+
 typedef void *fat32fs_handle_t;
 
 struct fat32fs_handle
@@ -33,7 +46,7 @@ struct fat32fs_handle
     //struct fs_handle common;      // TODO: What is this for?
     char *path;
     bool isdir;
-    struct fat_dirent *dirent;
+    uint32_t id;                    // Handle of the server
     off_t pos;
 };
 
@@ -45,6 +58,57 @@ struct fs_message {
     
 };
 
+// Operations per batch
+#define FS_RPC_BATCH_MAX           32
+
+// Handle of the file opened by the previous operation of the batch
+#define FS_RPC_HANDLE_LINKED       UINT32_MAX
+
+// Cancel the following operation if this one fails
+#define FS_RPC_OP_LINK             0x1
+
+enum fs_rpc_op_type {
+    FS_RPC_OP_OPEN,
+    FS_RPC_OP_CREATE,
+    FS_RPC_OP_CLOSE,
+    FS_RPC_OP_READ,
+    FS_RPC_OP_WRITE,
+    FS_RPC_OP_STAT,
+    FS_RPC_OP_READDIR
+};
+
+// Operation of a batch as sent to the server, its path, file data or
+// dirent is at buf_offset in the shared buffer
+struct fs_batch_op {
+    uint16_t type;
+    uint16_t flags;
+    uint32_t handle;
+    uint32_t pos;                   // File position or directory index
+    uint32_t bytes;
+    uint32_t buf_offset;
+};
+
+// Operation of a batch on the client
+struct fs_rpc_batch_op {
+    enum fs_rpc_op_type type;
+    bool link;                      // Cancel the following operation if this one fails
+    fat32fs_handle_t handle;        // NULL for the file opened by the previous operation
+    const char *path;               // Open and create
+    void *buffer;                   // Read and write
+    size_t bytes;
+    size_t pos;                     // Read and write
+    
+    // Results
+    errval_t err;
+    size_t ret_bytes;               // Read and write
+    fat32fs_handle_t ret_handle;    // Open and create
+    struct fs_fileinfo info;        // Stat and readdir
+    char *name;                     // Readdir
+};
+
+// Called with the completed operations when the reply to a batch arrived
+typedef void (*fs_rpc_batch_handler)(void *arg, struct fs_rpc_batch_op *ops, size_t count);
+
 errval_t fs_rpc_init(void *state);
 
 errval_t fs_rpc_open(void *st, char *path, fat32fs_handle_t *ret_handle);
@@ -67,6 +131,8 @@ errval_t fs_rpc_seek(void *st, fat32fs_handle_t handle, enum fs_seekpos whence,
 
 errval_t fs_rpc_close(void *st, fat32fs_handle_t inhandle);
 
+errval_t fs_rpc_sync(void *st);
+
 errval_t fs_rpc_opendir(void *st, char *path, fs_dirhandle_t *ret_handle);
 
 errval_t fs_rpc_readdir(void *st, fs_dirhandle_t dirhandle, char **ret_name, struct fs_fileinfo *info);
@@ -77,6 +143,22 @@ errval_t fs_rpc_mkdir(void *st, char *path);
 
 errval_t fs_rpc_rmdir(void *st, char *path);
 
+// Space of the shared buffer used by a batch and by a single operation
+size_t fs_rpc_batch_capacity(void);
+size_t fs_rpc_batch_op_size(const struct fs_rpc_batch_op *op);
+
+// Send a batch of operations without waiting for the reply (a batch that
+// is still in flight is waited for first), ops must stay valid until the
+// handler was called
+errval_t fs_rpc_batch_submit(struct fs_rpc_batch_op *ops, size_t count,
+                             fs_rpc_batch_handler handler, void *arg);
+
+// Receive the reply to the batch in flight and call its handler, returns
+// LIB_ERR_NO_URPC_MSG if the server is not done yet and blocking is false
+errval_t fs_rpc_batch_poll(bool blocking);
+
+bool fs_rpc_batch_in_flight(void);
+
 /*
 errval_t fat32fs_open(void *st, const char *path, fat32fs_handle_t *rethandle)
 
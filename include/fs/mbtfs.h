@@ -19,6 +19,10 @@ errval_t mbtfs_remove(void *st, char *path);
 
 errval_t mbtfs_read(void *st, mbtfs_handle_t handle, void *buffer, size_t bytes, size_t *bytes_read);
 
+// Get a read-only mapping of the whole file without copying (stays valid
+// after the handle is closed and must not be written or unmapped)
+errval_t mbtfs_mmap(void *st, mbtfs_handle_t handle, void **buffer, size_t *bytes);
+
 errval_t mbtfs_write(void *st, mbtfs_handle_t handle, void *buffer, size_t bytes, size_t *bytes_written);
 
 errval_t mbtfs_truncate(void *st, mbtfs_handle_t handle, size_t bytes);
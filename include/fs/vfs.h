@@ -21,9 +21,12 @@ struct mount_node {
     struct mount_node *next;
 };
 
+struct vfs_cache_file;
+
 struct vfs_handle {
     void *handle;
     enum fs_type type;
+    struct vfs_cache_file *cache;   // Page cache state, NULL if not cached
 };
 
 struct vfs_mount {
@@ -48,6 +51,9 @@ errval_t vfs_read(void *st, vfs_handle_t handle, void *buffer, size_t bytes, siz
 
 errval_t vfs_write(void *st, vfs_handle_t handle, void *buffer, size_t bytes, size_t *bytes_written);
 
+// Get a read-only mapping of the whole file without copying (multiboot files only)
+errval_t vfs_mmap(void *st, vfs_handle_t handle, void **buffer, size_t *bytes);
+
 errval_t vfs_truncate(void *st, vfs_handle_t handle, size_t bytes);
 
 errval_t vfs_tell(void *st, vfs_handle_t handle, size_t *pos);
@@ -58,6 +64,12 @@ errval_t vfs_seek(void *st, vfs_handle_t handle, enum fs_seekpos whence, off_t o
 
 errval_t vfs_close(void *st, vfs_handle_t handle);
 
+// Write back cached data of the file and let the file system sync
+errval_t vfs_sync(void *st, vfs_handle_t handle);
+
+// Write back cached data of all open files
+errval_t vfs_sync_all(void *st);
+
 
 errval_t vfs_opendir(void *st, const char *path, vfs_handle_t *rethandle);
 
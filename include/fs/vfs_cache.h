@@ -0,0 +1,70 @@
+//
+//  vfs_cache.h
+//  DoritOS
+//
+
+#ifndef vfs_cache_h
+#define vfs_cache_h
+
+#include <fs/fs.h>
+
+#define VFS_CACHE_PAGE_SIZE     4096
+#define VFS_CACHE_PAGES         64      // Pages per domain
+#define VFS_CACHE_WINDOW_MAX    16      // Largest transfer in pages
+
+#define VFS_CACHE_RA_MIN        2       // Default read-ahead windows in pages
+#define VFS_CACHE_RA_MAX        16
+
+#define VFS_CACHE_DIRTY_MAX     16      // Dirty pages per file before write-back
+
+// Backend of a cached file (same signatures as the file system functions)
+struct vfs_cache_ops {
+    errval_t (*read)(void *st, void *handle, void *buffer, size_t bytes, size_t *bytes_read);
+    errval_t (*write)(void *st, void *handle, const void *buffer, size_t bytes, size_t *bytes_written);
+    errval_t (*truncate)(void *st, void *handle, size_t bytes);
+    errval_t (*seek)(void *st, void *handle, enum fs_seekpos whence, off_t offset);
+    errval_t (*stat)(void *st, void *handle, struct fs_fileinfo *info);
+    errval_t (*sync)(void *st);
+};
+
+// Cache state of an open file
+struct vfs_cache_file {
+    const struct vfs_cache_ops *ops;
+    void *st;
+    void *handle;
+    size_t pos;                 // File position
+    size_t size;                // File size including cached writes
+    size_t backend_size;        // File size as known to the backend
+    size_t ra_window;           // Next read-ahead window in pages
+    size_t ra_next;             // Page a sequential reader misses next
+    size_t dirty_count;
+    struct vfs_cache_page *last_page;
+    struct vfs_cache_file *next;    // Next open cached file
+};
+
+
+// Set the read-ahead window of sequential readers, it starts at min_pages
+// and doubles with every sequential miss up to max_pages
+void vfs_cache_set_readahead(size_t min_pages, size_t max_pages);
+
+// Start caching an open file of the backend
+errval_t vfs_cache_open(const struct vfs_cache_ops *ops, void *st, void *handle,
+                        struct vfs_cache_file **ret_file);
+
+// Write back and forget the file's pages (the backend handle stays open)
+errval_t vfs_cache_close(struct vfs_cache_file *file);
+
+errval_t vfs_cache_read(struct vfs_cache_file *file, void *buffer, size_t bytes, size_t *bytes_read);
+errval_t vfs_cache_write(struct vfs_cache_file *file, const void *buffer, size_t bytes, size_t *bytes_written);
+errval_t vfs_cache_truncate(struct vfs_cache_file *file, size_t bytes);
+errval_t vfs_cache_seek(struct vfs_cache_file *file, enum fs_seekpos whence, off_t offset);
+errval_t vfs_cache_tell(struct vfs_cache_file *file, size_t *ret_pos);
+errval_t vfs_cache_stat(struct vfs_cache_file *file, struct fs_fileinfo *info);
+
+// Write back the file's dirty pages and let the backend sync
+errval_t vfs_cache_sync(struct vfs_cache_file *file);
+
+// Sync all open cached files
+errval_t vfs_cache_sync_all(void);
+
+#endif /* vfs_cache_h */
@@ -0,0 +1,115 @@
+//
+//  vfs_ring.h
+//  DoritOS
+//
+//  Asynchronous file I/O with a submission and a completion ring. Entries
+//  on the FAT server are sent as one batch per vfs_ring_submit() and
+//  complete when the server's reply was received, the caller can go on in
+//  the meantime. Entries on the local file systems (ramfs, multiboot) and
+//  on files of the page cache complete during vfs_ring_submit().
+//
+
+#ifndef vfs_ring_h
+#define vfs_ring_h
+
+#include <fs/fs.h>
+#include <fs/vfs.h>
+
+#define VFS_RING_ENTRIES_MAX    256
+
+// Run the following entry after this one and cancel it if this one fails
+#define VFS_RING_LINK           0x1
+
+// Handle of the file opened by an earlier entry of the same link chain
+#define VFS_RING_LINKED_FILE    NULL
+
+enum vfs_ring_op {
+    VFS_RING_OP_NOP,
+    VFS_RING_OP_OPEN,
+    VFS_RING_OP_CREATE,
+    VFS_RING_OP_CLOSE,
+    VFS_RING_OP_READ,
+    VFS_RING_OP_WRITE,
+    VFS_RING_OP_STAT,
+    VFS_RING_OP_READDIR
+};
+
+// Submission queue entry
+struct vfs_ring_sqe {
+    enum vfs_ring_op op;
+    uint32_t flags;
+    vfs_handle_t handle;        // Close, read, write, stat and readdir
+    const char *path;           // Open and create
+    void *buffer;               // Read and write
+    size_t bytes;
+    size_t pos;                 // File position of read and write (the handle's is not used)
+    struct fs_fileinfo *info;   // Stat and readdir
+    char **name;                // Readdir
+    uint64_t user_data;         // Passed on to the completion
+};
+
+// Completion queue entry
+struct vfs_ring_cqe {
+    uint64_t user_data;
+    errval_t err;
+    size_t bytes;               // Bytes read or written
+    vfs_handle_t handle;        // Handle of open and create
+};
+
+// Where the last entry of the current link chain is
+enum vfs_ring_link_state {
+    VFS_RING_LINK_DONE,         // Completed
+    VFS_RING_LINK_BATCH,        // In the batch that is filled
+    VFS_RING_LINK_IN_FLIGHT     // In the batch sent to the server
+};
+
+struct vfs_ring_batch;
+
+struct vfs_ring {
+    void *st;                   // VFS mount
+    size_t entries;
+
+    struct vfs_ring_sqe *sq;
+    size_t sq_head;
+    size_t sq_tail;
+
+    struct vfs_ring_cqe *cq;    // Twice as many entries as sq
+    size_t cq_head;
+    size_t cq_tail;
+
+    size_t in_flight;           // Entries sent to the server and not completed
+
+    // Link chain of the next entry
+    bool link;
+    enum vfs_ring_link_state link_state;
+    errval_t link_err;
+    vfs_handle_t link_handle;   // File opened by the chain
+    bool link_open_pending;     // The chain's open is in the batch that is filled
+
+    struct vfs_ring_batch *batch;       // Filled by vfs_ring_submit()
+    struct vfs_ring_batch *spare;       // Sent to the server or unused
+};
+
+
+// Set up a ring with entries (a power of two) submission queue entries
+errval_t vfs_ring_init(struct vfs_ring *ring, void *st, size_t entries);
+
+// Wait for all entries sent to the server and free the ring
+void vfs_ring_destroy(struct vfs_ring *ring);
+
+// Get a cleared submission queue entry, NULL if the submission queue is full
+struct vfs_ring_sqe *vfs_ring_get_sqe(struct vfs_ring *ring);
+
+// Start all queued entries, stops early if the completion queue could overflow
+errval_t vfs_ring_submit(struct vfs_ring *ring, size_t *ret_submitted);
+
+// Get the next completion, NULL if there is none yet
+struct vfs_ring_cqe *vfs_ring_peek_cqe(struct vfs_ring *ring);
+
+// Wait for the next completion
+errval_t vfs_ring_wait_cqe(struct vfs_ring *ring, struct vfs_ring_cqe **ret_cqe);
+
+// Remove the completion returned by peek or wait
+void vfs_ring_cqe_seen(struct vfs_ring *ring);
+
+#endif /* vfs_ring_h */
@@ -0,0 +1,74 @@
+//
+//  blockdev.h
+//  DoritOS
+//
+//  Block device interface of the FAT server. Backends transfer runs of
+//  consecutive blocks from/to a vector of buffers, so a run can be moved
+//  with a single multi-block command. Requests can also be queued and are
+//  then dispatched in block order with adjacent requests merged.
+//
+
+#ifndef blockdev_h
+#define blockdev_h
+
+#include <aos/aos.h>
+
+#define BLOCKDEV_MAX_IOV    64      // Buffers per transfer
+
+// A buffer of count consecutive blocks
+struct blockdev_iovec {
+    void *buffer;
+    size_t count;
+};
+
+struct blockdev;
+
+// Backend operations, transfer the blocks starting at block_nr from/to iov
+struct blockdev_ops {
+    errval_t (*readv)(struct blockdev *dev, size_t block_nr,
+                      const struct blockdev_iovec *iov, size_t iovcnt);
+    errval_t (*writev)(struct blockdev *dev, size_t block_nr,
+                       const struct blockdev_iovec *iov, size_t iovcnt);
+};
+
+// A queued request
+struct blockdev_request {
+    bool write;
+    size_t block_nr;
+    size_t count;
+    void *buffer;
+    errval_t err;                       // Result after the queue was run
+    struct blockdev_request *next;
+};
+
+struct blockdev {
+    const char *name;
+    size_t block_size;
+    size_t block_count;
+    const struct blockdev_ops *ops;
+    void *st;                           // Backend state
+    struct blockdev_request *queue;     // Sorted by block number
+};
+
+
+// Read or write count blocks starting at block_nr
+errval_t blockdev_read(struct blockdev *dev, size_t block_nr, size_t count, void *buffer);
+errval_t blockdev_write(struct blockdev *dev, size_t block_nr, size_t count, void *buffer);
+
+// Read or write consecutive blocks from/to multiple buffers
+errval_t blockdev_readv(struct blockdev *dev, size_t block_nr,
+                        const struct blockdev_iovec *iov, size_t iovcnt);
+errval_t blockdev_writev(struct blockdev *dev, size_t block_nr,
+                         const struct blockdev_iovec *iov, size_t iovcnt);
+
+// Queue a request (the request and its buffer must stay valid until the
+// queue was run)
+void blockdev_submit(struct blockdev *dev, struct blockdev_request *req);
+
+// Dispatch all queued requests, returns the first error
+errval_t blockdev_run_queue(struct blockdev *dev);
+
+// RAM disk backed by a copy of a multiboot module image
+errval_t blockdev_ram_create(const char *module, struct blockdev **ret_dev);
+
+#endif /* blockdev_h */
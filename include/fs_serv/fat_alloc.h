@@ -0,0 +1,23 @@
+//
+//  fat_alloc.h
+//  DoritOS
+//
+
+#ifndef fat_alloc_h
+#define fat_alloc_h
+
+#include <aos/aos.h>
+
+
+// Build the free-cluster bitmap by scanning the FAT once (called at mount)
+errval_t fat_alloc_init(void);
+
+// Keep the bitmap in sync with a FAT entry that was changed
+void fat_alloc_update(size_t cluster_nr, uint32_t value);
+
+// Find a run of at most max_count free contiguous clusters, searching from
+// hint on and wrapping around (hint < 2 continues after the last allocation)
+errval_t fat_alloc_find(size_t hint, size_t max_count,
+                        size_t *ret_cluster_nr, size_t *ret_count);
+
+#endif /* fat_alloc_h */
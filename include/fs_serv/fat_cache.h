@@ -0,0 +1,39 @@
+//
+//  fat_cache.h
+//  DoritOS
+//
+
+#ifndef fat_cache_h
+#define fat_cache_h
+
+#include <aos/aos.h>
+#include <fs_serv/blockdev.h>
+
+#define FAT_CACHE_SECTORS   256     // Cached sectors (128 KiB with 512 byte sectors)
+#define FAT_CACHE_BUCKETS   64      // Must be a power of two
+
+
+// Initialize the sector cache of a device (called once the sector size is known)
+errval_t fat_cache_init(struct blockdev *dev, size_t sector_size);
+
+// Get a pointer to a cached sector, valid until the next cache call. Set
+// write if the sector is going to be modified
+errval_t fat_cache_get(size_t sector_nr, bool write, void **ret_data);
+
+// Copy a sector out of the cache
+errval_t fat_cache_read(size_t sector_nr, void *buffer);
+
+// Overwrite a whole sector in the cache (written back later)
+errval_t fat_cache_write(size_t sector_nr, const void *buffer);
+
+// Copy consecutive sectors out of the cache, missing runs are read with one
+// multi-block transfer
+errval_t fat_cache_read_range(size_t sector_nr, size_t count, void *buffer);
+
+// Overwrite consecutive sectors in the cache (written back later)
+errval_t fat_cache_write_range(size_t sector_nr, size_t count, const void *buffer);
+
+// Write all dirty sectors back to the device
+errval_t fat_cache_flush(void);
+
+#endif /* fat_cache_h */
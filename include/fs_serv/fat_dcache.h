@@ -0,0 +1,38 @@
+//
+//  fat_dcache.h
+//  DoritOS
+//
+
+#ifndef fat_dcache_h
+#define fat_dcache_h
+
+#include <aos/aos.h>
+
+#define FAT_DCACHE_ENTRIES      256     // Cached (parent, name) lookups
+#define FAT_DCACHE_BUCKETS      128     // Must be a power of two
+
+#define FAT_DINDEX_DIRS         8       // Directories with a hash index
+#define FAT_DINDEX_MIN_ENTRIES  64      // Smaller directories are not indexed
+
+
+// Look up the directory entry named fat_name (11 bytes) in the directory
+// starting at parent_cluster_nr. Returns SYS_ERR_OK and the position and
+// raw 32 byte entry on a hit, FAT_ERR_FAT_LOOKUP if the name is known not
+// to exist and FS_CACHE_NOTPRESENT if the directory has to be searched
+errval_t fat_dcache_lookup(size_t parent_cluster_nr, const char *fat_name,
+                           size_t *ret_pos, uint8_t *ret_data);
+
+// Remember the result of a directory search (data is NULL if not found)
+void fat_dcache_insert(size_t parent_cluster_nr, const char *fat_name,
+                       size_t pos, const uint8_t *data);
+
+// Keep the cache in sync with a directory entry that was written
+void fat_dcache_update(size_t parent_cluster_nr, size_t pos, const uint8_t *data);
+
+// Build a hash index over a whole directory (slot_count raw entries)
+void fat_dcache_index(size_t cluster_nr, const uint8_t *slots, size_t slot_count);
+
+// Forget everything about a directory (e.g. after its clusters were freed)
+void fat_dcache_invalidate_dir(size_t cluster_nr);
+
+#endif /* fat_dcache_h */
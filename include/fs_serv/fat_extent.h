@@ -0,0 +1,58 @@
+//
+//  fat_extent.h
+//  DoritOS
+//
+
+#ifndef fat_extent_h
+#define fat_extent_h
+
+#include <aos/aos.h>
+
+#define FAT_EXTENT_CACHE_FILES  16      // Files with a cached extent map
+
+// A run of contiguous clusters of a file
+struct fat_extent {
+    size_t file_index;          // Index of the run's first cluster in the file
+    size_t cluster_nr;          // First cluster of the run
+    size_t count;               // Number of clusters in the run
+};
+
+// Extent map of a cluster chain, identified by its first cluster
+struct fat_extent_map {
+    size_t first_cluster_nr;    // 0 if unused
+    size_t cluster_count;       // Total number of clusters in the chain
+    size_t extent_count;
+    size_t extent_capacity;
+    struct fat_extent *extents;
+    uint32_t last_used;
+    size_t pin_count;           // Open files using the map
+};
+
+
+// Get the extent map of the chain starting at first_cluster_nr (built by
+// following the chain once if it is not cached)
+errval_t fat_extent_get(size_t first_cluster_nr, struct fat_extent_map **ret_map);
+
+// Translate a cluster index of the file into a cluster number, also returns
+// the number of contiguous clusters from there on
+errval_t fat_extent_lookup(struct fat_extent_map *map, size_t index,
+                           size_t *ret_cluster_nr, size_t *ret_run);
+
+// Last cluster of the chain
+size_t fat_extent_last(struct fat_extent_map *map);
+
+// Record a cluster that was appended to the chain
+errval_t fat_extent_append(struct fat_extent_map *map, size_t cluster_nr);
+
+// Drop all clusters from index cluster_count on
+void fat_extent_truncate(struct fat_extent_map *map, size_t cluster_count);
+
+// Forget the extent map of a chain (e.g. after it was freed)
+void fat_extent_invalidate(size_t first_cluster_nr);
+
+// Keep the extent map of a chain cached while a file is open (pinned maps
+// are only replaced when all maps are pinned)
+void fat_extent_pin(size_t first_cluster_nr);
+void fat_extent_unpin(size_t first_cluster_nr);
+
+#endif /* fat_extent_h */
@@ -0,0 +1,47 @@
+//
+//  fat_handle.h
+//  DoritOS
+//
+
+#ifndef fat_handle_h
+#define fat_handle_h
+
+#include <aos/aos.h>
+
+#include <fs/fs_fat.h>
+
+#define FAT_HANDLE_MAX      256     // Open handles of all clients
+#define FAT_VERSION_SLOTS   1024    // Version counters (power of two)
+
+// State of an open file or directory, shared by all handles to it
+struct fat_open_file {
+    struct fat_dirent dirent;       // Authoritative copy, including the size
+    size_t refcount;
+    struct fat_open_file *next;
+};
+
+
+// Open a handle to dirent for owner (the open file is shared with all other
+// handles to the same directory entry)
+errval_t fat_handle_open(void *owner, struct fat_dirent *dirent, uint32_t *ret_handle);
+
+// Look up the open file of a handle, fails unless owner opened the handle
+errval_t fat_handle_get(void *owner, uint32_t handle, struct fat_open_file **ret_file);
+
+// Close a handle, the open file is dropped with its last handle
+errval_t fat_handle_close(void *owner, uint32_t handle);
+
+// Close all handles of owner (a client that went away)
+void fat_handle_close_all(void *owner);
+
+// Note a modification of the directory entry at pos in parent_cluster_nr
+void fat_handle_touch(size_t parent_cluster_nr, size_t parent_pos);
+
+// Version of the directory entry at pos in parent_cluster_nr, changes with
+// every modification (never 0)
+uint32_t fat_handle_version(size_t parent_cluster_nr, size_t parent_pos);
+
+// Check if the directory entry at pos in parent_cluster_nr is open
+bool fat_handle_is_open(size_t parent_cluster_nr, size_t parent_pos);
+
+#endif /* fat_handle_h */
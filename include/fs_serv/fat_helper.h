@@ -45,6 +45,9 @@ uint32_t FATSz;
 
 char *convert_to_fat_name(const char *name);
 
+// Same as convert_to_fat_name but into a caller buffer of 12 bytes
+void convert_to_fat_name_buf(const char *name, char *ret_name);
+
 char *convert_to_normal_name(char *fat_name);
 
 #endif /* fat_helper_h */
@@ -9,6 +9,7 @@
 #include <aos/aos.h>
 
 #include <fs/fs_fat.h>
+#include <fs_serv/blockdev.h>
 
 #define GET_BYTES1(buf, offset) (uint8_t)   ((uint8_t *) buf)[offset]
 
@@ -83,7 +84,7 @@ struct fatfs_serv_mount {
     
 };
 
-errval_t init_BPB(void);
+errval_t init_BPB(struct blockdev *dev);
 
 uint32_t getFATEntry(size_t n);
 
@@ -172,6 +173,9 @@ errval_t write_dirent(struct fat_dirent *dirent, void *buffer, size_t start, siz
 errval_t read_cluster(size_t cluster_nr, void *buffer);
 errval_t write_cluster(size_t cluster_nr, void *buffer);
 
+errval_t read_clusters(size_t cluster_nr, size_t count, void *buffer);
+errval_t write_clusters(size_t cluster_nr, size_t count, void *buffer);
+
 errval_t read_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size_t bytes);
 errval_t write_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size_t bytes);
 
@@ -16,10 +16,13 @@
 #define _INIT_SPAWN_H_
 
 #include <aos/process.h>
+#include <aos/spawn_trace.h>
 
 #include "aos/slot_alloc.h"
 #include "aos/paging.h"
 
+#define SPAWN_POOL_SIZE     4       // Skeletons kept ready by init
+
 struct parent_mapping {
     struct parent_mapping *next;
     void *addr;
@@ -52,6 +55,7 @@ struct spawninfo {
     struct capref child_rootcn_cap;     // Capability to the child's L1 cnode
     struct capref child_root_pt_cap;    // Capability to the child's L1 pagetable
     struct capref child_dispatcher_cap; // Capability to the child's dispatcher
+    struct capref child_vspace_frame_caps[3]; // Child's paging state and slab frames
 
     // Process Info
     struct process_info *pi;
@@ -61,4 +65,40 @@ struct spawninfo {
 errval_t spawn_load_by_name(void * binary_name,
                             struct spawninfo * si,
                             domainid_t terminal_pid);
+
+// Image that is not an uncompressed boot module (e.g. a file). `fill` copies
+// `bytes` bytes at `image_offset` of the image into `frame` at `frame_offset`
+// (`frame_addr` is the frame's mapping in init). Reads are mostly sequential
+struct spawn_image_source {
+    size_t size;            // Size of the image in bytes
+    uint32_t version;       // Changes with the content (0 if unknown, not cached)
+    errval_t (*fill)(void *state, struct capref frame, void *frame_addr,
+                     size_t frame_offset, size_t image_offset, size_t bytes);
+    void *state;
+};
+
+// Start a child process from an image source. The first word of cmd is the
+// path of the image, loaded segments are cached by path, size and version.
+// Fills in si
+errval_t spawn_load_by_source(void *cmd,
+                              struct spawninfo *si,
+                              domainid_t terminal_pid,
+                              struct spawn_image_source *src);
+
+// Set the number of pre-built skeletons (cspace, lmp channel and vspace) kept
+// ready for spawn_load_by_name
+void spawn_pool_init(size_t target);
+
+// Build one skeleton if the pool is not full (call when idle)
+errval_t spawn_pool_refill(void);
+
+// Start the cycle counter used for tracing spawns
+void spawn_trace_init(void);
+
+// Record the phase cycles of one spawn of `name`
+void spawn_trace_record(const char *name, uint32_t cycles[SpawnPhase_Count]);
+
+// Copy all spawn histograms into a newly allocated struct spawn_trace_msg
+errval_t spawn_trace_snapshot(void **buf, size_t *size);
+
 #endif /* _INIT_SPAWN_H_ */
@@ -10,10 +10,25 @@
 #define SPAWN_SERV_H
 
 #include <aos/ump.h>
+#include <aos/lmp.h>
+
+// Completion of an asynchronous spawn with the PIDs of all new processes
+typedef lmp_server_spawn_callback spawn_serv_callback_t;
 
 errval_t spawn_serv_handler(char *name, coreid_t coreid,
                             domainid_t terminal_pid, domainid_t *pid);
 
+// Spawn `count` instances on any core, `callback` runs once all are running
+// (immediately for this core, when the other core responds otherwise)
+errval_t spawn_serv_spawn_async(char *name, coreid_t coreid,
+                                domainid_t terminal_pid, size_t count,
+                                spawn_serv_callback_t callback, void *arg);
+
+// Spawn `cmd` on this core from a file of the client on lc
+errval_t spawn_serv_file_handler(char *cmd, domainid_t terminal_pid,
+                                 size_t file_size, uint32_t file_version,
+                                 struct lmp_chan *lc, domainid_t *pid);
+
 errval_t spawn_serv_init(struct ump_chan *chan);
 
 #endif /* SPAWN_SERV_H */
@@ -13,24 +13,27 @@
 #include <collections/list.h>
 
 
-#define IO_BUFFER_SIZE  256
+#define IO_BUFFER_SIZE  4096    // Must be a power of two
 
 #define TERMINAL_STATE_INIT {\
                                 .write_lock = NULL,\
                                 .read_lock = NULL,\
+                                .line_reader = NULL,\
                                 .buffer = NULL,\
                             };
 
 
+// Ring buffer of received characters
 struct io_buffer {
     char *buf;
-    size_t pos;
-    struct io_buffer *next;
+    size_t head;    // Next position to write
+    size_t tail;    // Next position to read
 };
 
 struct terminal_state {
     void *write_lock;
     void *read_lock;
+    void *line_reader;      // Event currently editing a line
     struct io_buffer *buffer;
     collections_listnode *urpc_chan_list;
     collections_listnode *terminal_event_queue;
@@ -40,10 +43,16 @@ struct terminal_event {
     urpc_msg_type_t type;
     struct urpc_chan *chan;
     struct terminal_msg msg;
+    char *data;             // Payload of TerminalWriteString, line being read
+    size_t size;
+    size_t max_size;        // Requested length of TerminalReadBulk/ReadLine
 };
 
 
 void io_buffer_init(struct io_buffer **buf);
+bool io_buffer_put(struct io_buffer *buf, char c);
+bool io_buffer_get(struct io_buffer *buf, char *c);
+size_t io_buffer_count(struct io_buffer *buf);
 void terminal_runloop(struct terminal_state *st);
 
 // Need to be implemented:
@@ -12,6 +12,9 @@
  * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
  */
 
+#include <stdio.h>
+#include <string.h>
+
 #include <aos/aos_rpc.h>
 #include <aos/lmp.h>
 #include <aos/urpc.h>
@@ -194,6 +197,99 @@ errval_t aos_rpc_serial_putchar(struct aos_rpc *chan, char c)
     return err;
 }
 
+errval_t aos_rpc_serial_write(struct aos_rpc *chan, const char *buf, size_t len)
+{
+    errval_t err;
+
+    if (chan->uc == NULL) return LIB_ERR_TERMINAL_INIT;
+
+    assert(len <= TERMINAL_WRITE_MAX);
+
+    // Nothing to send (an empty UMP message would never arrive)
+    if (len == 0) {
+        return SYS_ERR_OK;
+    }
+
+    // Send the byte count with the string
+    size_t send_size = sizeof(struct terminal_write_req) + len;
+    struct terminal_write_req *req = (struct terminal_write_req *) malloc(send_size);
+    if (req == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    req->len = len;
+    memcpy(req + 1, buf, len);
+
+    err = urpc_send(chan->uc, (void *) req, send_size, URPC_MessageType_TerminalWriteString);
+    free(req);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+    size_t size;
+    urpc_msg_type_t msg_type;
+    struct terminal_msg *in;
+
+    err = urpc_recv_blocking(chan->uc, (void **) &in, &size, &msg_type);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+    assert(msg_type == URPC_MessageType_TerminalWriteString);
+
+    err = in->err;
+
+    free(in);
+
+    return err;
+}
+
+errval_t aos_rpc_serial_read(struct aos_rpc *chan, char *buf, size_t len,
+                             bool line, size_t *ret_len, char *end)
+{
+    errval_t err;
+
+    if (chan->uc == NULL) return LIB_ERR_TERMINAL_INIT;
+
+    struct terminal_read_req req = {
+        .len = MIN(len, TERMINAL_READ_MAX)
+    };
+    urpc_msg_type_t msg_type = line ? URPC_MessageType_TerminalReadLine
+                                    : URPC_MessageType_TerminalReadBulk;
+
+    err = urpc_send(chan->uc, (void *) &req, sizeof(struct terminal_read_req), msg_type);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+    size_t size;
+    urpc_msg_type_t msg_type_in;
+    struct terminal_read_reply *reply;
+
+    err = urpc_recv_blocking(chan->uc, (void **) &reply, &size, &msg_type_in);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+    assert(msg_type_in == msg_type);
+
+    err = reply->err;
+    if (err_is_ok(err)) {
+        *ret_len = MIN(reply->len, req.len);
+        memcpy(buf, reply + 1, *ret_len);
+        if (end != NULL) {
+            *end = reply->end;
+        }
+    }
+
+    free(reply);
+
+    return err;
+}
+
 errval_t aos_rpc_process_spawn(struct aos_rpc *chan, char *name,
                                coreid_t core, domainid_t *newpid)
 {
@@ -237,6 +333,165 @@ errval_t aos_rpc_process_spawn_with_terminal(struct aos_rpc *chan,
     
 }
 
+errval_t aos_rpc_process_spawn_batch(struct aos_rpc *chan, char *name,
+                                     coreid_t core, size_t count,
+                                     domainid_t *pids, size_t *ret_count)
+{
+    
+    errval_t err;
+    
+    // A single instance gets the plain spawn reply
+    if (count == 1) {
+        err = aos_rpc_process_spawn_with_terminal(chan, name, core, 0, pids);
+        *ret_count = err_is_ok(err) ? 1 : 0;
+        return err;
+    }
+    
+    // Send one spawn request for all instances
+    err = lmp_send_spawn_batch(chan->lc, name, core, 0, count);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
+    // Receive the status code and the pids form the spawn server
+    struct lmp_spawn_batch_reply *reply;
+    size_t reply_size;
+    uint8_t msg_type;
+    err = lmp_recv_buffer(chan->lc, (void **) &reply, &reply_size, &msg_type);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        *ret_count = 0;
+        return err;
+    }
+    
+    assert(msg_type == LMP_RequestType_Spawn);
+    assert(reply_size >= sizeof(struct lmp_spawn_batch_reply) + reply->count * sizeof(domainid_t));
+    
+    // Return the pids of the new processes
+    *ret_count = MIN(reply->count, count);
+    memcpy(pids, reply->pids, *ret_count * sizeof(domainid_t));
+    
+    // Return the status code
+    err = reply->err;
+    free(reply);
+    return err;
+    
+}
+
+// Copy part of a file into a frame sent by init during a file spawn
+static errval_t aos_rpc_spawn_file_fill(FILE *f, struct capref frame,
+                                        size_t frame_offset, size_t file_offset,
+                                        size_t bytes) {
+    
+    errval_t err;
+    
+    struct frame_identity fi;
+    err = frame_identify(frame, &fi);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    if (frame_offset + bytes > fi.bytes) {
+        return SPAWN_ERR_LOAD;
+    }
+    
+    // Map the frame and read the file straight into it
+    void *addr;
+    err = paging_map_frame(get_current_paging_state(), &addr, fi.bytes, frame,
+                           NULL, NULL);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    if (fseek(f, file_offset, SEEK_SET) != 0 ||
+        fread(addr + frame_offset, 1, bytes, f) != bytes) {
+        err = FS_ERR_READ;
+    }
+    
+    paging_unmap(get_current_paging_state(), addr);
+    cap_delete(frame);
+    slot_free(frame);
+    
+    return err;
+    
+}
+
+errval_t aos_rpc_process_spawn_file(struct aos_rpc *chan, char *cmd,
+                                    domainid_t terminal_pid, uint32_t version,
+                                    domainid_t *newpid)
+{
+    
+    errval_t err;
+    
+    // The path is the first word of the command
+    char *path = strndup(cmd, strcspn(cmd, " "));
+    if (path == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    FILE *f = fopen(path, "r");
+    free(path);
+    if (f == NULL) {
+        return FS_ERR_NOTFOUND;
+    }
+    
+    // Get the size of the image
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    if (size <= 0) {
+        fclose(f);
+        return SPAWN_ERR_LOAD;
+    }
+    
+    err = lmp_send_spawn_file(chan->lc, cmd, terminal_pid, size, version);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        fclose(f);
+        return err;
+    }
+    
+    // Initialize capref and message
+    struct capref cap;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    
+    // Serve the reads of the loader until the spawn server replies
+    while (true) {
+        
+        lmp_client_recv(chan->lc, &cap, &msg);
+        
+        if (msg.words[0] != LMP_RequestType_SpawnFileRead) {
+            break;
+        }
+        
+        // Allocate recv slot
+        err = lmp_chan_alloc_recv_slot(chan->lc);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+        }
+        
+        err = aos_rpc_spawn_file_fill(f, cap, msg.words[1], msg.words[2],
+                                      msg.words[3]);
+        
+        lmp_chan_send2(chan->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+                       LMP_RequestType_SpawnFileRead, err);
+        
+    }
+    
+    fclose(f);
+    
+    // Check we actually got a valid response
+    assert(msg.words[0] == LMP_RequestType_SpawnShort ||
+           msg.words[0] == LMP_RequestType_SpawnLong);
+    
+    // Return the PID of the new process
+    *newpid = msg.words[2];
+    
+    // Return the status code
+    err = (errval_t) msg.words[1];
+    return err;
+    
+}
+
 errval_t aos_rpc_process_get_name(struct aos_rpc *chan, domainid_t pid,
                                   char **name)
 {
@@ -394,14 +649,27 @@ errval_t aos_rpc_get_device_cap(struct aos_rpc *chan,
     
 }
 
-errval_t aos_rpc_get_module_list(struct aos_rpc *chan,
-                                 char ***modules,
-                                 size_t *module_count)
-{
+// A multiboot module as seen by this client
+struct aos_rpc_module {
+    char *name;
+    size_t size;
+    struct capref frame;        // NULL_CAP until the frame was requested
+    void *buf;                  // Read-only mapping, NULL until first mapped
+};
+
+// Client-side copy of init's module list (NULL if not fetched yet), the boot
+// modules never change
+static size_t module_cache_count = 0;
+static struct aos_rpc_module *module_cache = NULL;
 
+// Fetch the module list from init unless it is cached already
+static errval_t aos_rpc_module_cache_fill(struct aos_rpc *chan) {
+    
     errval_t err;
     
-    assert(modules != NULL);
+    if (module_cache != NULL) {
+        return SYS_ERR_OK;
+    }
     
     // Send request to get frame buffer with all multiboot module names
     err = lmp_chan_send1(chan->lc,
@@ -409,6 +677,10 @@ errval_t aos_rpc_get_module_list(struct aos_rpc *chan,
                          NULL_CAP,
                          LMP_RequestType_ModuleList
                          );
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
     
     // Buffer for names
     char *buffer;
@@ -420,57 +692,62 @@ errval_t aos_rpc_get_module_list(struct aos_rpc *chan,
     uint8_t msg_type;
     
     // Receive buffer with all module names from init
-    lmp_recv_buffer(chan->lc, (void **) &buffer, &buffer_size, &msg_type);
+    err = lmp_recv_buffer(chan->lc, (void **) &buffer, &buffer_size, &msg_type);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
     
     assert(msg_type == LMP_RequestType_ModuleList);
 
     // Get module count from buffer
     size_t count = ((uint32_t *) buffer)[0];
     
-    // Array of all module names
-    char **modules_array = calloc(count, sizeof(char *));
+    // Array of all modules
+    struct aos_rpc_module *modules = calloc(count, sizeof(struct aos_rpc_module));
+    if (modules == NULL) {
+        free(buffer);
+        return LIB_ERR_MALLOC_FAIL;
+    }
     
     // Pointer to beginning of current name string in buffer
     char *ptr = buffer + sizeof(uint32_t);
-    char *next_ptr;
+    char *end = buffer + buffer_size;
     
     size_t i;
-    for (i = 0; i < count; i++) {
+    for (i = 0; i < count && ptr < end; i++) {
         
-        next_ptr = strchr(ptr, '\0');
+        char *next_ptr = memchr(ptr, '\0', end - ptr);
         if (next_ptr == NULL) {
             debug_printf("Failed parsing module name buffer\n");
             break;
         }
         
-        // Set ith element in modules name array
-        modules_array[i] = strdup(ptr);
+        // Set ith module, the frame is only requested on first use
+        modules[i].name = strdup(ptr);
+        modules[i].frame = NULL_CAP;
         
         // Update pointer
         ptr = next_ptr + 1;
         
     }
     
-    // Set return module count
-    *module_count = i;
-    
-    // Set return modules array
-    *modules = modules_array;
-    
     // Free buffer
     free(buffer);
-
-    return err;
+    
+    module_cache = modules;
+    module_cache_count = i;
+    
+    return SYS_ERR_OK;
     
 }
 
-errval_t aos_rpc_get_module_frame(struct aos_rpc *chan, char *name,
-                                  struct capref *frame, size_t *ret_bytes) {
+// Request the frame of a module from init
+static errval_t aos_rpc_module_request_frame(struct aos_rpc *chan, const char *name,
+                                             struct capref *frame, size_t *ret_bytes) {
     
     errval_t err;
     
-    assert(ret_bytes != NULL);
-    
     // Allocating frame capability
     size_t ret_size;
     struct capref frame_cap;
@@ -531,13 +808,151 @@ errval_t aos_rpc_get_module_frame(struct aos_rpc *chan, char *name,
     // Check that it received correct response
     assert(msg.words[0] == LMP_RequestType_ModuleFrame);
     
-    // Set error
-    err = msg.words[1];
-    
     // Set return bytes
     *ret_bytes = msg.words[2];
     
-    return err;
+    // Return error
+    return msg.words[1];
+    
+}
+
+// Look up a module in the cache, requesting its frame from init on first use
+static errval_t aos_rpc_module_lookup(struct aos_rpc *chan, const char *name,
+                                      struct aos_rpc_module **ret_module) {
+    
+    errval_t err;
+    
+    err = aos_rpc_module_cache_fill(chan);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Find the module, unknown names are answered locally
+    struct aos_rpc_module *module = NULL;
+    for (size_t i = 0; i < module_cache_count; i++) {
+        if (strcmp(module_cache[i].name, name) == 0) {
+            module = &module_cache[i];
+            break;
+        }
+    }
+    if (module == NULL) {
+        return FS_ERR_NOTFOUND;
+    }
+    
+    // Frames that were requested before are reused
+    if (capref_is_null(module->frame)) {
+        err = aos_rpc_module_request_frame(chan, name, &module->frame, &module->size);
+        if (err_is_fail(err)) {
+            module->frame = NULL_CAP;
+            return err;
+        }
+    }
+    
+    *ret_module = module;
+    return SYS_ERR_OK;
+    
+}
+
+errval_t aos_rpc_get_module_list(struct aos_rpc *chan,
+                                 char ***modules,
+                                 size_t *module_count)
+{
+
+    errval_t err;
+    
+    assert(modules != NULL);
+    
+    // Only the first call has to ask init
+    err = aos_rpc_module_cache_fill(chan);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Array of all module names
+    char **modules_array = calloc(module_cache_count, sizeof(char *));
+    if (modules_array == NULL && module_cache_count > 0) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    for (size_t i = 0; i < module_cache_count; i++) {
+        modules_array[i] = strdup(module_cache[i].name);
+    }
+    
+    // Set return module count
+    *module_count = module_cache_count;
+    
+    // Set return modules array
+    *modules = modules_array;
+
+    return SYS_ERR_OK;
+    
+}
+
+errval_t aos_rpc_get_module_frame(struct aos_rpc *chan, char *name,
+                                  struct capref *frame, size_t *ret_bytes) {
+    
+    errval_t err;
+    
+    assert(ret_bytes != NULL);
+    
+    struct aos_rpc_module *module;
+    err = aos_rpc_module_lookup(chan, name, &module);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Hand out a copy, the cached capability stays with the cache
+    err = slot_alloc(frame);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    err = cap_copy(*frame, module->frame);
+    if (err_is_fail(err)) {
+        slot_free(*frame);
+        return err;
+    }
+    
+    // Set return bytes
+    *ret_bytes = module->size;
+    
+    return SYS_ERR_OK;
+    
+}
+
+errval_t aos_rpc_map_module(struct aos_rpc *chan, const char *name,
+                            void **buf, size_t *ret_bytes) {
+    
+    errval_t err;
+    
+    struct aos_rpc_module *module;
+    err = aos_rpc_module_lookup(chan, name, &module);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Map the module on first use and keep the mapping
+    if (module->buf == NULL) {
+        
+        struct frame_identity id;
+        err = invoke_frame_identify(module->frame, &id);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        
+        err = paging_map_frame_attr(get_current_paging_state(), &module->buf,
+                                    id.bytes, module->frame, VREGION_FLAGS_READ,
+                                    NULL, NULL);
+        if (err_is_fail(err)) {
+            module->buf = NULL;
+            return err;
+        }
+        
+    }
+    
+    *buf = module->buf;
+    *ret_bytes = module->size;
+    
+    return SYS_ERR_OK;
     
 }
 
@@ -588,6 +1003,33 @@ errval_t aos_rpc_process_deregister_notify(domainid_t pid) {
     return SYS_ERR_OK;
 }
 
+errval_t aos_rpc_get_spawn_stats(struct aos_rpc *chan,
+                                 struct spawn_trace_msg **msg) {
+    
+    errval_t err;
+    
+    // Request the histograms of this core's init
+    err = lmp_chan_send1(chan->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+                         LMP_RequestType_SpawnStats);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
+    size_t size;
+    uint8_t msg_type;
+    err = lmp_recv_buffer(chan->lc, (void **) msg, &size, &msg_type);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
+    assert(msg_type == LMP_RequestType_SpawnStats);
+    assert(size >= sizeof(struct spawn_trace_msg));
+    
+    return SYS_ERR_OK;
+}
+
 errval_t aos_rpc_init(struct aos_rpc *rpc, struct lmp_chan *lc)
 {
     errval_t err = SYS_ERR_OK;
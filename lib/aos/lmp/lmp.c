@@ -30,6 +30,9 @@ void lmp_set_bootinfo(struct bootinfo *bi) {
     lmp_bi = bi;
 }
 
+static void lmp_server_handle_msg(struct lmp_chan *lc, struct capref cap,
+                                  struct lmp_recv_msg *recv_msg);
+
 void lmp_server_dispatcher(void *arg) {
 
 #if PRINT_DEBUG
@@ -54,6 +57,23 @@ void lmp_server_dispatcher(void *arg) {
         return;
     }
 
+    lmp_server_handle_msg(lc, cap, &msg);
+
+    // Register again
+    err = lmp_chan_register_recv(lc, get_default_waitset(), MKCLOSURE(lmp_server_dispatcher, (void *) lc));
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+    }
+}
+
+// Handle a request received from a client
+static void lmp_server_handle_msg(struct lmp_chan *lc, struct capref cap,
+                                  struct lmp_recv_msg *recv_msg) {
+
+    errval_t err;
+
+    struct lmp_recv_msg msg = *recv_msg;
+
     char *string;
 
     // Check message type and handle
@@ -226,6 +246,13 @@ void lmp_server_dispatcher(void *arg) {
 #endif
             lmp_server_process_deregister_notify(lc, msg.words[1]);
             break;
+
+        case LMP_RequestType_SpawnStats:
+#if PRINT_DEBUG
+            debug_printf("Spawn Stats Message!\n");
+#endif
+            lmp_server_spawn_stats(lc);
+            break;
             
         default:
 #if PRINT_DEBUG
@@ -238,12 +265,6 @@ void lmp_server_dispatcher(void *arg) {
             
             
     }
-
-    // Register again
-    err = lmp_chan_register_recv(lc, get_default_waitset(), MKCLOSURE(lmp_server_dispatcher, (void *) lc));
-    if (err_is_fail(err)) {
-        debug_printf("%s\n", err_getstring(err));
-    }
 }
 
 // SPAWN: Handle registration requests from clients
@@ -432,18 +453,26 @@ errval_t lmp_server_device_cap(struct lmp_chan *lc, lpaddr_t paddr, size_t bytes
     
 }
 
-errval_t lmp_server_module_list(struct lmp_chan *lc) {
+// Serialized module list, built once since the boot modules never change
+static char *module_list_buffer = NULL;
+static size_t module_list_size = 0;
+
+// Build the serialized module list if necessary
+static void lmp_server_module_list_build(void) {
     
-    errval_t err = SYS_ERR_OK;
+    if (module_list_buffer != NULL) {
+        return;
+    }
     
-    // Buffer to save module names
+    // Buffer to save module count and names
     char *buffer = calloc(1, sizeof(uint32_t));
+    assert(buffer != NULL);
     
     // Buffer size
     size_t buffer_size = sizeof(uint32_t);
     
     // Module count
-    size_t module_count = 0;
+    uint32_t module_count = 0;
     
     // Iterate through all module regions
     for (int i = 0; i < lmp_bi->regions_length; i++) {
@@ -473,8 +502,20 @@ errval_t lmp_server_module_list(struct lmp_chan *lc) {
     // Copy in module count in the beginning
     memcpy(buffer, &module_count, sizeof(uint32_t));
     
+    module_list_buffer = buffer;
+    module_list_size = buffer_size;
+    
+}
+
+errval_t lmp_server_module_list(struct lmp_chan *lc) {
+    
+    errval_t err = SYS_ERR_OK;
+    
+    lmp_server_module_list_build();
+    
     // Send buffer with module names back to client
-    err = lmp_send_buffer(lc, buffer, buffer_size, LMP_RequestType_ModuleList);
+    err = lmp_send_buffer(lc, module_list_buffer, module_list_size,
+                          LMP_RequestType_ModuleList);
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
     }
@@ -617,8 +658,14 @@ errval_t lmp_server_process_deregister(struct lmp_chan *lc) {
 
     notify_deregister_listeners(pid);
 
+    // The other core has to learn about the process before it leaves
+    urpc_process_register_flush();
+
     ump_send(&init_uc, &pid, sizeof(domainid_t), UMP_MessageType_DeregisterForward);
 
+    // Remove the process from the registry
+    process_deregister(pid);
+
     return SYS_ERR_OK;
 }
 
@@ -628,13 +675,24 @@ errval_t lmp_server_process_deregister_notify(struct lmp_chan *lc, domainid_t pi
         collections_list_create(&dead_processes, free);
     }
 
-    struct process_listener *process_listener = (struct process_listener *) malloc(sizeof(process_listener));
+    struct process_listener *process_listener = (struct process_listener *) malloc(sizeof(struct process_listener));
     process_listener->pid = pid;
     process_listener->lc = lc;
 
 
-    if (collections_list_find_if(dead_processes, dead_processes_find, &pid)) {
+    // Local processes that are not in the registry are dead. The registration
+    // of a remote one might still be batched on its core, so ask that core,
+    // which forwards the deregistration if the process is gone
+    if (pid != 0 && process_info_for_pid(pid) == NULL &&
+        PROCESS_PID_CORE(pid) == disp_get_core_id()) {
+        lmp_chan_send1(lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, LMP_RequestType_ProcessDeregisterNotify);
+        free(process_listener);
+    } else if (pid != 0 && process_info_for_pid(pid) == NULL) {
+        collections_list_insert(deregister_listeners, (void *) process_listener);
+        ump_send(&init_uc, &pid, sizeof(domainid_t), UMP_MessageType_DeregisterQuery);
+    } else if (collections_list_find_if(dead_processes, dead_processes_find, &pid)) {
         lmp_chan_send1(lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, LMP_RequestType_ProcessDeregisterNotify);
+        free(process_listener);
     } else {
         collections_list_insert(deregister_listeners, (void *) process_listener);
     }
@@ -642,6 +700,36 @@ errval_t lmp_server_process_deregister_notify(struct lmp_chan *lc, domainid_t pi
     return SYS_ERR_OK;
 }
 
+static lmp_server_spawn_stats_handler lmp_server_spawn_stats_handler_func = NULL;
+void lmp_server_spawn_stats_register_handler(lmp_server_spawn_stats_handler handler) {
+    lmp_server_spawn_stats_handler_func = handler;
+}
+
+// Send the spawn phase histograms of this core
+errval_t lmp_server_spawn_stats(struct lmp_chan *lc) {
+    
+    errval_t err;
+    
+    assert(lmp_server_spawn_stats_handler_func != NULL);
+    
+    void *buf;
+    size_t size;
+    err = lmp_server_spawn_stats_handler_func(&buf, &size);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
+    err = lmp_send_buffer(lc, buf, size, LMP_RequestType_SpawnStats);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+    }
+    
+    free(buf);
+    
+    return err;
+}
+
 /* MARK: - ========== Client ========== */
 
 // Blocking call for receiving messages
@@ -1005,34 +1093,89 @@ void lmp_server_spawn_register_handler(lmp_server_spawn_handler handler) {
     lmp_server_spawn_handler_func = handler;
 }
 
+lmp_server_spawn_async_handler lmp_server_spawn_async_handler_func = NULL;
+void lmp_server_spawn_register_async_handler(lmp_server_spawn_async_handler handler) {
+    lmp_server_spawn_async_handler_func = handler;
+}
+
+lmp_server_spawn_file_handler lmp_server_spawn_file_handler_func = NULL;
+void lmp_server_spawn_register_file_handler(lmp_server_spawn_file_handler handler) {
+    lmp_server_spawn_file_handler_func = handler;
+}
+
+// Header of a spawn request buffer (followed by the name)
+struct lmp_spawn_header {
+    coreid_t core;
+    domainid_t terminal_pid;
+    uint32_t count;
+    uint32_t file_size;     // Non-zero if the client streams the image
+    uint32_t file_version;  // Version of the streamed image (0 if unknown)
+};
+
+static errval_t lmp_send_spawn_request(struct lmp_chan *lc, const char *name,
+                                       struct lmp_spawn_header *spawn_header);
+
 errval_t lmp_send_spawn(struct lmp_chan *lc, const char *name, coreid_t core,
                         domainid_t terminal_pid) {
     
+    return lmp_send_spawn_batch(lc, name, core, terminal_pid, 1);
+    
+}
+
+errval_t lmp_send_spawn_batch(struct lmp_chan *lc, const char *name, coreid_t core,
+                              domainid_t terminal_pid, size_t count) {
+    
+    struct lmp_spawn_header header = {
+        .core = core,
+        .terminal_pid = terminal_pid,
+        .count = count,
+        .file_size = 0
+    };
+    
+    return lmp_send_spawn_request(lc, name, &header);
+    
+}
+
+errval_t lmp_send_spawn_file(struct lmp_chan *lc, const char *cmd,
+                             domainid_t terminal_pid, size_t file_size,
+                             uint32_t file_version) {
+    
+    struct lmp_spawn_header header = {
+        .core = disp_get_core_id(),
+        .terminal_pid = terminal_pid,
+        .count = 1,
+        .file_size = file_size,
+        .file_version = file_version
+    };
+    
+    return lmp_send_spawn_request(lc, cmd, &header);
+    
+}
+
+// Send a spawn request buffer (automatically select protocol)
+static errval_t lmp_send_spawn_request(struct lmp_chan *lc, const char *name,
+                                       struct lmp_spawn_header *spawn_header) {
+    
     errval_t err;
     
     // Get length of the name
     size_t name_len = strlen(name);
     
     // Get length of entire buffer (including '\0')
-    size_t buf_len = sizeof(coreid_t) + sizeof(domainid_t) + name_len + 1;
+    size_t buf_len = sizeof(struct lmp_spawn_header) + name_len + 1;
     
     // Check wether to use SpawnShort with send_short_buf() or SpawnLong with send_frame()
     if (buf_len <= sizeof(uintptr_t) * SHORT_BUF_SIZE) {
         
-        // Construct buffer of length buf_len and fill in core id and name (including '\0')
+        // Construct buffer of length buf_len and fill in header and name (including '\0')
         char buf[buf_len];
         
-        // Copy core id into beginning of buffer
-        *(coreid_t *) buf = core;
-        
-        // Copy terminal pid into beginning of buffer
-        *(domainid_t *) (buf + sizeof(coreid_t)) = terminal_pid;
+        // Fill in the header
+        struct lmp_spawn_header *header = (struct lmp_spawn_header *) buf;
+        *header = *spawn_header;
         
-        // Initialize string as beginning of name
-        char *string = ((char *) buf) + sizeof(coreid_t) + sizeof(domainid_t);
-
-        // Copy name into buffer after core id
-        memcpy(string, name, name_len + 1);
+        // Copy name into buffer after the header
+        memcpy(buf + sizeof(struct lmp_spawn_header), name, name_len + 1);
         
         // Send buffer using arguments
         return lmp_send_short_buf(lc, LMP_RequestType_SpawnShort, (void *) buf, buf_len);
@@ -1058,19 +1201,12 @@ errval_t lmp_send_spawn(struct lmp_chan *lc, const char *name, coreid_t core,
             return err;
         }
         
-        // Fill in core id and name string (including \0) into memory/frame
+        // Fill in the header
+        struct lmp_spawn_header *header = (struct lmp_spawn_header *) buf;
+        *header = *spawn_header;
         
-        // Copy core id into beginning of buffer
-        *(coreid_t *) buf = core;
-        
-        // Copy terminal pid into beginning of buffer
-        *(domainid_t *) (buf + sizeof(coreid_t)) = terminal_pid;
-        
-        // Initialize string as beginning of name
-        char *string = ((char *) buf) + sizeof(coreid_t) + sizeof(domainid_t);
-        
-        // Copy name into buffer after core id
-        memcpy(string, name, name_len + 1);
+        // Copy name into buffer after the header
+        memcpy(buf + sizeof(struct lmp_spawn_header), name, name_len + 1);
         
         // Send the frame to the recipient
         err = lmp_send_frame(lc, LMP_RequestType_SpawnLong, frame_cap, ret_size);
@@ -1115,6 +1251,186 @@ errval_t lmp_recv_spawn(struct lmp_chan *lc, char **name) {
     return lmp_recv_spawn_from_msg(lc, cap, msg.words, name);
 }
 
+// Pending reply to a spawn request
+struct lmp_spawn_reply {
+    struct lmp_chan *lc;
+    uintptr_t type;
+    bool batch;         // Reply with a struct lmp_spawn_batch_reply
+};
+
+// Send the result of a spawn request back to the client
+static void lmp_server_spawn_reply(void *arg, errval_t err,
+                                   domainid_t *pids, size_t count) {
+    
+    struct lmp_spawn_reply *reply = (struct lmp_spawn_reply *) arg;
+    
+    if (reply->batch) {
+        
+        // Send the PIDs of all new processes
+        size_t size = sizeof(struct lmp_spawn_batch_reply) + count * sizeof(domainid_t);
+        struct lmp_spawn_batch_reply *buf = malloc(size);
+        if (buf == NULL) {
+            struct lmp_spawn_batch_reply failed = {
+                .err = LIB_ERR_MALLOC_FAIL,
+                .count = 0
+            };
+            lmp_send_buffer(reply->lc, &failed, sizeof(failed), LMP_RequestType_Spawn);
+            free(reply);
+            return;
+        }
+        buf->err = err;
+        buf->count = count;
+        if (count > 0) {
+            memcpy(buf->pids, pids, count * sizeof(domainid_t));
+        }
+        
+        err = lmp_send_buffer(reply->lc, buf, size, LMP_RequestType_Spawn);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+        }
+        
+        free(buf);
+        free(reply);
+        return;
+        
+    }
+    
+    lmp_chan_send4(reply->lc,
+                   LMP_SEND_FLAGS_DEFAULT,
+                   NULL_CAP,
+                   reply->type,
+                   err,
+                   count > 0 ? pids[0] : 0,
+                   count);
+    
+    free(reply);
+    
+}
+
+// Handle a spawn request buffer and reply once the processes are running
+static errval_t lmp_server_spawn_request(struct lmp_chan *lc, void *buf,
+                                         uintptr_t type, char **name) {
+    
+    errval_t err;
+    
+    struct lmp_spawn_header *header = (struct lmp_spawn_header *) buf;
+    
+    // Initialize string as beginning of name
+    char *string = ((char *) buf) + sizeof(struct lmp_spawn_header);
+    
+    // Get length of string
+    size_t string_len = strlen(string);
+    
+    // Allocate space to move return argument name onto the heap
+    *name = (char *) malloc(string_len + 1);
+    if (*name == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    // Copy string (including '\0') from buffer into name
+    memcpy(*name, string, string_len + 1);
+    
+    struct lmp_spawn_reply *reply = (struct lmp_spawn_reply *) malloc(sizeof(struct lmp_spawn_reply));
+    if (reply == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    reply->lc = lc;
+    reply->type = type;
+    reply->batch = header->count != 1;
+    
+    if (header->file_size != 0) {
+        
+        // Stream the image from the client (only on the client's core)
+        domainid_t pid = 0;
+        if (header->core != disp_get_core_id()) {
+            err = SPAWN_ERR_REMOTE_FILE;
+        } else {
+            err = lmp_server_spawn_file_handler_func(*name, header->terminal_pid,
+                                                     header->file_size,
+                                                     header->file_version, lc, &pid);
+        }
+        lmp_server_spawn_reply((void *) reply, err, &pid, err_is_ok(err) ? 1 : 0);
+        
+        return err;
+        
+    }
+    
+    if (lmp_server_spawn_async_handler_func != NULL) {
+        
+        // Hand the request to the spawn server, it replies when done
+        err = lmp_server_spawn_async_handler_func(*name, header->core,
+                                                  header->terminal_pid,
+                                                  header->count,
+                                                  lmp_server_spawn_reply,
+                                                  (void *) reply);
+        if (err_is_fail(err)) {
+            lmp_server_spawn_reply((void *) reply, err, NULL, 0);
+        }
+        
+        return err;
+        
+    }
+    
+    // Spawn the instances one by one
+    domainid_t *pids = (domainid_t *) malloc(MAX(header->count, 1) * sizeof(domainid_t));
+    if (pids == NULL) {
+        free(reply);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    size_t count;
+    err = SYS_ERR_OK;
+    for (count = 0; count < header->count && err_is_ok(err); count++) {
+        err = lmp_server_spawn_handler_func(*name, header->core,
+                                            header->terminal_pid, &pids[count]);
+    }
+    if (err_is_fail(err)) {
+        count--;
+    }
+    
+    lmp_server_spawn_reply((void *) reply, err, pids, count);
+    
+    free(pids);
+    
+    return err;
+    
+}
+
+// Let the client of a file spawn copy part of the image into a frame
+errval_t lmp_server_spawn_file_fill(struct lmp_chan *lc, struct capref frame,
+                                    size_t frame_offset, size_t file_offset,
+                                    size_t bytes) {
+    
+    errval_t err;
+    
+    err = lmp_chan_send4(lc, LMP_SEND_FLAGS_DEFAULT, frame,
+                         LMP_RequestType_SpawnFileRead, frame_offset,
+                         file_offset, bytes);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
+    // Wait until the client filled the frame, reading the file may need
+    // memory, so serve the client's other requests in the meantime
+    struct capref cap;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    while (true) {
+        
+        lmp_client_recv(lc, &cap, &msg);
+        
+        if (msg.words[0] == LMP_RequestType_SpawnFileRead) {
+            break;
+        }
+        
+        lmp_server_handle_msg(lc, cap, &msg);
+        
+    }
+    
+    return (errval_t) msg.words[1];
+    
+}
+
 // Process a spawn received through a message (automatically select protocol)
 errval_t lmp_recv_spawn_from_msg(struct lmp_chan *lc, struct capref cap,
                                  uintptr_t *words, char **name) {
@@ -1132,37 +1448,12 @@ errval_t lmp_recv_spawn_from_msg(struct lmp_chan *lc, struct capref cap,
         size_t size;
         lmp_recv_short_buf_from_msg(lc, LMP_RequestType_SpawnShort, words, &buf, &size);
         
-        // Get core id out of buffer
-        coreid_t core = *(coreid_t *) buf;
-        
-        // Get terminal pid out of buffer
-        domainid_t terminal_pid = *(coreid_t *) (buf + sizeof(coreid_t));
-                
-        // Initialize string as beginning of name
-        char *string = ((char *) buf) + sizeof(coreid_t) + sizeof(domainid_t);
-        
-        // Get length of string
-        size_t string_len = strlen(string);
-        
-        // Allocate space to move return argument name onto the heap
-        *name = (char *) malloc(string_len + 1);
-        if (*name == NULL) {
-            return LIB_ERR_MALLOC_FAIL;
-        }
-        
-        // Copy string (including '\0') from buffer into name
-        memcpy(*name, string, string_len + 1);
-        
         // Handle spawn request by passing it on to the spawn server
-        domainid_t pid = 0;
-        err = lmp_server_spawn_handler_func(*name, core, terminal_pid, &pid);
+        err = lmp_server_spawn_request(lc, buf, LMP_RequestType_SpawnShort, name);
         
         // Free buffer
         free(buf);
         
-        // Send result to client
-        lmp_chan_send3(lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, LMP_RequestType_SpawnShort, err, pid);
-        
         return err;
 
     }
@@ -1186,33 +1477,8 @@ errval_t lmp_recv_spawn_from_msg(struct lmp_chan *lc, struct capref cap,
             return err;
         }
         
-        // Extract core out of buffer
-        coreid_t core = *(coreid_t *) buf;
-        
-        // Get terminal pid out of buffer
-        domainid_t terminal_pid = *(coreid_t *) (buf + sizeof(coreid_t));
-        
-        // Initialize string as beginning of name
-        char *string = ((char *) buf) + sizeof(coreid_t) + sizeof(domainid_t);
-
-        // Get length of string
-        size_t string_len = strlen(string);
-        
-        // Allocate space to move return argument name onto the heap
-        *name = malloc(string_len + 1);
-        if (*name == NULL) {
-            return LIB_ERR_MALLOC_FAIL;
-        }
-        
-        // Copy the string (including '\0') from buffer to name
-        memcpy(*name, string, string_len + 1);
-        
         // Handle spawn request by passing it on to the spawn server
-        domainid_t pid = 0;
-        err = lmp_server_spawn_handler_func(*name, core, terminal_pid, &pid);
-        
-        // Send result to client
-        lmp_chan_send3(lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, LMP_RequestType_SpawnLong, err, pid);
+        err = lmp_server_spawn_request(lc, buf, LMP_RequestType_SpawnLong, name);
         
         // Clean up the frame
         err = paging_unmap(get_current_paging_state(), buf);
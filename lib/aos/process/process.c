@@ -4,48 +4,151 @@
 #include <aos/urpc.h>
 #include <aos/process.h>
 
+// All processes in insertion order
 static struct process_info *process_list = NULL;
+static struct process_info *process_list_tail = NULL;
 
+// Registry indices (chained through the process info)
+static struct process_info *pid_index[PROCESS_HASH_BUCKETS];
+static struct process_info *lc_index[PROCESS_HASH_BUCKETS];
+static struct process_info *name_index[PROCESS_HASH_BUCKETS];
+
+
+// MARK: - Hashing
+
+static inline size_t pid_bucket(domainid_t pid) {
+    return pid & (PROCESS_HASH_BUCKETS - 1);
+}
+
+static inline size_t lc_bucket(struct lmp_chan *lc) {
+    // Channels are heap allocated, drop the alignment bits
+    return ((uintptr_t) lc >> 4) & (PROCESS_HASH_BUCKETS - 1);
+}
+
+static inline size_t name_bucket(const char *name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619u;
+    }
+    return hash & (PROCESS_HASH_BUCKETS - 1);
+}
+
+// Unlink a process info from an index chain linked through `link`
+#define INDEX_REMOVE(head, pi, link)                                    \
+    do {                                                                \
+        struct process_info **node;                                     \
+        for (node = (head); *node != NULL; node = &(*node)->link) {     \
+            if (*node == (pi)) {                                        \
+                *node = (pi)->link;                                     \
+                break;                                                  \
+            }                                                           \
+        }                                                               \
+    } while (0)
+
+
+// MARK: - Registration
 
 void process_register(struct process_info *pi) {
     
-    // Counter for assigning new PIDs
+    // Counter for assigning new PIDs from this core's range
     static domainid_t pid_counter = 0;
     
-    if (disp_get_core_id() == 0) {
-        
-        // Set the PID for the new process
-        pi->pid = ++pid_counter;
-        
-    }
-    
     if (disp_get_core_id() == pi->core_id) {
         
-        // Register process with the other init
-        urpc_process_register(pi);
-        
-    }
+        // Set the PID for the new process, the counter wraps within the
+        // core's range and skips PIDs that are still in use
+        domainid_t pid;
+        size_t tries = 0;
+        do {
+            pid_counter = pid_counter % PROCESS_PID_N_MAX + 1;
+            pid = PROCESS_PID(disp_get_core_id(), pid_counter);
+            if (++tries > PROCESS_PID_N_MAX) {
+                USER_PANIC("out of PIDs on core %d\n", disp_get_core_id());
+            }
+        } while (process_info_for_pid(pid) != NULL);
+        pi->pid = pid;
         
-    if (disp_get_core_id() == 0) {
-        
-        // Reset the PID in case it changed during UMP call
-        pi->pid = pid_counter;
+        // Queue the registration for the other init
+        urpc_process_register(pi);
         
     }
     
-    // Set the next point to NULL just in case
+    // Append to the insertion ordered list
     pi->next = NULL;
+    pi->prev = process_list_tail;
+    if (process_list_tail != NULL) {
+        process_list_tail->next = pi;
+    } else {
+        process_list = pi;
+    }
+    process_list_tail = pi;
+    
+    // Index by PID
+    size_t bucket = pid_bucket(pi->pid);
+    pi->pid_next = pid_index[bucket];
+    pid_index[bucket] = pi;
     
-    // Insert at the end of the list
+    // Index by LMP channel (processes on the other core have none)
+    pi->lc_next = NULL;
+    if (pi->lc != NULL) {
+        bucket = lc_bucket(pi->lc);
+        pi->lc_next = lc_index[bucket];
+        lc_index[bucket] = pi;
+    }
+    
+    // Index by name (appended so the oldest process of a name is found first)
     struct process_info **node;
-    for (node = &process_list; *node != NULL; node = &((*node)->next));
+    for (node = &name_index[name_bucket(pi->name)]; *node != NULL; node = &(*node)->name_next);
+    pi->name_next = NULL;
     *node = pi;
 }
 
+// Remove a process from the registry and free its process information
+void process_deregister(domainid_t pid) {
+    
+    // Init is never registered
+    if (pid == 0) {
+        return;
+    }
+    
+    struct process_info *pi = process_info_for_pid(pid);
+    if (pi == NULL) {
+        return;
+    }
+    
+    // Unlink from the insertion ordered list
+    if (pi->prev != NULL) {
+        pi->prev->next = pi->next;
+    } else {
+        process_list = pi->next;
+    }
+    if (pi->next != NULL) {
+        pi->next->prev = pi->prev;
+    } else {
+        process_list_tail = pi->prev;
+    }
+    
+    // Unlink from the indices
+    INDEX_REMOVE(&pid_index[pid_bucket(pi->pid)], pi, pid_next);
+    if (pi->lc != NULL) {
+        INDEX_REMOVE(&lc_index[lc_bucket(pi->lc)], pi, lc_next);
+    }
+    INDEX_REMOVE(&name_index[name_bucket(pi->name)], pi, name_next);
+    
+    // The LMP channel stays with the dispatcher loop that owns it
+    free(pi->name);
+    free(pi);
+}
+
+
+// MARK: - Lookup
+
 // Returns the process information for a specific PID
 struct process_info *process_info_for_pid(domainid_t pid) {
     assert(pid != 0);
-    for (struct process_info *node = process_list; node != NULL; node = node->next) {
+    for (struct process_info *node = pid_index[pid_bucket(pid)]; node != NULL; node = node->pid_next) {
         if (node->pid == pid) {
             return node;
         }
@@ -55,7 +158,7 @@ struct process_info *process_info_for_pid(domainid_t pid) {
 
 // Returns the PID for a given LMP channel
 domainid_t process_pid_for_lmp_chan(struct lmp_chan *lc) {
-    for (struct process_info *node = process_list; node != NULL; node = node->next) {
+    for (struct process_info *node = lc_index[lc_bucket(lc)]; node != NULL; node = node->lc_next) {
         if (node->lc == lc) {
             return node->pid;
         }
@@ -63,9 +166,9 @@ domainid_t process_pid_for_lmp_chan(struct lmp_chan *lc) {
     return 0;
 }
 
-// Returns the PID for a given LMP channel
+// Returns the PID for a given name
 domainid_t process_pid_for_name(char *name) {
-    for (struct process_info *node = process_list; node != NULL; node = node->next) {
+    for (struct process_info *node = name_index[name_bucket(name)]; node != NULL; node = node->name_next) {
         if (!strcmp(node->name, name)) {
             return node->pid;
         }
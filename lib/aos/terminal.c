@@ -62,26 +62,34 @@ size_t terminal_write(const char* buf, size_t len) {
         return len;
     }
 
-    err = lock_terminal(chan, Terminal_Write, 1);
-    if (err_is_fail(err)) {
-        debug_printf("%s\n", err_getstring(err));
+    // A single message is written atomically, only lock across several
+    bool lock = len > TERMINAL_WRITE_MAX;
+
+    if (lock) {
+        err = lock_terminal(chan, Terminal_Write, 1);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+        }
     }
 
-    {
-        for (size_t i = 0; i < len; i++) {
+    while (n < len) {
 
-            err = aos_rpc_serial_putchar(chan, buf[i]);
-            if (err_is_fail(err)) {
-                debug_printf("%s\n", err_getstring(err));
-            }
+        size_t chunk = MIN(len - n, TERMINAL_WRITE_MAX);
 
-            n = i + 1;
+        err = aos_rpc_serial_write(chan, buf + n, chunk);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            break;
         }
+
+        n += chunk;
     }
 
-    err = lock_terminal(chan, Terminal_Write, 0);
-    if (err_is_fail(err)) {
-        debug_printf("%s\n", err_getstring(err));
+    if (lock) {
+        err = lock_terminal(chan, Terminal_Write, 0);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+        }
     }
 
     return n;
@@ -101,30 +109,43 @@ size_t terminal_read(char *buf, size_t len) {
         return n;
     }
 
-    err = lock_terminal(chan, Terminal_Read, 1);
-
-    {
-        for (size_t i = 0; i < len; i++) {
-
-            char c;
+    // Read a whole line (edited and echoed by the terminal) in one exchange
+    err = aos_rpc_serial_read(chan, buf, len, true, &n, NULL);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return 0;
+    }
 
-            err = aos_rpc_serial_getchar(chan, &c);
-            if (err_is_fail(err)) {
-                debug_printf("%s\n", err_getstring(err));
-            }
+    return n;
+}
 
-            if (c == 0x04 || c == 0x0A || c == 0x0D) {
-                break;
-            }
-            n = i + 1;
-            buf[i] = c;
-        }
+errval_t terminal_set_buffering(enum Terminal_Buffering mode) {
+
+    // Buffer owned by stdout once it is buffered
+    static char buf[BUFSIZ];
+
+    int type;
+
+    switch (mode) {
+        case Terminal_Unbuffered:
+            type = _IONBF;
+            break;
+        case Terminal_LineBuffered:
+            type = _IOLBF;
+            break;
+        case Terminal_FullyBuffered:
+            type = _IOFBF;
+            break;
+        default:
+            return TERM_ERR_UNKNOWN_CONFIG_OPT;
     }
 
-    err = lock_terminal(chan, Terminal_Read, 0);
-    if (err_is_fail(err)) {
-        debug_printf("%s\n", err_getstring(err));
+    // Don't lose what was written in the previous mode
+    fflush(stdout);
+
+    if (setvbuf(stdout, type == _IONBF ? NULL : buf, type, sizeof(buf)) != 0) {
+        return TERM_ERR_IO;
     }
 
-    return n;
-}
\ No newline at end of file
+    return SYS_ERR_OK;
+}
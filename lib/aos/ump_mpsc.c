@@ -0,0 +1,148 @@
+//
+//  ump_mpsc.c
+//  DoritOS
+//
+//  Multi-producer single-consumer UMP ring. Producers reserve slots with an
+//  atomic ticket counter, so a message spanning several slots always occupies
+//  a contiguous run of tickets. Every slot carries a sequence number that
+//  tells producers when it is free and the consumer when it is valid.
+//
+
+#include <string.h>
+
+#include <aos/capabilities.h>
+#include <machine/atomic.h>
+
+#include "aos/ump_mpsc.h"
+
+// Slots have to match the cache line size and tickets have to wrap cleanly
+STATIC_ASSERT_SIZEOF(struct ump_mpsc_slot, 64);
+STATIC_ASSERT((UMP_MPSC_NUM_SLOTS & (UMP_MPSC_NUM_SLOTS - 1)) == 0,
+              "UMP_MPSC_NUM_SLOTS must be a power of two");
+
+// Initialize a freshly mapped shared request ring
+void ump_mpsc_buf_init(struct ump_mpsc_buf *buf) {
+
+    buf->header.head = 0;
+
+    // Slot i is free for ticket i
+    for (uint32_t i = 0; i < UMP_MPSC_NUM_SLOTS; i++) {
+        buf->slots[i].seq = i;
+    }
+
+    // Memory barrier
+    dmb();
+
+}
+
+// Initialize the consumer state of a shared request ring
+void ump_mpsc_chan_init(struct ump_mpsc_chan *chan, struct ump_mpsc_buf *buf) {
+
+    chan->buf = buf;
+    chan->tail = 0;
+
+}
+
+// Send a buffer on a shared request ring (any number of concurrent producers)
+errval_t ump_mpsc_send(struct ump_mpsc_buf *buf, ump_mpsc_client_t client_id,
+                       const void *data, size_t size, ump_msg_type_t msg_type) {
+
+    // Number of slots needed (an empty message still takes one)
+    uint32_t count = MAX(1, DIVIDE_ROUND_UP(size, UMP_MPSC_SLOT_DATA_BYTES));
+
+    // Atomically reserve a contiguous run of tickets
+    uint32_t ticket = atomic_fetchadd_32(&buf->header.head, count);
+
+    for (uint32_t i = 0; i < count; i++) {
+
+        struct ump_mpsc_slot *slot = &buf->slots[(ticket + i) % UMP_MPSC_NUM_SLOTS];
+
+        // Wait for the consumer to release the slot for our lap
+        while (slot->seq != ticket + i) ;
+
+        // Memory barrier
+        dmb();
+
+        size_t msg_size = MIN(size, UMP_MPSC_SLOT_DATA_BYTES);
+
+        // Copy data to the slot
+        memcpy(slot->data, data, msg_size);
+        slot->client_id = client_id;
+        slot->msg_type = msg_type;
+        slot->last = i == count - 1;
+
+        // Memory barrier
+        dmb();
+
+        // Mark the slot as valid
+        slot->seq = ticket + i + 1;
+
+        data += msg_size;
+        size -= msg_size;
+
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+// Receive a buffer on a shared request ring (single consumer only)
+errval_t ump_mpsc_recv(struct ump_mpsc_chan *chan, ump_mpsc_client_t *client_id,
+                       void **data, size_t *size, ump_msg_type_t *msg_type) {
+
+    struct ump_mpsc_slot *slot = &chan->buf->slots[chan->tail % UMP_MPSC_NUM_SLOTS];
+
+    // Check if there is a new message
+    if (slot->seq != chan->tail + 1) {
+        return LIB_ERR_NO_UMP_MSG;
+    }
+
+    // Find the end of the message (the producer owns the whole run already)
+    uint32_t count = 0;
+    bool last;
+    do {
+
+        // Wait for the fragment
+        while (slot->seq != chan->tail + count + 1) ;
+
+        // Memory barrier
+        dmb();
+
+        last = slot->last;
+        count++;
+        slot = &chan->buf->slots[(chan->tail + count) % UMP_MPSC_NUM_SLOTS];
+
+    } while (!last);
+
+    // Allocate the whole message before consuming it, so the message stays
+    // in the ring if this fails
+    *size = count * UMP_MPSC_SLOT_DATA_BYTES;
+    *data = malloc(*size);
+    if (*data == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+
+        slot = &chan->buf->slots[chan->tail % UMP_MPSC_NUM_SLOTS];
+
+        // Copy data from the slot
+        memcpy(*data + i * UMP_MPSC_SLOT_DATA_BYTES, slot->data,
+               UMP_MPSC_SLOT_DATA_BYTES);
+        *client_id = slot->client_id;
+        *msg_type = slot->msg_type;
+
+        // Memory barrier
+        dmb();
+
+        // Release the slot for the next lap
+        slot->seq = chan->tail + UMP_MPSC_NUM_SLOTS;
+
+        // Set the index of the next slot to read
+        chan->tail++;
+
+    }
+
+    return SYS_ERR_OK;
+
+}
@@ -21,6 +21,13 @@ extern lmp_server_spawn_handler lmp_server_spawn_handler_func;
 
 // MARK: - Init URPC Server
 
+static urpc_spawn_ack_handler urpc_spawn_ack_handler_func = NULL;
+
+// Register the handler for UMP_MessageType_SpawnAck
+void urpc_register_spawn_ack_handler(urpc_spawn_ack_handler handler) {
+    urpc_spawn_ack_handler_func = handler;
+}
+
 static void urpc_spawn_handler(struct ump_chan *chan, void *msg, size_t size,
                                ump_msg_type_t msg_type);
 
@@ -34,6 +41,11 @@ void urpc_init_server_handler(struct ump_chan *chan, void *msg, size_t size,
             urpc_spawn_handler(chan, msg, size, msg_type);
             break;
             
+        case UMP_MessageType_SpawnAck:
+            assert(urpc_spawn_ack_handler_func != NULL);
+            urpc_spawn_ack_handler_func(msg, size);
+            break;
+            
         case UMP_MessageType_RegisterProcess:
             urpc_register_process_handler(chan, msg, size, msg_type);
             break;
@@ -45,6 +57,10 @@ void urpc_init_server_handler(struct ump_chan *chan, void *msg, size_t size,
         case UMP_MessageType_DeregisterForward:
             urpc_handle_deregister_forward(chan, msg, size, msg_type);
             break;
+
+        case UMP_MessageType_DeregisterQuery:
+            urpc_handle_deregister_query(chan, msg, size, msg_type);
+            break;
             
         default:
             USER_PANIC("Unknown UMP message type\n");
@@ -58,40 +74,68 @@ void urpc_init_server_handler(struct ump_chan *chan, void *msg, size_t size,
 static void urpc_spawn_handler(struct ump_chan *chan, void *msg, size_t size,
                                ump_msg_type_t msg_type) {
     
-    struct urpc_spaw_response res;
+    struct urpc_spawn_request *req = (struct urpc_spawn_request *) msg;
+    
+    size_t res_size = sizeof(struct urpc_spaw_response) + req->count * sizeof(domainid_t);
+    struct urpc_spaw_response *res = (struct urpc_spaw_response *) malloc(res_size);
+    assert(res != NULL);
+    
+    res->id = req->id;
+    res->err = SYS_ERR_OK;
+    
+    // Pass all instances to the spawn server
+    for (res->count = 0; res->count < req->count; res->count++) {
+        res->err = lmp_server_spawn_handler_func(req->name,
+                                                 disp_get_core_id(),
+                                                 req->terminal_pid,
+                                                 &res->pids[res->count]);
+        if (err_is_fail(res->err)) {
+            break;
+        }
+    }
     
-    // Pass message to spawn server
-    res.err = lmp_server_spawn_handler_func((char *) msg + sizeof(domainid_t), disp_get_core_id(), *(domainid_t *) msg, &res.pid);
+    // Make sure the requesting core knows the processes before the ack
+    urpc_process_register_flush();
     
     // Send response back to requesting core
     ump_send(chan,
-             (void *) &res,
-             sizeof(struct urpc_spaw_response),
+             (void *) res,
+             sizeof(struct urpc_spaw_response) + res->count * sizeof(domainid_t),
              UMP_MessageType_SpawnAck);
     
+    free(res);
+    
 }
 
 // Handle UMP_MessageType_RegisterProcess
 void urpc_register_process_handler(struct ump_chan *chan, void *msg,
                                    size_t size, ump_msg_type_t msg_type) {
     
-    struct urpc_process_register *req = msg;
-    struct process_info *new_process = malloc(sizeof(struct process_info));
-    assert(new_process != NULL);
-    
-    new_process->core_id = req->core_id;
-    new_process->pid = req->pid;
-    new_process->name = (char *) malloc(strlen(req->name) + 1);
-    assert(new_process->name != NULL);
-    strcpy(new_process->name, req->name);
-    
-    process_register(new_process);
+    struct urpc_process_register_batch *batch = msg;
+    char *entry = batch->entries;
     
-    ump_send_one(chan,
-                 &new_process->pid,
-                 sizeof(domainid_t),
-                 UMP_MessageType_RegisterProcessAck,
-                 1);
+    for (uint32_t i = 0; i < batch->count; i++) {
+        
+        struct urpc_process_register *req = (struct urpc_process_register *) entry;
+        
+        struct process_info *new_process = malloc(sizeof(struct process_info));
+        assert(new_process != NULL);
+        
+        new_process->core_id = req->core_id;
+        new_process->pid = req->pid;
+        new_process->dispatcher_cap = NULL;
+        new_process->lc = NULL;
+        new_process->name = (char *) malloc(strlen(req->name) + 1);
+        assert(new_process->name != NULL);
+        strcpy(new_process->name, req->name);
+        
+        process_register(new_process);
+        
+        // Advance to the next (word aligned) entry
+        entry += ROUND_UP(sizeof(struct urpc_process_register) + strlen(req->name) + 1,
+                          sizeof(uintptr_t));
+        
+    }
     
 }
 
@@ -99,36 +143,62 @@ void urpc_register_process_handler(struct ump_chan *chan, void *msg,
 
 // MARK: - Init URPC Client
 
-// RPC for registering a process
+// Registrations not yet sent to the other core
+static struct urpc_process_register_batch *register_batch = NULL;
+static size_t register_batch_size = 0;
+
+// Queue a process registration for the other core
 void urpc_process_register(struct process_info *pi) {
     
-    size_t msg_size = sizeof(struct urpc_process_register) + strlen(pi->name) + 1;
-    struct urpc_process_register *msg = (struct urpc_process_register *) malloc(msg_size);
-    assert(msg != NULL);
+    size_t entry_size = ROUND_UP(sizeof(struct urpc_process_register) + strlen(pi->name) + 1,
+                                 sizeof(uintptr_t));
     
+    // Start a new batch
+    if (register_batch == NULL) {
+        register_batch_size = sizeof(struct urpc_process_register_batch);
+        register_batch = (struct urpc_process_register_batch *) malloc(register_batch_size);
+        assert(register_batch != NULL);
+        register_batch->count = 0;
+    }
+    
+    // Append the entry
+    register_batch = realloc(register_batch, register_batch_size + entry_size);
+    assert(register_batch != NULL);
+    
+    struct urpc_process_register *msg =
+        (struct urpc_process_register *) ((char *) register_batch + register_batch_size);
     msg->core_id = pi->core_id;
     msg->pid = pi->pid;
     strcpy(msg->name, pi->name);
     
-    ump_send(&init_uc, (void *)msg, msg_size, UMP_MessageType_RegisterProcess);
+    register_batch_size += entry_size;
+    register_batch->count++;
     
-    free(msg);
+    // Don't let the batch grow beyond a handful of slots
+    if (register_batch->count == URPC_REGISTER_BATCH_MAX) {
+        urpc_process_register_flush();
+    }
     
-    domainid_t *pid = malloc(UMP_SLOT_DATA_BYTES);
+}
+
+// Send all queued process registrations to the other core
+void urpc_process_register_flush(void) {
     
-    ump_msg_type_t msg_type;
-    uint8_t last;
     errval_t err;
-    do {
-        err = ump_recv_one(&init_uc, (void *)pid, &msg_type, &last);
-    } while (err == LIB_ERR_NO_UMP_MSG);
-    assert(err_is_ok(err));
-    assert(msg_type == UMP_MessageType_RegisterProcessAck);
-    assert(last == 1);
     
-    pi->pid = *pid;
+    if (register_batch == NULL) {
+        return;
+    }
     
-    free(pid);
+    err = ump_send(&init_uc, (void *) register_batch, register_batch_size,
+                   UMP_MessageType_RegisterProcess);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+    }
+    
+    free(register_batch);
+    register_batch = NULL;
+    register_batch_size = 0;
     
 }
 
@@ -159,6 +229,7 @@ static errval_t urpc_accept_from_msg(struct urpc_chan *chan,
     
     // Set the new chanel to correct transport protocol
     chan->use_lmp = msg->words[0] == LMP_RequestType_LmpBind;
+    chan->mpsc = NULL;
     
     // Switch between transport protocols
     if (chan->use_lmp) {
@@ -289,6 +360,212 @@ errval_t urpc_accept_blocking(struct urpc_chan *chan) {
 
 
 
+// MARK: - Frame Sharing
+
+// Send a frame capability to a process (init forwards it across cores)
+errval_t urpc_share_frame(domainid_t pid, struct capref frame) {
+    
+    return lmp_chan_send2(get_init_lmp_chan(),
+                          LMP_SEND_FLAGS_DEFAULT,
+                          frame,
+                          LMP_RequestType_UmpBind,
+                          pid);
+    
+}
+
+// Wait for a frame capability shared with us and map it
+errval_t urpc_map_shared_frame(void **ret_buf, size_t *ret_bytes) {
+    
+    errval_t err;
+    
+    // Get the channel to this core's init
+    struct lmp_chan *lc = get_init_lmp_chan();
+    
+    // Initialize capref and message
+    struct capref frame_cap;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    
+    // Wait for the frame forwarded by init
+    lmp_client_recv(lc, &frame_cap, &msg);
+    
+    // Check we received a valid response
+    assert(msg.words[0] == LMP_RequestType_UmpBind);
+    
+    // Allocate recv slot
+    err = lmp_chan_alloc_recv_slot(lc);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
+    // Get the frame identity
+    struct frame_identity fi;
+    err = frame_identify(frame_cap, &fi);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Map the frame
+    err = paging_map_frame(get_current_paging_state(),
+                           ret_buf,
+                           fi.bytes,
+                           frame_cap,
+                           NULL,
+                           NULL);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    *ret_bytes = fi.bytes;
+    
+    return SYS_ERR_OK;
+    
+}
+
+
+
+// MARK: - Shared Request Ring Server
+
+// Allocate and map a shared request ring
+errval_t urpc_mpsc_server_init(struct urpc_mpsc_server *srv) {
+    
+    errval_t err;
+    
+    // Allocate a frame for the shared request ring
+    size_t frame_size;
+    err = frame_alloc(&srv->frame, UMP_MPSC_BUF_SIZE, &frame_size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Get the frame identity
+    err = frame_identify(srv->frame, &srv->chan.fi);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Map the shared request ring
+    struct ump_mpsc_buf *buf;
+    err = paging_map_frame(get_current_paging_state(),
+                           (void **) &buf,
+                           frame_size,
+                           srv->frame,
+                           NULL,
+                           NULL);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Initialize the ring and the consumer state
+    ump_mpsc_buf_init(buf);
+    ump_mpsc_chan_init(&srv->chan, buf);
+    
+    srv->clients = NULL;
+    srv->num_clients = 0;
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Attach a freshly accepted UMP channel to the shared request ring
+errval_t urpc_mpsc_accept(struct urpc_mpsc_server *srv, struct urpc_chan *chan) {
+    
+    errval_t err;
+    
+    // Sanity check: the shared ring is only used instead of UMP
+    assert(!chan->use_lmp);
+    
+    // Wait for the client to identify itself
+    domainid_t *pid;
+    size_t size;
+    urpc_msg_type_t msg_type;
+    err = urpc_recv_blocking(chan, (void **) &pid, &size, &msg_type);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Check we received the correct message
+    assert(msg_type == URPC_MessageType_MpscBind);
+    
+    // Send the shared ring to the client
+    err = urpc_share_frame(*pid, srv->frame);
+    free(pid);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Register the response channel under the first free client ID
+    ump_mpsc_client_t client_id = 0;
+    while (client_id < srv->num_clients && srv->clients[client_id] != NULL) {
+        client_id++;
+    }
+    if (client_id == srv->num_clients) {
+        struct urpc_chan **clients = realloc(srv->clients,
+                                             (srv->num_clients + 1) * sizeof(struct urpc_chan *));
+        if (clients == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        srv->clients = clients;
+        srv->num_clients++;
+    }
+    srv->clients[client_id] = chan;
+    
+    // Tell the client which ID to tag its requests with
+    return urpc_send(chan, &client_id, sizeof(ump_mpsc_client_t),
+                     URPC_MessageType_MpscBindAck);
+    
+}
+
+// Receive the next request on the shared ring and the channel to reply on
+errval_t urpc_mpsc_recv(struct urpc_mpsc_server *srv, struct urpc_chan **chan,
+                        void **buf, size_t *size, urpc_msg_type_t *msg_type) {
+    
+    ump_mpsc_client_t client_id;
+    
+    while (true) {
+        
+        errval_t err = ump_mpsc_recv(&srv->chan, &client_id, buf, size,
+                                     (ump_msg_type_t *) msg_type);
+        if (err == LIB_ERR_NO_UMP_MSG) {
+            return LIB_ERR_NO_URPC_MSG;
+        }
+        if (err_is_fail(err)) {
+            return err;
+        }
+        
+        // Look up the response channel of the client
+        if (client_id < srv->num_clients && srv->clients[client_id] != NULL) {
+            *chan = srv->clients[client_id];
+            return SYS_ERR_OK;
+        }
+        
+        // Nobody to reply to for a client that was released
+        debug_printf("Request of unknown client %u dropped\n", client_id);
+        free(*buf);
+        
+    }
+    
+}
+
+// Detach a client that sends no more requests and free its channel
+void urpc_mpsc_release(struct urpc_mpsc_server *srv, struct urpc_chan *chan) {
+    
+    for (size_t i = 0; i < srv->num_clients; i++) {
+        if (srv->clients[i] == chan) {
+            srv->clients[i] = NULL;
+            break;
+        }
+    }
+    
+    // Unmap the response channel
+    paging_unmap(get_current_paging_state(), chan->ump->buf);
+    free(chan->ump);
+    free(chan);
+    
+}
+
+
+
 // MARK: - Generic Client
 
 // Bind to a URPC server with a specific PID
@@ -298,6 +575,7 @@ errval_t urpc_bind(domainid_t pid, struct urpc_chan *chan, bool use_lmp) {
     
     // Set the new chanel to correct transport protocol
     chan->use_lmp = use_lmp;
+    chan->mpsc = NULL;
     
     // Get the channel to this core's init
     struct lmp_chan *lc = get_init_lmp_chan();
@@ -431,6 +709,60 @@ errval_t urpc_bind(domainid_t pid, struct urpc_chan *chan, bool use_lmp) {
     
 }
 
+// Bind to a URPC server which serves all clients through a shared request ring
+errval_t urpc_bind_mpsc(domainid_t pid, struct urpc_chan *chan) {
+    
+    errval_t err;
+    
+    // Set up the private channel which carries the responses
+    err = urpc_bind(pid, chan, false);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Identify ourselves so the server can send us the shared ring
+    domainid_t my_pid = disp_get_domain_id();
+    err = urpc_send(chan, &my_pid, sizeof(domainid_t),
+                    URPC_MessageType_MpscBind);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Allocate client side state of the shared ring
+    struct urpc_mpsc *mpsc = (struct urpc_mpsc *) malloc(sizeof(struct urpc_mpsc));
+    assert(mpsc);
+    
+    // Wait for the shared ring and map it
+    size_t ring_bytes;
+    err = urpc_map_shared_frame((void **) &mpsc->buf, &ring_bytes);
+    if (err_is_fail(err)) {
+        free(mpsc);
+        return err;
+    }
+    
+    // Wait for our client ID
+    ump_mpsc_client_t *client_id;
+    size_t retsize;
+    urpc_msg_type_t msg_type;
+    err = urpc_recv_blocking(chan, (void **) &client_id, &retsize, &msg_type);
+    if (err_is_fail(err)) {
+        free(mpsc);
+        return err;
+    }
+    
+    // Check we recieved the correct message
+    assert(msg_type == URPC_MessageType_MpscBindAck);
+    
+    mpsc->client_id = *client_id;
+    free(client_id);
+    
+    // From now on send all requests on the shared ring
+    chan->mpsc = mpsc;
+    
+    return SYS_ERR_OK;
+    
+}
+
 
 // MARK: - Generic Send & Receive
 
@@ -448,6 +780,15 @@ errval_t urpc_send(struct urpc_chan *chan, void *buf, size_t size,
         
         // MARK: UMP
         
+        // Requests of shared ring clients go to the shared ring
+        if (chan->mpsc != NULL) {
+            return ump_mpsc_send(chan->mpsc->buf,
+                                 chan->mpsc->client_id,
+                                 buf,
+                                 size,
+                                 (ump_msg_type_t) msg_type);
+        }
+        
         ump_send(chan->ump, buf, size, (ump_msg_type_t) msg_type);
         return SYS_ERR_OK;
         
@@ -575,16 +916,17 @@ void urpc_handle_lmp_bind_request(struct lmp_chan *lc,
     // Sanity check: cannot bind to init
     assert(msg.words[1] != 0 && "Cannot bind to init!");
     
-    // Get the requested process by it's PID
-    struct process_info *pi = process_info_for_pid(msg.words[1]);
-    
-    // Check the process exists
-    if (pi == NULL) {
-        return;
-    }
-    
-    // Check if the process is on this core
-    if (disp_get_core_id() == pi->core_id) {
+    // Check if the process is on this core (the core is part of the PID, so
+    // this works before its registration reached us)
+    if (disp_get_core_id() == PROCESS_PID_CORE(msg.words[1])) {
+        
+        // Get the requested process by it's PID
+        struct process_info *pi = process_info_for_pid(msg.words[1]);
+        
+        // Check the process exists
+        if (pi == NULL) {
+            return;
+        }
         
         // Forward the request to the process
         urpc_forward_request_lmp(pi->lc,
@@ -599,7 +941,7 @@ void urpc_handle_lmp_bind_request(struct lmp_chan *lc,
         assert(msg.words[0] == LMP_RequestType_UmpBind);
         
         // Forward the request to the other core
-        urpc_forward_request_ump(msg_cap, pi->pid);
+        urpc_forward_request_ump(msg_cap, msg.words[1]);
         
     }
     
@@ -658,4 +1000,19 @@ void urpc_handle_deregister_forward(struct ump_chan *chan, void *msg, size_t siz
     domainid_t *pid = (domainid_t *) msg;
 
     notify_deregister_listeners(*pid);
+
+    // Remove the process from this core's registry as well
+    process_deregister(*pid);
+}
+
+// Handle deregister queries, live processes are forwarded once they deregister
+void urpc_handle_deregister_query(struct ump_chan *chan, void *msg, size_t size,
+                                  ump_msg_type_t msg_type) {
+
+    domainid_t *pid = (domainid_t *) msg;
+
+    // This core's registry knows all of its processes
+    if (process_info_for_pid(*pid) == NULL) {
+        ump_send(chan, pid, sizeof(domainid_t), UMP_MessageType_DeregisterForward);
+    }
 }
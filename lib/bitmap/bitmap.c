@@ -57,7 +57,8 @@ struct bitmap
  */
 struct bitmap *bitmap_alloc(uint32_t nbits)
 {
-    struct bitmap *bm = calloc(1, sizeof(*bm) + BITMAP_DATA_SIZE(nbits));
+    struct bitmap *bm = calloc(1, sizeof(*bm) +
+                               BITMAP_DATA_SIZE(nbits) * sizeof(bitmap_data_t));
     if (bm == NULL) {
         return 0;
     }
@@ -312,12 +313,27 @@ bitmap_bit_t bitmap_get_last(const struct bitmap *bm)
  */
 bitmap_bit_t bitmap_get_next(const struct bitmap *bm, bitmap_bit_t i)
 {
-    for (bitmap_bit_t k = i+1; k < bm->nbits; ++k) {
-        if (bitmap_is_bit_set(bm, k)) {
-            return k;
+    uint32_t k = i + 1;
+    if (i < -1 || k >= bm->nbits) {
+        return BITMAP_BIT_NONE;
+    }
+
+    /* mask out the bits below k in the first element */
+    uint32_t idx = k / BITMAP_BITS_PER_ELEMENT;
+    bitmap_data_t data = bm->data[idx] & (~(bitmap_data_t)0 << (k % BITMAP_BITS_PER_ELEMENT));
+
+    /* skip empty elements a word at a time */
+    while (data == 0) {
+        if (++idx >= BITMAP_DATA_SIZE(bm->nbits)) {
+            return BITMAP_BIT_NONE;
         }
+        data = bm->data[idx];
     }
-    return BITMAP_BIT_NONE;
+
+    k = idx * BITMAP_BITS_PER_ELEMENT + __builtin_ctz(data);
+
+    /* bits past nbits in the last element may have been set by set_all */
+    return (k < bm->nbits) ? (bitmap_bit_t)k : BITMAP_BIT_NONE;
 }
 
 /**
@@ -331,15 +347,25 @@ bitmap_bit_t bitmap_get_next(const struct bitmap *bm, bitmap_bit_t i)
  */
 bitmap_bit_t bitmap_get_prev(const struct bitmap *bm, bitmap_bit_t i)
 {
-    if (i < bm->nbits) {
-        for (bitmap_bit_t k = i-1; k >= 0; --k) {
-            if (bitmap_is_bit_set(bm, k)) {
-                return k;
-            }
+    if (i <= 0 || i >= bm->nbits) {
+        return BITMAP_BIT_NONE;
+    }
+
+    /* mask out the bits from i on in the first element */
+    uint32_t k = i - 1;
+    uint32_t idx = k / BITMAP_BITS_PER_ELEMENT;
+    uint32_t shift = BITMAP_BITS_PER_ELEMENT - 1 - (k % BITMAP_BITS_PER_ELEMENT);
+    bitmap_data_t data = bm->data[idx] & (~(bitmap_data_t)0 >> shift);
+
+    /* skip empty elements a word at a time */
+    while (data == 0) {
+        if (idx == 0) {
+            return BITMAP_BIT_NONE;
         }
+        data = bm->data[--idx];
     }
 
-    return BITMAP_BIT_NONE;
+    return idx * BITMAP_BITS_PER_ELEMENT + (BITMAP_BITS_PER_ELEMENT - 1) - __builtin_clz(data);
 }
 
 /*
@@ -325,6 +325,61 @@ static errval_t fs_fstat(fs_dirhandle_t h, struct fs_fileinfo *b) {
     return vfs_stat(vfs_state, h, b);
 }
 
+errval_t filesystem_mmap(const char *path, void **buffer, size_t *bytes) {
+    
+    errval_t err;
+    
+    vfs_handle_t vh;
+    err = vfs_open(vfs_state, path, &vh);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // The mapping outlives the handle
+    err = vfs_mmap(vfs_state, vh, buffer, bytes);
+    
+    vfs_close(vfs_state, vh);
+    
+    return err;
+    
+}
+
+errval_t filesystem_stat(const char *path, struct fs_fileinfo *info) {
+    
+    errval_t err;
+    
+    vfs_handle_t vh;
+    err = vfs_open(vfs_state, path, &vh);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    err = vfs_stat(vfs_state, vh, info);
+    
+    vfs_close(vfs_state, vh);
+    
+    return err;
+    
+}
+
+errval_t filesystem_sync(void) {
+    
+    return vfs_sync_all(vfs_state);
+    
+}
+
+// Write back cached file data before the file server forgets this domain
+static void fs_libc_exit(void)
+{
+    // libc flushes the stdio buffers only after the exit handlers ran
+    fflush(NULL);
+    
+    errval_t err = filesystem_sync();
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+    }
+}
+
 
 typedef int   fsopen_fn_t(char *, int);
 typedef int   fsread_fn_t(int, void *buf, size_t);
@@ -349,4 +404,8 @@ void fs_libc_init(void *fs_state)
 
     vfs_state = fs_state;
     
+    // Exit handlers run in reverse order, so this one runs before the file
+    // server connection set up earlier is detached
+    atexit(fs_libc_exit);
+    
 }
@@ -4,6 +4,7 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <aos/aos.h>
@@ -18,15 +19,223 @@
 #include <fs/fs_rpc.h>
 #include <fs_serv/fat_helper.h>
 
+#include <bitmacros.h>
+
 //typedef struct fat32fs_handle *fat32fs_handle_t;
 
 
-static struct fat32fs_handle *handle_open(struct fat_dirent *dirent);
+static struct fat32fs_handle *handle_open(uint32_t id, bool isdir);
 static void handle_close(struct fat32fs_handle *handle);
+static errval_t fs_rpc_simple(urpc_msg_type_t msg_type, uint32_t id);
 
 
 static struct urpc_chan chan;
 
+// Buffer shared with the server, file data is passed through it
+static uint8_t *shared_buf;
+static size_t shared_buf_size;
+
+// Batch waiting for its reply (its data is in the shared buffer)
+static struct fs_rpc_batch_op *batch_ops;
+static size_t batch_count;
+static fs_rpc_batch_handler batch_handler;
+static void *batch_arg;
+
+
+// Set the results of the batch in flight and call its handler
+static void batch_complete(uint8_t *recv_buffer, size_t recv_size) {
+    
+    assert(batch_ops != NULL);
+    
+    struct fs_message *recv_msg = (struct fs_message *) recv_buffer;
+    struct fs_message *results = (struct fs_message *) (recv_buffer + sizeof(struct fs_message));
+    
+    // The whole batch failed if the server sent no results
+    errval_t batch_err = recv_msg->arg1;
+    if (err_is_ok(batch_err) &&
+        (recv_msg->arg2 != batch_count ||
+         recv_size < sizeof(struct fs_message) * (batch_count + 1))) {
+        batch_err = FS_ERR_READ;
+    }
+    
+    // File opened by the previous operation
+    struct fat32fs_handle *linked = NULL;
+    
+    size_t offset = 0;
+    for (size_t i = 0; i < batch_count; i++) {
+        
+        struct fs_rpc_batch_op *op = &batch_ops[i];
+        struct fat32fs_handle *h = op->handle != NULL ? op->handle : linked;
+        
+        // Location of the operation's data in the shared buffer
+        uint8_t *data = shared_buf + offset;
+        offset += fs_rpc_batch_op_size(op);
+        
+        op->err = err_is_fail(batch_err) ? batch_err : (errval_t) results[i].arg1;
+        op->ret_bytes = 0;
+        op->ret_handle = NULL;
+        op->name = NULL;
+        
+        if (err_is_fail(op->err)) {
+            
+            // A failed open leaves no file for the following operations
+            if (op->type == FS_RPC_OP_OPEN || op->type == FS_RPC_OP_CREATE) {
+                linked = NULL;
+            }
+            
+            // The server forgets the handle even if closing failed
+            if (op->type == FS_RPC_OP_CLOSE && op->err != FS_ERR_CANCELED && h != NULL) {
+                if (h == linked) {
+                    linked = NULL;
+                }
+                handle_close(h);
+            }
+            
+            continue;
+            
+        }
+        
+        switch (op->type) {
+            case FS_RPC_OP_OPEN:
+            case FS_RPC_OP_CREATE:
+                
+                // Construct handle with the server's handle and type
+                linked = handle_open(results[i].arg2, results[i].arg3);
+                linked->path = strdup((char *) data);
+                op->ret_handle = linked;
+                
+                break;
+                
+            case FS_RPC_OP_CLOSE:
+                
+                if (h == linked) {
+                    linked = NULL;
+                }
+                handle_close(h);
+                
+                break;
+                
+            case FS_RPC_OP_READ:
+                
+                // Copy read data from shared buffer into buffer
+                op->ret_bytes = MIN(results[i].arg2, op->bytes);
+                memcpy(op->buffer, data, op->ret_bytes);
+                
+                break;
+                
+            case FS_RPC_OP_WRITE:
+                
+                op->ret_bytes = MIN(results[i].arg2, op->bytes);
+                
+                break;
+                
+            case FS_RPC_OP_STAT:
+                
+                op->info.type = results[i].arg3 ? FS_DIRECTORY : FS_FILE;
+                op->info.size = results[i].arg2;
+                op->info.version = results[i].arg4;
+                
+                break;
+                
+            case FS_RPC_OP_READDIR: {
+                
+                // The server put the dirent into the shared buffer
+                struct fat_dirent dirent;
+                memcpy(&dirent, data, sizeof(struct fat_dirent));
+                
+                op->info.type = dirent.is_dir ? FS_DIRECTORY : FS_FILE;
+                op->info.size = dirent.size;
+                op->info.version = 0;
+                op->name = convert_to_normal_name(dirent.name);
+                
+                break;
+                
+            }
+        }
+        
+    }
+    
+    // Release the shared buffer before the handler can submit the next batch
+    struct fs_rpc_batch_op *ops = batch_ops;
+    size_t count = batch_count;
+    batch_ops = NULL;
+    batch_count = 0;
+    
+    batch_handler(batch_arg, ops, count);
+    
+}
+
+// Receive the reply to a request, a batch reply that comes first is handled
+static errval_t fs_rpc_recv(void **buf, size_t *size, urpc_msg_type_t *msg_type) {
+    
+    while (true) {
+        
+        errval_t err = urpc_recv_blocking(&chan, buf, size, msg_type);
+        if (err_is_fail(err) || *msg_type != URPC_MessageType_Batch) {
+            return err;
+        }
+        
+        batch_complete(*buf, *size);
+        
+        free(*buf);
+        
+    }
+    
+}
+
+
+/// -> [fs_message]
+/// <- [fs_message]
+static errval_t fs_rpc_map_buffer(void) {
+    
+    errval_t err;
+    
+    // Identify ourselves so the server can send us the frame
+    struct fs_message send_msg = {
+        .arg1 = disp_get_domain_id(),
+        .arg2 = 0,
+        .arg3 = 0,
+        .arg4 = 0
+    };
+    
+    // Send request message to server
+    urpc_send(&chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_MapBuffer);
+    
+    // Receive response message from server
+    size_t recv_size;
+    urpc_msg_type_t recv_msg_type;
+    uint8_t *recv_buffer;
+    
+    // Wait for response from server
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
+    
+    assert(recv_msg_type == URPC_MessageType_MapBuffer);
+    
+    // Set error
+    err = ((struct fs_message *) recv_buffer)->arg1;
+    
+    // Free receive buffer
+    free(recv_buffer);
+    
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // The frame is on its way, map it
+    return urpc_map_shared_frame((void **) &shared_buf, &shared_buf_size);
+    
+}
+
+// Let the server release the handles and the buffer of this domain
+static void fs_rpc_detach(void) {
+    
+    // Write out stdio buffers while the handles are still open
+    fflush(NULL);
+    
+    fs_rpc_simple(URPC_MessageType_Sync, FS_RPC_SYNC_DETACH);
+    
+}
+
 errval_t fs_rpc_init(void *state) {
 
     errval_t err;
@@ -39,19 +248,33 @@ errval_t fs_rpc_init(void *state) {
     }
 
     // Try to bind to mmchs
-    //  Use LMP when on core 0!
-    err = urpc_bind(pid, &chan, !disp_get_core_id());
+    //  Use LMP when on core 0, otherwise use the shared request ring!
+    if (disp_get_core_id() == 0) {
+        err = urpc_bind(pid, &chan, true);
+    }
+    else {
+        err = urpc_bind_mpsc(pid, &chan);
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Set up the buffer for file data
+    err = fs_rpc_map_buffer();
     if (err_is_fail(err)) {
         return err;
     }
     
+    // Release the server's state of this domain on exit
+    atexit(fs_rpc_detach);
+    
     return SYS_ERR_OK;
 
 }
 
 
 /// -> [fs_message] | [path]
-/// <- [fs_message] | [dirent]
+/// <- [fs_message]
 errval_t fs_rpc_open(void *st, char *path, fat32fs_handle_t *ret_handle) {
     
     errval_t err;
@@ -94,7 +317,7 @@ errval_t fs_rpc_open(void *st, char *path, fat32fs_handle_t *ret_handle) {
     uint8_t *recv_buffer;
     
     // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
     
     assert(recv_msg_type == URPC_MessageType_Open);
     
@@ -104,14 +327,12 @@ errval_t fs_rpc_open(void *st, char *path, fat32fs_handle_t *ret_handle) {
     err = recv_msg->arg1;
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
+        free(recv_buffer);
+        return err;
     }
     
-    // Allocate and copy in dirent from receive buffer
-    struct fat_dirent *dirent = calloc(1, sizeof(struct fat_dirent));
-    memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
-    
-    // Construct/open handle
-    struct fat32fs_handle *handle = handle_open(dirent);
+    // Construct/open handle with the server's handle and type
+    struct fat32fs_handle *handle = handle_open(recv_msg->arg2, recv_msg->arg3);
     
     // Copy in path string
     handle->path = strdup(path);
@@ -127,7 +348,7 @@ errval_t fs_rpc_open(void *st, char *path, fat32fs_handle_t *ret_handle) {
 }
 
 /// -> [fs_message] | [path]
-/// <- [fs_message] | [dirent]
+/// <- [fs_message]
 errval_t fs_rpc_create(void *st, char *path, fat32fs_handle_t *ret_handle) {
     
     errval_t err;
@@ -170,7 +391,7 @@ errval_t fs_rpc_create(void *st, char *path, fat32fs_handle_t *ret_handle) {
     uint8_t *recv_buffer;
     
     // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
     
     assert(recv_msg_type == URPC_MessageType_Create);
     
@@ -180,14 +401,12 @@ errval_t fs_rpc_create(void *st, char *path, fat32fs_handle_t *ret_handle) {
     err = recv_msg->arg1;
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
+        free(recv_buffer);
+        return err;
     }
     
-    // Allocate and copy in dirent from receive buffer
-    struct fat_dirent *dirent = calloc(1, sizeof(struct fat_dirent));
-    memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
-    
-    // Construct/open handle
-    struct fat32fs_handle *handle = handle_open(dirent);
+    // Construct/open handle with the server's handle and type
+    struct fat32fs_handle *handle = handle_open(recv_msg->arg2, recv_msg->arg3);
     
     // Copy in path string
     handle->path = strdup(path);
@@ -243,7 +462,7 @@ errval_t fs_rpc_remove(void *st, char *path)
     uint8_t *recv_buffer;
     
     // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
 
     assert(recv_msg_type == URPC_MessageType_Remove);
     
@@ -263,49 +482,23 @@ errval_t fs_rpc_remove(void *st, char *path)
     
 }
 
-/// -> [fs_message] | [dirent]
-/// <- [fs_message] | [buffer]
-errval_t fs_rpc_read(void *st, fat32fs_handle_t handle, void *buffer, size_t bytes,
-                      size_t *bytes_read) {
+/// -> [fs_message]
+/// <- [fs_message]
+static errval_t fs_rpc_transfer(struct fat32fs_handle *h, size_t bytes, size_t *ret_bytes,
+                                urpc_msg_type_t msg_type) {
     
     errval_t err;
     
-    struct fat32fs_handle *h = handle;
-    
-    assert(bytes_read != NULL);
-
-    assert(handle != NULL);
-    
-    if (h->isdir) {
-        return FS_ERR_NOTFILE;
-    }
-    
-    assert(h->pos >= 0);
-    
+    // The data itself is in the shared buffer
     struct fs_message send_msg = {
-        .arg1 = h->pos,
-        .arg2 = bytes,
-        .arg3 = 0,
+        .arg1 = h->id,
+        .arg2 = h->pos,
+        .arg3 = bytes,
         .arg4 = 0
     };
     
-    // Size of send buffer
-    size_t send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
-    
-    // Allocate send buffer
-    uint8_t *send_buffer = calloc(1, send_size);
-    
-    // Copy fs_message into send buffer
-    memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
-    
-    // Copy dirent into send buffer
-    memcpy(send_buffer + sizeof(struct fs_message), h->dirent, sizeof(struct fat_dirent));
-    
     // Send request message to server
-    urpc_send(&chan, send_buffer, send_size, URPC_MessageType_Read);
-    
-    // Free send buffer
-    free(send_buffer);
+    urpc_send(&chan, (void *) &send_msg, sizeof(struct fs_message), msg_type);
     
     // Receive response message from server
     size_t recv_size;
@@ -313,9 +506,9 @@ errval_t fs_rpc_read(void *st, fat32fs_handle_t handle, void *buffer, size_t byt
     uint8_t *recv_buffer;
     
     // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
     
-    assert(recv_msg_type == URPC_MessageType_Read);
+    assert(recv_msg_type == msg_type);
     
     // Receive header response message
     struct fs_message *recv_msg = (struct fs_message *) recv_buffer;
@@ -326,19 +519,11 @@ errval_t fs_rpc_read(void *st, fat32fs_handle_t handle, void *buffer, size_t byt
         debug_printf("%s\n", err_getstring(err));
     }
     
-    // Read bytes by server
-    size_t ret_bytes = recv_msg->arg2;
-    
-    assert(ret_bytes + sizeof(struct fs_message) <= recv_size);
+    // Bytes transferred by server (never more than requested)
+    *ret_bytes = MIN(recv_msg->arg2, bytes);
     
     // Update file position
-    h->pos += ret_bytes;
-    
-    // Copy read data from receive buffer into buffer
-    memcpy(buffer, recv_buffer + sizeof(struct fs_message), ret_bytes);
-    
-    // Set return argument bytes read by server
-    *bytes_read = ret_bytes;
+    h->pos += *ret_bytes;
     
     // Free receive buffer
     free(recv_buffer);
@@ -347,91 +532,109 @@ errval_t fs_rpc_read(void *st, fat32fs_handle_t handle, void *buffer, size_t byt
     
 }
 
-/// -> [fs_message] | [dirent] | [buffer]
-/// <- [fs_message] | [buffer]
-errval_t fs_rpc_write(void *st, fat32fs_handle_t handle, const void *buffer,
-                       size_t bytes, size_t *bytes_written) {
+errval_t fs_rpc_read(void *st, fat32fs_handle_t handle, void *buffer, size_t bytes,
+                      size_t *bytes_read) {
     
-    errval_t err;
+    errval_t err = SYS_ERR_OK;
     
     struct fat32fs_handle *h = handle;
     
-    assert(bytes_written != NULL);
-    
+    assert(bytes_read != NULL);
+
     assert(handle != NULL);
     
-    //struct fat32_handle *h = handle;
-    
     if (h->isdir) {
         return FS_ERR_NOTFILE;
     }
     
     assert(h->pos >= 0);
     
-    struct fs_message send_msg = {
-        .arg1 = h->pos,
-        .arg2 = bytes,
-        .arg3 = 0,
-        .arg4 = 0
-    };
-    
-    // Size of send buffer
-    size_t send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent) + bytes;
+    // The data of a batch in flight is still in the shared buffer
+    if (batch_ops != NULL) {
+        fs_rpc_batch_poll(true);
+    }
     
-    // Allocate send buffer
-    uint8_t *send_buffer = calloc(1, send_size);
+    // Read in chunks that fit into the shared buffer
+    size_t total = 0;
+    while (total < bytes) {
+        
+        size_t chunk = MIN(bytes - total, shared_buf_size);
+        size_t ret_bytes = 0;
+        
+        // Let the server read the chunk into the shared buffer
+        err = fs_rpc_transfer(h, chunk, &ret_bytes, URPC_MessageType_Read);
+        
+        // Copy read data from shared buffer into buffer
+        memcpy((uint8_t *) buffer + total, shared_buf, ret_bytes);
+        
+        total += ret_bytes;
+        
+        // Stop at an error or the end of the file
+        if (err_is_fail(err) || ret_bytes < chunk) {
+            break;
+        }
+        
+    }
     
-    // Copy fs_message into send buffer
-    memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
+    // Set return argument bytes read by server
+    *bytes_read = total;
     
-    // Copy dirent into send buffer
-    memcpy(send_buffer + sizeof(struct fs_message), h->dirent, sizeof(struct fat_dirent));
+    return err;
     
-    // Copy buffer into send buffer
-    memcpy(send_buffer + sizeof(struct fs_message) + sizeof(struct fat_dirent), buffer, bytes);
+}
+
+errval_t fs_rpc_write(void *st, fat32fs_handle_t handle, const void *buffer,
+                       size_t bytes, size_t *bytes_written) {
     
-    // Send request message to server
-    urpc_send(&chan, send_buffer, send_size, URPC_MessageType_Write);
+    errval_t err = SYS_ERR_OK;
     
-    // Free send buffer
-    free(send_buffer);
+    struct fat32fs_handle *h = handle;
     
-    // Receive response message from server
-    size_t recv_size;
-    urpc_msg_type_t recv_msg_type;
-    uint8_t *recv_buffer;
+    assert(bytes_written != NULL);
     
-    // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    assert(handle != NULL);
     
-    assert(recv_msg_type == URPC_MessageType_Write);
+    if (h->isdir) {
+        return FS_ERR_NOTFILE;
+    }
     
-    // Receive header response message
-    struct fs_message *recv_msg = (struct fs_message *) recv_buffer;
+    assert(h->pos >= 0);
     
-    // Set error
-    err = recv_msg->arg1;
-    if (err_is_fail(err)) {
-        debug_printf("%s\n", err_getstring(err));
+    // The data of a batch in flight is still in the shared buffer
+    if (batch_ops != NULL) {
+        fs_rpc_batch_poll(true);
     }
     
-    // Read bytes by server
-    size_t ret_bytes = recv_msg->arg2;
-    
-    // Update file position
-    h->pos += ret_bytes;
+    // Write in chunks that fit into the shared buffer
+    size_t total = 0;
+    while (total < bytes) {
+        
+        size_t chunk = MIN(bytes - total, shared_buf_size);
+        size_t ret_bytes = 0;
+        
+        // Copy buffer into shared buffer
+        memcpy(shared_buf, (const uint8_t *) buffer + total, chunk);
+        
+        // Let the server write the chunk from the shared buffer
+        err = fs_rpc_transfer(h, chunk, &ret_bytes, URPC_MessageType_Write);
+        
+        total += ret_bytes;
+        
+        // Stop at an error or a short write
+        if (err_is_fail(err) || ret_bytes < chunk) {
+            break;
+        }
+        
+    }
     
     // Set return argument bytes written by server
-    *bytes_written = ret_bytes;
-    
-    // Free receive buffer
-    free(recv_buffer);
+    *bytes_written = total;
     
     return err;
     
 }
 
-/// -> [fs_message] | [dirent]
+/// -> [fs_message]
 /// <- [fs_message]
 errval_t fs_rpc_truncate(void *st, fat32fs_handle_t handle, size_t bytes) {
     
@@ -440,29 +643,14 @@ errval_t fs_rpc_truncate(void *st, fat32fs_handle_t handle, size_t bytes) {
     struct fat32fs_handle *h = handle;
     
     struct fs_message send_msg = {
-        .arg1 = bytes,
-        .arg2 = 0,
+        .arg1 = h->id,
+        .arg2 = bytes,
         .arg3 = 0,
         .arg4 = 0
     };
     
-    // Size of send buffer
-    size_t send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
-
-    // Allocate send buffer
-    uint8_t *send_buffer = calloc(1, send_size);
-    
-    // Copy fs_message into send buffer
-    memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
-    
-    // Copy path (including '\0' into send buffers
-    memcpy(send_buffer + sizeof(struct fs_message), h->dirent, sizeof(struct fat32fs_handle));
-    
     // Send request message to server
-    urpc_send(&chan, send_buffer, send_size, URPC_MessageType_Truncate);
-    
-    // Free send buffer
-    free(send_buffer);
+    urpc_send(&chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_Truncate);
     
     // Receive response message from server
     size_t recv_size;
@@ -470,7 +658,7 @@ errval_t fs_rpc_truncate(void *st, fat32fs_handle_t handle, size_t bytes) {
     uint8_t *recv_buffer;
     
     // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
     
     assert(recv_msg_type == URPC_MessageType_Truncate);
     
@@ -518,17 +706,56 @@ errval_t fs_rpc_tell(void *st, fat32fs_handle_t handle, size_t *ret_pos) {
 
 }
 
+/// -> [fs_message]
+/// <- [fs_message]
 errval_t fs_rpc_stat(void *st, fat32fs_handle_t inhandle, struct fs_fileinfo *info) {
     
+    errval_t err;
+    
     struct fat32fs_handle *h = inhandle;
     
     assert(h != NULL);
     
     assert(info != NULL);
-    info->type = h->isdir ? FS_DIRECTORY : FS_FILE;
-    info->size = h->dirent->size;
     
-    return SYS_ERR_OK;
+    struct fs_message send_msg = {
+        .arg1 = h->id,
+        .arg2 = 0,
+        .arg3 = 0,
+        .arg4 = 0
+    };
+    
+    // Send request message to server
+    urpc_send(&chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_Stat);
+    
+    // Receive response message from server
+    size_t recv_size;
+    urpc_msg_type_t recv_msg_type;
+    uint8_t *recv_buffer;
+    
+    // Wait for response from server
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
+    
+    assert(recv_msg_type == URPC_MessageType_Stat);
+    
+    // Receive header response message
+    struct fs_message *recv_msg = (struct fs_message *) recv_buffer;
+    
+    // Set error
+    err = recv_msg->arg1;
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+    }
+    
+    // Set file information (the server has the current size)
+    info->type = recv_msg->arg3 ? FS_DIRECTORY : FS_FILE;
+    info->size = recv_msg->arg2;
+    info->version = recv_msg->arg4;
+    
+    // Free receive buffer
+    free(recv_buffer);
+    
+    return err;
     
 }
 
@@ -577,9 +804,50 @@ errval_t fs_rpc_seek(void *st, fat32fs_handle_t handle, enum fs_seekpos whence,
     
 }
 
+/// -> [fs_message]
+/// <- [fs_message]
+static errval_t fs_rpc_simple(urpc_msg_type_t msg_type, uint32_t id) {
+    
+    errval_t err;
+    
+    struct fs_message send_msg = {
+        .arg1 = id,
+        .arg2 = 0,
+        .arg3 = 0,
+        .arg4 = 0
+    };
+    
+    // Send request message to server
+    urpc_send(&chan, (void *) &send_msg, sizeof(struct fs_message), msg_type);
+    
+    // Receive response message from server
+    size_t recv_size;
+    urpc_msg_type_t recv_msg_type;
+    uint8_t *recv_buffer;
+    
+    // Wait for response from server
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
+    
+    assert(recv_msg_type == msg_type);
+    
+    // Set error
+    err = ((struct fs_message *) recv_buffer)->arg1;
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+    }
+    
+    // Free receive buffer
+    free(recv_buffer);
+    
+    return err;
+    
+}
+
 errval_t fs_rpc_close(void *st, fat32fs_handle_t inhandle)
 {
     
+    errval_t err;
+    
     struct fat32fs_handle *h = inhandle;
     
     //struct fat32fs_handle *handle = inhandle;
@@ -589,12 +857,22 @@ errval_t fs_rpc_close(void *st, fat32fs_handle_t inhandle)
         return FS_ERR_NOTFILE;
     }
     
+    // Let the server close the handle and write back its cached sectors
+    err = fs_rpc_simple(URPC_MessageType_Close, h->id);
+    
     handle_close(h);
     
-    return SYS_ERR_OK;
+    return err;
 
 }
 
+errval_t fs_rpc_sync(void *st) {
+    
+    // Let the server write back its cached sectors
+    return fs_rpc_simple(URPC_MessageType_Sync, 0);
+    
+}
+
 errval_t fs_rpc_opendir(void *st, char *path, fs_dirhandle_t *ret_dirhandle) {
     
     errval_t err;
@@ -633,7 +911,7 @@ errval_t fs_rpc_opendir(void *st, char *path, fs_dirhandle_t *ret_dirhandle) {
     uint8_t *recv_buffer;
     
     // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
     
     assert(recv_msg_type == URPC_MessageType_OpenDir);
     
@@ -643,14 +921,12 @@ errval_t fs_rpc_opendir(void *st, char *path, fs_dirhandle_t *ret_dirhandle) {
     err = recv_msg->arg1;
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
+        free(recv_buffer);
+        return err;
     }
     
-    // Allocate and copy in dirent from receive buffer
-    struct fat_dirent *dirent = calloc(1, sizeof(struct fat_dirent));
-    memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
-    
-    // Construct/open handle
-    struct fat32fs_handle *handle = handle_open(dirent);
+    // Construct/open handle with the server's handle and type
+    struct fat32fs_handle *handle = handle_open(recv_msg->arg2, recv_msg->arg3);
     
     // Copy in path string
     handle->path = strdup(path);
@@ -687,26 +963,14 @@ errval_t fs_rpc_readdir(void *st, fs_dirhandle_t dirhandle, char **ret_name,
     assert(handle->pos >= 0);
     
     struct fs_message send_msg = {
-        .arg1 = handle->pos,
-        .arg2 = 0,
+        .arg1 = handle->id,
+        .arg2 = handle->pos,
         .arg3 = 0,
         .arg4 = 0
     };
     
-    // Size of send buffer
-    size_t send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
-    
-    // Allocate send buffer
-    uint8_t *send_buffer = calloc(1, send_size);
-    
-    // Copy fs_message into send buffer
-    memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
-    
-    // Copy dirent into send buffer
-    memcpy(send_buffer + sizeof(struct fs_message), handle->dirent, sizeof(struct fat_dirent));
-    
     // Send request message to server
-    urpc_send(&chan, send_buffer, send_size, URPC_MessageType_ReadDir);
+    urpc_send(&chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_ReadDir);
     
     // Receive response message from server
     size_t recv_size;
@@ -714,7 +978,7 @@ errval_t fs_rpc_readdir(void *st, fs_dirhandle_t dirhandle, char **ret_name,
     uint8_t *recv_buffer;
     
     // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
     
     assert(recv_msg_type == URPC_MessageType_ReadDir);
     
@@ -759,6 +1023,7 @@ errval_t fs_rpc_readdir(void *st, fs_dirhandle_t dirhandle, char **ret_name,
     if (info != NULL) {
         info->type = dirent->is_dir ? FS_DIRECTORY : FS_FILE;
         info->size = dirent->size;
+        info->version = 0;
     }
     
     // Set return argument bytes read by server
@@ -785,9 +1050,12 @@ errval_t fs_rpc_closedir(void *st, fs_dirhandle_t dirhandle) {
         return FS_ERR_NOTDIR;
     }
     
+    // Let the server close the handle
+    errval_t err = fs_rpc_simple(URPC_MessageType_CloseDir, handle->id);
+    
     handle_close(dirhandle);
     
-    return SYS_ERR_OK;
+    return err;
 
 }
 
@@ -834,7 +1102,7 @@ errval_t fs_rpc_mkdir(void *st, char *path) {
     uint8_t *recv_buffer;
     
     // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
     
     assert(recv_msg_type == URPC_MessageType_MakeDir);
     
@@ -896,7 +1164,7 @@ errval_t fs_rpc_rmdir(void *st, char *path) {
     uint8_t *recv_buffer;
     
     // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    fs_rpc_recv((void **) &recv_buffer, &recv_size, &recv_msg_type);
     
     assert(recv_msg_type == URPC_MessageType_RemoveDir);
     
@@ -915,7 +1183,189 @@ errval_t fs_rpc_rmdir(void *st, char *path) {
     
 }
 
-static struct fat32fs_handle *handle_open(struct fat_dirent *dirent)
+size_t fs_rpc_batch_capacity(void) {
+    
+    return shared_buf_size;
+    
+}
+
+size_t fs_rpc_batch_op_size(const struct fs_rpc_batch_op *op) {
+    
+    size_t size;
+    
+    switch (op->type) {
+        case FS_RPC_OP_OPEN:
+        case FS_RPC_OP_CREATE:
+            size = strlen(op->path) + 1;
+            break;
+        case FS_RPC_OP_READ:
+        case FS_RPC_OP_WRITE:
+            size = op->bytes;
+            break;
+        case FS_RPC_OP_READDIR:
+            size = sizeof(struct fat_dirent);
+            break;
+        default:
+            size = 0;
+            break;
+    }
+    
+    // Keep the data of every operation aligned
+    return ROUND_UP(size, sizeof(uint64_t));
+    
+}
+
+/// -> [fs_message] | [fs_batch_op] * count
+/// <- [fs_message] | [fs_message] * count
+errval_t fs_rpc_batch_submit(struct fs_rpc_batch_op *ops, size_t count,
+                             fs_rpc_batch_handler handler, void *arg) {
+    
+    assert(ops != NULL);
+    assert(handler != NULL);
+    assert(count > 0 && count <= FS_RPC_BATCH_MAX);
+    
+    // Check that the data of all operations fits into the shared buffer
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += fs_rpc_batch_op_size(&ops[i]);
+    }
+    if (total > shared_buf_size) {
+        return FS_ERR_BUF_BOUNDS;
+    }
+    
+    // The shared buffer is still in use by the batch in flight
+    if (batch_ops != NULL) {
+        fs_rpc_batch_poll(true);
+    }
+    
+    struct fs_message send_msg = {
+        .arg1 = count,
+        .arg2 = 0,
+        .arg3 = 0,
+        .arg4 = 0
+    };
+    
+    // Size of send buffer
+    size_t send_size = sizeof(struct fs_message) + count * sizeof(struct fs_batch_op);
+    
+    // Allocate send buffer
+    uint8_t *send_buffer = calloc(1, send_size);
+    if (send_buffer == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    // Copy fs_message into send buffer
+    memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
+    
+    struct fs_batch_op *wire_ops = (struct fs_batch_op *) (send_buffer + sizeof(struct fs_message));
+    
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        
+        struct fs_rpc_batch_op *op = &ops[i];
+        struct fat32fs_handle *h = op->handle;
+        
+        wire_ops[i].type = op->type;
+        wire_ops[i].flags = op->link ? FS_RPC_OP_LINK : 0;
+        wire_ops[i].handle = h != NULL ? h->id : FS_RPC_HANDLE_LINKED;
+        wire_ops[i].pos = op->pos;
+        wire_ops[i].bytes = op->bytes;
+        wire_ops[i].buf_offset = offset;
+        
+        switch (op->type) {
+            case FS_RPC_OP_OPEN:
+            case FS_RPC_OP_CREATE:
+                
+                // Copy path (including '\0') into shared buffer
+                wire_ops[i].bytes = strlen(op->path) + 1;
+                memcpy(shared_buf + offset, op->path, wire_ops[i].bytes);
+                
+                break;
+                
+            case FS_RPC_OP_WRITE:
+                
+                // Copy buffer into shared buffer
+                memcpy(shared_buf + offset, op->buffer, op->bytes);
+                
+                break;
+                
+            case FS_RPC_OP_READDIR:
+                
+                // Take the next directory index (a file just opened starts at 0)
+                wire_ops[i].pos = h != NULL ? h->pos++ : 0;
+                wire_ops[i].bytes = sizeof(struct fat_dirent);
+                
+                break;
+                
+            default:
+                break;
+        }
+        
+        offset += fs_rpc_batch_op_size(op);
+        
+    }
+    
+    // Send request message to server
+    errval_t err = urpc_send(&chan, send_buffer, send_size, URPC_MessageType_Batch);
+    
+    // Free send buffer
+    free(send_buffer);
+    
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Wait for the reply later
+    batch_ops = ops;
+    batch_count = count;
+    batch_handler = handler;
+    batch_arg = arg;
+    
+    return SYS_ERR_OK;
+    
+}
+
+errval_t fs_rpc_batch_poll(bool blocking) {
+    
+    errval_t err;
+    
+    assert(batch_ops != NULL);
+    
+    // Receive response message from server
+    size_t recv_size;
+    urpc_msg_type_t recv_msg_type;
+    uint8_t *recv_buffer;
+    
+    // Only the batch can be outstanding, synchronous calls wait for their reply
+    if (blocking) {
+        err = urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    }
+    else {
+        err = urpc_recv(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    assert(recv_msg_type == URPC_MessageType_Batch);
+    
+    // Set results and call handler
+    batch_complete(recv_buffer, recv_size);
+    
+    // Free receive buffer
+    free(recv_buffer);
+    
+    return SYS_ERR_OK;
+    
+}
+
+bool fs_rpc_batch_in_flight(void) {
+    
+    return batch_ops != NULL;
+    
+}
+
+static struct fat32fs_handle *handle_open(uint32_t id, bool isdir)
 {
     struct fat32fs_handle *handle = calloc(1, sizeof(struct fat32fs_handle));
     if (handle == NULL) {
@@ -923,8 +1373,8 @@ static struct fat32fs_handle *handle_open(struct fat_dirent *dirent)
     }
     
     //handle->common = NULL;
-    handle->isdir = dirent->is_dir;
-    handle->dirent = dirent;
+    handle->isdir = isdir;
+    handle->id = id;
     handle->pos = 0;
 
     return handle;
@@ -934,7 +1384,6 @@ static void handle_close(struct fat32fs_handle *handle)
 {
     //assert(h->dirent->refcount > 0);
     //h->dirent->refcount--;
-    //free(handle->dirent);
     free(handle->path);
     free(handle);
 }
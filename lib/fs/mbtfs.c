@@ -28,8 +28,7 @@ struct mbtfs_handle {
     
     off_t pos;
     
-    struct capref frame;
-    void *buffer;
+    void *buffer;               // Shared mapping of the module, never unmapped
     
     size_t size;
     
@@ -47,27 +46,15 @@ errval_t mbtfs_open(void *st, char *path, mbtfs_handle_t *ret_handle) {
         pos++;
     }
     
-    struct capref frame;
-    size_t ret_bytes = 0;
-    
-    // Get module frame from init
-    err = aos_rpc_get_module_frame(aos_rpc_get_init_channel(), &path[pos], &frame, &ret_bytes);
-    if (err_is_fail(err)) {
-        debug_printf("%s\n", err_getstring(err));
-        return FS_ERR_NOTFOUND;
-    }
-    
     // Buffer for file data
     void *buffer;
+    size_t ret_bytes = 0;
     
-    // Get frame size from frame identity
-    struct frame_identity id;
-    invoke_frame_identify(frame, &id);
-
-    // Map frame to virtual address space
-    err = paging_map_frame_attr(get_current_paging_state(), &buffer, id.bytes, frame, VREGION_FLAGS_READ, NULL, NULL);
+    // Get the shared mapping of the module (only the first open asks init)
+    err = aos_rpc_map_module(aos_rpc_get_init_channel(), &path[pos], &buffer, &ret_bytes);
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
+        return FS_ERR_NOTFOUND;
     }
     
     // Allocate return header
@@ -77,7 +64,6 @@ errval_t mbtfs_open(void *st, char *path, mbtfs_handle_t *ret_handle) {
     handle->path = strdup(&path[pos]);
     handle->isdir = false;
     handle->pos = 0;
-    handle->frame = frame;
     handle->buffer = buffer;
     handle->size = ret_bytes;
     
@@ -114,10 +100,10 @@ errval_t mbtfs_read(void *st, mbtfs_handle_t handle, void *buffer, size_t bytes,
     // Start index of requested range
     size_t start = h->pos;
     
-    // Return if requested file range is not overlapping
+    // Nothing to read if the position is at or past the end of the file
     if (start >= file_size) {
         
-        debug_printf("handler position is out of bounds\n");
+        *bytes_read = 0;
         return SYS_ERR_OK;
         
     }
@@ -131,8 +117,8 @@ errval_t mbtfs_read(void *st, mbtfs_handle_t handle, void *buffer, size_t bytes,
         
     }
     
-    // Copy requested amount of bytes from handle buffer to buffers
-    memcpy(buffer, h->buffer, start + temp);
+    // Copy only the requested window from the module mapping
+    memcpy(buffer, h->buffer + start, temp);
     
     // Update handle
     h->pos += temp;
@@ -144,6 +130,22 @@ errval_t mbtfs_read(void *st, mbtfs_handle_t handle, void *buffer, size_t bytes,
     
 }
 
+errval_t mbtfs_mmap(void *st, mbtfs_handle_t handle, void **buffer, size_t *bytes) {
+    
+    struct mbtfs_handle *h = handle;
+    
+    if (h->isdir) {
+        return FS_ERR_NOTFILE;
+    }
+    
+    // Hand out the read-only module mapping itself, it outlives the handle
+    *buffer = h->buffer;
+    *bytes = h->size;
+    
+    return SYS_ERR_OK;
+    
+}
+
 errval_t mbtfs_write(void *st, mbtfs_handle_t handle, void *buffer, size_t bytes, size_t *bytes_written) {
     
     debug_printf("Multiboot Filesystem is read only!\n");
@@ -187,6 +189,9 @@ errval_t mbtfs_stat(void *st, mbtfs_handle_t handle, struct fs_fileinfo *info) {
         info->size = h->size;
     }
     
+    // Boot modules never change
+    info->version = 1;
+    
     return SYS_ERR_OK;
 
 }
@@ -225,8 +230,6 @@ errval_t mbtfs_seek(void *st, mbtfs_handle_t handle, enum fs_seekpos whence, off
 
 errval_t mbtfs_close(void *st, mbtfs_handle_t handle) {
     
-    errval_t err;
-    
     assert(handle != NULL);
     
     struct mbtfs_handle *h = handle;
@@ -234,19 +237,12 @@ errval_t mbtfs_close(void *st, mbtfs_handle_t handle) {
     // Free path of handle
     free(h->path);
     
-    // Unmap handle buffer
-    err = paging_unmap(get_current_paging_state(), h->buffer);
-    
-    // Delete handle frame
-    cap_delete(h->frame);
-    
-    // Free slot of handle frame
-    slot_free(h->frame);
+    // The module mapping is kept by the module cache for the next open
     
     // Free handle
     free(h);
     
-    return err;
+    return SYS_ERR_OK;
     
 }
 
@@ -263,7 +259,6 @@ errval_t mbtfs_opendir(void *st, char *path, mbtfs_handle_t *ret_handle) {
     dh->path = strdup(mt->name);
     dh->isdir = true;
     dh->pos = 0;
-    dh->frame = NULL_CAP;
     dh->buffer = NULL;
     dh->size = mt->module_count;
     
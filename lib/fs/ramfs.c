@@ -18,13 +18,21 @@
 #define BULK_MEM_SIZE       (1U << 16)      // 64kB
 #define BULK_BLOCK_SIZE     BULK_MEM_SIZE   // (it's RPC)
 
+#define RAMFS_CHUNK_SIZE    4096            ///< file data is stored in chunks
+
+#define RAMFS_DIR_HASH_MIN      32          ///< entries before a directory is hashed
+#define RAMFS_PATH_CACHE_SIZE   64          ///< path lookup cache entries (power of two)
+
 
 /**
  * @brief an entry in the ramfs
  */
+struct ramfs_dir_hash;
+
 struct ramfs_dirent
 {
     char *name;                     ///< name of the file or directory
+    uint32_t name_hash;             ///< hash of the name
     size_t size;                    ///< the size of the direntry in bytes or files
     size_t refcount;                ///< reference count for open handles
     struct ramfs_dirent *parent;    ///< parent directory
@@ -35,9 +43,32 @@ struct ramfs_dirent
     bool is_dir;                    ///< flag indicationg this is a dir
 
     union {
-        void *data;                 ///< file data pointer
+        uint8_t **chunks;           ///< file data chunks, NULL for holes
         struct ramfs_dirent *dir;   ///< directory pointer
     };
+    size_t chunk_slots;             ///< entries of the chunk table
+
+    struct ramfs_dir_hash *hash;    ///< hash table of large directories
+    struct ramfs_dirent *hash_next; ///< next entry in the hash bucket
+};
+
+/**
+ * @brief hash table of the entries of a directory
+ */
+struct ramfs_dir_hash
+{
+    size_t nbuckets;                ///< power of two
+    struct ramfs_dirent **buckets;
+};
+
+/**
+ * @brief a cached path lookup
+ */
+struct ramfs_path_cache_entry
+{
+    char *path;                     ///< path without the leading separator
+    uint32_t hash;
+    struct ramfs_dirent *dirent;
 };
 
 /**
@@ -57,8 +88,68 @@ struct ramfs_handle
 
 struct ramfs_mount {
     struct ramfs_dirent *root;
+    struct ramfs_path_cache_entry path_cache[RAMFS_PATH_CACHE_SIZE];
 };
 
+/* FNV-1a */
+static uint32_t name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *name != '\0'; name++) {
+        hash ^= (uint8_t)*name;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static struct ramfs_dirent *path_cache_lookup(struct ramfs_mount *mount,
+                                              const char *path)
+{
+    uint32_t hash = name_hash(path);
+    struct ramfs_path_cache_entry *e =
+        &mount->path_cache[hash & (RAMFS_PATH_CACHE_SIZE - 1)];
+
+    if (e->path != NULL && e->hash == hash && strcmp(e->path, path) == 0) {
+        return e->dirent;
+    }
+
+    return NULL;
+}
+
+static void path_cache_insert(struct ramfs_mount *mount, const char *path,
+                              struct ramfs_dirent *dirent)
+{
+    uint32_t hash = name_hash(path);
+    struct ramfs_path_cache_entry *e =
+        &mount->path_cache[hash & (RAMFS_PATH_CACHE_SIZE - 1)];
+
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return;
+    }
+
+    free(e->path);
+    e->path = copy;
+    e->hash = hash;
+    e->dirent = dirent;
+}
+
+/* forget all cached lookups of a dirent before it is freed */
+static void path_cache_invalidate(struct ramfs_mount *mount,
+                                  struct ramfs_dirent *dirent)
+{
+    for (size_t i = 0; i < RAMFS_PATH_CACHE_SIZE; i++) {
+        struct ramfs_path_cache_entry *e = &mount->path_cache[i];
+        if (e->path != NULL && e->dirent == dirent) {
+            free(e->path);
+            e->path = NULL;
+            e->dirent = NULL;
+        }
+    }
+}
+
 static struct ramfs_handle *handle_open(struct ramfs_dirent *d)
 {
     struct ramfs_handle *h = calloc(1, sizeof(*h));
@@ -82,8 +173,66 @@ static inline void handle_close(struct ramfs_handle *h)
 }
 
 
+static void dir_hash_add(struct ramfs_dir_hash *hash, struct ramfs_dirent *entry)
+{
+    size_t bucket = entry->name_hash & (hash->nbuckets - 1);
+
+    entry->hash_next = hash->buckets[bucket];
+    hash->buckets[bucket] = entry;
+}
+
+static void dir_hash_del(struct ramfs_dir_hash *hash, struct ramfs_dirent *entry)
+{
+    struct ramfs_dirent **indirect =
+        &hash->buckets[entry->name_hash & (hash->nbuckets - 1)];
+
+    while (*indirect != NULL && *indirect != entry) {
+        indirect = &(*indirect)->hash_next;
+    }
+
+    if (*indirect != NULL) {
+        *indirect = entry->hash_next;
+    }
+    entry->hash_next = NULL;
+}
+
+/* (re)build the hash table of a directory, the old table stays on failure */
+static errval_t dir_hash_build(struct ramfs_dirent *dir, size_t nbuckets)
+{
+    struct ramfs_dirent **buckets = calloc(nbuckets, sizeof(*buckets));
+    if (buckets == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    if (dir->hash == NULL) {
+        dir->hash = calloc(1, sizeof(struct ramfs_dir_hash));
+        if (dir->hash == NULL) {
+            free(buckets);
+            return LIB_ERR_MALLOC_FAIL;
+        }
+    }
+
+    free(dir->hash->buckets);
+    dir->hash->buckets = buckets;
+    dir->hash->nbuckets = nbuckets;
+
+    for (struct ramfs_dirent *d = dir->dir; d != NULL; d = d->next) {
+        dir_hash_add(dir->hash, d);
+    }
+
+    return SYS_ERR_OK;
+}
+
 static void dirent_remove(struct ramfs_dirent *entry)
 {
+    if (entry->parent) {
+        assert(entry->parent->size > 0);
+        entry->parent->size--;
+        if (entry->parent->hash) {
+            dir_hash_del(entry->parent->hash, entry);
+        }
+    }
+
     if (entry->prev == NULL) {
         /* entry was the first in list, update parent pointer */
         if (entry->parent) {
@@ -101,12 +250,47 @@ static void dirent_remove(struct ramfs_dirent *entry)
     }
 }
 
+/* make room for at least slots chunks, the table grows by doubling */
+static errval_t chunks_reserve(struct ramfs_dirent *entry, size_t slots)
+{
+    if (slots <= entry->chunk_slots) {
+        return SYS_ERR_OK;
+    }
+
+    size_t new_slots = MAX(slots, 2 * entry->chunk_slots);
+    uint8_t **chunks = realloc(entry->chunks, new_slots * sizeof(uint8_t *));
+    if (chunks == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    memset(chunks + entry->chunk_slots, 0,
+           (new_slots - entry->chunk_slots) * sizeof(uint8_t *));
+
+    entry->chunks = chunks;
+    entry->chunk_slots = new_slots;
+
+    return SYS_ERR_OK;
+}
+
+/* free all chunks starting at chunk first */
+static void chunks_free(struct ramfs_dirent *entry, size_t first)
+{
+    for (size_t i = first; i < entry->chunk_slots; i++) {
+        free(entry->chunks[i]);
+        entry->chunks[i] = NULL;
+    }
+}
+
 static void dirent_remove_and_free(struct ramfs_dirent *entry)
 {
     dirent_remove(entry);
     free(entry->name);
     if (!entry->is_dir) {
-        free(entry->data);
+        chunks_free(entry, 0);
+        free(entry->chunks);
+    } else if (entry->hash) {
+        free(entry->hash->buckets);
+        free(entry->hash);
     }
 
     memset(entry, 0x00, sizeof(*entry));
@@ -127,6 +311,18 @@ static void dirent_insert(struct ramfs_dirent *parent, struct ramfs_dirent *entr
     }
 
     parent->dir = entry;
+    parent->size++;
+
+    /* large directories are hashed, with at most one entry per bucket on
+     * average (a failed allocation only makes lookups slower) */
+    if (parent->hash) {
+        if (parent->size <= parent->hash->nbuckets ||
+            err_is_fail(dir_hash_build(parent, 2 * parent->hash->nbuckets))) {
+            dir_hash_add(parent->hash, entry);
+        }
+    } else if (parent->size >= RAMFS_DIR_HASH_MIN) {
+        dir_hash_build(parent, 2 * RAMFS_DIR_HASH_MIN);
+    }
 }
 
 static struct ramfs_dirent *dirent_create(const char *name, bool is_dir)
@@ -138,6 +334,7 @@ static struct ramfs_dirent *dirent_create(const char *name, bool is_dir)
 
     d->is_dir = is_dir;
     d->name = strdup(name);
+    d->name_hash = name_hash(name);
 
     return d;
 }
@@ -149,10 +346,28 @@ static errval_t find_dirent(struct ramfs_dirent *root, char *name,
         return FS_ERR_NOTDIR;
     }
 
+    uint32_t hash = name_hash(name);
+
+    if (root->hash) {
+        struct ramfs_dirent *d =
+            root->hash->buckets[hash & (root->hash->nbuckets - 1)];
+
+        while (d) {
+            if (d->name_hash == hash && strcmp(d->name, name) == 0) {
+                *ret_de = d;
+                return SYS_ERR_OK;
+            }
+
+            d = d->hash_next;
+        }
+
+        return FS_ERR_NOTFOUND;
+    }
+
     struct ramfs_dirent *d = root->dir;
 
     while(d) {
-        if (strcmp(d->name, name) == 0) {
+        if (d->name_hash == hash && strcmp(d->name, name) == 0) {
             *ret_de = d;
             return SYS_ERR_OK;
         }
@@ -163,17 +378,30 @@ static errval_t find_dirent(struct ramfs_dirent *root, char *name,
     return FS_ERR_NOTFOUND;
 }
 
-static errval_t resolve_path(struct ramfs_dirent *root, char *path,
+static errval_t resolve_path(struct ramfs_mount *mount, char *path,
                              struct ramfs_handle **ret_fh)
 {
     errval_t err;
 
+    struct ramfs_dirent *root = mount->root;
+
     // skip leading /
     size_t pos = 0;
     if (path[0] == FS_PATH_SEP) {
         pos++;
     }
 
+    // try the path lookup cache before walking the tree
+    const char *key = &path[pos];
+    struct ramfs_dirent *cached = NULL;
+    if (*key != '\0') {
+        cached = path_cache_lookup(mount, key);
+        if (cached) {
+            root = cached;
+            pos += strlen(key);
+        }
+    }
+
     struct ramfs_dirent *next_dirent;
 
     while (path[pos] != '\0') {
@@ -206,6 +434,10 @@ static errval_t resolve_path(struct ramfs_dirent *root, char *path,
         pos += nextlen + 1;
     }
 
+    if (cached == NULL && *key != '\0') {
+        path_cache_insert(mount, key, root);
+    }
+
     /* create the handle */
 
     if (ret_fh) {
@@ -230,7 +462,7 @@ errval_t ramfs_open(void *st, char *path, ramfs_handle_t *rethandle)
     struct ramfs_mount *mount = st;
 
     struct ramfs_handle *handle;
-    err = resolve_path(mount->root, path, &handle);
+    err = resolve_path(mount, path, &handle);
     if (err_is_fail(err)) {
         return err;
     }
@@ -251,7 +483,7 @@ errval_t ramfs_create(void *st, char *path, ramfs_handle_t *rethandle)
 
     struct ramfs_mount *mount = st;
 
-    err = resolve_path(mount->root, path, NULL);
+    err = resolve_path(mount, path, NULL);
     if (err_is_ok(err)) {
         return FS_ERR_EXISTS;
     }
@@ -270,7 +502,7 @@ errval_t ramfs_create(void *st, char *path, ramfs_handle_t *rethandle)
         pathbuf[pathlen] = '\0';
 
         // resolve parent directory
-        err = resolve_path(mount->root, pathbuf, &parent);
+        err = resolve_path(mount, pathbuf, &parent);
         if (err_is_fail(err)) {
             return err;
         } else if (!parent->isdir) {
@@ -311,7 +543,7 @@ errval_t ramfs_remove(void *st, char *path)
     struct ramfs_mount *mount = st;
 
     struct ramfs_handle *handle;
-    err = resolve_path(mount->root, path, &handle);
+    err = resolve_path(mount, path, &handle);
     if (err_is_fail(err)) {
         return err;
     }
@@ -327,6 +559,7 @@ errval_t ramfs_remove(void *st, char *path)
     }
 
 
+    path_cache_invalidate(mount, dirent);
     dirent_remove_and_free(dirent);
 
     return SYS_ERR_OK;
@@ -343,16 +576,30 @@ errval_t ramfs_read(void *st, ramfs_handle_t handle, void *buffer, size_t bytes,
 
     assert(h->file_pos >= 0);
 
-    if (h->dirent->data == NULL) {
-        bytes = 0;
-    } else if (h->dirent->size < h->file_pos) {
+    struct ramfs_dirent *d = h->dirent;
+    size_t offset = h->file_pos;
+
+    if (d->size <= offset) {
         bytes = 0;
-    } else if (h->dirent->size < h->file_pos + bytes) {
-        bytes = h->dirent->size - h->file_pos;
-        assert(h->file_pos + bytes == h->dirent->size);
+    } else if (d->size < offset + bytes) {
+        bytes = d->size - offset;
+        assert(offset + bytes == d->size);
     }
 
-    memcpy(buffer, h->dirent->data + h->file_pos, bytes);
+    for (size_t done = 0; done < bytes; ) {
+        size_t index = (offset + done) / RAMFS_CHUNK_SIZE;
+        size_t chunk_offset = (offset + done) % RAMFS_CHUNK_SIZE;
+        size_t len = MIN(bytes - done, RAMFS_CHUNK_SIZE - chunk_offset);
+
+        /* holes read as zeros */
+        if (index >= d->chunk_slots || d->chunks[index] == NULL) {
+            memset((uint8_t *)buffer + done, 0, len);
+        } else {
+            memcpy((uint8_t *)buffer + done, d->chunks[index] + chunk_offset, len);
+        }
+
+        done += len;
+    }
 
     h->file_pos += bytes;
 
@@ -373,25 +620,50 @@ errval_t ramfs_write(void *st, ramfs_handle_t handle, const void *buffer,
         return FS_ERR_NOTFILE;
     }
 
-    if (h->dirent->size < offset + bytes) {
-        /* need to realloc the buffer */
-        void *newbuf = realloc(h->dirent->data, offset + bytes);
-        if (newbuf == NULL) {
-            return LIB_ERR_MALLOC_FAIL;
-        }
-        h->dirent->data = newbuf;
+    struct ramfs_dirent *d = h->dirent;
+
+    /* make room for the chunks up to the end of the write */
+    errval_t err = chunks_reserve(d, (offset + bytes + RAMFS_CHUNK_SIZE - 1)
+                                     / RAMFS_CHUNK_SIZE);
+    if (err_is_fail(err)) {
+        return err;
     }
 
-    memcpy(h->dirent->data + offset, buffer, bytes);
+    size_t done = 0;
+    while (done < bytes) {
+        size_t index = (offset + done) / RAMFS_CHUNK_SIZE;
+        size_t chunk_offset = (offset + done) % RAMFS_CHUNK_SIZE;
+        size_t len = MIN(bytes - done, RAMFS_CHUNK_SIZE - chunk_offset);
+
+        if (d->chunks[index] == NULL) {
+            /* the rest of a partially written chunk has to read as zeros */
+            if (len == RAMFS_CHUNK_SIZE) {
+                d->chunks[index] = malloc(RAMFS_CHUNK_SIZE);
+            } else {
+                d->chunks[index] = calloc(1, RAMFS_CHUNK_SIZE);
+            }
+            if (d->chunks[index] == NULL) {
+                err = LIB_ERR_MALLOC_FAIL;
+                break;
+            }
+        }
+
+        memcpy(d->chunks[index] + chunk_offset, (const uint8_t *)buffer + done, len);
+
+        done += len;
+    }
 
     if (bytes_written) {
-        *bytes_written = bytes;
+        *bytes_written = done;
     }
 
-    h->file_pos += bytes;
-    h->dirent->size += bytes;
+    /* overwrites keep the size */
+    h->file_pos += done;
+    if (done > 0 && d->size < offset + done) {
+        d->size = offset + done;
+    }
 
-    return SYS_ERR_OK;
+    return err;
 }
 
 
@@ -403,12 +675,26 @@ errval_t ramfs_truncate(void *st, ramfs_handle_t handle, size_t bytes)
         return FS_ERR_NOTFILE;
     }
 
-    void *newdata = realloc(h->dirent->data, bytes);
-    if (newdata == NULL) {
-        return LIB_ERR_MALLOC_FAIL;
+    struct ramfs_dirent *d = h->dirent;
+
+    if (bytes < d->size) {
+        /* free the chunks past the end and clear the rest of the last one,
+         * so that a later extension reads zeros */
+        size_t index = bytes / RAMFS_CHUNK_SIZE;
+        size_t chunk_offset = bytes % RAMFS_CHUNK_SIZE;
+        if (chunk_offset == 0) {
+            chunks_free(d, index);
+        } else {
+            chunks_free(d, index + 1);
+            if (index < d->chunk_slots && d->chunks[index] != NULL) {
+                memset(d->chunks[index] + chunk_offset, 0,
+                       RAMFS_CHUNK_SIZE - chunk_offset);
+            }
+        }
     }
-    h->dirent->data = newdata;
-    h->dirent->size = bytes;
+
+    /* extending leaves a hole */
+    d->size = bytes;
 
     return SYS_ERR_OK;
 }
@@ -431,6 +717,9 @@ errval_t ramfs_stat(void *st, ramfs_handle_t inhandle, struct fs_fileinfo *info)
     assert(info != NULL);
     info->type = h->isdir ? FS_DIRECTORY : FS_FILE;
     info->size = h->dirent->size;
+    /* a ramfs is private to its process, so another process can hold
+     * different contents under the same path: versions are unknown */
+    info->version = 0;
 
     return SYS_ERR_OK;
 }
@@ -505,7 +794,7 @@ errval_t ramfs_opendir(void *st, char *path, ramfs_handle_t *rethandle)
     struct ramfs_mount *mount = st;
 
     struct ramfs_handle *handle;
-    err = resolve_path(mount->root, path, &handle);
+    err = resolve_path(mount, path, &handle);
     if (err_is_fail(err)) {
         return err;
     }
@@ -544,6 +833,7 @@ errval_t ramfs_dir_read_next(void *st, ramfs_handle_t inhandle, char **retname,
     if (info != NULL) {
         info->type = d->is_dir ? FS_DIRECTORY : FS_FILE;
         info->size = d->size;
+        info->version = 0;
     }
 
     h->dir_pos = d->next;
@@ -571,7 +861,7 @@ errval_t ramfs_mkdir(void *st, char *path)
 
     struct ramfs_mount *mount = st;
 
-    err = resolve_path(mount->root, path, NULL);
+    err = resolve_path(mount, path, NULL);
     if (err_is_ok(err)) {
         return FS_ERR_EXISTS;
     }
@@ -591,7 +881,7 @@ errval_t ramfs_mkdir(void *st, char *path)
         pathbuf[pathlen] = '\0';
 
         // resolve parent directory
-        err = resolve_path(mount->root, pathbuf, &parent);
+        err = resolve_path(mount, pathbuf, &parent);
         if (err_is_fail(err)) {
             handle_close(parent);
             return err;
@@ -627,14 +917,14 @@ errval_t ramfs_rmdir(void *st, char *path)
     struct ramfs_mount *mount = st;
 
     struct ramfs_handle *handle;
-    err = resolve_path(mount->root, path, &handle);
+    err = resolve_path(mount, path, &handle);
     if (err_is_fail(err)) {
         return err;
     }
 
     if (!handle->isdir) {
-        goto out;
-        err =  FS_ERR_NOTDIR;
+        handle_close(handle);
+        return FS_ERR_NOTDIR;
     }
 
     if (handle->dirent->refcount != 1) {
@@ -645,16 +935,17 @@ errval_t ramfs_rmdir(void *st, char *path)
     assert(handle->dirent->is_dir);
 
     if (handle->dirent->dir) {
-        err = FS_ERR_NOTEMPTY;
-        goto out;
+        handle_close(handle);
+        return FS_ERR_NOTEMPTY;
     }
 
+    path_cache_invalidate(mount, handle->dirent);
     dirent_remove_and_free(handle->dirent);
 
-    out:
+    free(handle->path);
     free(handle);
 
-    return err;
+    return SYS_ERR_OK;
 }
 
 
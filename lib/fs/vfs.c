@@ -11,6 +11,17 @@
 #include <fs/mbtfs.h>
 
 #include <fs/vfs.h>
+#include <fs/vfs_cache.h>
+
+// Files on the FAT server are cached, every access is an RPC otherwise
+static const struct vfs_cache_ops fat_cache_ops = {
+    .read = fs_rpc_read,
+    .write = fs_rpc_write,
+    .truncate = fs_rpc_truncate,
+    .seek = fs_rpc_seek,
+    .stat = fs_rpc_stat,
+    .sync = fs_rpc_sync
+};
 
 enum fs_type find_mount_type(struct mount_node *head, const char *path, char **ret_path) {
     
@@ -71,6 +82,9 @@ errval_t vfs_open(void *st, const char *path, vfs_handle_t *rethandle) {
             break;
         case FATFS:
             err = fs_rpc_open(mt->fat_mount, rel_path, &h->handle);
+            if (err_is_ok(err)) {
+                err = vfs_cache_open(&fat_cache_ops, mt->fat_mount, h->handle, &h->cache);
+            }
             break;
         case MBTFS:
             err = mbtfs_open(mt->mbt_mount, rel_path, &h->handle);
@@ -118,6 +132,9 @@ errval_t vfs_create(void *st, const char *path, vfs_handle_t *rethandle) {
             break;
         case FATFS:
             err = fs_rpc_create(mt->fat_mount, rel_path, &h->handle);
+            if (err_is_ok(err)) {
+                err = vfs_cache_open(&fat_cache_ops, mt->fat_mount, h->handle, &h->cache);
+            }
             break;
         case MBTFS:
             err = mbtfs_create(mt->mbt_mount, rel_path, &h->handle);
@@ -187,6 +204,11 @@ errval_t vfs_read(void *st, vfs_handle_t handle, void *buffer, size_t bytes, siz
     // VFS handle to store the FS specific handle and the type
     struct vfs_handle *h = handle;
     
+    // Cached files
+    if (h->cache != NULL) {
+        return vfs_cache_read(h->cache, buffer, bytes, bytes_read);
+    }
+    
     switch (h->type) {
         case RAMFS:
             err = ramfs_read(mt->ram_mount, h->handle, buffer, bytes, bytes_read);
@@ -217,15 +239,20 @@ errval_t vfs_write(void *st, vfs_handle_t handle, void *buffer, size_t bytes, si
     // VFS handle to store the FS specific handle and the type
     struct vfs_handle *h = handle;
     
+    // Cached files
+    if (h->cache != NULL) {
+        return vfs_cache_write(h->cache, buffer, bytes, bytes_written);
+    }
+    
     switch (h->type) {
         case RAMFS:
-            err = ramfs_read(mt->ram_mount, h->handle, buffer, bytes, bytes_written);
+            err = ramfs_write(mt->ram_mount, h->handle, buffer, bytes, bytes_written);
             break;
         case FATFS:
-            err = fs_rpc_read(mt->fat_mount, h->handle, buffer, bytes, bytes_written);
+            err = fs_rpc_write(mt->fat_mount, h->handle, buffer, bytes, bytes_written);
             break;
         case MBTFS:
-            err = mbtfs_read(mt->mbt_mount, h->handle, buffer, bytes, bytes_written);
+            err = mbtfs_write(mt->mbt_mount, h->handle, buffer, bytes, bytes_written);
             break;
         default:
             err = SYS_ERR_OK;
@@ -237,6 +264,30 @@ errval_t vfs_write(void *st, vfs_handle_t handle, void *buffer, size_t bytes, si
     
 }
 
+errval_t vfs_mmap(void *st, vfs_handle_t handle, void **buffer, size_t *bytes) {
+    
+    errval_t err;
+    
+    // VFS mount state with root directories and mount linked list
+    struct vfs_mount *mt = st;
+    
+    // VFS handle to store the FS specific handle and the type
+    struct vfs_handle *h = handle;
+    
+    switch (h->type) {
+        case MBTFS:
+            err = mbtfs_mmap(mt->mbt_mount, h->handle, buffer, bytes);
+            break;
+        default:
+            // Only files that are backed by a frame can be mapped
+            err = VFS_ERR_NOT_SUPPORTED;
+            break;
+    }
+    
+    return err;
+    
+}
+
 errval_t vfs_truncate(void *st, vfs_handle_t handle, size_t bytes) {
     
     errval_t err;
@@ -247,6 +298,11 @@ errval_t vfs_truncate(void *st, vfs_handle_t handle, size_t bytes) {
     // VFS handle to store the FS specific handle and the type
     struct vfs_handle *h = handle;
     
+    // Cached files
+    if (h->cache != NULL) {
+        return vfs_cache_truncate(h->cache, bytes);
+    }
+    
     switch (h->type) {
         case RAMFS:
             err = ramfs_truncate(mt->ram_mount, h->handle, bytes);
@@ -277,6 +333,11 @@ errval_t vfs_tell(void *st, vfs_handle_t handle, size_t *pos){
     // VFS handle to store the FS specific handle and the type
     struct vfs_handle *h = handle;
     
+    // Cached files
+    if (h->cache != NULL) {
+        return vfs_cache_tell(h->cache, pos);
+    }
+    
     switch (h->type) {
         case RAMFS:
             err = ramfs_tell(mt->ram_mount, h->handle, pos);
@@ -308,6 +369,11 @@ errval_t vfs_stat(void *st, vfs_handle_t handle, struct fs_fileinfo *info) {
     // VFS handle to store the FS specific handle and the type
     struct vfs_handle *h = handle;
     
+    // Cached files
+    if (h->cache != NULL) {
+        return vfs_cache_stat(h->cache, info);
+    }
+    
     switch (h->type) {
         case RAMFS:
             err = ramfs_stat(mt->ram_mount, h->handle, info);
@@ -338,6 +404,11 @@ errval_t vfs_seek(void *st, vfs_handle_t handle, enum fs_seekpos whence, off_t o
     // VFS handle to store the FS specific handle and the type
     struct vfs_handle *h = handle;
     
+    // Cached files
+    if (h->cache != NULL) {
+        return vfs_cache_seek(h->cache, whence, offset);
+    }
+    
     switch (h->type) {
         case RAMFS:
             err = ramfs_seek(mt->ram_mount, h->handle, whence, offset);
@@ -369,6 +440,12 @@ errval_t vfs_close(void *st, vfs_handle_t handle) {
     // VFS handle to store the FS specific handle and the type
     struct vfs_handle *h = handle;
     
+    // Write back cached data before the handle goes away
+    errval_t cache_err = SYS_ERR_OK;
+    if (h->cache != NULL) {
+        cache_err = vfs_cache_close(h->cache);
+    }
+    
     switch (h->type) {
         case RAMFS:
             err = ramfs_close(mt->ram_mount, h->handle);
@@ -388,10 +465,46 @@ errval_t vfs_close(void *st, vfs_handle_t handle) {
     // Free VFS handle
     free(h);
     
+    return err_is_fail(cache_err) ? cache_err : err;
+    
+}
+
+errval_t vfs_sync(void *st, vfs_handle_t handle) {
+    
+    errval_t err;
+    
+    // VFS mount state with root directories and mount linked list
+    struct vfs_mount *mt = st;
+    
+    // VFS handle to store the FS specific handle and the type
+    struct vfs_handle *h = handle;
+    
+    // Cached files
+    if (h->cache != NULL) {
+        return vfs_cache_sync(h->cache);
+    }
+    
+    switch (h->type) {
+        case FATFS:
+            err = fs_rpc_sync(mt->fat_mount);
+            break;
+        default:
+            // Other file systems write through
+            err = SYS_ERR_OK;
+            break;
+    }
+    
     return err;
     
 }
 
+errval_t vfs_sync_all(void *st) {
+    
+    // Only files of other domains are cached, the rest writes through
+    return vfs_cache_sync_all();
+    
+}
+
 errval_t vfs_opendir(void *st, const char *path, vfs_handle_t *rethandle) {
     
     errval_t err;
@@ -0,0 +1,638 @@
+//
+//  vfs_cache.c
+//  DoritOS
+//
+//  Page cache of the VFS for files whose backend is another domain. Reads
+//  miss in windows of pages (the window grows while the file is read
+//  sequentially), writes only dirty cached pages and are written back in
+//  coalesced runs once enough pages of a file are dirty, when a dirty page
+//  is replaced, and on close, sync and exit.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs/vfs_cache.h>
+
+#define PRINT_DEBUG 0
+
+
+struct vfs_cache_page {
+    struct vfs_cache_file *file;    // NULL if unused
+    size_t index;                   // Page index in the file
+    bool dirty;
+    size_t dirty_start;             // Dirty byte range in the page
+    size_t dirty_end;
+    uint32_t last_used;
+    uint8_t *data;
+};
+
+static struct vfs_cache_page pages[VFS_CACHE_PAGES];
+
+// Logical clock for the LRU replacement
+static uint32_t cache_clock = 0;
+
+// Read-ahead windows in pages
+static size_t ra_min = VFS_CACHE_RA_MIN;
+static size_t ra_max = VFS_CACHE_RA_MAX;
+
+// Buffer for transfers of multiple pages
+static uint8_t *window_buf = NULL;
+
+// Open cached files
+static struct vfs_cache_file *open_files = NULL;
+
+
+void vfs_cache_set_readahead(size_t min_pages, size_t max_pages) {
+
+    ra_max = MAX(1, MIN(max_pages, VFS_CACHE_WINDOW_MAX));
+    ra_min = MAX(1, MIN(min_pages, ra_max));
+
+}
+
+static void page_touch(struct vfs_cache_page *page) {
+
+    page->last_used = ++cache_clock;
+    page->file->last_page = page;
+
+}
+
+static struct vfs_cache_page *page_find(struct vfs_cache_file *file, size_t index) {
+
+    // Most accesses hit the page of the previous access
+    struct vfs_cache_page *page = file->last_page;
+    if (page != NULL && page->file == file && page->index == index) {
+        return page;
+    }
+
+    for (size_t i = 0; i < VFS_CACHE_PAGES; i++) {
+        if (pages[i].file == file && pages[i].index == index) {
+            return &pages[i];
+        }
+    }
+
+    return NULL;
+
+}
+
+static void page_release(struct vfs_cache_page *page) {
+
+    if (page->file->last_page == page) {
+        page->file->last_page = NULL;
+    }
+
+    page->file = NULL;
+    page->dirty = false;
+    page->last_used = 0;
+
+}
+
+static errval_t backend_read_at(struct vfs_cache_file *file, size_t offset,
+                                void *buffer, size_t bytes, size_t *bytes_read) {
+
+    errval_t err = file->ops->seek(file->st, file->handle, FS_SEEK_SET, offset);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return file->ops->read(file->st, file->handle, buffer, bytes, bytes_read);
+
+}
+
+static errval_t backend_write_at(struct vfs_cache_file *file, size_t offset,
+                                 const void *buffer, size_t bytes) {
+
+    errval_t err = file->ops->seek(file->st, file->handle, FS_SEEK_SET, offset);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    size_t bytes_written;
+    err = file->ops->write(file->st, file->handle, buffer, bytes, &bytes_written);
+    if (err_is_ok(err) && bytes_written < bytes) {
+        err = FS_ERR_WRITE;
+    }
+
+    return err;
+
+}
+
+static errval_t window_buf_alloc(void) {
+
+    if (window_buf == NULL) {
+        window_buf = malloc(VFS_CACHE_WINDOW_MAX * VFS_CACHE_PAGE_SIZE);
+        if (window_buf == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+// Write back all dirty pages of a file, adjacent dirty bytes are written
+// with one backend call
+static errval_t cache_writeback(struct vfs_cache_file *file) {
+
+    errval_t err = SYS_ERR_OK;
+
+    if (file->dirty_count == 0) {
+        return SYS_ERR_OK;
+    }
+
+    err = window_buf_alloc();
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Collect the dirty pages sorted by index
+    struct vfs_cache_page *dirty[VFS_CACHE_PAGES];
+    size_t dirty_count = 0;
+    for (size_t i = 0; i < VFS_CACHE_PAGES; i++) {
+        if (pages[i].file == file && pages[i].dirty) {
+            size_t j = dirty_count++;
+            while (j > 0 && dirty[j - 1]->index > pages[i].index) {
+                dirty[j] = dirty[j - 1];
+                j--;
+            }
+            dirty[j] = &pages[i];
+        }
+    }
+
+    size_t i = 0;
+    while (i < dirty_count) {
+
+        struct vfs_cache_page *first = dirty[i];
+        size_t offset = first->index * VFS_CACHE_PAGE_SIZE + first->dirty_start;
+        size_t bytes = first->dirty_end - first->dirty_start;
+        memcpy(window_buf, first->data + first->dirty_start, bytes);
+
+        // Extend the run while the dirty bytes continue in the next page
+        size_t j = i + 1;
+        while (j < dirty_count &&
+               dirty[j]->index == dirty[j - 1]->index + 1 &&
+               dirty[j - 1]->dirty_end == VFS_CACHE_PAGE_SIZE &&
+               dirty[j]->dirty_start == 0 &&
+               bytes + dirty[j]->dirty_end <= VFS_CACHE_WINDOW_MAX * VFS_CACHE_PAGE_SIZE) {
+            memcpy(window_buf + bytes, dirty[j]->data, dirty[j]->dirty_end);
+            bytes += dirty[j]->dirty_end;
+            j++;
+        }
+
+#if PRINT_DEBUG
+        debug_printf("vfs_cache: writing %zu bytes at %zu from %zu pages\n", bytes, offset, j - i);
+#endif
+
+        err = backend_write_at(file, offset, window_buf, bytes);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        file->backend_size = MAX(file->backend_size, offset + bytes);
+
+        // The run is clean now
+        for (; i < j; i++) {
+            dirty[i]->dirty = false;
+            file->dirty_count--;
+        }
+
+    }
+
+    return err;
+
+}
+
+// Get an unused page or replace the least recently used one
+static errval_t page_alloc(struct vfs_cache_file *file, size_t index,
+                           struct vfs_cache_page **ret_page) {
+
+    errval_t err;
+
+    struct vfs_cache_page *page = &pages[0];
+    for (size_t i = 1; i < VFS_CACHE_PAGES && page->file != NULL; i++) {
+        if (pages[i].file == NULL || pages[i].last_used < page->last_used) {
+            page = &pages[i];
+        }
+    }
+
+    if (page->file != NULL) {
+
+        // Write back the file of a dirty page before its data is lost
+        if (page->dirty) {
+            err = cache_writeback(page->file);
+            if (err_is_fail(err)) {
+                return err;
+            }
+        }
+
+        page_release(page);
+
+    }
+
+    if (page->data == NULL) {
+        page->data = malloc(VFS_CACHE_PAGE_SIZE);
+        if (page->data == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+    }
+
+    page->file = file;
+    page->index = index;
+    page->dirty = false;
+    page_touch(page);
+
+    *ret_page = page;
+
+    return SYS_ERR_OK;
+
+}
+
+// Read the page at index and, for readers, the following pages of the
+// read-ahead window
+static errval_t page_fill(struct vfs_cache_file *file, size_t index, bool readahead,
+                          struct vfs_cache_page **ret_page) {
+
+    errval_t err;
+
+    // Grow the window while the file is read sequentially
+    size_t count = 1;
+    if (readahead) {
+        if (index == file->ra_next) {
+            count = file->ra_window;
+            file->ra_window = MIN(2 * file->ra_window, ra_max);
+        } else {
+            file->ra_window = ra_min;
+        }
+    }
+
+    // Stop at the end of the file and at pages that are already cached
+    size_t page_count = (file->size + VFS_CACHE_PAGE_SIZE - 1) / VFS_CACHE_PAGE_SIZE;
+    count = MAX(1, MIN(count, page_count > index ? page_count - index : 1));
+    for (size_t k = 1; k < count; k++) {
+        if (page_find(file, index + k) != NULL) {
+            count = k;
+            break;
+        }
+    }
+
+    err = window_buf_alloc();
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Allocate the pages first, replacing a page can write back
+    struct vfs_cache_page *window[VFS_CACHE_WINDOW_MAX];
+    for (size_t k = 0; k < count; k++) {
+        err = page_alloc(file, index + k, &window[k]);
+        if (err_is_fail(err)) {
+            while (k-- > 0) {
+                page_release(window[k]);
+            }
+            return err;
+        }
+    }
+
+    // Read what the backend has, the rest of the window is zero
+    size_t offset = index * VFS_CACHE_PAGE_SIZE;
+    size_t bytes_read = 0;
+    if (offset < file->backend_size) {
+        size_t bytes = MIN(count * VFS_CACHE_PAGE_SIZE, file->backend_size - offset);
+        err = backend_read_at(file, offset, window_buf, bytes, &bytes_read);
+        if (err_is_fail(err)) {
+            for (size_t k = 0; k < count; k++) {
+                page_release(window[k]);
+            }
+            return err;
+        }
+    }
+    memset(window_buf + bytes_read, 0, count * VFS_CACHE_PAGE_SIZE - bytes_read);
+
+#if PRINT_DEBUG
+    debug_printf("vfs_cache: read %zu pages at %zu\n", count, index);
+#endif
+
+    for (size_t k = 0; k < count; k++) {
+        memcpy(window[k]->data, window_buf + k * VFS_CACHE_PAGE_SIZE, VFS_CACHE_PAGE_SIZE);
+    }
+
+    if (readahead) {
+        file->ra_next = index + count;
+    }
+
+    page_touch(window[0]);
+
+    *ret_page = window[0];
+
+    return SYS_ERR_OK;
+
+}
+
+// Forget all pages of a file
+static void cache_drop(struct vfs_cache_file *file) {
+
+    for (size_t i = 0; i < VFS_CACHE_PAGES; i++) {
+        if (pages[i].file == file) {
+            page_release(&pages[i]);
+        }
+    }
+
+    file->dirty_count = 0;
+
+}
+
+errval_t vfs_cache_open(const struct vfs_cache_ops *ops, void *st, void *handle,
+                        struct vfs_cache_file **ret_file) {
+
+    errval_t err;
+
+    struct vfs_cache_file *file = calloc(1, sizeof(struct vfs_cache_file));
+    if (file == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    file->ops = ops;
+    file->st = st;
+    file->handle = handle;
+
+    // Get the current size
+    struct fs_fileinfo info;
+    err = ops->stat(st, handle, &info);
+    if (err_is_fail(err)) {
+        free(file);
+        return err;
+    }
+
+    file->size = info.size;
+    file->backend_size = info.size;
+    file->ra_window = ra_min;
+    file->ra_next = 0;
+
+    file->next = open_files;
+    open_files = file;
+
+    *ret_file = file;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t vfs_cache_close(struct vfs_cache_file *file) {
+
+    errval_t err = cache_writeback(file);
+
+    cache_drop(file);
+
+    struct vfs_cache_file **node = &open_files;
+    while (*node != file) {
+        node = &(*node)->next;
+    }
+    *node = file->next;
+
+    free(file);
+
+    return err;
+
+}
+
+errval_t vfs_cache_read(struct vfs_cache_file *file, void *buffer, size_t bytes, size_t *bytes_read) {
+
+    errval_t err = SYS_ERR_OK;
+
+    assert(bytes_read != NULL);
+
+    // Don't read past the end of the file
+    bytes = file->pos < file->size ? MIN(bytes, file->size - file->pos) : 0;
+
+    size_t total = 0;
+    while (total < bytes) {
+
+        size_t index = file->pos / VFS_CACHE_PAGE_SIZE;
+        size_t offset = file->pos % VFS_CACHE_PAGE_SIZE;
+        size_t chunk = MIN(VFS_CACHE_PAGE_SIZE - offset, bytes - total);
+
+        struct vfs_cache_page *page = page_find(file, index);
+        if (page == NULL) {
+            err = page_fill(file, index, true, &page);
+            if (err_is_fail(err)) {
+                break;
+            }
+        } else {
+            page_touch(page);
+        }
+
+        memcpy((uint8_t *) buffer + total, page->data + offset, chunk);
+
+        total += chunk;
+        file->pos += chunk;
+
+    }
+
+    *bytes_read = total;
+
+    return err;
+
+}
+
+errval_t vfs_cache_write(struct vfs_cache_file *file, const void *buffer, size_t bytes, size_t *bytes_written) {
+
+    errval_t err = SYS_ERR_OK;
+
+    assert(bytes_written != NULL);
+
+    size_t total = 0;
+    while (total < bytes) {
+
+        size_t index = file->pos / VFS_CACHE_PAGE_SIZE;
+        size_t offset = file->pos % VFS_CACHE_PAGE_SIZE;
+        size_t chunk = MIN(VFS_CACHE_PAGE_SIZE - offset, bytes - total);
+
+        struct vfs_cache_page *page = page_find(file, index);
+        if (page == NULL) {
+
+            // Whole pages and pages past the backend's end need not be read
+            if (chunk == VFS_CACHE_PAGE_SIZE ||
+                index * VFS_CACHE_PAGE_SIZE >= file->backend_size) {
+                err = page_alloc(file, index, &page);
+                if (err_is_ok(err)) {
+                    memset(page->data, 0, VFS_CACHE_PAGE_SIZE);
+                }
+            } else {
+                err = page_fill(file, index, false, &page);
+            }
+            if (err_is_fail(err)) {
+                break;
+            }
+
+        } else {
+            page_touch(page);
+        }
+
+        memcpy(page->data + offset, (const uint8_t *) buffer + total, chunk);
+
+        // Extend the dirty range of the page
+        if (page->dirty) {
+            page->dirty_start = MIN(page->dirty_start, offset);
+            page->dirty_end = MAX(page->dirty_end, offset + chunk);
+        } else {
+            page->dirty = true;
+            page->dirty_start = offset;
+            page->dirty_end = offset + chunk;
+            file->dirty_count++;
+        }
+
+        total += chunk;
+        file->pos += chunk;
+        file->size = MAX(file->size, file->pos);
+
+        // Write behind once a full window is dirty
+        if (file->dirty_count >= VFS_CACHE_DIRTY_MAX) {
+            err = cache_writeback(file);
+            if (err_is_fail(err)) {
+                break;
+            }
+        }
+
+    }
+
+    *bytes_written = total;
+
+    return err;
+
+}
+
+errval_t vfs_cache_truncate(struct vfs_cache_file *file, size_t bytes) {
+
+    errval_t err;
+
+    // Write back and forget the cached data, then let the backend truncate
+    err = cache_writeback(file);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    cache_drop(file);
+
+    err = file->ops->truncate(file->st, file->handle, bytes);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    file->size = bytes;
+    file->backend_size = bytes;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t vfs_cache_seek(struct vfs_cache_file *file, enum fs_seekpos whence, off_t offset) {
+
+    errval_t err = SYS_ERR_OK;
+
+    struct fs_fileinfo info;
+
+    switch (whence) {
+        case FS_SEEK_SET:
+
+            assert(offset >= 0);
+            file->pos = offset;
+
+            break;
+
+        case FS_SEEK_CUR:
+
+            assert(offset >= 0 || (size_t) -offset <= file->pos);
+            file->pos += offset;
+
+            break;
+
+        case FS_SEEK_END:
+
+            err = vfs_cache_stat(file, &info);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            assert(offset >= 0 || (size_t) -offset <= info.size);
+            file->pos = info.size + offset;
+
+            break;
+
+        default:
+            USER_PANIC("invalid whence argument to vfs cache seek");
+    }
+
+    return err;
+
+}
+
+errval_t vfs_cache_tell(struct vfs_cache_file *file, size_t *ret_pos) {
+
+    assert(ret_pos != NULL);
+
+    *ret_pos = file->pos;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t vfs_cache_stat(struct vfs_cache_file *file, struct fs_fileinfo *info) {
+
+    errval_t err;
+
+    err = file->ops->stat(file->st, file->handle, info);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Follow size changes of other clients unless we have cached writes
+    file->backend_size = info->size;
+    if (file->dirty_count == 0) {
+        file->size = info->size;
+    } else {
+        file->size = MAX(file->size, info->size);
+    }
+
+    info->size = file->size;
+
+    // The version of the server does not cover our cached writes yet
+    if (file->dirty_count != 0) {
+        info->version = 0;
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t vfs_cache_sync(struct vfs_cache_file *file) {
+
+    errval_t err;
+
+    err = cache_writeback(file);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (file->ops->sync != NULL) {
+        err = file->ops->sync(file->st);
+    }
+
+    return err;
+
+}
+
+errval_t vfs_cache_sync_all(void) {
+
+    errval_t err = SYS_ERR_OK;
+
+    // Keep going after a failure so the other files are not lost
+    for (struct vfs_cache_file *file = open_files; file != NULL; file = file->next) {
+        errval_t file_err = vfs_cache_sync(file);
+        if (err_is_fail(file_err) && err_is_ok(err)) {
+            err = file_err;
+        }
+    }
+
+    return err;
+
+}
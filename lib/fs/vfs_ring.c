@@ -0,0 +1,642 @@
+//
+//  vfs_ring.c
+//  DoritOS
+//
+//  Submission/completion rings on top of the VFS. Consecutive entries on
+//  uncached files of the FAT server are collected into a batch that the
+//  server runs in a single round trip, the batch's data is passed through
+//  the buffer shared with the server. All other entries run synchronously
+//  through the VFS during submission. A link chain is kept in order by
+//  waiting for its previous entry when the chain moves between the two.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs/fs_rpc.h>
+#include <fs/vfs_ring.h>
+
+#define PRINT_DEBUG 0
+
+
+// Batch of entries for the FAT server
+struct vfs_ring_batch {
+    struct vfs_ring *ring;
+    size_t count;
+    size_t bytes;                           // Shared buffer space used
+    bool in_flight;
+    bool sent;                              // The server got the batch
+    bool link_head;                         // The first entry continues a link chain
+    vfs_handle_t link_handle;               // File of that chain
+    bool link_tail;                         // The last entry's chain goes on after the batch
+    struct fs_rpc_batch_op ops[FS_RPC_BATCH_MAX];
+    struct vfs_ring_sqe sqes[FS_RPC_BATCH_MAX];
+};
+
+
+static void post_cqe(struct vfs_ring *ring, struct vfs_ring_sqe *sqe, errval_t err,
+                     size_t bytes, vfs_handle_t handle) {
+
+    size_t cq_entries = 2 * ring->entries;
+
+    assert(ring->cq_tail - ring->cq_head < cq_entries);
+
+    struct vfs_ring_cqe *cqe = &ring->cq[ring->cq_tail & (cq_entries - 1)];
+    cqe->user_data = sqe->user_data;
+    cqe->err = err;
+    cqe->bytes = bytes;
+    cqe->handle = handle;
+
+    ring->cq_tail++;
+
+}
+
+// Files of the FAT server that are not cached
+static bool is_fat_file(vfs_handle_t handle) {
+
+    struct vfs_handle *h = handle;
+
+    return h != NULL && h->type == FATFS && h->cache == NULL;
+
+}
+
+// Handle of the entry, the chain's file for VFS_RING_LINKED_FILE
+static vfs_handle_t resolve_handle(struct vfs_ring *ring, struct vfs_ring_sqe *sqe, bool linked) {
+
+    if (sqe->handle != VFS_RING_LINKED_FILE) {
+        return sqe->handle;
+    }
+
+    return linked ? ring->link_handle : NULL;
+
+}
+
+static void batch_handler(void *arg, struct fs_rpc_batch_op *ops, size_t count) {
+
+    struct vfs_ring_batch *batch = arg;
+    struct vfs_ring *ring = batch->ring;
+
+    assert(batch->in_flight && count == batch->count);
+
+    // File opened by the link chain
+    vfs_handle_t chain_handle = batch->link_head ? batch->link_handle : NULL;
+
+    for (size_t i = 0; i < count; i++) {
+
+        struct fs_rpc_batch_op *op = &ops[i];
+        struct vfs_ring_sqe *sqe = &batch->sqes[i];
+
+        // A new chain starts after an entry without the link flag
+        if (i > 0 && !ops[i - 1].link) {
+            chain_handle = NULL;
+        }
+
+        vfs_handle_t h = sqe->handle != NULL ? sqe->handle : chain_handle;
+        vfs_handle_t ret_handle = NULL;
+
+        switch (op->type) {
+            case FS_RPC_OP_OPEN:
+            case FS_RPC_OP_CREATE:
+
+                // Wrap the server's handle in a VFS handle
+                if (err_is_ok(op->err)) {
+                    struct vfs_handle *vh = calloc(1, sizeof(struct vfs_handle));
+                    assert(vh != NULL);
+                    vh->handle = op->ret_handle;
+                    vh->type = FATFS;
+                    ret_handle = vh;
+                }
+                chain_handle = ret_handle;
+
+                // Free relative path
+                free((char *) op->path);
+
+                break;
+
+            case FS_RPC_OP_CLOSE:
+
+                // The FAT handle is gone unless the close did not run
+                if (batch->sent && op->err != FS_ERR_CANCELED) {
+                    if (h == chain_handle) {
+                        chain_handle = NULL;
+                    }
+                    free(h);
+                }
+
+                break;
+
+            case FS_RPC_OP_STAT:
+
+                if (err_is_ok(op->err)) {
+                    *sqe->info = op->info;
+                }
+
+                break;
+
+            case FS_RPC_OP_READDIR:
+
+                *sqe->name = op->name;
+                if (err_is_ok(op->err) && sqe->info != NULL) {
+                    *sqe->info = op->info;
+                }
+
+                break;
+
+            default:
+                break;
+        }
+
+#if PRINT_DEBUG
+        debug_printf("vfs_ring: entry %llu completed: %s\n", sqe->user_data, err_getstring(op->err));
+#endif
+
+        post_cqe(ring, sqe, op->err, op->ret_bytes, ret_handle);
+
+    }
+
+    // The rest of the chain can go on now
+    if (batch->link_tail) {
+        ring->link_state = VFS_RING_LINK_DONE;
+        ring->link_err = ops[count - 1].err;
+        ring->link_handle = chain_handle;
+    }
+
+    ring->in_flight -= count;
+    batch->in_flight = false;
+
+}
+
+// Wait for the batch sent to the server
+static void ring_wait(struct vfs_ring *ring) {
+
+    while (ring->spare->in_flight) {
+        fs_rpc_batch_poll(true);
+    }
+
+}
+
+// Send the batch that is filled to the server and optionally wait for it
+static errval_t ring_flush(struct vfs_ring *ring, bool wait) {
+
+    errval_t err = SYS_ERR_OK;
+
+    struct vfs_ring_batch *batch = ring->batch;
+
+    if (batch->count > 0) {
+
+        // The other batch becomes the one that is filled
+        ring_wait(ring);
+
+        batch->link_tail = ring->link && ring->link_state == VFS_RING_LINK_BATCH;
+
+        batch->in_flight = true;
+        ring->in_flight += batch->count;
+        ring->link_open_pending = false;
+        if (batch->link_tail) {
+            ring->link_state = VFS_RING_LINK_IN_FLIGHT;
+        }
+
+        err = fs_rpc_batch_submit(batch->ops, batch->count, batch_handler, batch);
+        batch->sent = err_is_ok(err);
+        if (err_is_fail(err)) {
+
+            // Fail all entries of the batch
+            for (size_t i = 0; i < batch->count; i++) {
+                batch->ops[i].err = err;
+                batch->ops[i].ret_bytes = 0;
+                batch->ops[i].name = NULL;
+            }
+            batch_handler(batch, batch->ops, batch->count);
+
+        }
+
+        // Swap batches
+        ring->batch = ring->spare;
+        ring->spare = batch;
+        ring->batch->count = 0;
+        ring->batch->bytes = 0;
+
+    }
+
+    if (wait) {
+        ring_wait(ring);
+    }
+
+    return err;
+
+}
+
+// Set up the batch operation of an entry, fails if it does not run on the server
+static bool batch_prepare(struct vfs_ring *ring, struct vfs_ring_sqe *sqe, bool linked,
+                          struct fs_rpc_batch_op *op) {
+
+    struct vfs_mount *mt = ring->st;
+
+    memset(op, 0, sizeof(struct fs_rpc_batch_op));
+    op->link = sqe->flags & VFS_RING_LINK;
+    op->buffer = sqe->buffer;
+    op->bytes = sqe->bytes;
+    op->pos = sqe->pos;
+
+    // The chain's file is opened in the batch and only the server knows its handle
+    bool pending = sqe->handle == VFS_RING_LINKED_FILE && linked && ring->link_open_pending;
+
+    // Entries on a file have to be on an uncached file of the server
+    if (sqe->op != VFS_RING_OP_OPEN && sqe->op != VFS_RING_OP_CREATE && !pending) {
+        vfs_handle_t handle = resolve_handle(ring, sqe, linked);
+        if (!is_fat_file(handle)) {
+            return false;
+        }
+        op->handle = ((struct vfs_handle *) handle)->handle;
+    }
+
+    switch (sqe->op) {
+        case VFS_RING_OP_OPEN:
+        case VFS_RING_OP_CREATE: {
+
+            // Only paths on the FAT server
+            char *rel_path;
+            if (find_mount_type(mt->head, sqe->path, &rel_path) != FATFS) {
+                free(rel_path);
+                return false;
+            }
+            op->type = sqe->op == VFS_RING_OP_OPEN ? FS_RPC_OP_OPEN : FS_RPC_OP_CREATE;
+            op->path = rel_path;
+
+            break;
+
+        }
+        case VFS_RING_OP_CLOSE:
+            op->type = FS_RPC_OP_CLOSE;
+            break;
+        case VFS_RING_OP_READ:
+            op->type = FS_RPC_OP_READ;
+            break;
+        case VFS_RING_OP_WRITE:
+            op->type = FS_RPC_OP_WRITE;
+            break;
+        case VFS_RING_OP_STAT:
+            op->type = FS_RPC_OP_STAT;
+            break;
+        case VFS_RING_OP_READDIR:
+            op->type = FS_RPC_OP_READDIR;
+            break;
+        default:
+            return false;
+    }
+
+    // Transfers larger than the shared buffer run synchronously
+    if (fs_rpc_batch_op_size(op) > fs_rpc_batch_capacity()) {
+        free((char *) op->path);
+        return false;
+    }
+
+    return true;
+
+}
+
+static bool batch_fits(struct vfs_ring *ring, struct fs_rpc_batch_op *op) {
+
+    struct vfs_ring_batch *batch = ring->batch;
+
+    return batch->count < FS_RPC_BATCH_MAX &&
+           batch->bytes + fs_rpc_batch_op_size(op) <= fs_rpc_batch_capacity();
+
+}
+
+static void batch_release(struct fs_rpc_batch_op *op) {
+
+    if (op->type == FS_RPC_OP_OPEN || op->type == FS_RPC_OP_CREATE) {
+        free((char *) op->path);
+    }
+
+}
+
+// Read or write at pos without moving the file position
+static errval_t run_transfer(void *st, struct vfs_ring_sqe *sqe, vfs_handle_t handle,
+                             size_t *ret_bytes) {
+
+    errval_t err;
+
+    size_t old_pos;
+    err = vfs_tell(st, handle, &old_pos);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    err = vfs_seek(st, handle, FS_SEEK_SET, sqe->pos);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (sqe->op == VFS_RING_OP_READ) {
+        err = vfs_read(st, handle, sqe->buffer, sqe->bytes, ret_bytes);
+    }
+    else {
+        err = vfs_write(st, handle, sqe->buffer, sqe->bytes, ret_bytes);
+    }
+
+    errval_t seek_err = vfs_seek(st, handle, FS_SEEK_SET, old_pos);
+
+    return err_is_fail(err) ? err : seek_err;
+
+}
+
+// Run an entry synchronously through the VFS
+static errval_t run_entry(struct vfs_ring *ring, struct vfs_ring_sqe *sqe, vfs_handle_t handle,
+                          size_t *ret_bytes, vfs_handle_t *ret_handle) {
+
+    errval_t err;
+
+    *ret_bytes = 0;
+    *ret_handle = NULL;
+
+    if (sqe->op != VFS_RING_OP_NOP && sqe->op != VFS_RING_OP_OPEN &&
+        sqe->op != VFS_RING_OP_CREATE && handle == NULL) {
+        return FS_ERR_INVALID_FH;
+    }
+
+    switch (sqe->op) {
+        case VFS_RING_OP_NOP:
+            err = SYS_ERR_OK;
+            break;
+        case VFS_RING_OP_OPEN:
+        case VFS_RING_OP_CREATE:
+            if (sqe->op == VFS_RING_OP_OPEN) {
+                err = vfs_open(ring->st, sqe->path, ret_handle);
+            }
+            else {
+                err = vfs_create(ring->st, sqe->path, ret_handle);
+            }
+            if (err_is_fail(err)) {
+                free(*ret_handle);
+                *ret_handle = NULL;
+            }
+            break;
+        case VFS_RING_OP_CLOSE:
+            err = vfs_close(ring->st, handle);
+            break;
+        case VFS_RING_OP_READ:
+        case VFS_RING_OP_WRITE:
+            err = run_transfer(ring->st, sqe, handle, ret_bytes);
+            break;
+        case VFS_RING_OP_STAT:
+            err = vfs_stat(ring->st, handle, sqe->info);
+            break;
+        case VFS_RING_OP_READDIR:
+            err = vfs_dir_read_next(ring->st, handle, sqe->name, sqe->info);
+            break;
+        default:
+            err = VFS_ERR_NOT_SUPPORTED;
+            break;
+    }
+
+    return err;
+
+}
+
+static void submit_entry(struct vfs_ring *ring, struct vfs_ring_sqe *sqe) {
+
+    // Does the entry continue a link chain and does the chain go on after it?
+    // The ring keeps the previous entry's flag until the entry is placed, since
+    // flushing the batch looks at it.
+    bool linked = ring->link;
+    bool link = sqe->flags & VFS_RING_LINK;
+
+    // The chain's previous entry was sent to the server already
+    if (linked && ring->link_state == VFS_RING_LINK_IN_FLIGHT) {
+        ring_wait(ring);
+    }
+
+    struct fs_rpc_batch_op op;
+    bool batched = batch_prepare(ring, sqe, linked, &op);
+
+    // The chain's previous entry is in the batch and this one cannot follow it
+    if (linked && ring->link_state == VFS_RING_LINK_BATCH && !(batched && batch_fits(ring, &op))) {
+        if (batched) {
+            batch_release(&op);
+        }
+        ring_flush(ring, true);
+        batched = batch_prepare(ring, sqe, linked, &op);
+    }
+
+    if (linked && ring->link_state == VFS_RING_LINK_DONE && err_is_fail(ring->link_err)) {
+
+        // Cancel the entry since the chain failed
+        if (batched) {
+            batch_release(&op);
+        }
+        post_cqe(ring, sqe, FS_ERR_CANCELED, 0, NULL);
+
+    }
+    else if (batched) {
+
+        // Start a new batch if the entry does not fit into this one
+        if (!batch_fits(ring, &op)) {
+            ring_flush(ring, false);
+        }
+
+        struct vfs_ring_batch *batch = ring->batch;
+        if (batch->count == 0) {
+            batch->link_head = linked;
+            batch->link_handle = ring->link_handle;
+        }
+
+        // Add entry with its resolved handle (NULL for the file opened in the batch)
+        vfs_handle_t handle = op.handle != NULL ? resolve_handle(ring, sqe, linked) : NULL;
+        batch->ops[batch->count] = op;
+        batch->sqes[batch->count] = *sqe;
+        batch->sqes[batch->count].handle = handle;
+        batch->count++;
+        batch->bytes += fs_rpc_batch_op_size(&op);
+
+        if (link) {
+            ring->link_state = VFS_RING_LINK_BATCH;
+            if (op.type == FS_RPC_OP_OPEN || op.type == FS_RPC_OP_CREATE) {
+                ring->link_open_pending = true;
+            }
+        }
+
+        // The chain's file goes away with the close
+        if (op.type == FS_RPC_OP_CLOSE && (handle == NULL || handle == ring->link_handle)) {
+            ring->link_open_pending = false;
+            ring->link_handle = NULL;
+        }
+
+    }
+    else {
+
+        // Run entry now
+        vfs_handle_t handle = resolve_handle(ring, sqe, linked);
+        size_t bytes;
+        vfs_handle_t ret_handle;
+        errval_t err = run_entry(ring, sqe, handle, &bytes, &ret_handle);
+
+        post_cqe(ring, sqe, err, bytes, ret_handle);
+
+        if (link) {
+            ring->link_state = VFS_RING_LINK_DONE;
+            ring->link_err = err;
+            if (sqe->op == VFS_RING_OP_OPEN || sqe->op == VFS_RING_OP_CREATE) {
+                ring->link_handle = ret_handle;
+            }
+            else if (sqe->op == VFS_RING_OP_CLOSE && handle == ring->link_handle) {
+                ring->link_handle = NULL;
+            }
+        }
+
+    }
+
+    ring->link = link;
+
+    // A chain ends with an entry without the link flag
+    if (!link) {
+        ring->link_state = VFS_RING_LINK_DONE;
+        ring->link_err = SYS_ERR_OK;
+        ring->link_handle = NULL;
+        ring->link_open_pending = false;
+    }
+
+}
+
+errval_t vfs_ring_init(struct vfs_ring *ring, void *st, size_t entries) {
+
+    assert(ring != NULL);
+    assert(entries > 0 && entries <= VFS_RING_ENTRIES_MAX);
+    assert((entries & (entries - 1)) == 0);
+
+    memset(ring, 0, sizeof(struct vfs_ring));
+
+    ring->st = st;
+    ring->entries = entries;
+    ring->link_state = VFS_RING_LINK_DONE;
+    ring->link_err = SYS_ERR_OK;
+
+    ring->sq = calloc(entries, sizeof(struct vfs_ring_sqe));
+    ring->cq = calloc(2 * entries, sizeof(struct vfs_ring_cqe));
+    ring->batch = calloc(1, sizeof(struct vfs_ring_batch));
+    ring->spare = calloc(1, sizeof(struct vfs_ring_batch));
+    if (ring->sq == NULL || ring->cq == NULL || ring->batch == NULL || ring->spare == NULL) {
+        vfs_ring_destroy(ring);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    ring->batch->ring = ring;
+    ring->spare->ring = ring;
+
+    return SYS_ERR_OK;
+
+}
+
+void vfs_ring_destroy(struct vfs_ring *ring) {
+
+    // The server still writes to the buffers of entries in flight
+    if (ring->spare != NULL) {
+        ring_wait(ring);
+    }
+
+    free(ring->sq);
+    free(ring->cq);
+    free(ring->batch);
+    free(ring->spare);
+
+    memset(ring, 0, sizeof(struct vfs_ring));
+
+}
+
+struct vfs_ring_sqe *vfs_ring_get_sqe(struct vfs_ring *ring) {
+
+    if (ring->sq_tail - ring->sq_head == ring->entries) {
+        return NULL;
+    }
+
+    struct vfs_ring_sqe *sqe = &ring->sq[ring->sq_tail & (ring->entries - 1)];
+    memset(sqe, 0, sizeof(struct vfs_ring_sqe));
+
+    ring->sq_tail++;
+
+    return sqe;
+
+}
+
+errval_t vfs_ring_submit(struct vfs_ring *ring, size_t *ret_submitted) {
+
+    size_t submitted = 0;
+
+    while (ring->sq_head != ring->sq_tail) {
+
+        // Every entry needs room for its completion
+        size_t cq_used = ring->cq_tail - ring->cq_head + ring->in_flight + ring->batch->count;
+        if (cq_used >= 2 * ring->entries) {
+            break;
+        }
+
+        // Copy entry so it can be reused right away
+        struct vfs_ring_sqe sqe = ring->sq[ring->sq_head & (ring->entries - 1)];
+        ring->sq_head++;
+
+        submit_entry(ring, &sqe);
+        submitted++;
+
+    }
+
+    // Send the batch, its entries complete when the server's reply arrives
+    errval_t err = ring_flush(ring, false);
+
+    if (ret_submitted != NULL) {
+        *ret_submitted = submitted;
+    }
+
+    return err;
+
+}
+
+struct vfs_ring_cqe *vfs_ring_peek_cqe(struct vfs_ring *ring) {
+
+    // Pick up the server's reply if it arrived
+    if (ring->cq_head == ring->cq_tail && ring->in_flight > 0) {
+        fs_rpc_batch_poll(false);
+    }
+
+    if (ring->cq_head == ring->cq_tail) {
+        return NULL;
+    }
+
+    return &ring->cq[ring->cq_head & (2 * ring->entries - 1)];
+
+}
+
+errval_t vfs_ring_wait_cqe(struct vfs_ring *ring, struct vfs_ring_cqe **ret_cqe) {
+
+    errval_t err;
+
+    assert(ret_cqe != NULL);
+
+    while (ring->cq_head == ring->cq_tail) {
+
+        if (ring->in_flight == 0) {
+            return FS_ERR_RING_EMPTY;
+        }
+
+        err = fs_rpc_batch_poll(true);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+    }
+
+    *ret_cqe = &ring->cq[ring->cq_head & (2 * ring->entries - 1)];
+
+    return SYS_ERR_OK;
+
+}
+
+void vfs_ring_cqe_seen(struct vfs_ring *ring) {
+
+    assert(ring->cq_head != ring->cq_tail);
+
+    ring->cq_head++;
+
+}
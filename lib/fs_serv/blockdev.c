@@ -0,0 +1,146 @@
+//
+//  blockdev.c
+//  DoritOS
+//
+
+#include <aos/aos.h>
+
+#include <fs_serv/blockdev.h>
+
+#define PRINT_DEBUG 0
+
+
+static errval_t blockdev_check(struct blockdev *dev, size_t block_nr,
+                               const struct blockdev_iovec *iov, size_t iovcnt) {
+
+    size_t count = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        count += iov[i].count;
+    }
+
+    if (count > dev->block_count || block_nr > dev->block_count - count) {
+        return FAT_ERR_BLOCK_BOUNDS;
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t blockdev_readv(struct blockdev *dev, size_t block_nr,
+                        const struct blockdev_iovec *iov, size_t iovcnt) {
+
+    errval_t err = blockdev_check(dev, block_nr, iov, iovcnt);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return dev->ops->readv(dev, block_nr, iov, iovcnt);
+
+}
+
+errval_t blockdev_writev(struct blockdev *dev, size_t block_nr,
+                         const struct blockdev_iovec *iov, size_t iovcnt) {
+
+    errval_t err = blockdev_check(dev, block_nr, iov, iovcnt);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return dev->ops->writev(dev, block_nr, iov, iovcnt);
+
+}
+
+errval_t blockdev_read(struct blockdev *dev, size_t block_nr, size_t count, void *buffer) {
+
+    struct blockdev_iovec iov = {
+        .buffer = buffer,
+        .count = count
+    };
+
+    return blockdev_readv(dev, block_nr, &iov, 1);
+
+}
+
+errval_t blockdev_write(struct blockdev *dev, size_t block_nr, size_t count, void *buffer) {
+
+    struct blockdev_iovec iov = {
+        .buffer = buffer,
+        .count = count
+    };
+
+    return blockdev_writev(dev, block_nr, &iov, 1);
+
+}
+
+void blockdev_submit(struct blockdev *dev, struct blockdev_request *req) {
+
+    // Insert sorted by block number
+    struct blockdev_request **indirect = &dev->queue;
+    while (*indirect != NULL && (*indirect)->block_nr <= req->block_nr) {
+        indirect = &(*indirect)->next;
+    }
+
+    req->err = SYS_ERR_OK;
+    req->next = *indirect;
+    *indirect = req;
+
+}
+
+errval_t blockdev_run_queue(struct blockdev *dev) {
+
+    errval_t ret_err = SYS_ERR_OK;
+
+    struct blockdev_iovec iov[BLOCKDEV_MAX_IOV];
+
+    while (dev->queue != NULL) {
+
+        struct blockdev_request *first = dev->queue;
+
+        // Merge the following requests of the same kind that continue the run
+        size_t iovcnt = 0;
+        size_t count = 0;
+        struct blockdev_request *last = first;
+        for (struct blockdev_request *req = first; req != NULL; req = req->next) {
+            if (iovcnt == BLOCKDEV_MAX_IOV || req->write != first->write ||
+                req->block_nr != first->block_nr + count) {
+                break;
+            }
+            iov[iovcnt].buffer = req->buffer;
+            iov[iovcnt].count = req->count;
+            iovcnt++;
+            count += req->count;
+            last = req;
+        }
+
+        // Dequeue the merged requests before dispatching them
+        dev->queue = last->next;
+
+#if PRINT_DEBUG
+        debug_printf("blockdev: %s %zu blocks at %zu in %zu requests\n",
+                     first->write ? "write" : "read", count, first->block_nr, iovcnt);
+#endif
+
+        errval_t err;
+        if (first->write) {
+            err = blockdev_writev(dev, first->block_nr, iov, iovcnt);
+        } else {
+            err = blockdev_readv(dev, first->block_nr, iov, iovcnt);
+        }
+
+        // Report the result to all merged requests
+        for (struct blockdev_request *req = first; ; req = req->next) {
+            req->err = err;
+            if (req == last) {
+                break;
+            }
+        }
+
+        if (err_is_fail(err) && err_is_ok(ret_err)) {
+            ret_err = err;
+        }
+
+    }
+
+    return ret_err;
+
+}
@@ -0,0 +1,97 @@
+//
+//  blockdev_ram.c
+//  DoritOS
+//
+//  RAM disk backend. The disk is a private, writable copy of a multiboot
+//  module (e.g. a FAT image), so the FAT server can run without the SD card
+//  controller.
+//
+
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/aos_rpc.h>
+
+#include <fs_serv/blockdev.h>
+
+#define PRINT_DEBUG 0
+
+#define BLOCKDEV_RAM_BLOCK_SIZE 512
+
+
+static errval_t blockdev_ram_readv(struct blockdev *dev, size_t block_nr,
+                                   const struct blockdev_iovec *iov, size_t iovcnt) {
+
+    uint8_t *disk = dev->st;
+
+    for (size_t i = 0; i < iovcnt; i++) {
+        size_t bytes = iov[i].count * dev->block_size;
+        memcpy(iov[i].buffer, disk + block_nr * dev->block_size, bytes);
+        block_nr += iov[i].count;
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+static errval_t blockdev_ram_writev(struct blockdev *dev, size_t block_nr,
+                                    const struct blockdev_iovec *iov, size_t iovcnt) {
+
+    uint8_t *disk = dev->st;
+
+    for (size_t i = 0; i < iovcnt; i++) {
+        size_t bytes = iov[i].count * dev->block_size;
+        memcpy(disk + block_nr * dev->block_size, iov[i].buffer, bytes);
+        block_nr += iov[i].count;
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+static const struct blockdev_ops blockdev_ram_ops = {
+    .readv = blockdev_ram_readv,
+    .writev = blockdev_ram_writev
+};
+
+errval_t blockdev_ram_create(const char *module, struct blockdev **ret_dev) {
+
+    errval_t err;
+
+    // Map the module image (read-only and shared with other clients)
+    void *image;
+    size_t image_bytes;
+    err = aos_rpc_map_module(aos_rpc_get_init_channel(), module, &image, &image_bytes);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+    struct blockdev *dev = calloc(1, sizeof(struct blockdev));
+    if (dev == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    // Make a private copy that can be written
+    dev->st = malloc(image_bytes);
+    if (dev->st == NULL) {
+        free(dev);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    memcpy(dev->st, image, image_bytes);
+
+    dev->name = module;
+    dev->block_size = BLOCKDEV_RAM_BLOCK_SIZE;
+    dev->block_count = image_bytes / BLOCKDEV_RAM_BLOCK_SIZE;
+    dev->ops = &blockdev_ram_ops;
+    dev->queue = NULL;
+
+#if PRINT_DEBUG
+    debug_printf("blockdev_ram: %s with %zu blocks\n", module, dev->block_count);
+#endif
+
+    *ret_dev = dev;
+
+    return SYS_ERR_OK;
+
+}
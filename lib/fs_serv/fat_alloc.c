@@ -0,0 +1,124 @@
+//
+//  fat_alloc.c
+//  DoritOS
+//
+//  In-memory bitmap of the free clusters. It is built from the FAT once at
+//  mount and kept in sync by setFATEntry, so finding free clusters no longer
+//  reads FAT sectors. A set bit means the cluster is free.
+//
+
+#include <aos/aos.h>
+#include <bitmap.h>
+
+#include <fs_serv/fat_helper.h>
+#include <fs_serv/fat_cache.h>
+#include <fs_serv/fat_alloc.h>
+
+#define PRINT_DEBUG 0
+
+
+static struct bitmap *free_clusters = NULL;
+
+// Cluster after the last allocation, where searches without hint start
+static size_t next_hint = 2;
+
+
+errval_t fat_alloc_init(void) {
+
+    errval_t err;
+
+    // Total number of sectors
+    size_t TotSec = BPB_TotSec16 != 0 ? BPB_TotSec16 : BPB_TotSec32;
+
+    // Number of FAT entries that fit into one sector
+    size_t FATEntPerSec = BPB_BytsPerSec / sizeof(uint32_t);
+
+    // Number of valid cluster numbers (clusters 0 and 1 are reserved)
+    size_t cluster_count = (TotSec - FirstDataSector) / BPB_SecPerClus + 2;
+    cluster_count = MIN(cluster_count, FATSz * FATEntPerSec);
+
+    free_clusters = bitmap_alloc(cluster_count);
+    if (free_clusters == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    // Scan the FAT one sector at a time
+    for (size_t n = 0; n < cluster_count; n += FATEntPerSec) {
+
+        uint32_t *buffer;
+        err = fat_cache_get(BPB_ResvdSecCnt + n / FATEntPerSec, false, (void **) &buffer);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            bitmap_free(free_clusters);
+            free_clusters = NULL;
+            return err;
+        }
+
+        size_t end = MIN(FATEntPerSec, cluster_count - n);
+        for (size_t i = 0; i < end; i++) {
+            if (n + i >= 2 && (buffer[i] & 0x0FFFFFFF) == 0) {
+                bitmap_set_bit(free_clusters, n + i);
+            }
+        }
+
+    }
+
+#if PRINT_DEBUG
+    debug_printf("fat_alloc: %u of %zu clusters free\n",
+                 bitmap_get_weight(free_clusters), cluster_count);
+#endif
+
+    return SYS_ERR_OK;
+
+}
+
+void fat_alloc_update(size_t cluster_nr, uint32_t value) {
+
+    if (free_clusters == NULL) {
+        return;
+    }
+
+    if (value == 0) {
+        bitmap_set_bit(free_clusters, cluster_nr);
+    } else {
+        bitmap_clear_bit(free_clusters, cluster_nr);
+    }
+
+}
+
+errval_t fat_alloc_find(size_t hint, size_t max_count,
+                        size_t *ret_cluster_nr, size_t *ret_count) {
+
+    assert(free_clusters != NULL);
+    assert(max_count > 0);
+
+    if (hint < 2) {
+        hint = next_hint;
+    }
+
+    // First free cluster from hint on, otherwise wrap around
+    bitmap_bit_t first = bitmap_get_next(free_clusters, hint - 1);
+    if (first == BITMAP_BIT_NONE) {
+        first = bitmap_get_first(free_clusters);
+    }
+    if (first == BITMAP_BIT_NONE) {
+#if PRINT_DEBUG
+        debug_printf("FAT full! Couldn't find a free entry...\n");
+#endif
+        return FAT_ERR_FAT_LOOKUP;
+    }
+
+    // Extend the run as long as the following clusters are free
+    size_t count = 1;
+    while (count < max_count && bitmap_is_bit_set(free_clusters, first + count)) {
+        count++;
+    }
+
+    next_hint = first + count;
+
+    *ret_cluster_nr = first;
+    *ret_count = count;
+
+    return SYS_ERR_OK;
+
+}
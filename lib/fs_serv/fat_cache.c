@@ -0,0 +1,382 @@
+//
+//  fat_cache.c
+//  DoritOS
+//
+//  Write-back LRU sector cache shared by FAT table and data accesses. Dirty
+//  sectors are written to the block device when they are evicted or on
+//  flush. Runs of missing sectors are read with one multi-block transfer
+//  straight into the cache entries, and a flush writes runs of dirty sectors
+//  through the request queue of the device.
+//
+
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/blockdev.h>
+#include <fs_serv/fat_cache.h>
+
+#define PRINT_DEBUG 0
+
+STATIC_ASSERT((FAT_CACHE_BUCKETS & (FAT_CACHE_BUCKETS - 1)) == 0,
+              "FAT_CACHE_BUCKETS must be a power of two");
+
+
+struct fat_cache_entry {
+    size_t sector_nr;
+    bool valid;
+    bool dirty;
+    uint8_t *data;
+    struct fat_cache_entry *lru_prev;       // Towards the most recently used
+    struct fat_cache_entry *lru_next;       // Towards the least recently used
+    struct fat_cache_entry *hash_next;
+};
+
+static struct fat_cache_entry entries[FAT_CACHE_SECTORS];
+static struct fat_cache_entry *buckets[FAT_CACHE_BUCKETS];
+
+// Most and least recently used entries
+static struct fat_cache_entry *lru_head = NULL;
+static struct fat_cache_entry *lru_tail = NULL;
+
+static size_t cache_sector_size = 0;
+
+static struct blockdev *cache_dev = NULL;
+
+
+static inline struct fat_cache_entry **fat_cache_bucket(size_t sector_nr) {
+    return &buckets[sector_nr & (FAT_CACHE_BUCKETS - 1)];
+}
+
+static void fat_cache_lru_unlink(struct fat_cache_entry *e) {
+
+    if (e->lru_prev != NULL) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        lru_head = e->lru_next;
+    }
+
+    if (e->lru_next != NULL) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        lru_tail = e->lru_prev;
+    }
+
+}
+
+// Make the entry the most recently used one
+static void fat_cache_lru_touch(struct fat_cache_entry *e) {
+
+    if (lru_head == e) {
+        return;
+    }
+
+    fat_cache_lru_unlink(e);
+
+    e->lru_prev = NULL;
+    e->lru_next = lru_head;
+    lru_head->lru_prev = e;
+    lru_head = e;
+
+}
+
+static struct fat_cache_entry *fat_cache_lookup(size_t sector_nr) {
+
+    for (struct fat_cache_entry *e = *fat_cache_bucket(sector_nr); e != NULL; e = e->hash_next) {
+        if (e->sector_nr == sector_nr) {
+            return e;
+        }
+    }
+
+    return NULL;
+
+}
+
+static void fat_cache_hash_remove(struct fat_cache_entry *e) {
+
+    struct fat_cache_entry **indirect = fat_cache_bucket(e->sector_nr);
+    while (*indirect != e) {
+        indirect = &(*indirect)->hash_next;
+    }
+    *indirect = e->hash_next;
+
+}
+
+// Reuse the least recently used entry for a sector, writing it back if dirty
+static errval_t fat_cache_claim(size_t sector_nr, struct fat_cache_entry **ret_entry) {
+
+    errval_t err;
+
+    struct fat_cache_entry *e = lru_tail;
+
+    if (e->valid) {
+
+        if (e->dirty) {
+            err = blockdev_write(cache_dev, e->sector_nr, 1, e->data);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            e->dirty = false;
+        }
+
+        fat_cache_hash_remove(e);
+        e->valid = false;
+
+    }
+
+    // Insert entry for the new sector
+    e->sector_nr = sector_nr;
+    e->hash_next = *fat_cache_bucket(sector_nr);
+    *fat_cache_bucket(sector_nr) = e;
+
+    fat_cache_lru_touch(e);
+
+    *ret_entry = e;
+
+    return SYS_ERR_OK;
+
+}
+
+// Drop an entry whose sector could not be read
+static void fat_cache_invalidate(struct fat_cache_entry *e) {
+
+    fat_cache_hash_remove(e);
+    e->valid = false;
+    e->dirty = false;
+
+    // Reuse it first
+    fat_cache_lru_unlink(e);
+    e->lru_next = NULL;
+    e->lru_prev = lru_tail;
+    lru_tail->lru_next = e;
+    lru_tail = e;
+
+}
+
+errval_t fat_cache_init(struct blockdev *dev, size_t sector_size) {
+
+    assert(sector_size == dev->block_size);
+
+    // Allocate the data of all entries at once
+    uint8_t *data = calloc(FAT_CACHE_SECTORS, sector_size);
+    if (data == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    cache_sector_size = sector_size;
+    cache_dev = dev;
+
+    // Chain all entries into the LRU list
+    for (size_t i = 0; i < FAT_CACHE_SECTORS; i++) {
+        entries[i].valid = false;
+        entries[i].dirty = false;
+        entries[i].data = data + i * sector_size;
+        entries[i].lru_prev = i > 0 ? &entries[i - 1] : NULL;
+        entries[i].lru_next = i + 1 < FAT_CACHE_SECTORS ? &entries[i + 1] : NULL;
+        entries[i].hash_next = NULL;
+    }
+    lru_head = &entries[0];
+    lru_tail = &entries[FAT_CACHE_SECTORS - 1];
+
+    memset(buckets, 0, sizeof(buckets));
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_get(size_t sector_nr, bool write, void **ret_data) {
+
+    errval_t err;
+
+    struct fat_cache_entry *e = fat_cache_lookup(sector_nr);
+    if (e != NULL) {
+
+        fat_cache_lru_touch(e);
+
+    } else {
+
+        err = fat_cache_claim(sector_nr, &e);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        // Read the sector from the device
+        err = blockdev_read(cache_dev, sector_nr, 1, e->data);
+        if (err_is_fail(err)) {
+            fat_cache_invalidate(e);
+            return err;
+        }
+        e->valid = true;
+
+    }
+
+    if (write) {
+        e->dirty = true;
+    }
+
+    *ret_data = e->data;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_read(size_t sector_nr, void *buffer) {
+
+    errval_t err;
+
+    void *data;
+    err = fat_cache_get(sector_nr, false, &data);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    memcpy(buffer, data, cache_sector_size);
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_write(size_t sector_nr, const void *buffer) {
+
+    errval_t err;
+
+    // The whole sector is overwritten, no need to read it first
+    struct fat_cache_entry *e = fat_cache_lookup(sector_nr);
+    if (e != NULL) {
+        fat_cache_lru_touch(e);
+    } else {
+        err = fat_cache_claim(sector_nr, &e);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        e->valid = true;
+    }
+
+    memcpy(e->data, buffer, cache_sector_size);
+    e->dirty = true;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_read_range(size_t sector_nr, size_t count, void *buffer) {
+
+    errval_t err;
+
+    uint8_t *temp_buf = buffer;
+
+    for (size_t i = 0; i < count; ) {
+
+        // Copy cached sectors out directly
+        struct fat_cache_entry *e = fat_cache_lookup(sector_nr + i);
+        if (e != NULL) {
+            fat_cache_lru_touch(e);
+            memcpy(temp_buf + i * cache_sector_size, e->data, cache_sector_size);
+            i++;
+            continue;
+        }
+
+        // Claim entries for the run of missing sectors
+        struct fat_cache_entry *run[BLOCKDEV_MAX_IOV];
+        struct blockdev_iovec iov[BLOCKDEV_MAX_IOV];
+        size_t n = 0;
+        err = SYS_ERR_OK;
+        while (i + n < count && n < BLOCKDEV_MAX_IOV &&
+               fat_cache_lookup(sector_nr + i + n) == NULL) {
+            err = fat_cache_claim(sector_nr + i + n, &run[n]);
+            if (err_is_fail(err)) {
+                break;
+            }
+            iov[n].buffer = run[n]->data;
+            iov[n].count = 1;
+            n++;
+        }
+
+        // Read the whole run with one transfer
+        if (err_is_ok(err)) {
+            err = blockdev_readv(cache_dev, sector_nr + i, iov, n);
+        }
+        if (err_is_fail(err)) {
+            for (size_t k = 0; k < n; k++) {
+                fat_cache_invalidate(run[k]);
+            }
+            return err;
+        }
+
+        for (size_t k = 0; k < n; k++) {
+            run[k]->valid = true;
+            memcpy(temp_buf + (i + k) * cache_sector_size, run[k]->data, cache_sector_size);
+        }
+
+        i += n;
+
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_write_range(size_t sector_nr, size_t count, const void *buffer) {
+
+    errval_t err;
+
+    const uint8_t *temp_buf = buffer;
+
+    for (size_t i = 0; i < count; i++) {
+        err = fat_cache_write(sector_nr + i, temp_buf + i * cache_sector_size);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_flush(void) {
+
+    errval_t err;
+
+    static struct blockdev_request requests[FAT_CACHE_SECTORS];
+
+    // Queue all dirty sectors, the queue merges adjacent ones
+    size_t count = 0;
+    for (size_t i = 0; i < FAT_CACHE_SECTORS; i++) {
+
+        struct fat_cache_entry *e = &entries[i];
+        if (!e->valid || !e->dirty) {
+            continue;
+        }
+
+        requests[i].write = true;
+        requests[i].block_nr = e->sector_nr;
+        requests[i].count = 1;
+        requests[i].buffer = e->data;
+        blockdev_submit(cache_dev, &requests[i]);
+
+        count++;
+
+    }
+
+    err = blockdev_run_queue(cache_dev);
+
+    // Only the sectors that were written are clean now
+    for (size_t i = 0; i < FAT_CACHE_SECTORS; i++) {
+        struct fat_cache_entry *e = &entries[i];
+        if (e->valid && e->dirty && err_is_ok(requests[i].err)) {
+            e->dirty = false;
+        }
+    }
+
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+#if PRINT_DEBUG
+    debug_printf("fat_cache: flushed %zu sectors\n", count);
+#endif
+
+    return err;
+
+}
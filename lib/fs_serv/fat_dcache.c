@@ -0,0 +1,464 @@
+//
+//  fat_dcache.c
+//  DoritOS
+//
+//  Directory entry cache for path resolution. Lookups are cached by
+//  (parent cluster, 8.3 name), including names that were not found. Large
+//  directories additionally get a hash index over all of their entries, so
+//  a miss in them does not need a linear search either.
+//
+//  All directory entry writes go through fat_dcache_update, which keeps
+//  both structures in sync with the directory.
+//
+
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/fat_dcache.h>
+
+#define PRINT_DEBUG 0
+
+STATIC_ASSERT((FAT_DCACHE_BUCKETS & (FAT_DCACHE_BUCKETS - 1)) == 0,
+              "FAT_DCACHE_BUCKETS must be a power of two");
+
+
+struct fat_dcache_entry {
+    bool valid;
+    bool negative;                          // Name does not exist
+    size_t parent_cluster_nr;
+    char name[11];
+    size_t pos;
+    uint8_t data[32];                       // Raw directory entry
+    struct fat_dcache_entry *lru_prev;      // Towards the most recently used
+    struct fat_dcache_entry *lru_next;      // Towards the least recently used
+    struct fat_dcache_entry *name_next;
+    struct fat_dcache_entry *pos_next;      // Only for positive entries
+};
+
+// Hash index over all entries of one directory
+struct fat_dindex {
+    size_t cluster_nr;                      // 0 if unused
+    size_t slot_count;
+    uint8_t *slots;                         // Copy of the directory entries
+    int32_t *next;                          // Hash chains through slot numbers
+    int32_t *buckets;
+    size_t bucket_count;
+    uint32_t last_used;
+};
+
+static struct fat_dcache_entry entries[FAT_DCACHE_ENTRIES];
+static struct fat_dcache_entry *name_buckets[FAT_DCACHE_BUCKETS];
+static struct fat_dcache_entry *pos_buckets[FAT_DCACHE_BUCKETS];
+
+// Most and least recently used entries
+static struct fat_dcache_entry *lru_head = NULL;
+static struct fat_dcache_entry *lru_tail = NULL;
+
+static struct fat_dindex indexes[FAT_DINDEX_DIRS];
+
+// Logical clock for the LRU replacement of indexes
+static uint32_t dindex_clock = 0;
+
+
+// Check if a raw directory entry is in use
+static inline bool fat_dcache_live(const uint8_t *data) {
+    return data[0] != 0x00 && data[0] != 0xE5;
+}
+
+static uint32_t fat_dcache_hash(size_t cluster_nr, const char *name) {
+
+    // FNV-1a over the 8.3 name, seeded with the directory
+    uint32_t hash = 2166136261u ^ cluster_nr;
+    for (int i = 0; i < 11; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+
+}
+
+static inline struct fat_dcache_entry **fat_dcache_name_bucket(size_t cluster_nr,
+                                                                const char *name) {
+    return &name_buckets[fat_dcache_hash(cluster_nr, name) & (FAT_DCACHE_BUCKETS - 1)];
+}
+
+static inline struct fat_dcache_entry **fat_dcache_pos_bucket(size_t cluster_nr, size_t pos) {
+    return &pos_buckets[(cluster_nr * 31 + pos) & (FAT_DCACHE_BUCKETS - 1)];
+}
+
+static void fat_dcache_init(void) {
+
+    // Chain all entries into the LRU list
+    for (size_t i = 0; i < FAT_DCACHE_ENTRIES; i++) {
+        entries[i].valid = false;
+        entries[i].lru_prev = i > 0 ? &entries[i - 1] : NULL;
+        entries[i].lru_next = i + 1 < FAT_DCACHE_ENTRIES ? &entries[i + 1] : NULL;
+    }
+    lru_head = &entries[0];
+    lru_tail = &entries[FAT_DCACHE_ENTRIES - 1];
+
+}
+
+static void fat_dcache_lru_unlink(struct fat_dcache_entry *e) {
+
+    if (e->lru_prev != NULL) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        lru_head = e->lru_next;
+    }
+
+    if (e->lru_next != NULL) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        lru_tail = e->lru_prev;
+    }
+
+}
+
+// Make the entry the most recently used one
+static void fat_dcache_lru_touch(struct fat_dcache_entry *e) {
+
+    if (lru_head == e) {
+        return;
+    }
+
+    fat_dcache_lru_unlink(e);
+
+    e->lru_prev = NULL;
+    e->lru_next = lru_head;
+    lru_head->lru_prev = e;
+    lru_head = e;
+
+}
+
+static struct fat_dcache_entry *fat_dcache_find_name(size_t cluster_nr, const char *name) {
+
+    for (struct fat_dcache_entry *e = *fat_dcache_name_bucket(cluster_nr, name);
+         e != NULL; e = e->name_next) {
+        if (e->parent_cluster_nr == cluster_nr && memcmp(e->name, name, 11) == 0) {
+            return e;
+        }
+    }
+
+    return NULL;
+
+}
+
+static struct fat_dcache_entry *fat_dcache_find_pos(size_t cluster_nr, size_t pos) {
+
+    for (struct fat_dcache_entry *e = *fat_dcache_pos_bucket(cluster_nr, pos);
+         e != NULL; e = e->pos_next) {
+        if (e->parent_cluster_nr == cluster_nr && e->pos == pos) {
+            return e;
+        }
+    }
+
+    return NULL;
+
+}
+
+// Remove an entry from the hash chains and reuse it first
+static void fat_dcache_drop(struct fat_dcache_entry *e) {
+
+    struct fat_dcache_entry **indirect = fat_dcache_name_bucket(e->parent_cluster_nr, e->name);
+    while (*indirect != e) {
+        indirect = &(*indirect)->name_next;
+    }
+    *indirect = e->name_next;
+
+    if (!e->negative) {
+        indirect = fat_dcache_pos_bucket(e->parent_cluster_nr, e->pos);
+        while (*indirect != e) {
+            indirect = &(*indirect)->pos_next;
+        }
+        *indirect = e->pos_next;
+    }
+
+    e->valid = false;
+
+    fat_dcache_lru_unlink(e);
+    e->lru_next = NULL;
+    e->lru_prev = lru_tail;
+    lru_tail->lru_next = e;
+    lru_tail = e;
+
+}
+
+
+/// DIRECTORY INDEX
+
+static struct fat_dindex *fat_dindex_find(size_t cluster_nr) {
+
+    // Unused indexes have cluster_nr 0 as well, which is also the root's
+    for (size_t i = 0; i < FAT_DINDEX_DIRS; i++) {
+        if (indexes[i].buckets != NULL && indexes[i].cluster_nr == cluster_nr) {
+            return &indexes[i];
+        }
+    }
+
+    return NULL;
+
+}
+
+static void fat_dindex_free(struct fat_dindex *idx) {
+
+    free(idx->slots);
+    free(idx->next);
+    free(idx->buckets);
+
+    idx->cluster_nr = 0;
+    idx->slots = NULL;
+    idx->next = NULL;
+    idx->buckets = NULL;
+    idx->last_used = 0;
+
+}
+
+static inline int32_t *fat_dindex_bucket(struct fat_dindex *idx, const char *name) {
+    return &idx->buckets[fat_dcache_hash(idx->cluster_nr, name) & (idx->bucket_count - 1)];
+}
+
+static void fat_dindex_link(struct fat_dindex *idx, size_t slot) {
+
+    int32_t *bucket = fat_dindex_bucket(idx, (char *) &idx->slots[slot * 32]);
+    idx->next[slot] = *bucket;
+    *bucket = slot;
+
+}
+
+static void fat_dindex_unlink(struct fat_dindex *idx, size_t slot) {
+
+    int32_t *indirect = fat_dindex_bucket(idx, (char *) &idx->slots[slot * 32]);
+    while (*indirect != (int32_t) slot) {
+        indirect = &idx->next[*indirect];
+    }
+    *indirect = idx->next[slot];
+
+}
+
+static bool fat_dindex_lookup(struct fat_dindex *idx, const char *name,
+                              size_t *ret_pos, uint8_t *ret_data) {
+
+    for (int32_t slot = *fat_dindex_bucket(idx, name); slot != -1; slot = idx->next[slot]) {
+        if (memcmp(&idx->slots[slot * 32], name, 11) == 0) {
+            *ret_pos = slot;
+            memcpy(ret_data, &idx->slots[slot * 32], 32);
+            return true;
+        }
+    }
+
+    return false;
+
+}
+
+static void fat_dindex_update(struct fat_dindex *idx, size_t pos, const uint8_t *data) {
+
+    // The directory grew, rebuild the index on the next miss
+    if (pos >= idx->slot_count) {
+        fat_dindex_free(idx);
+        return;
+    }
+
+    if (fat_dcache_live(&idx->slots[pos * 32])) {
+        fat_dindex_unlink(idx, pos);
+    }
+
+    memcpy(&idx->slots[pos * 32], data, 32);
+
+    if (fat_dcache_live(data)) {
+        fat_dindex_link(idx, pos);
+    }
+
+}
+
+
+/// INTERFACE
+
+errval_t fat_dcache_lookup(size_t parent_cluster_nr, const char *fat_name,
+                           size_t *ret_pos, uint8_t *ret_data) {
+
+    if (lru_head == NULL) {
+        fat_dcache_init();
+    }
+
+    struct fat_dcache_entry *e = fat_dcache_find_name(parent_cluster_nr, fat_name);
+    if (e != NULL) {
+
+        fat_dcache_lru_touch(e);
+
+        if (e->negative) {
+            return FAT_ERR_FAT_LOOKUP;
+        }
+
+        *ret_pos = e->pos;
+        memcpy(ret_data, e->data, 32);
+
+        return SYS_ERR_OK;
+
+    }
+
+    // The index of a large directory knows all of its names
+    struct fat_dindex *idx = fat_dindex_find(parent_cluster_nr);
+    if (idx != NULL) {
+
+        idx->last_used = ++dindex_clock;
+
+        if (!fat_dindex_lookup(idx, fat_name, ret_pos, ret_data)) {
+            return FAT_ERR_FAT_LOOKUP;
+        }
+
+        // Keep the hit in the entry cache as well
+        fat_dcache_insert(parent_cluster_nr, fat_name, *ret_pos, ret_data);
+
+        return SYS_ERR_OK;
+
+    }
+
+    return FS_CACHE_NOTPRESENT;
+
+}
+
+void fat_dcache_insert(size_t parent_cluster_nr, const char *fat_name,
+                       size_t pos, const uint8_t *data) {
+
+    if (lru_head == NULL) {
+        fat_dcache_init();
+    }
+
+    // Replace an older result for the same name
+    struct fat_dcache_entry *e = fat_dcache_find_name(parent_cluster_nr, fat_name);
+    if (e != NULL) {
+        fat_dcache_drop(e);
+    }
+
+    // Reuse the least recently used entry
+    e = lru_tail;
+    if (e->valid) {
+        fat_dcache_drop(e);
+    }
+
+    e->valid = true;
+    e->negative = data == NULL;
+    e->parent_cluster_nr = parent_cluster_nr;
+    memcpy(e->name, fat_name, 11);
+
+    struct fat_dcache_entry **bucket = fat_dcache_name_bucket(parent_cluster_nr, fat_name);
+    e->name_next = *bucket;
+    *bucket = e;
+
+    if (data != NULL) {
+        e->pos = pos;
+        memcpy(e->data, data, 32);
+
+        bucket = fat_dcache_pos_bucket(parent_cluster_nr, pos);
+        e->pos_next = *bucket;
+        *bucket = e;
+    }
+
+    fat_dcache_lru_touch(e);
+
+}
+
+void fat_dcache_update(size_t parent_cluster_nr, size_t pos, const uint8_t *data) {
+
+    if (lru_head == NULL) {
+        fat_dcache_init();
+    }
+
+    // Whatever was cached at this position is outdated
+    struct fat_dcache_entry *e = fat_dcache_find_pos(parent_cluster_nr, pos);
+    if (e != NULL) {
+        fat_dcache_drop(e);
+    }
+
+    // Replaces a negative entry for the new name
+    if (fat_dcache_live(data)) {
+        fat_dcache_insert(parent_cluster_nr, (const char *) data, pos, data);
+    }
+
+    struct fat_dindex *idx = fat_dindex_find(parent_cluster_nr);
+    if (idx != NULL) {
+        fat_dindex_update(idx, pos, data);
+    }
+
+}
+
+void fat_dcache_index(size_t cluster_nr, const uint8_t *slots, size_t slot_count) {
+
+    // Small directories are cheap enough to search
+    size_t live_count = 0;
+    for (size_t i = 0; i < slot_count; i++) {
+        if (fat_dcache_live(&slots[i * 32])) {
+            live_count++;
+        }
+    }
+    if (live_count < FAT_DINDEX_MIN_ENTRIES) {
+        return;
+    }
+
+    // Replace an existing index of the directory or the least recently used one
+    struct fat_dindex *idx = fat_dindex_find(cluster_nr);
+    if (idx == NULL) {
+        idx = &indexes[0];
+        for (size_t i = 1; i < FAT_DINDEX_DIRS; i++) {
+            if (indexes[i].last_used < idx->last_used) {
+                idx = &indexes[i];
+            }
+        }
+    }
+    fat_dindex_free(idx);
+
+    // Power of two number of buckets, about one per slot
+    size_t bucket_count = 1;
+    while (bucket_count < slot_count) {
+        bucket_count *= 2;
+    }
+
+    idx->slots = malloc(slot_count * 32);
+    idx->next = malloc(slot_count * sizeof(int32_t));
+    idx->buckets = malloc(bucket_count * sizeof(int32_t));
+    if (idx->slots == NULL || idx->next == NULL || idx->buckets == NULL) {
+        fat_dindex_free(idx);
+        return;
+    }
+
+    idx->cluster_nr = cluster_nr;
+    idx->slot_count = slot_count;
+    idx->bucket_count = bucket_count;
+    idx->last_used = ++dindex_clock;
+
+    memcpy(idx->slots, slots, slot_count * 32);
+    memset(idx->buckets, 0xff, bucket_count * sizeof(int32_t));
+
+    for (size_t i = 0; i < slot_count; i++) {
+        if (fat_dcache_live(&slots[i * 32])) {
+            fat_dindex_link(idx, i);
+        }
+    }
+
+#if PRINT_DEBUG
+    debug_printf("fat_dcache: indexed %zu entries of directory %zu\n", live_count, cluster_nr);
+#endif
+
+}
+
+void fat_dcache_invalidate_dir(size_t cluster_nr) {
+
+    if (lru_head == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < FAT_DCACHE_ENTRIES; i++) {
+        if (entries[i].valid && entries[i].parent_cluster_nr == cluster_nr) {
+            fat_dcache_drop(&entries[i]);
+        }
+    }
+
+    struct fat_dindex *idx = fat_dindex_find(cluster_nr);
+    if (idx != NULL) {
+        fat_dindex_free(idx);
+    }
+
+}
@@ -0,0 +1,233 @@
+//
+//  fat_extent.c
+//  DoritOS
+//
+//  Extent maps of recently used cluster chains. A chain is followed through
+//  the FAT once, afterwards a file offset is translated by a binary search
+//  over the runs of contiguous clusters. The maps are cached by the first
+//  cluster of the chain, maps of open files are pinned.
+//
+
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/fatfs_serv.h>
+#include <fs_serv/fat_extent.h>
+
+#define PRINT_DEBUG 0
+
+#define FAT_EXTENT_INITIAL_CAPACITY 4
+
+
+static struct fat_extent_map maps[FAT_EXTENT_CACHE_FILES];
+
+// Logical clock for the LRU replacement
+static uint32_t extent_clock = 0;
+
+
+static struct fat_extent_map *fat_extent_find(size_t first_cluster_nr) {
+
+    for (size_t i = 0; i < FAT_EXTENT_CACHE_FILES; i++) {
+        if (maps[i].first_cluster_nr == first_cluster_nr) {
+            return &maps[i];
+        }
+    }
+
+    return NULL;
+
+}
+
+static void fat_extent_reset(struct fat_extent_map *map) {
+
+    map->first_cluster_nr = 0;
+    map->cluster_count = 0;
+    map->extent_count = 0;
+    map->pin_count = 0;
+
+}
+
+errval_t fat_extent_append(struct fat_extent_map *map, size_t cluster_nr) {
+
+    // Extend the last run if the cluster is contiguous
+    if (map->extent_count > 0) {
+        struct fat_extent *last = &map->extents[map->extent_count - 1];
+        if (last->cluster_nr + last->count == cluster_nr) {
+            last->count++;
+            map->cluster_count++;
+            return SYS_ERR_OK;
+        }
+    }
+
+    // Grow the extent array if necessary
+    if (map->extent_count == map->extent_capacity) {
+        size_t capacity = MAX(FAT_EXTENT_INITIAL_CAPACITY, 2 * map->extent_capacity);
+        struct fat_extent *extents = realloc(map->extents, capacity * sizeof(struct fat_extent));
+        if (extents == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        map->extents = extents;
+        map->extent_capacity = capacity;
+    }
+
+    // Start a new run
+    struct fat_extent *extent = &map->extents[map->extent_count++];
+    extent->file_index = map->cluster_count;
+    extent->cluster_nr = cluster_nr;
+    extent->count = 1;
+    map->cluster_count++;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_extent_get(size_t first_cluster_nr, struct fat_extent_map **ret_map) {
+
+    errval_t err;
+
+    if (first_cluster_nr < 2) {
+        return FAT_ERR_CLUSTER_BOUNDS;
+    }
+
+    extent_clock++;
+
+    struct fat_extent_map *map = fat_extent_find(first_cluster_nr);
+    if (map != NULL) {
+        map->last_used = extent_clock;
+        *ret_map = map;
+        return SYS_ERR_OK;
+    }
+
+    // Replace the least recently used map, preferably an unpinned one
+    map = &maps[0];
+    for (size_t i = 1; i < FAT_EXTENT_CACHE_FILES; i++) {
+        if ((maps[i].pin_count == 0 && map->pin_count > 0) ||
+            ((maps[i].pin_count == 0) == (map->pin_count == 0) &&
+             maps[i].last_used < map->last_used)) {
+            map = &maps[i];
+        }
+    }
+    fat_extent_reset(map);
+
+    // Follow the chain once
+    size_t cluster_nr = first_cluster_nr;
+    while (2 <= cluster_nr && cluster_nr < 0x0FFFFFF8) {
+
+        err = fat_extent_append(map, cluster_nr);
+        if (err_is_fail(err)) {
+            fat_extent_reset(map);
+            return err;
+        }
+
+        cluster_nr = getFATEntry(cluster_nr);
+
+    }
+
+#if PRINT_DEBUG
+    debug_printf("fat_extent: chain %zu has %zu clusters in %zu extents\n",
+                 first_cluster_nr, map->cluster_count, map->extent_count);
+#endif
+
+    map->first_cluster_nr = first_cluster_nr;
+    map->last_used = extent_clock;
+
+    *ret_map = map;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_extent_lookup(struct fat_extent_map *map, size_t index,
+                           size_t *ret_cluster_nr, size_t *ret_run) {
+
+    if (index >= map->cluster_count) {
+        return FAT_ERR_CLUSTER_BOUNDS;
+    }
+
+    // Binary search for the last run starting at or before index
+    size_t low = 0;
+    size_t high = map->extent_count;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (map->extents[mid].file_index <= index) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    struct fat_extent *extent = &map->extents[low];
+    size_t offset = index - extent->file_index;
+
+    *ret_cluster_nr = extent->cluster_nr + offset;
+    *ret_run = extent->count - offset;
+
+    return SYS_ERR_OK;
+
+}
+
+size_t fat_extent_last(struct fat_extent_map *map) {
+
+    assert(map->extent_count > 0);
+
+    struct fat_extent *last = &map->extents[map->extent_count - 1];
+
+    return last->cluster_nr + last->count - 1;
+
+}
+
+void fat_extent_truncate(struct fat_extent_map *map, size_t cluster_count) {
+
+    // Drop whole runs past the new end
+    while (map->extent_count > 0 &&
+           map->extents[map->extent_count - 1].file_index >= cluster_count) {
+        map->extent_count--;
+    }
+
+    // Shorten the last run
+    if (map->extent_count > 0) {
+        struct fat_extent *last = &map->extents[map->extent_count - 1];
+        last->count = MIN(last->count, cluster_count - last->file_index);
+    }
+
+    map->cluster_count = MIN(map->cluster_count, cluster_count);
+
+}
+
+void fat_extent_invalidate(size_t first_cluster_nr) {
+
+    if (first_cluster_nr < 2) {
+        return;
+    }
+
+    struct fat_extent_map *map = fat_extent_find(first_cluster_nr);
+    if (map != NULL) {
+        fat_extent_reset(map);
+        map->last_used = 0;
+    }
+
+}
+
+void fat_extent_pin(size_t first_cluster_nr) {
+
+    struct fat_extent_map *map;
+    errval_t err = fat_extent_get(first_cluster_nr, &map);
+    if (err_is_ok(err)) {
+        map->pin_count++;
+    }
+
+}
+
+void fat_extent_unpin(size_t first_cluster_nr) {
+
+    if (first_cluster_nr < 2) {
+        return;
+    }
+
+    // The map may have been replaced while all maps were pinned
+    struct fat_extent_map *map = fat_extent_find(first_cluster_nr);
+    if (map != NULL && map->pin_count > 0) {
+        map->pin_count--;
+    }
+
+}
@@ -0,0 +1,180 @@
+//
+//  fat_handle.c
+//  DoritOS
+//
+//  Open file table of the FAT server. Clients refer to open files by a
+//  handle, the server keeps the dirent (and with it the file size) of each
+//  open file, so all clients see the same size. The extent map of an open
+//  file stays pinned in the extent cache.
+//
+
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/fat_extent.h>
+#include <fs_serv/fat_handle.h>
+
+#define PRINT_DEBUG 0
+
+
+struct fat_handle {
+    void *owner;
+    struct fat_open_file *file;     // NULL if unused
+};
+
+static struct fat_handle handles[FAT_HANDLE_MAX];
+
+// All open files
+static struct fat_open_file *open_files = NULL;
+
+// Versions of directory entries, entries that share a slot change together
+// (which only costs a spurious change), unmodified ones are at version 1
+static uint32_t versions[FAT_VERSION_SLOTS];
+static uint32_t version_clock = 1;
+
+
+static struct fat_open_file *fat_open_file_find(size_t parent_cluster_nr, size_t parent_pos) {
+
+    for (struct fat_open_file *file = open_files; file != NULL; file = file->next) {
+        if (file->dirent.parent_cluster_nr == parent_cluster_nr &&
+            file->dirent.parent_pos == parent_pos) {
+            return file;
+        }
+    }
+
+    return NULL;
+
+}
+
+errval_t fat_handle_open(void *owner, struct fat_dirent *dirent, uint32_t *ret_handle) {
+
+    // Find a free handle
+    uint32_t handle;
+    for (handle = 0; handle < FAT_HANDLE_MAX; handle++) {
+        if (handles[handle].file == NULL) {
+            break;
+        }
+    }
+    if (handle == FAT_HANDLE_MAX) {
+        return FS_ERR_NO_HANDLES;
+    }
+
+    // Share the open file if the entry is already open
+    struct fat_open_file *file = fat_open_file_find(dirent->parent_cluster_nr,
+                                                    dirent->parent_pos);
+    if (file == NULL) {
+
+        file = calloc(1, sizeof(struct fat_open_file));
+        if (file == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+
+        memcpy(&file->dirent, dirent, sizeof(struct fat_dirent));
+
+        file->next = open_files;
+        open_files = file;
+
+        // Keep the cluster chain translation warm
+        fat_extent_pin(file->dirent.first_cluster_nr);
+
+    }
+
+    file->refcount++;
+
+    handles[handle].owner = owner;
+    handles[handle].file = file;
+
+#if PRINT_DEBUG
+    debug_printf("fat_handle: opened %u for %s (%zu refs)\n",
+                 handle, file->dirent.name, file->refcount);
+#endif
+
+    *ret_handle = handle;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_handle_get(void *owner, uint32_t handle, struct fat_open_file **ret_file) {
+
+    if (handle >= FAT_HANDLE_MAX || handles[handle].file == NULL ||
+        handles[handle].owner != owner) {
+        return FS_ERR_INVALID_FH;
+    }
+
+    *ret_file = handles[handle].file;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_handle_close(void *owner, uint32_t handle) {
+
+    struct fat_open_file *file;
+    errval_t err = fat_handle_get(owner, handle, &file);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    handles[handle].owner = NULL;
+    handles[handle].file = NULL;
+
+    assert(file->refcount > 0);
+    file->refcount--;
+    if (file->refcount > 0) {
+        return SYS_ERR_OK;
+    }
+
+    // Drop the open file with its last handle
+    struct fat_open_file **indirect = &open_files;
+    while (*indirect != file) {
+        indirect = &(*indirect)->next;
+    }
+    *indirect = file->next;
+
+    fat_extent_unpin(file->dirent.first_cluster_nr);
+
+    free(file);
+
+    return SYS_ERR_OK;
+
+}
+
+void fat_handle_close_all(void *owner) {
+
+    for (uint32_t handle = 0; handle < FAT_HANDLE_MAX; handle++) {
+        if (handles[handle].file != NULL && handles[handle].owner == owner) {
+            fat_handle_close(owner, handle);
+        }
+    }
+
+}
+
+static uint32_t *fat_version_slot(size_t parent_cluster_nr, size_t parent_pos) {
+
+    size_t key = parent_cluster_nr * 2654435761u + parent_pos;
+
+    return &versions[key & (FAT_VERSION_SLOTS - 1)];
+
+}
+
+void fat_handle_touch(size_t parent_cluster_nr, size_t parent_pos) {
+
+    *fat_version_slot(parent_cluster_nr, parent_pos) = ++version_clock;
+
+}
+
+uint32_t fat_handle_version(size_t parent_cluster_nr, size_t parent_pos) {
+
+    uint32_t version = *fat_version_slot(parent_cluster_nr, parent_pos);
+
+    return version == 0 ? 1 : version;
+
+}
+
+bool fat_handle_is_open(size_t parent_cluster_nr, size_t parent_pos) {
+
+    return fat_open_file_find(parent_cluster_nr, parent_pos) != NULL;
+
+}
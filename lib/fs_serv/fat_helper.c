@@ -15,12 +15,20 @@
 
 char *convert_to_fat_name(const char *name) {
     
-    // Length of name (not including '\0')
-    size_t len = strlen(name);
-    
     // Allocate return name string with length 12 (one extra for '\0')
     char *ret_name = calloc(1, 12);
     
+    convert_to_fat_name_buf(name, ret_name);
+    
+    return ret_name;
+    
+}
+
+void convert_to_fat_name_buf(const char *name, char *ret_name) {
+    
+    // Length of name (not including '\0')
+    size_t len = strlen(name);
+    
     // Set memory to space char
     memset(ret_name, ' ', 12);
     
@@ -87,8 +95,6 @@ char *convert_to_fat_name(const char *name) {
         head[i] = toupper(name[i]);
     }
     
-    return ret_name;
-    
 }
 
 char *convert_to_normal_name(char *fat_name) {
@@ -12,6 +12,8 @@
 
 #include <fs_serv/fatfs_serv.h>
 #include <fs_serv/fatfs_rpc_serv.h>
+#include <fs_serv/fat_cache.h>
+#include <fs_serv/fat_handle.h>
 
 #include <fs/fs_rpc.h>
 
@@ -19,9 +21,358 @@
 
 #define PRINT_DEBUG 0
 
-// List of bound channels
+// List of bound LMP channels
 static collections_listnode *chan_list;
 
+// Shared request ring for all UMP clients
+static struct urpc_mpsc_server mpsc_serv;
+
+// Data buffer shared with a client
+struct fs_rpc_buffer {
+    struct urpc_chan *chan;
+    struct capref frame;
+    uint8_t *buf;
+    size_t size;
+};
+
+// List of data buffers of all clients
+static collections_listnode *buf_list;
+
+
+static int32_t buffer_has_chan(void *data, void *arg) {
+    return ((struct fs_rpc_buffer *) data)->chan == arg;
+}
+
+// Allocate a buffer for the client on chan and send it to the client
+static errval_t buffer_create(struct urpc_chan *chan, domainid_t pid) {
+    
+    errval_t err;
+    
+    struct fs_rpc_buffer *buffer = calloc(1, sizeof(struct fs_rpc_buffer));
+    if (buffer == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    buffer->chan = chan;
+    
+    // Allocate frame
+    err = frame_alloc(&buffer->frame, FS_RPC_BUF_SIZE, &buffer->size);
+    if (err_is_fail(err)) {
+        free(buffer);
+        return err;
+    }
+    
+    // Map frame
+    err = paging_map_frame(get_current_paging_state(),
+                           (void **) &buffer->buf,
+                           buffer->size,
+                           buffer->frame,
+                           NULL,
+                           NULL);
+    if (err_is_fail(err)) {
+        cap_destroy(buffer->frame);
+        free(buffer);
+        return err;
+    }
+    
+    // Send frame to client
+    err = urpc_share_frame(pid, buffer->frame);
+    if (err_is_fail(err)) {
+        paging_unmap(get_current_paging_state(), buffer->buf);
+        cap_destroy(buffer->frame);
+        free(buffer);
+        return err;
+    }
+    
+    collections_list_insert(buf_list, buffer);
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Free the buffer of the client on chan
+static void buffer_destroy(struct urpc_chan *chan) {
+    
+    struct fs_rpc_buffer *buffer = collections_list_remove_if(buf_list, buffer_has_chan, chan);
+    if (buffer == NULL) {
+        return;
+    }
+    
+    paging_unmap(get_current_paging_state(), buffer->buf);
+    cap_destroy(buffer->frame);
+    free(buffer);
+    
+}
+
+
+// Open a handle to dirent and send it to the client
+static void send_handle(struct urpc_chan *chan, errval_t err,
+                        struct fat_dirent *dirent, urpc_msg_type_t msg_type) {
+    
+    // File system message
+    struct fs_message send_msg = {
+        .arg1 = 0,
+        .arg2 = 0,
+        .arg3 = 0,
+        .arg4 = 0
+    };
+    
+    // The root directory has no dirent when opened as a file
+    if (err_is_ok(err) && dirent == NULL) {
+        err = FS_ERR_NOTFILE;
+    }
+    
+    // Open handle
+    uint32_t handle = 0;
+    if (err_is_ok(err)) {
+        err = fat_handle_open(chan, dirent, &handle);
+    }
+    
+    // Set error, handle and type
+    send_msg.arg1 = err;
+    if (err_is_ok(err)) {
+        send_msg.arg2 = handle;
+        send_msg.arg3 = dirent->is_dir;
+    }
+    
+    // Send response message to client
+    urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), msg_type);
+    
+}
+
+// Run an operation of a batch on the client's shared buffer and set its results
+static errval_t batch_op(struct urpc_chan *chan, struct fatfs_serv_mount *mt,
+                         struct fs_rpc_buffer *buffer, struct fs_batch_op *op,
+                         uint32_t *linked, struct fs_message *result) {
+    
+    errval_t err;
+    
+    // Open file for operations on a handle
+    struct fat_open_file *file;
+    
+    // Check that the operation's data is inside the shared buffer
+    if (op->buf_offset > buffer->size || op->bytes > buffer->size - op->buf_offset) {
+        return FS_ERR_BUF_BOUNDS;
+    }
+    uint8_t *data = buffer->buf + op->buf_offset;
+    
+    // Use the file opened by the previous operation if asked for
+    uint32_t handle = op->handle == FS_RPC_HANDLE_LINKED ? *linked : op->handle;
+    
+    size_t bytes = 0;
+    
+    switch (op->type) {
+        case FS_RPC_OP_OPEN:
+        case FS_RPC_OP_CREATE: {
+            
+            // The following operations get nothing if this fails
+            *linked = FS_RPC_HANDLE_LINKED;
+            
+            // Path (including '\0') has to be terminated inside its data
+            if (op->bytes == 0 || data[op->bytes - 1] != '\0') {
+                return FS_ERR_BUF_BOUNDS;
+            }
+            char *path = strndup((char *) data, op->bytes);
+            
+            // Open existing or create new file and return dirent
+            struct fat_dirent *dirent = NULL;
+            if (op->type == FS_RPC_OP_OPEN) {
+                err = fatfs_serv_open((void *) mt, path, &dirent);
+            }
+            else {
+                err = fatfs_serv_create((void *) mt, path, &dirent);
+                if (err_is_ok(err) && dirent != NULL) {
+                    fat_handle_touch(dirent->parent_cluster_nr, dirent->parent_pos);
+                }
+            }
+            
+            // Free path string
+            free(path);
+            
+            // The root directory has no dirent when opened as a file
+            if (err_is_ok(err) && dirent == NULL) {
+                err = FS_ERR_NOTFILE;
+            }
+            
+            // Open handle
+            if (err_is_ok(err)) {
+                err = fat_handle_open(chan, dirent, &handle);
+            }
+            
+            // Set handle and type
+            if (err_is_ok(err)) {
+                result->arg2 = handle;
+                result->arg3 = dirent->is_dir;
+                *linked = handle;
+            }
+            
+            free(dirent);
+            
+            break;
+            
+        }
+            
+        case FS_RPC_OP_CLOSE:
+            
+            // Close handle and write all dirty sectors back to the card
+            err = fat_handle_close(chan, handle);
+            if (err_is_ok(err)) {
+                err = fat_cache_flush();
+            }
+            
+            break;
+            
+        case FS_RPC_OP_READ:
+            
+            // Read dirent data straight into the shared buffer
+            err = fat_handle_get(chan, handle, &file);
+            if (err_is_ok(err)) {
+                err = read_dirent(&file->dirent, data, op->pos, op->bytes, &bytes);
+            }
+            
+            // Set bytes read
+            result->arg2 = bytes;
+            
+            break;
+            
+        case FS_RPC_OP_WRITE:
+            
+            // Write the shared buffer to dirent
+            err = fat_handle_get(chan, handle, &file);
+            if (err_is_ok(err)) {
+                err = write_dirent(&file->dirent, data, op->pos, op->bytes, &bytes);
+                fat_handle_touch(file->dirent.parent_cluster_nr, file->dirent.parent_pos);
+            }
+            
+            // Set bytes written
+            result->arg2 = bytes;
+            
+            break;
+            
+        case FS_RPC_OP_STAT:
+            
+            // Set size, type and version
+            err = fat_handle_get(chan, handle, &file);
+            if (err_is_ok(err)) {
+                result->arg2 = file->dirent.size;
+                result->arg3 = file->dirent.is_dir;
+                result->arg4 = fat_handle_version(file->dirent.parent_cluster_nr,
+                                                  file->dirent.parent_pos);
+            }
+            
+            break;
+            
+        case FS_RPC_OP_READDIR: {
+            
+            if (op->bytes < sizeof(struct fat_dirent)) {
+                return FS_ERR_BUF_BOUNDS;
+            }
+            
+            // Find dirent at the directory index
+            struct fat_dirent *ret_dirent = NULL;
+            err = fat_handle_get(chan, handle, &file);
+            if (err_is_ok(err)) {
+                err = fatfs_serv_readdir(file->dirent.first_cluster_nr, op->pos, &ret_dirent);
+            }
+            
+            // Copy it into the shared buffer
+            if (err_is_ok(err)) {
+                memcpy(data, ret_dirent, sizeof(struct fat_dirent));
+            }
+            
+            free(ret_dirent);
+            
+            break;
+            
+        }
+            
+        default:
+            err = VFS_ERR_NOT_SUPPORTED;
+            break;
+    }
+    
+    return err;
+    
+}
+
+// Run all operations of a batch in order and send their results to the client
+static void handle_batch(struct urpc_chan *chan, struct fatfs_serv_mount *mt,
+                         struct fs_rpc_buffer *buffer, uint8_t *recv_buffer, size_t recv_size) {
+    
+    errval_t err = SYS_ERR_OK;
+    
+    // Number of operations
+    size_t count = ((struct fs_message *) recv_buffer)->arg1;
+    struct fs_batch_op *ops = (struct fs_batch_op *) (recv_buffer + sizeof(struct fs_message));
+    
+    if (count > FS_RPC_BATCH_MAX ||
+        recv_size < sizeof(struct fs_message) + count * sizeof(struct fs_batch_op)) {
+        err = FS_ERR_BUF_BOUNDS;
+    }
+    else if (buffer == NULL) {
+        err = FS_ERR_BULK_NOT_INIT;
+    }
+    if (err_is_fail(err)) {
+        count = 0;
+    }
+    
+    // Size of send buffer
+    size_t send_size = sizeof(struct fs_message) * (count + 1);
+    
+    // Allocate send buffer
+    uint8_t *send_buffer = calloc(1, send_size);
+    if (send_buffer == NULL) {
+        
+        // Let the client know that the batch failed
+        struct fs_message send_msg = {
+            .arg1 = LIB_ERR_MALLOC_FAIL,
+            .arg2 = 0,
+            .arg3 = 0,
+            .arg4 = 0
+        };
+        urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_Batch);
+        
+        return;
+        
+    }
+    
+    struct fs_message *results = (struct fs_message *) (send_buffer + sizeof(struct fs_message));
+    
+    // Handle opened by the last open or create
+    uint32_t linked = FS_RPC_HANDLE_LINKED;
+    
+    for (size_t i = 0; i < count; i++) {
+        
+        // A linked operation is only run if the previous one succeeded
+        errval_t op_err;
+        if (i > 0 && (ops[i - 1].flags & FS_RPC_OP_LINK) && err_is_fail(results[i - 1].arg1)) {
+            op_err = FS_ERR_CANCELED;
+        }
+        else {
+            op_err = batch_op(chan, mt, buffer, &ops[i], &linked, &results[i]);
+        }
+        if (err_is_fail(op_err)) {
+#if PRINT_DEBUG
+            debug_printf("%s\n", err_getstring(op_err));
+#endif
+        }
+        
+        // Set error
+        results[i].arg1 = op_err;
+        
+    }
+    
+    // Set error and number of results
+    ((struct fs_message *) send_buffer)->arg1 = err;
+    ((struct fs_message *) send_buffer)->arg2 = count;
+    
+    // Send response message to client
+    urpc_send(chan, send_buffer, send_size, URPC_MessageType_Batch);
+    
+    // Free send buffer
+    free(send_buffer);
+    
+}
 
 static void handle_urpc_msg(struct urpc_chan *chan,
                             uint8_t *recv_buffer,
@@ -51,6 +402,12 @@ static void handle_urpc_msg(struct urpc_chan *chan,
     // Path for open and create
     char *path;
     
+    // Open file for requests on a handle
+    struct fat_open_file *file;
+    
+    // Shared data buffer of the client
+    struct fs_rpc_buffer *buffer = collections_list_find_if(buf_list, buffer_has_chan, chan);
+    
     // File system message
     struct fs_message send_msg = {
         .arg1 = 0,
@@ -61,89 +418,139 @@ static void handle_urpc_msg(struct urpc_chan *chan,
     
     switch (recv_msg_type) {
             
+        case URPC_MessageType_MapBuffer:
+#if PRINT_DEBUG
+            debug_printf("URPC Message Map Buffer Request!\n");
+#endif
+            // Create buffer unless the client already has one
+            if (buffer == NULL) {
+                err = buffer_create(chan, recv_msg->arg1);
+                if (err_is_fail(err)) {
+                    debug_printf("%s\n", err_getstring(err));
+                }
+            }
+            else {
+                err = FS_ERR_BULK_ALREADY_INIT;
+            }
+            
+            // Set error
+            send_msg.arg1 = err;
+            
+            // Send response message to client
+            urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_MapBuffer);
+            
+            break;
+            
+        case URPC_MessageType_Batch:
+#if PRINT_DEBUG
+            debug_printf("URPC Message Batch Request!\n");
+#endif
+            // Run operations and send results to client
+            handle_batch(chan, mt, buffer, recv_buffer, recv_size);
+            
+            break;
+            
         case URPC_MessageType_Open:
 #if PRINT_DEBUG
             debug_printf("URPC Message Open Request!\n");
 #endif
             // Copy path string from recieve buffer
             path = strdup((char *) (recv_buffer + sizeof(struct fs_message)));
-            //int flags = recv_msg->arg1;
             
             // Open existing file and return dirent
             err = fatfs_serv_open((void *) mt, path, &dirent);
             if (err_is_fail(err)) {
+#if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
+#endif
             }
             
             // Free path string
             free(path);
             
-            // Set err as argument 1 of send message
-            send_msg.arg1 = err;
-            
-            // Size of send buffer
-            send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
-            
-            // Allocate send buffer
-            send_buffer = calloc(1, send_size);
-            
-            // Copy fs_message into send buffer
-            memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
-            
-            // Copy dirent into send buffers
-            memcpy(send_buffer + sizeof(struct fs_message), dirent, sizeof(struct fat_dirent));
-            
-            // Send response message to client
-            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Open);
-            
-            // Free send buffer
-            free(send_buffer);
+            // Open handle and send it to client
+            send_handle(chan, err, dirent, URPC_MessageType_Open);
             
             break;
             
         case URPC_MessageType_Create:
 #if PRINT_DEBUG
-            debug_printf("URPC Message Creates Request!\n");
+            debug_printf("URPC Message Create Request!\n");
 #endif
+            // Copy path string from recieve buffer
             path = strdup((char *) (recv_buffer + sizeof(struct fs_message)));
-            //int flags = recv_msg->arg1;
             
-            // Create existing file and return dirent
+            // Create new file and return dirent
             err = fatfs_serv_create((void *) mt, path, &dirent);
+            if (err_is_ok(err) && dirent != NULL) {
+                fat_handle_touch(dirent->parent_cluster_nr, dirent->parent_pos);
+            }
             if (err_is_fail(err)) {
+#if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
+#endif
             }
             
             // Free path string
             free(path);
             
-            // Set err as argument 1 of send message
-            send_msg.arg1 = err;
+            // Open handle and send it to client
+            send_handle(chan, err, dirent, URPC_MessageType_Create);
             
-            // Size of send buffer
-            send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
-            
-            // Allocate send buffer
-            send_buffer = calloc(1, send_size);
+            break;
             
-            // Copy fs_message into send buffer
-            memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
+        case URPC_MessageType_Close:
+#if PRINT_DEBUG
+            debug_printf("URPC Message Close Request!\n");
+#endif
+            // Close handle and write all dirty sectors back to the card
+            err = fat_handle_close(chan, recv_msg->arg1);
+            if (err_is_ok(err)) {
+                err = fat_cache_flush();
+            }
+            if (err_is_fail(err)) {
+#if PRINT_DEBUG
+                debug_printf("%s\n", err_getstring(err));
+#endif
+            }
             
-            // Copy path (including '\0' into send buffers
-            memcpy(send_buffer + sizeof(struct fs_message), dirent, sizeof(struct fat_dirent));
+            // Set error
+            send_msg.arg1 = err;
             
             // Send response message to client
-            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Create);
-            
-            // Free send buffer
-            free(send_buffer);
+            urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_Close);
             
             break;
             
-        case URPC_MessageType_Close:
+        case URPC_MessageType_Sync:
 #if PRINT_DEBUG
-            debug_printf("URPC Message Close Request!\n");
+            debug_printf("URPC Message Sync Request!\n");
+#endif
+            // Release everything of a client that exits
+            if (recv_msg->arg1 == FS_RPC_SYNC_DETACH) {
+                fat_handle_close_all(chan);
+                buffer_destroy(chan);
+            }
+            
+            // Write all dirty sectors back to the card
+            err = fat_cache_flush();
+            if (err_is_fail(err)) {
+#if PRINT_DEBUG
+                debug_printf("%s\n", err_getstring(err));
 #endif
+            }
+            
+            // Set error
+            send_msg.arg1 = err;
+            
+            // Send response message to client
+            urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_Sync);
+            
+            // The client ID of an exiting client on the shared ring is reused
+            if (recv_msg->arg1 == FS_RPC_SYNC_DETACH && !chan->use_lmp) {
+                urpc_mpsc_release(&mpsc_serv, chan);
+            }
+            
             break;
             
         case URPC_MessageType_Read:
@@ -151,30 +558,22 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             debug_printf("URPC Message Read Request!\n");
 #endif
             // Set start and bytes
-            start = recv_msg->arg1;
-            bytes = recv_msg->arg2;
-            
-            // Copy from buffer into dirents
-            memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
+            start = recv_msg->arg2;
+            bytes = recv_msg->arg3;
             
-            // Update dirent size
-            err = update_dirent_size(dirent);
-            if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
-            }
             // Setup bytes that will be read
             size_t bytes_read = 0;
             
-            // Size of send buffer
-            send_size = sizeof(struct fs_message) + bytes;
-            
-            // Allocate send buffer
-            send_buffer = calloc(1, send_size);
+            // Get open file of handle
+            err = fat_handle_get(chan, recv_msg->arg1, &file);
+            if (err_is_ok(err) && buffer == NULL) {
+                err = FS_ERR_BULK_NOT_INIT;
+            }
             
-            // Read dirent data into buffer part of send buffer
-            err = read_dirent(dirent, send_buffer + sizeof(struct fs_message), start, bytes, &bytes_read);
+            // Read dirent data straight into the shared buffer
+            if (err_is_ok(err)) {
+                err = read_dirent(&file->dirent, buffer->buf, start, MIN(bytes, buffer->size), &bytes_read);
+            }
             if (err_is_fail(err)) {
 #if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
@@ -182,16 +581,13 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             }
             
             // Set error
-            ((struct fs_message *) send_buffer)->arg1 = err;
+            send_msg.arg1 = err;
             
             // Set bytes read
-            ((struct fs_message *) send_buffer)->arg2 = bytes_read;
+            send_msg.arg2 = bytes_read;
             
             // Send response message to client
-            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Read);
-            
-            // Free send buffer
-            free(send_buffer);
+            urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_Read);
             
             break;
             
@@ -200,48 +596,37 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             debug_printf("URPC Message Write Request!\n");
 #endif
             // Get start and bytes from arguments
-            start = recv_msg->arg1;
-            bytes = recv_msg->arg2;
-            
-            // Copy from receive buffer into dirent
-            memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
-            
-            // Update dirent size
-            err = update_dirent_size(dirent);
-            if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
-            }
+            start = recv_msg->arg2;
+            bytes = recv_msg->arg3;
             
             // Setup bytes that will be written
             size_t bytes_written = 0;
             
-            // Write buffer part of receive buffer to dirent
-            err = write_dirent(dirent, recv_buffer + sizeof(struct fs_message) + sizeof(struct fat_dirent), start, bytes, &bytes_written);
+            // Get open file of handle
+            err = fat_handle_get(chan, recv_msg->arg1, &file);
+            if (err_is_ok(err) && buffer == NULL) {
+                err = FS_ERR_BULK_NOT_INIT;
+            }
+            
+            // Write the shared buffer to dirent
+            if (err_is_ok(err)) {
+                err = write_dirent(&file->dirent, buffer->buf, start, MIN(bytes, buffer->size), &bytes_written);
+                fat_handle_touch(file->dirent.parent_cluster_nr, file->dirent.parent_pos);
+            }
             if (err_is_fail(err)) {
 #if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
 #endif
             }
             
-            // Size of send buffer
-            send_size = sizeof(struct fs_message) + bytes;
-            
-            // Allocate send buffer
-            send_buffer = calloc(1, send_size);
-            
             // Set error
-            ((struct fs_message *) send_buffer)->arg1 = err;
+            send_msg.arg1 = err;
             
             // Set bytes written
-            ((struct fs_message *) send_buffer)->arg2 = bytes_written;
+            send_msg.arg2 = bytes_written;
             
             // Send response message to client
-            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Write);
-            
-            // Free send buffer
-            free(send_buffer);
+            urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_Write);
             
             break;
             
@@ -251,41 +636,51 @@ static void handle_urpc_msg(struct urpc_chan *chan,
 #endif
 
             // Get bytes to be truncated from arguments
-            bytes = recv_msg->arg1;
+            bytes = recv_msg->arg2;
             
-            // Copy from receive buffer into dirents
-            memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
-      
-            // Update dirent size
-            err = update_dirent_size(dirent);
-            if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
-            }
+            // Get open file of handle
+            err = fat_handle_get(chan, recv_msg->arg1, &file);
             
             // Truncate dirent to size bytes
-            err = truncate_dirent(dirent, bytes);
+            if (err_is_ok(err)) {
+                err = truncate_dirent(&file->dirent, bytes);
+                fat_handle_touch(file->dirent.parent_cluster_nr, file->dirent.parent_pos);
+            }
             if (err_is_fail(err)) {
 #if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
 #endif
             }
             
-            // Size of send buffer
-            send_size = sizeof(struct fs_message);
+            // Set error
+            send_msg.arg1 = err;
             
-            // Allocate send buffer
-            send_buffer = calloc(1, send_size);
+            // Send response message to client
+            urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_Truncate);
+            
+            break;
+            
+        case URPC_MessageType_Stat:
+#if PRINT_DEBUG
+            debug_printf("URPC Message Stat Request!\n");
+#endif
+            // Get open file of handle
+            err = fat_handle_get(chan, recv_msg->arg1, &file);
+            if (err_is_ok(err)) {
+                
+                // Set size, type and version
+                send_msg.arg2 = file->dirent.size;
+                send_msg.arg3 = file->dirent.is_dir;
+                send_msg.arg4 = fat_handle_version(file->dirent.parent_cluster_nr,
+                                                   file->dirent.parent_pos);
+                
+            }
             
             // Set error
-            ((struct fs_message *) send_buffer)->arg1 = err;
+            send_msg.arg1 = err;
             
             // Send response message to client
-            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Truncate);
-            
-            // Free send buffer
-            free(send_buffer);
+            urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_Stat);
             
             break;
             
@@ -344,26 +739,33 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             // Free path string
             free(path);
             
-            // Set err as argument 1 of send message
-            send_msg.arg1 = err;
+            // Open handle and send it to client
+            send_handle(chan, err, dirent, URPC_MessageType_OpenDir);
             
-            // Size of send buffer
-            send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
+            // The root dirent belongs to the mount (the handle has a copy)
+            if (dirent == mt->root) {
+                dirent = NULL;
+            }
             
-            // Allocate send buffer
-            send_buffer = calloc(1, send_size);
+            break;
             
-            // Copy fs_message into send buffer
-            memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
+        case URPC_MessageType_CloseDir:
+#if PRINT_DEBUG
+            debug_printf("URPC Message Close Directory Request!\n");
+#endif
+            // Close handle
+            err = fat_handle_close(chan, recv_msg->arg1);
+            if (err_is_fail(err)) {
+#if PRINT_DEBUG
+                debug_printf("%s\n", err_getstring(err));
+#endif
+            }
             
-            // Copy dirent into send buffers
-            memcpy(send_buffer + sizeof(struct fs_message), dirent, sizeof(struct fat_dirent));
+            // Set error
+            send_msg.arg1 = err;
             
             // Send response message to client
-            urpc_send(chan, send_buffer, send_size, URPC_MessageType_OpenDir);
-            
-            // Free send buffer
-            free(send_buffer);
+            urpc_send(chan, (void *) &send_msg, sizeof(struct fs_message), URPC_MessageType_CloseDir);
             
             break;
             
@@ -372,18 +774,7 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             debug_printf("URPC Message Read Directory Request!\n");
 #endif
             // Set directory index
-            dir_index = recv_msg->arg1;
-            
-            // Copy from receive buffer into dirents
-            memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
-            
-            // Update dirent size
-            err = update_dirent_size(dirent);
-            if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
-            }
+            dir_index = recv_msg->arg2;
             
             // Size of send buffer
             send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
@@ -394,8 +785,13 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             // Allocate return dirent
             struct fat_dirent *ret_dirent = calloc(1, sizeof(struct fat_dirent));
             
+            // Get open directory of handle
+            err = fat_handle_get(chan, recv_msg->arg1, &file);
+            
             // Find dirent data
-            err = fatfs_serv_readdir(dirent->first_cluster_nr, dir_index, &ret_dirent);
+            if (err_is_ok(err)) {
+                err = fatfs_serv_readdir(file->dirent.first_cluster_nr, dir_index, &ret_dirent);
+            }
             if (err_is_fail(err)) {
 #if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
@@ -516,6 +912,16 @@ errval_t run_rpc_serv(void) {
     // Initialize channel list
     collections_list_create(&chan_list, free);
     
+    // Initialize buffer list
+    collections_list_create(&buf_list, free);
+    
+    // Initialize shared request ring
+    err = urpc_mpsc_server_init(&mpsc_serv);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
 //    domainid_t pid = 0;
 //    aos_rpc_process_spawn(aos_rpc_get_init_channel(), "filereader", 0, &pid);
     
@@ -541,7 +947,20 @@ errval_t run_rpc_serv(void) {
         // Accept a binding request from a client
         err = urpc_accept(new_chan);
         if (err_is_ok(err)) {
-            collections_list_insert(chan_list, new_chan);
+            
+            // UMP clients send their requests on the shared ring
+            if (new_chan->use_lmp) {
+                collections_list_insert(chan_list, new_chan);
+            }
+            else {
+                err = urpc_mpsc_accept(&mpsc_serv, new_chan);
+                if (err_is_fail(err)) {
+#if PRINT_DEBUG
+                    debug_printf("Error in urpc_mpsc_accept(): %s\n", err_getstring(err));
+#endif
+                }
+            }
+            
             new_chan = malloc(sizeof(struct urpc_chan));
             assert(new_chan);
         }
@@ -551,8 +970,28 @@ errval_t run_rpc_serv(void) {
 #endif
         }
         
-        // Iterate all bound URPC channels
+        // Handle all pending requests on the shared ring
         struct urpc_chan *chan;
+        while ((err = urpc_mpsc_recv(&mpsc_serv,
+                                     &chan,
+                                     (void **) &recv_buffer,
+                                     &recv_size,
+                                     &recv_msg_type)) == SYS_ERR_OK) {
+            
+            // Handle received message
+            handle_urpc_msg(chan, recv_buffer, recv_size, recv_msg_type, &mt);
+            
+            // Free receive buffer
+            free(recv_buffer);
+            
+        }
+        if (err != LIB_ERR_NO_URPC_MSG) {
+#if PRINT_DEBUG
+            debug_printf("Error in urpc_mpsc_recv(): %s\n", err_getstring(err));
+#endif
+        }
+        
+        // Iterate all bound LMP channels
         collections_list_traverse_start(chan_list);
         while ((chan = (struct urpc_chan *) collections_list_traverse_next(chan_list)) != NULL) {
             
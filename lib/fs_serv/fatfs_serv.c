@@ -9,14 +9,16 @@
 #include <aos/aos.h>
 
 #include <fs_serv/fat_helper.h>
+#include <fs_serv/fat_cache.h>
+#include <fs_serv/fat_extent.h>
+#include <fs_serv/fat_alloc.h>
+#include <fs_serv/fat_dcache.h>
+#include <fs_serv/fat_handle.h>
 
 #include <fs_serv/fatfs_serv.h>
 
 #define PRINT_DEBUG 0
 
-extern errval_t mmchs_read_block(size_t block_nr, void *buffer);
-extern errval_t mmchs_write_block(size_t block_nr, void *buffer);
-
 static void get_dot_dir_data(size_t cluster_nr, struct DIR_Entry *dir_data);
 static void get_dot_dot_dir_data(size_t cluster_nr, struct DIR_Entry *dir_data);
 
@@ -24,15 +26,15 @@ static void get_dot_dot_dir_data(size_t cluster_nr, struct DIR_Entry *dir_data);
 static void data_to_dir_data(struct DIR_Entry *dest, void *src);
 static void dir_data_to_data(void *dest, struct DIR_Entry *src);
 
-errval_t init_BPB(void) {
+errval_t init_BPB(struct blockdev *dev) {
     
     // Boot Sector and BPB Structure
     
     errval_t err;
     
-    uint8_t *data = calloc(512, sizeof(uint8_t));
+    uint8_t *data = calloc(dev->block_size, sizeof(uint8_t));
     
-    err = mmchs_read_block(0, data);
+    err = blockdev_read(dev, 0, 1, data);
     if (err_is_fail(err)) {
         assert(err_is_ok(err));
         debug_printf("%s\n", err_getstring(err));
@@ -135,6 +137,20 @@ errval_t init_BPB(void) {
  
     free(data);
     
+    // Initialize the sector cache now that the sector size is known
+    err = fat_cache_init(dev, BPB_BytsPerSec);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
+    // Build the free-cluster bitmap from the FAT
+    err = fat_alloc_init();
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
     return err;
     
 }
@@ -158,25 +174,18 @@ uint32_t getFATEntry(size_t n) {
     // FAT entry in that sector
     size_t ThisFATEnt = n % FATEntPerSec;
     
-    // Allocate buffer for FAT sector
-    uint32_t *buffer = calloc(FATEntPerSec, sizeof(uint32_t));
-    
-    // Read FAT sector
-    err = mmchs_read_block(ThisFATSecNum, buffer);
+    // Get FAT sector from the cache
+    uint32_t *buffer;
+    err = fat_cache_get(ThisFATSecNum, false, (void **) &buffer);
     if (err_is_fail(err)) {
-        free(buffer);
 #if PRINT_DEBUG
         debug_printf("%s\n", err_getstring(err));
 #endif
         return err;
     }
     
-    uint32_t value = buffer[ThisFATEnt] & 0x0FFFFFFF;
-    
-    free(buffer);
-    
     // Return entry in FAT with MSB masked out
-    return value;
+    return buffer[ThisFATEnt] & 0x0FFFFFFF;
     
 }
 
@@ -194,13 +203,10 @@ errval_t setFATEntry(size_t n, uint32_t value) {
     // FAT entry in that sector
     size_t ThisFATEnt = n % FATEntPerSec;
 
-    // Allocate buffer for FAT sector
-    uint32_t *buffer = calloc(FATEntPerSec, sizeof(uint32_t));
-
-    // Read FAT sector of SD card
-    err = mmchs_read_block(ThisFATSecNum, buffer);
+    // Get FAT sector from the cache, it is written back later
+    uint32_t *buffer;
+    err = fat_cache_get(ThisFATSecNum, true, (void **) &buffer);
     if (err_is_fail(err)) {
-        free(buffer);
 #if PRINT_DEBUG
         debug_printf("%s\n", err_getstring(err));
 #endif
@@ -210,18 +216,9 @@ errval_t setFATEntry(size_t n, uint32_t value) {
     // Change FAT entry to value without MSB
     buffer[ThisFATEnt] = buffer[ThisFATEnt] & 0xF0000000;
     buffer[ThisFATEnt] = buffer[ThisFATEnt] | value;
- 
-    // Write FAT sector back to SD card
-    err = mmchs_write_block(ThisFATSecNum, buffer);
-    if (err_is_fail(err)) {
-        free(buffer);
-#if PRINT_DEBUG
-        debug_printf("%s\n", err_getstring(err));
-#endif
-        return err;
-    }
     
-    free(buffer);
+    // Keep the free-cluster bitmap in sync
+    fat_alloc_update(n, value);
  
     return err;
  
@@ -489,99 +486,137 @@ errval_t fat_resolve_path(struct fat_dirent *root, char *path, struct fat_dirent
     
 }
 
-errval_t fat_find_dirent(struct fat_dirent *curr_dirent, char *name, struct fat_dirent **ret_dirent) {
+// Construct a dirent from a raw directory entry
+static struct fat_dirent *data_to_dirent(uint8_t *dirent_data, size_t parent_cluster_nr, size_t pos) {
     
-    errval_t err;
+    // Allocating memory for return dirent
+    struct fat_dirent *dirent = calloc(1, sizeof(struct fat_dirent));
+    
+    // Set size of dirent
+    dirent->size = *((uint32_t *) &dirent_data[28]);
+    
+    // Set name of dirent
+    memcpy(&dirent->name, &dirent_data[0], 11);
+    
+    // Set parent directory first cluster number
+    dirent->parent_cluster_nr = parent_cluster_nr;
+    
+    // Set position in parent directory
+    dirent->parent_pos = pos;
+    
+    // Set if dirent is a directory
+    dirent->is_dir = dirent_data[11] & 0x18;
+    
+    // Set first cluster number of dirent
+    dirent->first_cluster_nr = *((uint16_t *) &dirent_data[26]) | *((uint16_t *) &dirent_data[20]) << 16;
+    
+    return dirent;
+    
+}
 
-    assert(curr_dirent != NULL);
-    assert(ret_dirent != NULL);
+// Search a directory for fat_name and remember the result in the dentry cache
+static errval_t search_dir(size_t cluster_nr, char *fat_name, size_t *ret_pos, uint8_t *ret_data) {
     
-    // Converts name into fat directory name format (with max 8 + 3 size)
-    char *fat_name = convert_to_fat_name(name);
+    errval_t err;
     
     // Bytes per cluster
     uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
     
-    // Temporal cluster number
-    size_t temp_nr = curr_dirent->first_cluster_nr;
+    // Extent map to get the size of the directory
+    struct fat_extent_map *map;
+    err = fat_extent_get(cluster_nr, &map);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
     
-    // Indicates if End Of File is reached
-    bool isEOF = false;
+    // Number of directory entries
+    size_t slot_count = map->cluster_count * BytesPerClus / 32;
     
-    // Data buffer for the data of one cluster
-    uint8_t *data = calloc(1, BytesPerClus);
+    // Read the whole directory at once
+    uint8_t *data = malloc(slot_count * 32);
+    if (data == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    err = read_cluster_chain(cluster_nr, data, 0, slot_count * 32);
+    if (err_is_fail(err)) {
+        free(data);
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
     
-    for (int cluster_index = 0; !isEOF; cluster_index++) {
+    err = FAT_ERR_FAT_LOOKUP;
+    
+    for (size_t pos = 0; pos < slot_count; pos++) {
         
-        // Read data from cluster[temp_nr] in data section
-        err = read_cluster(temp_nr , (void *) data);
-        if (err_is_fail(err)) {
-            // Free converted FAT directory entry name
-            free(fat_name);
-            // Free data buffer
-            free(data);
-            
+        uint8_t *dirent_data = &data[pos * 32];
+        
+        if (memcmp(fat_name, &dirent_data[0], 11) == 0) {
 #if PRINT_DEBUG
-            debug_printf("%s\n", err_getstring(err));
+            debug_printf("SAME NAME\n");
 #endif
-            return err;
-        }
-        
-        for (int pos_index = 0; pos_index < BytesPerClus / 32; pos_index++) {
+            *ret_pos = pos;
+            memcpy(ret_data, dirent_data, 32);
             
-            uint8_t *dirent_data = &data[pos_index * 32];
+            err = SYS_ERR_OK;
             
-            if (memcmp(fat_name, &dirent_data[0], 11) == 0) {
-#if PRINT_DEBUG
-                debug_printf("SAME NAME\n");
-#endif
-                // Allocating memory for return dirent
-                struct fat_dirent *dirent = calloc(1, sizeof(struct fat_dirent));
-                
-                // Set size of dirent
-                dirent->size = *((uint32_t *) &dirent_data[28]);
-                
-                // Set name of dirent
-                memcpy(&dirent->name, &dirent_data[0], 11);
-                
-                // Set parent directory first cluster number
-                dirent->parent_cluster_nr = curr_dirent->first_cluster_nr;
-                
-                // Set position in parent directory
-                dirent->parent_pos = (cluster_index * BytesPerClus / 32) + pos_index;
-                
-                // Set if dirent is a directory
-                dirent->is_dir = dirent_data[11] & 0x18;
-                
-                // Set first cluster number of dirent
-                dirent->first_cluster_nr = *((uint16_t *) &dirent_data[26]) | *((uint16_t *) &dirent_data[20]) << 16;
-                
-                // Return newly allocated dirent
-                *ret_dirent = dirent;
-                
-                // Free data buffer
-                free(data);
-                
-                return SYS_ERR_OK;
-                
-            }
+            break;
             
         }
         
-        // Update temp_nr to be next cluster_nr and check if it is EOF
-        if (0x0FFFFFF8 <= (temp_nr = getFATEntry(temp_nr))) {
-            isEOF = true;
-        }
-        
     }
     
-    // Free converted FAT directory entry name
-    free(fat_name);
+    // Remember the result, found or not
+    fat_dcache_insert(cluster_nr, fat_name, *ret_pos, err_is_ok(err) ? ret_data : NULL);
+    
+    // Index large directories so that the next misses are cheap too
+    fat_dcache_index(cluster_nr, data, slot_count);
     
     // Free data buffer
     free(data);
     
-    return FAT_ERR_FAT_LOOKUP;
+    return err;
+    
+}
+
+errval_t fat_find_dirent(struct fat_dirent *curr_dirent, char *name, struct fat_dirent **ret_dirent) {
+    
+    errval_t err;
+
+    assert(curr_dirent != NULL);
+    assert(ret_dirent != NULL);
+    
+    // Converts name into fat directory name format (with max 8 + 3 size)
+    char fat_name[12];
+    convert_to_fat_name_buf(name, fat_name);
+    
+    // Parent directory first cluster number
+    size_t parent_cluster_nr = curr_dirent->first_cluster_nr;
+    
+    // Position and raw data of the directory entry
+    size_t pos = 0;
+    uint8_t dirent_data[32];
+    
+    // Try the dentry cache first and only search the directory on a miss
+    err = fat_dcache_lookup(parent_cluster_nr, fat_name, &pos, dirent_data);
+    if (err == FS_CACHE_NOTPRESENT) {
+        err = search_dir(parent_cluster_nr, fat_name, &pos, dirent_data);
+    }
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
+    
+    // Return newly allocated dirent
+    *ret_dirent = data_to_dirent(dirent_data, parent_cluster_nr, pos);
+    
+    return SYS_ERR_OK;
     
 }
 
@@ -874,6 +909,9 @@ errval_t set_dir_entry(size_t cluster_nr, size_t pos, struct DIR_Entry *dir_data
         return err;
     }
     
+    // Keep the dentry cache in sync
+    fat_dcache_update(cluster_nr, pos, data);
+    
     return err;
     
 }
@@ -963,6 +1001,12 @@ errval_t fatfs_rm_serv(void *st, char *path) {
         return FS_ERR_NOTFILE;
     }
 
+    // Open files cannot be removed
+    if (fat_handle_is_open(dirent->parent_cluster_nr, dirent->parent_pos)) {
+        free(dirent);
+        return FS_ERR_BUSY;
+    }
+
     // Remove dirent from directory and set FAT entries to zero
     err = remove_dirent(dirent);
     if (err_is_fail(err)) {
@@ -1014,6 +1058,12 @@ errval_t remove_dir_entry(size_t cluster_nr, size_t pos) {
         return err;
     }
     
+    // Keep the dentry cache in sync (only the free marker matters)
+    uint8_t removed_data[32];
+    memset(removed_data, 0, 32);
+    removed_data[0] = 0xE5;
+    fat_dcache_update(cluster_nr, pos, removed_data);
+    
     return err;
     
 }
@@ -1071,6 +1121,9 @@ errval_t set_dir_entry_size(size_t cluster_nr, size_t pos, size_t file_size) {
         return err;
     }
     
+    // Keep the dentry cache in sync
+    fat_dcache_update(cluster_nr, pos, (uint8_t *) data);
+    
     return err;
     
 }
@@ -1111,6 +1164,9 @@ errval_t add_dir_entry_size(size_t cluster_nr, size_t pos, int delta, size_t *re
         return err;
     }
     
+    // Keep the dentry cache in sync
+    fat_dcache_update(cluster_nr, pos, (uint8_t *) data);
+    
     // Return new file size
     *ret_size = file_size + delta;
     
@@ -1123,6 +1179,10 @@ errval_t remove_fat_entries(size_t cluster_nr) {
     
     errval_t err = SYS_ERR_OK;
     
+    // The chain is gone, so is its extent map and (for directories) its entries
+    fat_extent_invalidate(cluster_nr);
+    fat_dcache_invalidate_dir(cluster_nr);
+    
     // Current cluster number
     size_t curr_nr = cluster_nr;
     
@@ -1170,50 +1230,67 @@ errval_t remove_fat_entries_from(size_t cluster_nr, size_t start_index) {
     
     errval_t err = SYS_ERR_OK;
     
-    // Current cluster number
-    size_t curr_nr = cluster_nr;
+    // Removing the whole chain
+    if (start_index == 0) {
+        return remove_fat_entries(cluster_nr);
+    }
     
-    // Next cluster number
-    size_t next_nr;
+    struct fat_extent_map *map;
+    err = fat_extent_get(cluster_nr, &map);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
     
-    // End of file
-    bool isEOF = false;
+    // Nothing to remove
+    if (start_index >= map->cluster_count) {
+        return err;
+    }
     
-    // Set cluster chain entries in FAT to zero
-    for (int cluster_index = 0; !isEOF; cluster_index++) {
-        
-        // Set next cluster number to be next cluster number of current cluster number and check if it is EOC
-        if (0x0FFFFFF8 <= (next_nr = getFATEntry(curr_nr))) {
-            isEOF = true;
-        }
+    // Cluster that becomes the new end of the chain
+    size_t last_nr;
+    size_t run;
+    err = fat_extent_lookup(map, start_index - 1, &last_nr, &run);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Set FAT entries of all clusters from start_index on to zero
+    for (size_t cluster_index = start_index; cluster_index < map->cluster_count; ) {
         
-        // Check that current cluster number is not one of the first two special FAT entries
-        if (curr_nr < 2) {
-#if PRINT_DEBUG
-            debug_printf("Current cluster number is in first two special FAT entries\n");
-#endif
-            break;
+        size_t curr_nr;
+        err = fat_extent_lookup(map, cluster_index, &curr_nr, &run);
+        if (err_is_fail(err)) {
+            return err;
         }
         
-        // Only start setting FAT entries to zero when we have reached
-        if (start_index <= cluster_index) {
-            
-            // Set current cluster number FAT entry to zero
-            err = setFATEntry(curr_nr, 0);
+        for (size_t i = 0; i < run; i++) {
+            err = setFATEntry(curr_nr + i, 0);
             if (err_is_fail(err)) {
 #if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
 #endif
                 return err;
             }
-
         }
         
-        // Update current cluster number to next cluster number
-        curr_nr = next_nr;
+        cluster_index += run;
         
     }
     
+    // Mark the new end of the chain
+    err = setFATEntry(last_nr, 0x0FFFFFFF);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
+    
+    fat_extent_truncate(map, start_index);
+    
     return err;
     
 }
@@ -1229,27 +1306,18 @@ errval_t read_dirent(struct fat_dirent *dirent, void *buffer, size_t start, size
     assert(dirent != NULL);
     assert(bytes_read != NULL);
 
-    // Current file size
-    size_t file_size;
-    
-    // Get the current file size from parent directory entry
-    err = get_dir_entry_size(dirent->parent_cluster_nr, dirent->parent_pos, &file_size);
-    if (err_is_fail(err)) {
-#if PRINT_DEBUG
-        debug_printf("%s\n", err_getstring(err));
-#endif
-        return err;
-    }
+    // Current file size (the dirent of an open file is authoritative)
+    size_t file_size = dirent->size;
     
     // Check if requested region start is in file bounds
     if (start >= file_size) {
         *bytes_read = 0;
-        return err;
+        return SYS_ERR_OK;
     }
     
     // Check if entire requested region in file bounds and if not shorten it
     if (start + bytes > file_size) {
-        bytes = (start + bytes) - file_size;
+        bytes = file_size - start;
     }
     
     //assert(start + bytes <= file_size);
@@ -1277,26 +1345,20 @@ errval_t write_dirent(struct fat_dirent *dirent, void *buffer, size_t start, siz
     assert(dirent != NULL);
     assert(bytes_written != NULL);
     
-    // Current file size
-    size_t file_size;
-    
-    // Get the current file size from parent directory entry
-    err = get_dir_entry_size(dirent->parent_cluster_nr, dirent->parent_pos, &file_size);
-    if (err_is_fail(err)) {
-#if PRINT_DEBUG
-        debug_printf("%s\n", err_getstring(err));
-#endif
-        return err;
-    }
+    // Current file size (the dirent of an open file is authoritative)
+    size_t file_size = dirent->size;
     
     // Current data buffer
     uint8_t *data = buffer;
     
+    // Size of zeroed out data written in front of the buffer
+    size_t zero_size = 0;
+    
     // Check if requested region start is in file bounds and add padding if required
     if (start > file_size) {
  
         // Size of zeroed out data to be written
-        size_t zero_size = start - file_size;
+        zero_size = start - file_size;
         
         // Allocate data buffer to encapsulate zeros padding in the front
         data = calloc(1, zero_size + bytes);
@@ -1331,6 +1393,12 @@ errval_t write_dirent(struct fat_dirent *dirent, void *buffer, size_t start, siz
     
     // Write data to cluster chain region
     err = write_cluster_chain(dirent->first_cluster_nr, data, start, bytes);
+    
+    // Free padded data buffer
+    if (data != buffer) {
+        free(data);
+    }
+    
     if (err_is_fail(err)) {
 #if PRINT_DEBUG
         debug_printf("%s\n", err_getstring(err));
@@ -1350,8 +1418,11 @@ errval_t write_dirent(struct fat_dirent *dirent, void *buffer, size_t start, siz
         return err;
     }
     
-    // Return actual bytes written (can be more due to padding)
-    *bytes_written = bytes;
+    // Update dirent size
+    dirent->size = file_size;
+    
+    // Return bytes written from the caller's buffer (padding excluded)
+    *bytes_written = bytes - zero_size;
     
     return err;
     
@@ -1402,6 +1473,9 @@ errval_t truncate_dirent(struct fat_dirent *dirent, size_t bytes) {
         
     }
     
+    // Update dirent size
+    dirent->size = bytes;
+    
     return err;
     
 }
@@ -1412,58 +1486,50 @@ errval_t truncate_dirent(struct fat_dirent *dirent, size_t bytes) {
 
 errval_t read_cluster(size_t cluster_nr, void *buffer) {
     
-    errval_t err = SYS_ERR_OK;
+    return read_clusters(cluster_nr, 1, buffer);
+    
+}
+
+errval_t write_cluster(size_t cluster_nr, void *buffer) {
+    
+    return write_clusters(cluster_nr, 1, buffer);
+    
+}
+
+errval_t read_clusters(size_t cluster_nr, size_t count, void *buffer) {
+    
+    errval_t err;
     
     // Sector number of cluster that occupies the data
     size_t sector_nr = getFirstSectorOfCluster(cluster_nr);
     
-    // Temporal buffer
-    uint8_t *temp_buffer = buffer;
-    
-    for (int i = 0; i < BPB_SecPerClus; i++) {
-        
-        // Read part of cluster and write it to buffer
-        err = mmchs_read_block(sector_nr + i, temp_buffer);
-        if (err_is_fail(err)) {
+    // Read all sectors of the clusters (missing ones with multi-block reads)
+    err = fat_cache_read_range(sector_nr, count * BPB_SecPerClus, buffer);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("%s\n", err_getstring(err));
+        debug_printf("%s\n", err_getstring(err));
 #endif
-            return err;
-        }
-        
-        // Update temporal buffer
-        temp_buffer += BPB_BytsPerSec;
-        
+        return err;
     }
     
     return err;
     
 }
 
-errval_t write_cluster(size_t cluster_nr, void *buffer) {
+errval_t write_clusters(size_t cluster_nr, size_t count, void *buffer) {
     
-    errval_t err = SYS_ERR_OK;
+    errval_t err;
     
     // Sector number of cluster that occupies the data
     size_t sector_nr = getFirstSectorOfCluster(cluster_nr);
     
-    // Temporal buffer
-    uint8_t *temp_buffer = buffer;
-    
-    for (int i = 0; i < BPB_SecPerClus; i++) {
-        
-        // Write back part of buffer
-        err = mmchs_write_block(sector_nr + i, temp_buffer);
-        if (err_is_fail(err)) {
+    // Write all sectors of the clusters into the cache
+    err = fat_cache_write_range(sector_nr, count * BPB_SecPerClus, buffer);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("%s\n", err_getstring(err));
+        debug_printf("%s\n", err_getstring(err));
 #endif
-            return err;
-        }
-        
-        // Update temporal buffer
-        temp_buffer += BPB_BytsPerSec;
-
+        return err;
     }
     
     return err;
@@ -1477,11 +1543,22 @@ errval_t read_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size_
     
     errval_t err = SYS_ERR_OK;
     
+    if (bytes == 0) {
+        return err;
+    }
+    
     // Bytes per cluster
     uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
     
-    // Temporal cluster number
-    size_t temp_nr = cluster_nr;
+    // Extent map of the cluster chain
+    struct fat_extent_map *map;
+    err = fat_extent_get(cluster_nr, &map);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
     
     // Temporal buffer of data to be read from cluster chain
     uint8_t *temp_buf = buffer;
@@ -1492,83 +1569,87 @@ errval_t read_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size_
     // Index of last cluster that covers requested region (inclusive)
     size_t end_index = (start + bytes - 1) / BytesPerClus;
     
-    // Offset for first cluster that covers requested region
-    size_t offset;
+    // Data buffer for partially read clusters
+    uint8_t *data = NULL;
     
-    // Carryover for last cluster that covers requested region
-    size_t carryover;
+    // Current cluster number and contiguous clusters left in its run
+    size_t temp_nr = 0;
+    size_t run = 0;
     
-    // Data buffer for the data of one cluster
-    uint8_t data[BytesPerClus];
+    for (size_t cluster_index = start_index; cluster_index <= end_index; cluster_index++) {
+        
+        // Translate the cluster index when leaving a run
+        if (run == 0) {
+            err = fat_extent_lookup(map, cluster_index, &temp_nr, &run);
+            if (err_is_fail(err)) {
 #if PRINT_DEBUG
-    debug_printf("start_index: %zu end_index: %zu\n", start_index, end_index);
+                debug_printf("Input range was too big for file\n");
 #endif
-    bool isEOF = false;
-    
-    int cluster_index;
-    
-    for (cluster_index = 0; !isEOF && cluster_index <= end_index; cluster_index++) {
+                break;
+            }
+        }
+        
+        // Region of this cluster that is requested
+        size_t cluster_start = cluster_index * BytesPerClus;
+        size_t offset = MAX(start, cluster_start) - cluster_start;
+        size_t copy_size = MIN(start + bytes, cluster_start + BytesPerClus) - cluster_start - offset;
         
-        if (start_index <= cluster_index && cluster_index <= end_index) {
+        // Number of clusters transferred in this iteration
+        size_t n = 1;
+        
+        if (copy_size == BytesPerClus) {
             
-            // Set offset if first cluster that covers requested region
-            if (cluster_index == start_index) {
-                offset = start % BytesPerClus;
-            } else {
-                offset = 0;
+            // Extend over the following whole clusters of the same run
+            while (n < run && (cluster_index + n + 1) * BytesPerClus <= start + bytes) {
+                n++;
             }
+            copy_size = n * BytesPerClus;
             
-            // Set carryover if last cluster that covers requested region
-            if (cluster_index == end_index) {
-                carryover = BytesPerClus - ((start + bytes) % BytesPerClus);
-            } else {
-                carryover = 0;
-            }
-#if PRINT_DEBUG
-            debug_printf("offset: %zu carryover: %zu\n", offset, carryover);
-#endif
-            // Actual bytes that are copied fron data to temp_buf
-            size_t copy_size = BytesPerClus - offset - carryover;
-
-            // Read data from cluster[temp_nr] in data section
-            err = read_cluster(temp_nr, (void *) data);
-            if (err_is_fail(err)) {
-                debug_printf("%s\n", err_getstring(err));
-                return err;
-            }
+            // Read whole clusters directly into the buffer
+            err = read_clusters(temp_nr, n, temp_buf);
             
-            //debug_printf("Copy size %zu\n", copy_size);
+        } else {
             
-            // Copy data from data (with offset) into temp_buf
-            memcpy(temp_buf, data + offset, copy_size);
+            if (data == NULL) {
+                data = malloc(BytesPerClus);
+                if (data == NULL) {
+                    err = LIB_ERR_MALLOC_FAIL;
+                    break;
+                }
+            }
             
-            // Increment temp_buf pointer by the amount of data copied over
-            temp_buf += copy_size;
+            // Read data from cluster[temp_nr] in data section
+            err = read_cluster(temp_nr, data);
+            if (err_is_ok(err)) {
+                
+                // Copy data from data (with offset) into temp_buf
+                memcpy(temp_buf, data + offset, copy_size);
+                
+            }
             
         }
-        
-        // Update temp_nr to be next cluster_nr and check if it is EOF
-        if (0x0FFFFFF8 <= (temp_nr = getFATEntry(temp_nr))) {
-#if PRINT_DEBUG
-            debug_printf("is EOF\n");
-#endif
-            isEOF = true;
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            break;
         }
-#if PRINT_DEBUG
-        debug_printf("temp_nr: %zu\n", temp_nr);
-#endif
+        
+        // Increment temp_buf pointer by the amount of data copied over
+        temp_buf += copy_size;
+        
+        // Next cluster of the run
+        temp_nr += n;
+        run -= n;
+        cluster_index += n - 1;
+        
     }
     
-    if (isEOF && !(cluster_index > end_index)) {
-#if PRINT_DEBUG
-        debug_printf("Input range was too big for file\n");
-        return FAT_ERR_CLUSTER_BOUNDS;
-#endif
-    } else {
+    free(data);
+    
 #if PRINT_DEBUG
+    if (err_is_ok(err)) {
         debug_printf("Successfully read file with starting cluster %zu in range [%zu,%zu]\n", cluster_nr, start, start + bytes - 1);
-#endif
     }
+#endif
     
     return err;
 
@@ -1578,13 +1659,24 @@ errval_t write_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size
     
     errval_t err = SYS_ERR_OK;
     
+    if (bytes == 0) {
+        return err;
+    }
+    
     // Bytes per cluster
     uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
     
-    // Temporal cluster number
-    size_t temp_nr = cluster_nr;
+    // Extent map of the cluster chain
+    struct fat_extent_map *map;
+    err = fat_extent_get(cluster_nr, &map);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
     
-    // Temporal buffer of data to be read from cluster chain
+    // Temporal buffer of data to be written to cluster chain
     uint8_t *temp_buf = buffer;
     
     // Index of first cluster that covers requested region
@@ -1593,97 +1685,95 @@ errval_t write_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size
     // Index of last cluster that covers requested region (inclusive)
     size_t end_index = (start + bytes - 1) / BytesPerClus;
     
-    // Offset for first cluster that covers requested region
-    size_t offset;
+    // Data buffer for partially written clusters
+    uint8_t *data = NULL;
     
-    // Carryover for last cluster that covers requested region
-    size_t carryover;
+    // Current cluster number and contiguous clusters left in its run
+    size_t temp_nr = 0;
+    size_t run = 0;
     
-    // Data buffer for the data of one cluster
-    uint8_t *data = calloc(1, BytesPerClus);
-    
-    bool isEOF = false;
-
-    int cluster_index;
-    
-    for (cluster_index = 0; !isEOF && cluster_index <= end_index; cluster_index++) {
+    for (size_t cluster_index = start_index; cluster_index <= end_index; cluster_index++) {
         
-        if (start_index <= cluster_index && cluster_index <= end_index) {
-            
-            // Set offset if first cluster that covers requested region
-            if (cluster_index == start_index) {
-                offset = start % BytesPerClus;
-            } else {
-                offset = 0;
+        // Translate the cluster index when leaving a run
+        if (run == 0) {
+            err = fat_extent_lookup(map, cluster_index, &temp_nr, &run);
+            if (err_is_fail(err)) {
+#if PRINT_DEBUG
+                debug_printf("Input range was too big for file\n");
+#endif
+                break;
             }
+        }
+        
+        // Region of this cluster that is written
+        size_t cluster_start = cluster_index * BytesPerClus;
+        size_t offset = MAX(start, cluster_start) - cluster_start;
+        size_t copy_size = MIN(start + bytes, cluster_start + BytesPerClus) - cluster_start - offset;
+#if PRINT_DEBUG
+        debug_printf("offset: %zu copy_size: %zu\n", offset, copy_size);
+#endif
+        
+        // Number of clusters transferred in this iteration
+        size_t n = 1;
+        
+        if (copy_size == BytesPerClus) {
             
-            // Set carryover if last cluster that covers requested region
-            if (cluster_index == end_index) {
-                carryover = BytesPerClus - ((start + bytes) % BytesPerClus);
-            } else {
-                carryover = 0;
+            // Extend over the following whole clusters of the same run
+            while (n < run && (cluster_index + n + 1) * BytesPerClus <= start + bytes) {
+                n++;
             }
+            copy_size = n * BytesPerClus;
             
-            // Actual bytes that are copied fron temp_buf to data
-            size_t copy_size = BytesPerClus - offset - carryover;
+            // Write whole clusters directly from the buffer
+            err = write_clusters(temp_nr, n, temp_buf);
             
-            // Copy previously stored data into data buffer if not entire cluster is overwritten
-            if (copy_size < BytesPerClus) {
-                
-                // Read data from cluster[temp_nr] in data section
-                err = read_cluster(temp_nr, (void *) data);
-                if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                    debug_printf("%s\n", err_getstring(err));
-#endif
-                    return err;
+        } else {
+            
+            if (data == NULL) {
+                data = malloc(BytesPerClus);
+                if (data == NULL) {
+                    err = LIB_ERR_MALLOC_FAIL;
+                    break;
                 }
-                
             }
-#if PRINT_DEBUG
-            debug_printf("offset: %zu carryover: %zu copy_size: %zu\n", offset, carryover, copy_size);
-#endif
             
-            // Copy data from temp_buf into data (with offset)
-            memcpy(data + offset, temp_buf, copy_size);
+            // Merge with the previously stored data of the cluster
+            err = read_cluster(temp_nr, data);
+            if (err_is_ok(err)) {
+                
+                // Copy data from temp_buf into data (with offset)
+                memcpy(data + offset, temp_buf, copy_size);
+                
+                // Write data to cluster[temp_nr] in data section
+                err = write_cluster(temp_nr, data);
+                
+            }
             
-            // Write data to cluster[temp_nr] in data section
-            err = write_cluster(temp_nr, (void *) data);
-            if (err_is_fail(err)) {
-                // Free data
-                free(data);
+        }
+        if (err_is_fail(err)) {
 #if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
+            debug_printf("%s\n", err_getstring(err));
 #endif
-                return err;
-            }
-            
-            // Increment temp_buf pointer by the amount of data copied over
-            temp_buf += copy_size;
-            
+            break;
         }
         
-        // Update temp_nr to be next cluster_nr and check if it is EOF
-        if (0x0FFFFFF8 <= (temp_nr = getFATEntry(temp_nr))) {
-            isEOF = true;
-        }
+        // Increment temp_buf pointer by the amount of data copied over
+        temp_buf += copy_size;
+        
+        // Next cluster of the run
+        temp_nr += n;
+        run -= n;
+        cluster_index += n - 1;
         
     }
     
-    if (isEOF && cluster_index < end_index) {
-#if PRINT_DEBUG
-        debug_printf("Input range was too big for file\n");
-#endif
-        return FAT_ERR_CLUSTER_BOUNDS;
-        
-    } else {
+    free(data);
+    
 #if PRINT_DEBUG
+    if (err_is_ok(err)) {
         debug_printf("Successfully write file with starting cluster %zu in range [%zu,%zu]\n", cluster_nr, start, start + bytes - 1);
-#endif
     }
-    
-    // Free data
-    free(data);
+#endif
     
     return err;
     
@@ -1694,22 +1784,10 @@ uint32_t find_free_fat_entry_and_set(size_t start_search_entry, uint32_t value)
     
     errval_t err;
     
-    // Set it search entry to start with at least to 2
-    if (start_search_entry < 2) {
-        start_search_entry = 2;
-    }
-    
-    // Number of FAT entries that fit into one sector
-    size_t FATEntPerSec = BPB_BytsPerSec/sizeof(uint32_t);
-
-    // Buffer for FAT sector
-    uint32_t *buffer = calloc(FATEntPerSec, sizeof(uint32_t));
-    
-    // FAT sector that contains nth entry
-    size_t ThisFATSecNum = BPB_ResvdSecCnt + (start_search_entry / FATEntPerSec);
-    
-    // Read new FAT sector into buffer
-    err = mmchs_read_block(ThisFATSecNum, buffer);
+    // Look up a free cluster in the free-cluster bitmap
+    size_t free_nr;
+    size_t count;
+    err = fat_alloc_find(start_search_entry, 1, &free_nr, &count);
     if (err_is_fail(err)) {
 #if PRINT_DEBUG
         debug_printf("%s\n", err_getstring(err));
@@ -1717,96 +1795,44 @@ uint32_t find_free_fat_entry_and_set(size_t start_search_entry, uint32_t value)
         return -1;
     }
     
-    // FAT entry in that sector
-    size_t ThisFATEnt = start_search_entry % FATEntPerSec;
-
-    for (int n = start_search_entry; n < FATEntPerSec * FATSz; n++) {
-        
-        if (n % FATEntPerSec == 0) {
-            
-            // Update FAT sector that contains nth entry
-            ThisFATSecNum = BPB_ResvdSecCnt + (n / FATEntPerSec);
-            
-            // Read new FAT sector into buffer
-            err = mmchs_read_block(ThisFATSecNum, buffer);
-            if (err_is_fail(err)) {
-                free(buffer);
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
-                return -1;
-            }
-            
-        }
-        
-        // Update FAT entry in that sector
-        ThisFATEnt = n % FATEntPerSec;
-
-        if ((n >= 2) && (buffer[ThisFATEnt] == 0)) {
-            
-            // Change FAT entry to value without MSB
-            buffer[ThisFATEnt] = buffer[ThisFATEnt] & 0xF0000000;
-            buffer[ThisFATEnt] = buffer[ThisFATEnt] | value;
-
-            // Write new FAT sector with changed free entry back
-            err = mmchs_write_block(ThisFATSecNum, buffer);
-            if (err_is_fail(err)) {
-                free(buffer);
+    // Change FAT entry to value without MSB (written back later)
+    err = setFATEntry(free_nr, value);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
+        debug_printf("%s\n", err_getstring(err));
 #endif
-                return -1;
-            }
-            
-            free(buffer);
-            
-            return n;
-            
-        }
-        
+        return -1;
     }
     
-    free(buffer);
-    
-    // Couldn't find a free FAT entry
-    return -1;
+    return free_nr;
     
 }
 
 
 errval_t append_cluster_chain(size_t cluster_nr, size_t cluster_count) {
     
-    errval_t err;
-    
-    assert(cluster_count > 0);
-    
-    // Current cluster number
-    size_t curr_nr = cluster_nr;
-    
-    // Next cluster number
-    size_t next_nr;
-    
-    // End of file
-    bool isEOF = false;
+    errval_t err = SYS_ERR_OK;
     
-    // Set cluster chain entries in FAT to zero
-    while(!isEOF) {
-        
-        // Set next cluster number to be next cluster number of current cluster number and check if it is EOC
-        if (0x0FFFFFF8 <= (next_nr = getFATEntry(curr_nr))) {
-            isEOF = true;
-        }
-        
-        // Check that current cluster number is not one of the first two special FAT entries
-        if (next_nr < 2) {
+    // Extent map of the cluster chain
+    struct fat_extent_map *map;
+    err = fat_extent_get(cluster_nr, &map);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("Current cluster number is in first two special FAT entries\n");
+        debug_printf("%s\n", err_getstring(err));
 #endif
-            break;
-        }
+        return err;
+    }
+    
+    // Current cluster number (end of the chain)
+    size_t curr_nr = fat_extent_last(map);
+    
+    // Append cluster_count clusters to the end of the cluster chain
+    while (cluster_count > 0) {
         
-        // Set current cluster number FAT entry to zero
-        err = setFATEntry(curr_nr, 0);
+        // Reserve a run of free clusters, preferably right after the end
+        size_t run_nr;
+        size_t run_count;
+        err = fat_alloc_find(curr_nr + 1, cluster_count, &run_nr, &run_count);
         if (err_is_fail(err)) {
 #if PRINT_DEBUG
             debug_printf("%s\n", err_getstring(err));
@@ -1814,40 +1840,22 @@ errval_t append_cluster_chain(size_t cluster_nr, size_t cluster_count) {
             return err;
         }
         
-        // Update current cluster number to next cluster number
-        curr_nr = next_nr;
-        
-    }
-    
-    // Entry to start searching for the next free FAT entry
-    size_t free_entry = 0;
-    
-    // Append cluster_count clusters to the end of the cluster chain
-    for (int i = 0; i < cluster_count; i++) {
-        
-        // Find a free FAT entry and set it to value 0x0FFFFFFF
-        next_nr = find_free_fat_entry_and_set(free_entry, 0x0FFFFFFF);
-        if (next_nr == -1) {
+        // Link the run internally and terminate it
+        for (size_t i = 0; i < run_count; i++) {
+            
+            uint32_t next_nr = (i + 1 < run_count) ? run_nr + i + 1 : 0x0FFFFFFF;
+            err = setFATEntry(run_nr + i, next_nr);
+            if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("FAT full! Couldn't find a free entry...\n");
+                debug_printf("%s\n", err_getstring(err));
 #endif
-            return FAT_ERR_FAT_LOOKUP;
-        }
-        
-        // Update entry to start searching for the next free FAT entry
-        free_entry = next_nr + 1;
-        
-        /*
-        // Mark this FAT entry as taken
-        err = setFATEntry(next_nr, 0x0FFFFFFF);
-        if (err_is_fail(err)) {
-            debug_printf("%s\n", err_getstring(err));
-            return err;
+                return err;
+            }
+            
         }
-        */
         
-        // Let current FAT entry point to next (previously free) FAT entry
-        err = setFATEntry(curr_nr, next_nr);
+        // Let current end of the chain point to the run
+        err = setFATEntry(curr_nr, run_nr);
         if (err_is_fail(err)) {
 #if PRINT_DEBUG
             debug_printf("%s\n", err_getstring(err));
@@ -1855,8 +1863,18 @@ errval_t append_cluster_chain(size_t cluster_nr, size_t cluster_count) {
             return err;
         }
         
-        // Update current cluster number to next cluster number
-        curr_nr = next_nr;
+        // Record the new clusters in the extent map
+        for (size_t i = 0; i < run_count; i++) {
+            err = fat_extent_append(map, run_nr + i);
+            if (err_is_fail(err)) {
+                fat_extent_invalidate(cluster_nr);
+                return err;
+            }
+        }
+        
+        // Update current cluster number to the end of the run
+        curr_nr = run_nr + run_count - 1;
+        cluster_count -= run_count;
         
     }
     
@@ -2227,6 +2245,11 @@ errval_t fatfs_serv_rmdir(void *st, char *path) {
         return FS_ERR_NOTDIR;
     }
     
+    // Open directories cannot be removed
+    if (fat_handle_is_open(dirent->parent_cluster_nr, dirent->parent_pos)) {
+        return FS_ERR_BUSY;
+    }
+    
     // Directory entry count
     size_t dir_count = 0;
     
@@ -100,5 +100,14 @@ struct mem_region *multiboot_find_module(struct bootinfo *bi, const char *name)
         }
     }
 
+    // Fall back to a compressed module (name.gz)
+    size_t len = strlen(name);
+    if (len < 3 || strcmp(name + len - 3, ".gz") != 0) {
+        char gzname[len + 4];
+        memcpy(gzname, name, len);
+        memcpy(gzname + len, ".gz", 4);
+        return multiboot_find_module(bi, gzname);
+    }
+
     return NULL;
 }
@@ -7,14 +7,17 @@
 #include <aos/dispatcher_arch.h>
 #include <barrelfish_kpi/paging_arm_v7.h>
 #include <barrelfish_kpi/domain_params.h>
+#include <barrelfish_kpi/asm_inlines_arch.h>
 #include <spawn/multiboot.h>
 #include <aos/lmp.h>
 #include <aos/waitset.h>
 
+#include "spawn_internal.h"
+
 extern struct bootinfo *bi;
 
 
-static void add_parent_mapping(struct spawninfo *si, void *addr) {
+void add_parent_mapping(struct spawninfo *si, void *addr) {
     // Check if parent_mappings exists
     struct parent_mapping *mapping = (struct parent_mapping *) malloc(sizeof(struct parent_mapping));
     if (si->parent_mappings == NULL) {
@@ -159,6 +162,9 @@ static errval_t spawn_setup_lmp_channel(struct spawninfo *si) {
 
     // Allocate and initialize lmp channel
     si->pi->lc = (struct lmp_chan *) malloc(sizeof(struct lmp_chan));
+    if (si->pi->lc == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
 
     // Open channel to messages
     err = lmp_chan_accept(si->pi->lc, LMP_RECV_LENGTH, NULL_CAP);
@@ -210,6 +216,7 @@ static errval_t spawn_setup_vspace(struct spawninfo *si) {
     if (err_is_fail(err)) {
         return err;
     }
+    si->child_vspace_frame_caps[0] = paging_state_frame_cap;
     
     // Allocate two frames for the child's paging state slab allocators
     struct capref slab_frame_1_cap;
@@ -220,30 +227,31 @@ static errval_t spawn_setup_vspace(struct spawninfo *si) {
     if (err_is_fail(err)) {
         return err;
     }
+    si->child_vspace_frame_caps[1] = slab_frame_1_cap;
     err = frame_alloc(&slab_frame_2_cap, slab_frame_2_size, &slab_frame_2_size);
     if (err_is_fail(err)) {
         return err;
     }
+    si->child_vspace_frame_caps[2] = slab_frame_2_cap;
     
     // Map the frames into parent's virtual address space
+    // (unmapped again after the spawn)
     err = paging_map_frame(get_current_paging_state(), (void **) &si->child_paging_state, paging_state_frame_size, paging_state_frame_cap, NULL, NULL);
     if (err_is_fail(err)) {
         return err;
     }
+    add_parent_mapping(si, si->child_paging_state);
     void *slab_frame_1_addr;
     err = paging_map_frame(get_current_paging_state(), (void **) &slab_frame_1_addr, slab_frame_1_size, slab_frame_1_cap, NULL, NULL);
     if (err_is_fail(err)) {
         return err;
     }
+    add_parent_mapping(si, slab_frame_1_addr);
     void *slab_frame_2_addr;
     err = paging_map_frame(get_current_paging_state(), (void **) &slab_frame_2_addr, slab_frame_2_size, slab_frame_2_cap, NULL, NULL);
     if (err_is_fail(err)) {
         return err;
     }
-    
-    // Unmap these frames later PF
-    add_parent_mapping(si, si->child_paging_state);
-    add_parent_mapping(si, slab_frame_1_addr);
     add_parent_mapping(si, slab_frame_2_addr);
     
     
@@ -622,18 +630,212 @@ static errval_t spawn_cleanup(struct spawninfo *si) {
     return err;
 }
 
-// TODO(M2): Implement this function such that it starts a new process
-// TODO(M4): Build and pass a messaging channel to your child process
-errval_t spawn_load_by_name(void *cmd,
-                            struct spawninfo *si,
-                            domainid_t terminal_pid) {
+// Account the cycles since the end of the previous phase to `phase`
+static inline void spawn_trace_phase(uint32_t *cycles, enum spawn_phase phase,
+                                     uint32_t *last) {
+    uint32_t now = get_cycle_count();
+    cycles[phase] = now - *last;
+    *last = now;
+}
+
+// Set up everything that does not depend on the binary: cspace, lmp channel
+// and vspace (including the child's paging state and slab frames)
+static errval_t spawn_setup_skeleton(struct spawninfo *si, uint32_t *cycles,
+                                     uint32_t *last) {
+    
+    errval_t err;
+    
+    si->pi = (struct process_info *) calloc(1, sizeof(struct process_info));
+    if (si->pi == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    // Set up cspace
+    err = spawn_setup_cspace(si);
+    if (err_is_fail(err)) {
+        debug_printf("spawn: Failed setting up cspace: %s\n", err_getstring(err));
+        return err;
+    }
+    spawn_trace_phase(cycles, SpawnPhase_Cspace, last);
+
+    // Set up lmp channel
+    err = spawn_setup_lmp_channel(si);
+    if (err_is_fail(err)) {
+        debug_printf("spawn: Failed setting up lmp channel: %s\n", err_getstring(err));
+        return err;
+    }
+    spawn_trace_phase(cycles, SpawnPhase_LmpChannel, last);
+
+    // Set up vspace
+    err = spawn_setup_vspace(si);
+    if (err_is_fail(err)) {
+        debug_printf("spawn: Failed setting up vspace: %s\n", err_getstring(err));
+        return err;
+    }
+    spawn_trace_phase(cycles, SpawnPhase_Vspace, last);
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Release a skeleton whose setup failed part way (si was zeroed before)
+static void spawn_teardown_skeleton(struct spawninfo *si) {
+    
+    // Parent mappings of the vspace
+    struct parent_mapping *mapping = si->parent_mappings;
+    while (mapping != NULL) {
+        struct parent_mapping *next = mapping->next;
+        paging_unmap(get_current_paging_state(), mapping->addr);
+        free(mapping);
+        mapping = next;
+    }
+    si->parent_mappings = NULL;
+    
+    // The child's cspace and vspace go away with its L1 cnode and pagetable
+    if (!capref_is_null(si->child_root_pt_cap)) {
+        cap_destroy(si->child_root_pt_cap);
+    }
+    if (!capref_is_null(si->child_rootcn_cap)) {
+        cap_destroy(si->child_rootcn_cap);
+    }
+    if (!capref_is_null(si->child_dispatcher_cap)) {
+        cap_destroy(si->child_dispatcher_cap);
+    }
+    for (size_t i = 0; i < ARRAY_LENGTH(si->child_vspace_frame_caps); i++) {
+        if (!capref_is_null(si->child_vspace_frame_caps[i])) {
+            cap_destroy(si->child_vspace_frame_caps[i]);
+        }
+    }
+    
+    if (si->pi == NULL) {
+        return;
+    }
+    
+    // The lmp channel exists once its endpoint was created
+    struct lmp_chan *lc = si->pi->lc;
+    if (lc != NULL) {
+        if (lc->endpoint != NULL) {
+            lmp_chan_deregister_recv(lc);
+            if (!capref_is_null(lc->endpoint->recv_slot)) {
+                slot_free(lc->endpoint->recv_slot);
+            }
+            lmp_chan_destroy(lc);
+        }
+        free(lc);
+    }
+    
+    free(si->pi);
+    si->pi = NULL;
+    
+}
+
+
+// Pre-built skeletons ready to be turned into processes
+struct spawn_skeleton {
+    struct spawninfo si;
+    struct spawn_skeleton *next;
+};
+
+// Maximum number of refills skipped after failed builds
+#define SPAWN_POOL_BACKOFF_MAX  1024
+
+static struct spawn_skeleton *pool_list = NULL;
+static size_t pool_count = 0;
+static size_t pool_target = 0;
+
+// Refills left to skip after a failed build, doubles with every failure
+static size_t pool_backoff = 0;
+static size_t pool_backoff_next = 1;
+
+// Set the number of skeletons the pool keeps ready
+void spawn_pool_init(size_t target) {
+    pool_target = target;
+}
+
+// Build one skeleton if the pool is not full
+errval_t spawn_pool_refill(void) {
+    
+    errval_t err;
+    
+    if (pool_count >= pool_target) {
+        return SYS_ERR_OK;
+    }
+    
+    // Give memory a chance to come back after a failed build
+    if (pool_backoff > 0) {
+        pool_backoff--;
+        return SYS_ERR_OK;
+    }
+    
+    struct spawn_skeleton *skel = (struct spawn_skeleton *) calloc(1, sizeof(struct spawn_skeleton));
+    if (skel == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    // Skeleton builds are not traced
+    uint32_t cycles[SpawnPhase_Count];
+    uint32_t last = get_cycle_count();
+    
+    err = spawn_setup_skeleton(&skel->si, cycles, &last);
+    if (err_is_fail(err)) {
+        // Retry later with the partially built skeleton released
+        spawn_teardown_skeleton(&skel->si);
+        free(skel);
+        pool_backoff = pool_backoff_next;
+        pool_backoff_next = MIN(pool_backoff_next * 2, SPAWN_POOL_BACKOFF_MAX);
+        return err;
+    }
+    
+    pool_backoff_next = 1;
+    
+    skel->next = pool_list;
+    pool_list = skel;
+    pool_count++;
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Move a pooled skeleton into si, returns false if the pool is empty
+static bool spawn_pool_take(struct spawninfo *si) {
+    
+    struct spawn_skeleton *skel = pool_list;
+    if (skel == NULL) {
+        return false;
+    }
+    
+    pool_list = skel->next;
+    pool_count--;
+    
+    // Keep the binary name of the spawn in progress
+    char *binary_name = si->binary_name;
+    *si = skel->si;
+    si->binary_name = binary_name;
+    
+    free(skel);
+    
+    return true;
+    
+}
+
+// Start a child process from the boot image (src == NULL) or from an image
+// source. Fills in si
+static errval_t spawn_load(void *cmd,
+                           struct spawninfo *si,
+                           domainid_t terminal_pid,
+                           struct spawn_image_source *src) {
     //printf("spawn start_child: starting: %s\n", binary_name);
 
     errval_t err = SYS_ERR_OK;
 
+    // Phase timing
+    uint32_t cycles[SpawnPhase_Count];
+    spawn_trace_init();
+    uint32_t start = get_cycle_count();
+    uint32_t last = start;
+
     // Init spawninfo
     memset(si, 0, sizeof(*si));
-    si->pi = (struct process_info *) malloc(sizeof(struct process_info));
     
     // Extract binary name
     si->binary_name = malloc(strlen((char *) cmd));
@@ -659,59 +861,115 @@ errval_t spawn_load_by_name(void *cmd,
     // - Setup environment
     // - Make dispatcher runnable
 
-    // Finding the memory region containing the ELF image
-    struct mem_region *mem = multiboot_find_module(bi, si->binary_name);
-    if (!mem) {
-        return SPAWN_ERR_FIND_MODULE;
+    struct mem_region *mem = NULL;
+    char *path = NULL;
+    
+    if (src == NULL) {
+        
+        // Finding the memory region containing the ELF image
+        mem = multiboot_find_module(bi, si->binary_name);
+        if (!mem) {
+            return SPAWN_ERR_FIND_MODULE;
+        }
+        
+    } else {
+        
+        // Keep the path for the image cache and name the process after the file
+        path = si->binary_name;
+        char *base = strrchr(path, '/');
+        si->binary_name = strdup(base != NULL ? base + 1 : path);
+        if (!si->binary_name) {
+            free(path);
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        
     }
 
-    // Constructing the capability for the frame containing the ELF image
-    struct capref child_frame = {
-        .cnode = cnode_module,
-        .slot = mem->mrmod_slot
-    };
-
-    // Mapping the ELF image into the virtual address space
-    void *elf_buf = NULL;
-    err = paging_map_frame_attr(get_current_paging_state(), &elf_buf, mem->mrmod_size, child_frame, VREGION_FLAGS_READ, NULL, NULL);
-    if (err_is_fail(err)) {
-        debug_printf("spawn: Failed mapping ELF into virtual memory: %s\n", err_getstring(err));
-        return err;
+    // Take a pre-built cspace, lmp channel and vspace or build them now
+    if (spawn_pool_take(si)) {
+        // Account the hand-over to the cspace phase
+        cycles[SpawnPhase_LmpChannel] = 0;
+        cycles[SpawnPhase_Vspace] = 0;
+        spawn_trace_phase(cycles, SpawnPhase_Cspace, &last);
+    } else {
+        err = spawn_setup_skeleton(si, cycles, &last);
+        if (err_is_fail(err)) {
+            spawn_teardown_skeleton(si);
+            free(path);
+            return err;
+        }
     }
 
-    // Add mapping to parent mappings list
-    add_parent_mapping(si, elf_buf);
-
-    char *elf = elf_buf;
-    //debug_printf("Mapped ELF into memory: 0x%x %c%c%c\n", elf[0], elf[1], elf[2], elf[3]);
-    assert(elf[0] == 0x7f && elf[1] == 'E' && elf[2] == 'L' && elf[3] == 'F');
-
-    // Set up cspace
-    err = spawn_setup_cspace(si);
-    if (err_is_fail(err)) {
-        debug_printf("spawn: Failed setting up cspace: %s\n", err_getstring(err));
-        return err;
-    }
+    if (src == NULL) {
+        
+        // Constructing the capability for the frame containing the ELF image
+        struct capref child_frame = {
+            .cnode = cnode_module,
+            .slot = mem->mrmod_slot
+        };
+
+        // Mapping the ELF image into the virtual address space
+        void *elf_buf = NULL;
+        err = paging_map_frame_attr(get_current_paging_state(), &elf_buf, mem->mrmod_size, child_frame, VREGION_FLAGS_READ, NULL, NULL);
+        if (err_is_fail(err)) {
+            debug_printf("spawn: Failed mapping ELF into virtual memory: %s\n", err_getstring(err));
+            return err;
+        }
 
-    // Set up lmp channel
-    err = spawn_setup_lmp_channel(si);
-    if (err_is_fail(err)) {
-        debug_printf("spawn: Failed setting up lmp channel: %s\n", err_getstring(err));
-        return err;
-    }
+        // Add mapping to parent mappings list
+        add_parent_mapping(si, elf_buf);
 
-    // Set up vspace
-    err = spawn_setup_vspace(si);
-    if (err_is_fail(err)) {
-        debug_printf("spawn: Failed setting up vspace: %s\n", err_getstring(err));
-        return err;
-    }
-    
-    // Parse the elf
-    err = spawn_parse_elf(si, elf_buf, mem->mrmod_size);
-    if (err_is_fail(err)) {
-        debug_printf("spawn: Failed to parse the ELF: %s\n", err_getstring(err));
-        return err;
+        spawn_trace_phase(cycles, SpawnPhase_MapElf, &last);
+        
+        if (spawn_gzip_check(elf_buf, mem->mrmod_size)) {
+            
+            // Inflate the compressed module into the child (or use the image cache)
+            struct spawn_image_source gzip_src;
+            err = spawn_gzip_source_init(&gzip_src, elf_buf, mem->mrmod_size);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            err = spawn_image_load(si, si->binary_name, &gzip_src);
+            spawn_gzip_source_free(&gzip_src);
+            if (err_is_fail(err)) {
+                debug_printf("spawn: Failed to load the compressed ELF: %s\n", err_getstring(err));
+                return err;
+            }
+            
+        } else {
+            
+            char *elf = elf_buf;
+            //debug_printf("Mapped ELF into memory: 0x%x %c%c%c\n", elf[0], elf[1], elf[2], elf[3]);
+            assert(elf[0] == 0x7f && elf[1] == 'E' && elf[2] == 'L' && elf[3] == 'F');
+            
+            // Parse the elf (lazily if the module asks for it)
+            if (spawn_lazy_check(mem)) {
+                err = spawn_lazy_load(si, mem, elf_buf, mem->mrmod_size);
+            } else {
+                err = spawn_parse_elf(si, elf_buf, mem->mrmod_size);
+            }
+            if (err_is_fail(err)) {
+                debug_printf("spawn: Failed to parse the ELF: %s\n", err_getstring(err));
+                return err;
+            }
+            
+        }
+        spawn_trace_phase(cycles, SpawnPhase_ParseElf, &last);
+        
+    } else {
+        
+        // Nothing to map, segments are streamed into the child's frames
+        spawn_trace_phase(cycles, SpawnPhase_MapElf, &last);
+        
+        // Load the ELF from the image source (or the image cache)
+        err = spawn_image_load(si, path, src);
+        free(path);
+        if (err_is_fail(err)) {
+            debug_printf("spawn: Failed to load the ELF: %s\n", err_getstring(err));
+            return err;
+        }
+        spawn_trace_phase(cycles, SpawnPhase_ParseElf, &last);
+        
     }
     
     // Check terminal PID
@@ -729,6 +987,7 @@ errval_t spawn_load_by_name(void *cmd,
     
     // Commit fixed vspace allocations
     paging_alloc_fixed_commit(si->child_paging_state);
+    spawn_trace_phase(cycles, SpawnPhase_Dispatcher, &last);
     
     // Get arguments string from multiboot
     //const char *argstring = multiboot_module_opts(mem);
@@ -742,6 +1001,7 @@ errval_t spawn_load_by_name(void *cmd,
     
     // Move all L2 cnode capabilities to the cild's cspace
     spawn_recursive_child_l2_tree_walk(si, si->child_paging_state->l2_tree_root, 1);
+    spawn_trace_phase(cycles, SpawnPhase_Args, &last);
     
     // Launch dispatcher 🚀
     err = spawn_invoke_dispatcher(si);
@@ -749,6 +1009,7 @@ errval_t spawn_load_by_name(void *cmd,
         debug_printf("spawn: Failed invoking the dispatcher: %s\n", err_getstring(err));
         return err;
     }
+    spawn_trace_phase(cycles, SpawnPhase_Invoke, &last);
 
     // Cleanup 
     err = spawn_cleanup(si);
@@ -756,6 +1017,27 @@ errval_t spawn_load_by_name(void *cmd,
         debug_printf("spawn: Failed cleanup: %s\n", err_getstring(err));
         return err;
     }
+    spawn_trace_phase(cycles, SpawnPhase_Cleanup, &last);
+
+    // Aggregate the timings of this spawn
+    cycles[SpawnPhase_Total] = last - start;
+    spawn_trace_record(si->binary_name, cycles);
 
     return err;
 }
+
+// TODO(M2): Implement this function such that it starts a new process
+// TODO(M4): Build and pass a messaging channel to your child process
+errval_t spawn_load_by_name(void *cmd,
+                            struct spawninfo *si,
+                            domainid_t terminal_pid) {
+    return spawn_load(cmd, si, terminal_pid, NULL);
+}
+
+// Start a child process from an image source (e.g. a file). Fills in si
+errval_t spawn_load_by_source(void *cmd,
+                              struct spawninfo *si,
+                              domainid_t terminal_pid,
+                              struct spawn_image_source *src) {
+    return spawn_load(cmd, si, terminal_pid, src);
+}
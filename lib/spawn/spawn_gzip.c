@@ -0,0 +1,156 @@
+//
+//  spawn_gzip.c
+//  DoritOS
+//
+//  Image source for gzip-compressed boot modules. The module is inflated
+//  sequentially straight into the frames of the child, seeking backwards
+//  restarts the stream from the beginning.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <zlib.h>
+
+#include "spawn_internal.h"
+
+#define SPAWN_GZIP_SCRATCH_SIZE     BASE_PAGE_SIZE
+
+// State of a gzip image source
+struct spawn_gzip_state {
+    z_stream strm;
+    bool active;                // Whether strm is initialized
+    const uint8_t *data;        // Compressed module
+    size_t data_size;
+    size_t pos;                 // Uncompressed bytes produced so far
+};
+
+// Discarded output while skipping forward
+static uint8_t scratch[SPAWN_GZIP_SCRATCH_SIZE];
+
+
+// Start inflating from the beginning of the module
+static errval_t spawn_gzip_restart(struct spawn_gzip_state *st) {
+    
+    if (st->active) {
+        inflateEnd(&st->strm);
+        st->active = false;
+    }
+    
+    memset(&st->strm, 0, sizeof(z_stream));
+    st->strm.next_in = (Bytef *) st->data;
+    st->strm.avail_in = st->data_size;
+    
+    // Expect a gzip header
+    if (inflateInit2(&st->strm, 16 + MAX_WBITS) != Z_OK) {
+        return SPAWN_ERR_LOAD;
+    }
+    
+    st->active = true;
+    st->pos = 0;
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Inflate the next bytes of the image into buf
+static errval_t spawn_gzip_inflate(struct spawn_gzip_state *st, void *buf,
+                                   size_t bytes) {
+    
+    st->strm.next_out = (Bytef *) buf;
+    st->strm.avail_out = bytes;
+    
+    while (st->strm.avail_out > 0) {
+        
+        int ret = inflate(&st->strm, Z_NO_FLUSH);
+        
+        if (ret == Z_STREAM_END && st->strm.avail_out > 0) {
+            return ELF_ERR_FILESZ;
+        }
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            return SPAWN_ERR_LOAD;
+        }
+        
+    }
+    
+    st->pos += bytes;
+    
+    return SYS_ERR_OK;
+    
+}
+
+static errval_t spawn_gzip_fill(void *state, struct capref frame,
+                                void *frame_addr, size_t frame_offset,
+                                size_t image_offset, size_t bytes) {
+    
+    errval_t err;
+    
+    struct spawn_gzip_state *st = (struct spawn_gzip_state *) state;
+    
+    // Streams can only move forward
+    if (!st->active || image_offset < st->pos) {
+        err = spawn_gzip_restart(st);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    
+    // Skip to the requested offset
+    while (st->pos < image_offset) {
+        err = spawn_gzip_inflate(st, scratch,
+                                 MIN(SPAWN_GZIP_SCRATCH_SIZE, image_offset - st->pos));
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    
+    // Inflate straight into the frame
+    return spawn_gzip_inflate(st, frame_addr + frame_offset, bytes);
+    
+}
+
+// Check for the gzip magic bytes
+bool spawn_gzip_check(const void *buf, size_t size) {
+    
+    const uint8_t *bytes = (const uint8_t *) buf;
+    
+    return size >= 18 && bytes[0] == 0x1f && bytes[1] == 0x8b;
+    
+}
+
+// Create an image source for a mapped gzip-compressed module
+errval_t spawn_gzip_source_init(struct spawn_image_source *src,
+                                const void *buf, size_t size) {
+    
+    struct spawn_gzip_state *st = (struct spawn_gzip_state *) calloc(1, sizeof(struct spawn_gzip_state));
+    if (st == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    st->data = (const uint8_t *) buf;
+    st->data_size = size;
+    
+    // The uncompressed size (mod 2^32) is stored little endian in the trailer
+    const uint8_t *isize = st->data + size - 4;
+    src->size = isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((uint32_t) isize[3] << 24);
+    src->version = 1;           // Boot modules never change
+    src->fill = spawn_gzip_fill;
+    src->state = (void *) st;
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Release the state of a gzip image source
+void spawn_gzip_source_free(struct spawn_image_source *src) {
+    
+    struct spawn_gzip_state *st = (struct spawn_gzip_state *) src->state;
+    
+    if (st->active) {
+        inflateEnd(&st->strm);
+    }
+    
+    free(st);
+    
+}
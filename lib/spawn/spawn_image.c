@@ -0,0 +1,495 @@
+//
+//  spawn_image.c
+//  DoritOS
+//
+//  Streaming ELF loader for images that are not plain boot modules. Only the
+//  headers are copied into init, every PT_LOAD segment is filled by the
+//  image source directly into the frame that backs it in the child. The
+//  segments of recently loaded images are cached: read-only segments are
+//  shared with later children, writable segments are kept as pristine copies.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <elf/elf.h>
+
+#include "spawn_internal.h"
+
+#define PRINT_DEBUG 0
+
+#define SPAWN_IMAGE_CACHE_SIZE      4
+#define SPAWN_IMAGE_MAX_SEGMENTS    8
+
+
+// A loaded PT_LOAD segment
+struct spawn_image_segment {
+    lvaddr_t base;              // Page aligned base address in the child
+    size_t size;                // Size of the frame
+    uint32_t flags;             // ELF segment flags
+    struct capref frame;        // Shared frame (read-only) or pristine copy (writable)
+    void *addr;                 // Mapping of the pristine copy in init
+};
+
+// A cached image
+struct spawn_image {
+    char *path;                 // NULL if the entry is unused
+    size_t size;
+    uint32_t version;           // Version of the source
+    genvaddr_t entry_addr;
+    void *got_addr;
+    size_t segment_count;
+    struct spawn_image_segment segments[SPAWN_IMAGE_MAX_SEGMENTS];
+    uint32_t last_use;
+};
+
+static struct spawn_image image_cache[SPAWN_IMAGE_CACHE_SIZE];
+static uint32_t image_clock = 0;
+
+
+// MARK: - Cache
+
+// Find the cached image for path, size and version
+static struct spawn_image *spawn_image_cache_lookup(const char *path, size_t size,
+                                                    uint32_t version) {
+    
+    for (size_t i = 0; i < SPAWN_IMAGE_CACHE_SIZE; i++) {
+        struct spawn_image *image = &image_cache[i];
+        if (image->path != NULL && image->size == size &&
+            image->version == version && !strcmp(image->path, path)) {
+            image->last_use = ++image_clock;
+            return image;
+        }
+    }
+    
+    return NULL;
+    
+}
+
+// Release a cache entry
+static void spawn_image_cache_evict(struct spawn_image *image) {
+    
+    for (size_t i = 0; i < image->segment_count; i++) {
+        
+        struct spawn_image_segment *seg = &image->segments[i];
+        
+        // Shared frames stay mapped in the children, only drop pristine copies
+        if (seg->addr != NULL) {
+            paging_unmap(get_current_paging_state(), seg->addr);
+            cap_delete(seg->frame);
+            slot_free(seg->frame);
+        }
+        
+    }
+    
+    free(image->path);
+    memset(image, 0, sizeof(struct spawn_image));
+    
+}
+
+// Get a free cache entry, evicting the least recently used one if necessary
+static struct spawn_image *spawn_image_cache_alloc(void) {
+    
+    struct spawn_image *victim = &image_cache[0];
+    
+    for (size_t i = 0; i < SPAWN_IMAGE_CACHE_SIZE; i++) {
+        if (image_cache[i].path == NULL) {
+            return &image_cache[i];
+        }
+        if (image_cache[i].last_use < victim->last_use) {
+            victim = &image_cache[i];
+        }
+    }
+    
+    spawn_image_cache_evict(victim);
+    
+    return victim;
+    
+}
+
+
+// MARK: - Loading
+
+// Read a small part of the image (headers) into a newly allocated buffer
+static errval_t spawn_image_read(struct spawn_image_source *src, size_t offset,
+                                 size_t bytes, void **ret) {
+    
+    errval_t err;
+    
+    if (offset + bytes > src->size) {
+        return ELF_ERR_FILESZ;
+    }
+    
+    // Let the source fill a temporary frame
+    struct capref frame_cap;
+    size_t frame_size;
+    err = frame_alloc(&frame_cap, bytes, &frame_size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    void *addr;
+    err = paging_map_frame(get_current_paging_state(), &addr, frame_size,
+                           frame_cap, NULL, NULL);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    err = src->fill(src->state, frame_cap, addr, 0, offset, bytes);
+    if (err_is_ok(err)) {
+        *ret = malloc(bytes);
+        if (*ret == NULL) {
+            err = LIB_ERR_MALLOC_FAIL;
+        } else {
+            memcpy(*ret, addr, bytes);
+        }
+    }
+    
+    paging_unmap(get_current_paging_state(), addr);
+    cap_delete(frame_cap);
+    slot_free(frame_cap);
+    
+    return err;
+    
+}
+
+// Find the address of the .got section
+static errval_t spawn_image_find_got(struct spawn_image_source *src,
+                                     struct Elf32_Ehdr *ehdr,
+                                     struct Elf32_Phdr *phdrs, void **got_addr) {
+    
+    errval_t err;
+    
+    size_t shdrs_size = ehdr->e_shnum * sizeof(struct Elf32_Shdr);
+    if (ehdr->e_shoff == 0 || ehdr->e_shstrndx >= ehdr->e_shnum ||
+        ehdr->e_shoff + shdrs_size > src->size) {
+        return ELF_ERR_HEADER;
+    }
+    
+    // The section headers and their name table (GNU ld puts it in front of
+    // the headers) follow the segments, read everything after the segments
+    // at once so a streamed source never has to go back
+    size_t start = ehdr->e_shoff;
+    for (size_t i = 0; i < ehdr->e_phnum; i++) {
+        if (phdrs[i].p_type == PT_LOAD) {
+            start = MAX(start, phdrs[i].p_offset + phdrs[i].p_filesz);
+        }
+    }
+    start = MIN(start, ehdr->e_shoff);
+    
+    uint8_t *tail;
+    err = spawn_image_read(src, start, src->size - start, (void **) &tail);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Copy the section headers out in case they are not aligned in the tail
+    struct Elf32_Shdr *shdrs = malloc(shdrs_size);
+    if (shdrs == NULL) {
+        free(tail);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    memcpy(shdrs, tail + ehdr->e_shoff - start, shdrs_size);
+    
+    // Find the section name string table, only unusual layouts put it
+    // before the tail
+    struct Elf32_Shdr *strtab = &shdrs[ehdr->e_shstrndx];
+    char *names;
+    if (strtab->sh_offset >= start && strtab->sh_offset + strtab->sh_size <= src->size) {
+        names = (char *) tail + strtab->sh_offset - start;
+    } else {
+        free(tail);
+        err = spawn_image_read(src, strtab->sh_offset, strtab->sh_size,
+                               (void **) &tail);
+        if (err_is_fail(err)) {
+            free(shdrs);
+            return err;
+        }
+        names = (char *) tail;
+    }
+    
+    err = ELF_ERR_HEADER;
+    for (size_t i = 0; i < ehdr->e_shnum; i++) {
+        if (shdrs[i].sh_name < strtab->sh_size &&
+            !strncmp(names + shdrs[i].sh_name, ".got", strtab->sh_size - shdrs[i].sh_name)) {
+            *got_addr = (void *) shdrs[i].sh_addr;
+            err = SYS_ERR_OK;
+            break;
+        }
+    }
+    
+    free(tail);
+    free(shdrs);
+    
+    return err;
+    
+}
+
+// Map a segment frame into the child's vspace
+static errval_t spawn_image_map_child(struct spawninfo *si,
+                                      struct spawn_image_segment *seg,
+                                      struct capref frame) {
+    
+    paging_alloc_fixed(si->child_paging_state, (void *) seg->base, seg->size);
+    
+    return paging_map_fixed_attr(si->child_paging_state, seg->base, frame,
+                                 seg->size, seg->flags);
+    
+}
+
+// Load one PT_LOAD segment, streaming the file data into the child's frame
+static errval_t spawn_image_load_segment(struct spawninfo *si,
+                                         struct spawn_image_source *src,
+                                         struct Elf32_Phdr *phdr,
+                                         struct spawn_image_segment *seg,
+                                         struct capref *ret_frame,
+                                         void **ret_addr) {
+    
+    errval_t err;
+    
+    if (phdr->p_filesz > phdr->p_memsz ||
+        phdr->p_offset + phdr->p_filesz > src->size) {
+        return ELF_ERR_PROGHDR;
+    }
+    
+    // Aligning to page boundry in child's virtual memory
+    seg->base = ROUND_DOWN(phdr->p_vaddr, BASE_PAGE_SIZE);
+    size_t offset = phdr->p_vaddr - seg->base;
+    seg->flags = phdr->p_flags;
+    
+    // Allocating memory for the segment
+    err = frame_alloc(ret_frame, offset + phdr->p_memsz, &seg->size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Map the frame into parent virtual address space
+    err = paging_map_frame_attr(get_current_paging_state(), ret_addr, seg->size,
+                                *ret_frame, VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Add mapping to parent mappings list
+    add_parent_mapping(si, *ret_addr);
+    
+    // Zero the parts that are not backed by the file
+    memset(*ret_addr, 0, offset);
+    memset(*ret_addr + offset + phdr->p_filesz, 0,
+           seg->size - offset - phdr->p_filesz);
+    
+    // Stream the file data directly into the frame
+    if (phdr->p_filesz > 0) {
+        err = src->fill(src->state, *ret_frame, *ret_addr, offset,
+                        phdr->p_offset, phdr->p_filesz);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    
+    return spawn_image_map_child(si, seg, *ret_frame);
+    
+}
+
+// Load an image that is not cached yet and cache it if possible
+static errval_t spawn_image_load_source(struct spawninfo *si, const char *path,
+                                        struct spawn_image_source *src) {
+    
+    errval_t err;
+    
+    // Read and check the ELF header
+    struct Elf32_Ehdr *ehdr;
+    err = spawn_image_read(src, 0, sizeof(struct Elf32_Ehdr), (void **) &ehdr);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    if (!IS_ELF(*ehdr) || ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+        ehdr->e_machine != EM_ARM ||
+        ehdr->e_phentsize != sizeof(struct Elf32_Phdr)) {
+        free(ehdr);
+        return ELF_ERR_HEADER;
+    }
+    
+    // Read the program headers
+    struct Elf32_Phdr *phdrs;
+    err = spawn_image_read(src, ehdr->e_phoff,
+                           ehdr->e_phnum * sizeof(struct Elf32_Phdr),
+                           (void **) &phdrs);
+    if (err_is_fail(err)) {
+        free(ehdr);
+        return err;
+    }
+    
+    si->entry_addr = ehdr->e_entry;
+    
+    // Only cache images whose segments all fit into an entry
+    size_t load_count = 0;
+    for (size_t i = 0; i < ehdr->e_phnum; i++) {
+        if (phdrs[i].p_type == PT_LOAD) {
+            load_count++;
+        }
+    }
+    struct spawn_image *image = NULL;
+    if (load_count <= SPAWN_IMAGE_MAX_SEGMENTS && src->version != 0) {
+        image = spawn_image_cache_alloc();
+    }
+    
+    struct spawn_image_segment seg;
+    for (size_t i = 0; i < ehdr->e_phnum; i++) {
+        
+        if (phdrs[i].p_type != PT_LOAD) {
+            continue;
+        }
+        
+        struct capref frame;
+        void *addr;
+        err = spawn_image_load_segment(si, src, &phdrs[i], &seg, &frame, &addr);
+        if (err_is_fail(err)) {
+            break;
+        }
+        
+        if (image == NULL) {
+            continue;
+        }
+        
+        if (!(seg.flags & PF_W)) {
+            
+            // Read-only segments are shared with later children
+            seg.frame = frame;
+            seg.addr = NULL;
+            
+        } else {
+            
+            // Keep a pristine copy of writable segments
+            size_t size;
+            err = frame_alloc(&seg.frame, seg.size, &size);
+            if (err_is_fail(err)) {
+                break;
+            }
+            err = paging_map_frame(get_current_paging_state(), &seg.addr,
+                                   seg.size, seg.frame, NULL, NULL);
+            if (err_is_fail(err)) {
+                break;
+            }
+            memcpy(seg.addr, addr, seg.size);
+            
+        }
+        
+        image->segments[image->segment_count++] = seg;
+        
+    }
+    
+    // Section headers come last in the file, read them after the segments to
+    // keep the reads sequential
+    if (err_is_ok(err)) {
+        err = spawn_image_find_got(src, ehdr, phdrs, &si->got_addr);
+    }
+    
+    if (image != NULL) {
+        if (err_is_ok(err)) {
+            
+            // Older versions of the image are never used again
+            for (size_t i = 0; i < SPAWN_IMAGE_CACHE_SIZE; i++) {
+                if (image_cache[i].path != NULL && !strcmp(image_cache[i].path, path)) {
+                    spawn_image_cache_evict(&image_cache[i]);
+                }
+            }
+            
+            image->path = strdup(path);
+            image->size = src->size;
+            image->version = src->version;
+            image->entry_addr = si->entry_addr;
+            image->got_addr = si->got_addr;
+            image->last_use = ++image_clock;
+        }
+        if (image->path == NULL) {
+            spawn_image_cache_evict(image);
+        }
+    }
+    
+    free(phdrs);
+    free(ehdr);
+    
+    return err;
+    
+}
+
+// Load a cached image without touching the image source
+static errval_t spawn_image_load_cached(struct spawninfo *si,
+                                        struct spawn_image *image) {
+    
+    errval_t err;
+    
+    for (size_t i = 0; i < image->segment_count; i++) {
+        
+        struct spawn_image_segment *seg = &image->segments[i];
+        struct capref frame;
+        
+        if (seg->addr == NULL) {
+            
+            // Share the read-only frame through a copy of the capability
+            err = slot_alloc(&frame);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            err = cap_copy(frame, seg->frame);
+            if (err_is_fail(err)) {
+                slot_free(frame);
+                return err;
+            }
+            
+        } else {
+            
+            // Copy the pristine writable segment
+            size_t size;
+            err = frame_alloc(&frame, seg->size, &size);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            void *addr;
+            err = paging_map_frame_attr(get_current_paging_state(), &addr, seg->size,
+                                        frame, VREGION_FLAGS_READ_WRITE, NULL, NULL);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            add_parent_mapping(si, addr);
+            memcpy(addr, seg->addr, seg->size);
+            
+        }
+        
+        err = spawn_image_map_child(si, seg, frame);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        
+    }
+    
+    si->entry_addr = image->entry_addr;
+    si->got_addr = image->got_addr;
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Load the ELF segments from an image source into the child's vspace (or
+// from the image cache) and fill in the entry and .got addresses
+errval_t spawn_image_load(struct spawninfo *si, const char *path,
+                          struct spawn_image_source *src) {
+    
+    // Sources of unknown version are never cached
+    struct spawn_image *image = NULL;
+    if (src->version != 0) {
+        image = spawn_image_cache_lookup(path, src->size, src->version);
+    }
+    if (image != NULL) {
+#if PRINT_DEBUG
+        debug_printf("Image cache hit for %s\n", path);
+#endif
+        return spawn_image_load_cached(si, image);
+    }
+    
+    return spawn_image_load_source(si, path, src);
+    
+}
@@ -0,0 +1,38 @@
+//
+//  spawn_internal.h
+//  DoritOS
+//
+
+#ifndef spawn_internal_h
+#define spawn_internal_h
+
+#include <spawn/spawn.h>
+
+// Remember a mapping in the parent's vspace that is removed after the spawn
+void add_parent_mapping(struct spawninfo *si, void *addr);
+
+// Load the ELF segments from an image source into the child's vspace (or
+// from the image cache) and fill in the entry and .got addresses
+errval_t spawn_image_load(struct spawninfo *si, const char *path,
+                          struct spawn_image_source *src);
+
+// Check if the module was marked for lazy loading in the boot menu
+bool spawn_lazy_check(struct mem_region *mem);
+
+// Load a boot module lazily into the child's vspace: read-only segments are
+// shared with the module and large .bss objects are left to the child's page
+// fault handler. Fills in the entry and .got addresses
+errval_t spawn_lazy_load(struct spawninfo *si, struct mem_region *mem,
+                         void *elf, size_t elf_size);
+
+// Check for the gzip magic bytes
+bool spawn_gzip_check(const void *buf, size_t size);
+
+// Create an image source for a mapped gzip-compressed module
+errval_t spawn_gzip_source_init(struct spawn_image_source *src,
+                                const void *buf, size_t size);
+
+// Release the state of a gzip image source
+void spawn_gzip_source_free(struct spawn_image_source *src);
+
+#endif /* spawn_internal_h */
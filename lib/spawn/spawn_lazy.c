@@ -0,0 +1,347 @@
+//
+//  spawn_lazy.c
+//  DoritOS
+//
+//  Lazy ELF loader for boot modules with the "lazy" module option. Read-only
+//  segments are not copied at all, the child maps a sub-frame of the module
+//  that is shared by all of its instances. Writable segments are copied,
+//  except for the pages inside large .bss objects: they are only reserved in
+//  the child's vspace and zero-filled by the child's page fault handler on
+//  first touch.
+//
+//  Everything the child touches before paging_init installs its exception
+//  handler (text, .data, .got and the static stack of the main thread in
+//  .bss) has to be mapped at spawn, which is why only objects larger than
+//  that stack are left to the fault handler.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <elf/elf.h>
+#include <spawn/multiboot.h>
+
+#include "spawn_internal.h"
+
+#define PRINT_DEBUG 0
+
+#define SPAWN_LAZY_MODULE_OPTION    "lazy"
+#define SPAWN_LAZY_MIN_OBJECT       (128 * 1024)
+
+// The static main thread stack is used before the fault handler exists
+STATIC_ASSERT(SPAWN_LAZY_MIN_OBJECT > THREADS_DEFAULT_STACK_BYTES,
+              "SPAWN_LAZY_MIN_OBJECT must exceed the static thread stack");
+
+
+// A read-only sub-frame of a module, retyped once and shared by all children
+struct spawn_lazy_frame {
+    cslot_t module_slot;
+    size_t offset;
+    size_t size;
+    struct capref frame;
+    struct spawn_lazy_frame *next;
+};
+
+static struct spawn_lazy_frame *lazy_frames = NULL;
+
+
+// Check if the module was marked for lazy loading in the boot menu
+bool spawn_lazy_check(struct mem_region *mem) {
+
+    const char *opts = multiboot_module_opts(mem);
+    size_t option_len = strlen(SPAWN_LAZY_MODULE_OPTION);
+
+    // Skip the module name and look at every option
+    for (const char *arg = strchr(opts, ' '); arg != NULL; arg = strchr(arg, ' ')) {
+        arg++;
+        size_t len = strcspn(arg, " ");
+        if (len == option_len && strncmp(arg, SPAWN_LAZY_MODULE_OPTION, len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+
+}
+
+// Get the shared sub-frame covering [offset, offset + size) of a module
+static errval_t spawn_lazy_shared_frame(struct mem_region *mem, size_t offset,
+                                        size_t size, struct capref *ret) {
+
+    errval_t err;
+
+    // Reuse the sub-frame of an earlier spawn (a second retype would overlap)
+    for (struct spawn_lazy_frame *f = lazy_frames; f != NULL; f = f->next) {
+        if (f->module_slot == mem->mrmod_slot && f->offset == offset && f->size == size) {
+            *ret = f->frame;
+            return SYS_ERR_OK;
+        }
+    }
+
+    struct spawn_lazy_frame *f = malloc(sizeof(struct spawn_lazy_frame));
+    if (f == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    err = slot_alloc(&f->frame);
+    if (err_is_fail(err)) {
+        free(f);
+        return err;
+    }
+
+    // Retype as DevFrame, retyping to a Frame would zero the module
+    struct capref module = {
+        .cnode = cnode_module,
+        .slot = mem->mrmod_slot
+    };
+    err = cap_retype(f->frame, module, offset, ObjType_DevFrame, size, 1);
+    if (err_is_fail(err)) {
+        slot_free(f->frame);
+        free(f);
+        return err;
+    }
+
+    f->module_slot = mem->mrmod_slot;
+    f->offset = offset;
+    f->size = size;
+    f->next = lazy_frames;
+    lazy_frames = f;
+
+    *ret = f->frame;
+
+    return SYS_ERR_OK;
+
+}
+
+// Map a read-only segment straight from the module into the child
+static errval_t spawn_lazy_share_segment(struct spawninfo *si,
+                                         struct mem_region *mem,
+                                         struct Elf32_Phdr *phdr) {
+
+    errval_t err;
+
+    lvaddr_t base = ROUND_DOWN(phdr->p_vaddr, BASE_PAGE_SIZE);
+    size_t offset = ROUND_DOWN(phdr->p_offset, BASE_PAGE_SIZE);
+    size_t size = ROUND_UP(phdr->p_offset + phdr->p_filesz, BASE_PAGE_SIZE) - offset;
+
+    struct capref shared;
+    err = spawn_lazy_shared_frame(mem, offset, size, &shared);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Give the child its own copy of the shared sub-frame
+    struct capref frame;
+    err = slot_alloc(&frame);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    err = cap_copy(frame, shared);
+    if (err_is_fail(err)) {
+        slot_free(frame);
+        return err;
+    }
+
+    // Map the sub-frame into child's virtual address space
+    paging_alloc_fixed(si->child_paging_state, (void *) base, size);
+    return paging_map_fixed_attr(si->child_paging_state, base, frame, size,
+                                 phdr->p_flags);
+
+}
+
+// Mark the pages that lie completely inside a large .bss object
+static void spawn_lazy_mark_objects(void *elf, size_t elf_size,
+                                    struct Elf32_Phdr *phdr, lvaddr_t base,
+                                    bool *lazy) {
+
+    struct Elf32_Ehdr *head = elf;
+
+    if (head->e_shoff + head->e_shnum * sizeof(struct Elf32_Shdr) > elf_size) {
+        return;
+    }
+
+    // Stripped binaries are loaded eagerly
+    struct Elf32_Shdr *shdrs = elf + head->e_shoff;
+    struct Elf32_Shdr *symtab = elf32_find_section_header_type(shdrs, head->e_shnum,
+                                                               SHT_SYMTAB);
+    if (symtab == NULL || symtab->sh_offset + symtab->sh_size > elf_size) {
+        return;
+    }
+
+    lvaddr_t bss_start = phdr->p_vaddr + phdr->p_filesz;
+    lvaddr_t bss_end = phdr->p_vaddr + phdr->p_memsz;
+
+    struct Elf32_Sym *syms = elf + symtab->sh_offset;
+    size_t count = symtab->sh_size / sizeof(struct Elf32_Sym);
+
+    for (size_t i = 0; i < count; i++) {
+
+        // Symbol type is in the low nibble of st_info
+        if ((syms[i].st_info & 0xf) != STT_OBJECT ||
+            syms[i].st_size < SPAWN_LAZY_MIN_OBJECT) {
+            continue;
+        }
+
+        lvaddr_t start = syms[i].st_value;
+        lvaddr_t end = start + syms[i].st_size;
+        if (start < bss_start || end > bss_end) {
+            continue;
+        }
+
+        // Pages shared with other objects stay eager
+        for (lvaddr_t page = ROUND_UP(start, BASE_PAGE_SIZE);
+             page < ROUND_DOWN(end, BASE_PAGE_SIZE); page += BASE_PAGE_SIZE) {
+            lazy[(page - base) / BASE_PAGE_SIZE] = true;
+        }
+
+    }
+
+}
+
+// Copy a run of pages of a writable segment into a new frame for the child
+static errval_t spawn_lazy_copy_run(struct spawninfo *si, void *elf,
+                                    struct Elf32_Phdr *phdr, lvaddr_t base,
+                                    size_t size) {
+
+    errval_t err;
+
+    // Allocating memory for the run
+    struct capref frame;
+    size_t ret_size;
+    err = frame_alloc(&frame, size, &ret_size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Map the frame into parent virtual address space
+    void *addr;
+    err = paging_map_frame_attr(get_current_paging_state(), &addr, ret_size,
+                                frame, VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Add mapping to parent mappings list
+    add_parent_mapping(si, addr);
+
+    // Copy the part of the file data that falls into this run
+    memset(addr, 0, size);
+    lvaddr_t file_start = MAX(phdr->p_vaddr, base);
+    lvaddr_t file_end = MIN(phdr->p_vaddr + phdr->p_filesz, base + size);
+    if (file_start < file_end) {
+        memcpy(addr + (file_start - base),
+               elf + phdr->p_offset + (file_start - phdr->p_vaddr),
+               file_end - file_start);
+    }
+
+    // Map the frame into child's virtual address space
+    return paging_map_fixed_attr(si->child_paging_state, base, frame, size,
+                                 phdr->p_flags);
+
+}
+
+// Copy a writable segment, leaving the pages of large .bss objects unmapped
+static errval_t spawn_lazy_copy_segment(struct spawninfo *si, void *elf,
+                                        size_t elf_size, struct Elf32_Phdr *phdr) {
+
+    errval_t err = SYS_ERR_OK;
+
+    lvaddr_t base = ROUND_DOWN(phdr->p_vaddr, BASE_PAGE_SIZE);
+    size_t pages = (ROUND_UP(phdr->p_vaddr + phdr->p_memsz, BASE_PAGE_SIZE) - base)
+                   / BASE_PAGE_SIZE;
+
+    bool *lazy = calloc(pages, sizeof(bool));
+    if (lazy == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    spawn_lazy_mark_objects(elf, elf_size, phdr, base, lazy);
+
+    // Reserve the whole segment, the fault handler fills the lazy pages
+    paging_alloc_fixed(si->child_paging_state, (void *) base, pages * BASE_PAGE_SIZE);
+
+    for (size_t i = 0; i < pages; ) {
+
+        // Find the end of the run of pages of the same kind
+        size_t j = i;
+        while (j < pages && lazy[j] == lazy[i]) {
+            j++;
+        }
+
+        if (lazy[i]) {
+#if PRINT_DEBUG
+            debug_printf("spawn_lazy: leaving %zu pages at 0x%x to the fault handler\n",
+                         j - i, base + i * BASE_PAGE_SIZE);
+#endif
+        } else {
+            err = spawn_lazy_copy_run(si, elf, phdr, base + i * BASE_PAGE_SIZE,
+                                      (j - i) * BASE_PAGE_SIZE);
+            if (err_is_fail(err)) {
+                break;
+            }
+        }
+
+        i = j;
+
+    }
+
+    free(lazy);
+
+    return err;
+
+}
+
+// Load a boot module lazily into the child's vspace and fill in the entry
+// and .got addresses
+errval_t spawn_lazy_load(struct spawninfo *si, struct mem_region *mem,
+                         void *elf, size_t elf_size) {
+
+    errval_t err;
+
+    struct Elf32_Ehdr *head = elf;
+    if (elf_size < sizeof(struct Elf32_Ehdr) || !IS_ELF(*head) ||
+        head->e_ident[EI_CLASS] != ELFCLASS32 ||
+        head->e_phoff + head->e_phnum * sizeof(struct Elf32_Phdr) > elf_size) {
+        return ELF_ERR_HEADER;
+    }
+
+    struct Elf32_Phdr *phdrs = elf + head->e_phoff;
+
+    for (size_t i = 0; i < head->e_phnum; i++) {
+
+        struct Elf32_Phdr *phdr = &phdrs[i];
+        if (phdr->p_type != PT_LOAD) {
+            continue;
+        }
+
+        if (phdr->p_filesz > phdr->p_memsz ||
+            phdr->p_offset + phdr->p_filesz > elf_size) {
+            return ELF_ERR_PROGHDR;
+        }
+
+        // Read-only segments that are page congruent with the file are shared
+        if (!(phdr->p_flags & PF_W) && phdr->p_filesz == phdr->p_memsz &&
+            phdr->p_offset % BASE_PAGE_SIZE == phdr->p_vaddr % BASE_PAGE_SIZE) {
+            err = spawn_lazy_share_segment(si, mem, phdr);
+        } else {
+            err = spawn_lazy_copy_segment(si, elf, elf_size, phdr);
+        }
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+    }
+
+    si->entry_addr = head->e_entry;
+
+    // Get the address of the .got section
+    struct Elf32_Shdr *got_header = elf32_find_section_header_name((genvaddr_t) (lvaddr_t) elf,
+                                                                   elf_size, ".got");
+    if (got_header == NULL) {
+        return ELF_ERR_HEADER;
+    }
+    si->got_addr = (void *) got_header->sh_addr;
+
+    return SYS_ERR_OK;
+
+}
@@ -0,0 +1,106 @@
+//
+//  spawn_trace.c
+//  DoritOS
+//
+//  Aggregates per-phase spawn cycle counts into per-binary histograms.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <barrelfish_kpi/asm_inlines_arch.h>
+
+#include <spawn/spawn.h>
+
+
+// Histograms of all binaries spawned so far
+struct spawn_trace_node {
+    struct spawn_trace_stats stats;
+    struct spawn_trace_node *next;
+};
+
+static struct spawn_trace_node *trace_list = NULL;
+static size_t trace_count = 0;
+
+
+// Start the cycle counter (once per core)
+void spawn_trace_init(void) {
+    
+    static bool initialized = false;
+    
+    if (!initialized) {
+        reset_cycle_counter();
+        initialized = true;
+    }
+    
+}
+
+// Add a sample to a histogram
+static void spawn_trace_hist_add(struct spawn_trace_hist *hist, uint32_t cycles) {
+    
+    if (hist->count == 0 || cycles < hist->min) {
+        hist->min = cycles;
+    }
+    if (cycles > hist->max) {
+        hist->max = cycles;
+    }
+    hist->count++;
+    hist->sum += cycles;
+    
+    // Bucket by the position of the most significant bit
+    size_t bucket = cycles == 0 ? 0 : 31 - __builtin_clz(cycles);
+    hist->buckets[bucket]++;
+    
+}
+
+// Record the phase cycles of one spawn of `name`
+void spawn_trace_record(const char *name, uint32_t cycles[SpawnPhase_Count]) {
+    
+    // Find the binary's histograms
+    struct spawn_trace_node *node;
+    for (node = trace_list; node != NULL; node = node->next) {
+        if (!strncmp(node->stats.name, name, SPAWN_TRACE_NAME_LEN - 1)) {
+            break;
+        }
+    }
+    
+    // First spawn of this binary
+    if (node == NULL) {
+        node = (struct spawn_trace_node *) calloc(1, sizeof(struct spawn_trace_node));
+        if (node == NULL) {
+            return;
+        }
+        strncpy(node->stats.name, name, SPAWN_TRACE_NAME_LEN - 1);
+        node->next = trace_list;
+        trace_list = node;
+        trace_count++;
+    }
+    
+    for (size_t i = 0; i < SpawnPhase_Count; i++) {
+        spawn_trace_hist_add(&node->stats.phases[i], cycles[i]);
+    }
+    
+}
+
+// Copy all histograms into a newly allocated message
+errval_t spawn_trace_snapshot(void **buf, size_t *size) {
+    
+    *size = sizeof(struct spawn_trace_msg) + trace_count * sizeof(struct spawn_trace_stats);
+    
+    struct spawn_trace_msg *msg = (struct spawn_trace_msg *) malloc(*size);
+    if (msg == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    msg->core_id = disp_get_core_id();
+    msg->count = 0;
+    for (struct spawn_trace_node *node = trace_list; node != NULL; node = node->next) {
+        msg->stats[msg->count++] = node->stats;
+    }
+    
+    *buf = msg;
+    
+    return SYS_ERR_OK;
+    
+}
@@ -9,76 +9,161 @@
 
 static struct ump_chan *ump_chan;
 
+// Spawn request waiting for the other core's response
+struct spawn_request {
+    uint32_t id;
+    spawn_serv_callback_t callback;
+    void *arg;
+    struct spawn_request *next;
+};
+
+// Outstanding remote spawn requests
+static struct spawn_request *pending_requests = NULL;
+
+// State of a synchronous remote spawn
+struct spawn_sync_state {
+    bool done;
+    errval_t err;
+    domainid_t pid;
+};
+
 static errval_t request_remote_spawn(char *name, coreid_t coreid,
-                                     domainid_t terminal_pid, domainid_t *pid) {
+                                     domainid_t terminal_pid, size_t count,
+                                     spawn_serv_callback_t callback, void *arg) {
     
     errval_t err = SYS_ERR_OK;
     
+    // Request IDs for matching responses
+    static uint32_t request_id = 0;
+    
+    // Remember the request until the response arrives
+    struct spawn_request *request = (struct spawn_request *) malloc(sizeof(struct spawn_request));
+    if (!request) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    request->id = ++request_id;
+    request->callback = callback;
+    request->arg = arg;
+    
     // Build message
-    size_t msg_size = sizeof(domainid_t) + strlen(name) + 1;
-    char *msg = malloc(msg_size);
+    size_t msg_size = sizeof(struct urpc_spawn_request) + strlen(name) + 1;
+    struct urpc_spawn_request *msg = malloc(msg_size);
     if (!msg) {
+        free(request);
         return LIB_ERR_MALLOC_FAIL;
     }
-    *(domainid_t *) msg = terminal_pid;
-    strcpy((char *) msg + sizeof(domainid_t), name);
+    msg->id = request->id;
+    msg->terminal_pid = terminal_pid;
+    msg->count = count;
+    strcpy(msg->name, name);
     
     // Send request to spawn server on other core
     err = ump_send(ump_chan, msg, msg_size, UMP_MessageType_Spawn);
+    
+    // Free the message
+    free(msg);
+    
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
+        free(request);
+        return err;
     }
     
-    // Free the message
-    free(msg);
+    // Insert into the outstanding requests
+    request->next = pending_requests;
+    pending_requests = request;
     
-    // Waiting for response
-    size_t retsize;
-    ump_msg_type_t msg_type;
+    return SYS_ERR_OK;
     
-    struct urpc_spaw_response *recv_buf;
+}
 
-    // Repeat until a message is received
-    do {
-        
-        // Receive response of spawn server and save it in recv_buf
-        err = ump_recv(ump_chan, (void **) &recv_buf, &retsize, &msg_type);
-        
-        // Check for a process register message
-        if (err_is_ok(err) && msg_type == UMP_MessageType_RegisterProcess) {
-            
-            // Pass message to URPC handler
-            urpc_register_process_handler(ump_chan,
-                                          (void *)recv_buf,
-                                          retsize,
-                                          msg_type);
-            free(recv_buf);
-            
-            // Continue looping
-            err = LIB_ERR_NO_UMP_MSG;
+// Handle UMP_MessageType_SpawnAck
+static void spawn_serv_ack_handler(void *msg, size_t size) {
+    
+    struct urpc_spaw_response *res = (struct urpc_spaw_response *) msg;
+    
+    // Find and unlink the matching request
+    struct spawn_request **node;
+    for (node = &pending_requests; *node != NULL; node = &(*node)->next) {
+        if ((*node)->id == res->id) {
+            break;
         }
-        
-    } while (err == LIB_ERR_NO_UMP_MSG);
+    }
     
-    // Check that receive was successful
-    if (err_is_fail(err)) {
-        return err;
+    if (*node == NULL) {
+        debug_printf("Spawn response for unknown request %u\n", res->id);
+        return;
     }
     
-    // TODO: Handle incorrect UMP_MessageType gracefully
-    assert(msg_type == UMP_MessageType_SpawnAck);
+    struct spawn_request *request = *node;
+    *node = request->next;
     
-    // Set pid of spawned process
-    *pid = recv_buf->pid;
+    // Complete the request
+    request->callback(request->arg, res->err, res->pids, res->count);
     
-    // Returned error code
-    err = recv_buf->err;
+    free(request);
     
-    // Free memory of recv_buf
-    free(recv_buf);
+}
+
+// Forget the outstanding request with callback argument arg
+static void cancel_remote_spawn(void *arg) {
     
-    // Return status
-    return err;
+    struct spawn_request **node;
+    for (node = &pending_requests; *node != NULL; node = &(*node)->next) {
+        if ((*node)->arg == arg) {
+            struct spawn_request *request = *node;
+            *node = request->next;
+            free(request);
+            return;
+        }
+    }
+    
+}
+
+static void spawn_sync_callback(void *arg, errval_t err,
+                                domainid_t *pids, size_t count) {
+    
+    struct spawn_sync_state *state = (struct spawn_sync_state *) arg;
+    
+    state->err = err;
+    state->pid = count > 0 ? pids[0] : 0;
+    state->done = true;
+    
+}
+
+errval_t spawn_serv_spawn_async(char *name, coreid_t coreid,
+                                domainid_t terminal_pid, size_t count,
+                                spawn_serv_callback_t callback, void *arg) {
+    
+    errval_t err = SYS_ERR_OK;
+    
+    // Check if spawn request for another core
+    if (coreid != disp_get_core_id()) {
+        
+        return request_remote_spawn(name, coreid, terminal_pid, count,
+                                    callback, arg);
+        
+    }
+    
+    // Spawn the instances right away
+    domainid_t *pids = (domainid_t *) malloc(MAX(count, 1) * sizeof(domainid_t));
+    if (pids == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    size_t spawned;
+    for (spawned = 0; spawned < count; spawned++) {
+        err = spawn_serv_handler(name, coreid, terminal_pid, &pids[spawned]);
+        if (err_is_fail(err)) {
+            break;
+        }
+    }
+    
+    callback(arg, err, pids, spawned);
+    
+    free(pids);
+    
+    return SYS_ERR_OK;
     
 }
 
@@ -89,7 +174,38 @@ errval_t spawn_serv_handler(char *name, coreid_t coreid,
     // Check if spawn request for this core
     if (coreid != disp_get_core_id()) {
         
-        return request_remote_spawn(name, coreid, terminal_pid, pid);
+        struct spawn_sync_state state = {
+            .done = false
+        };
+        
+        err = request_remote_spawn(name, coreid, terminal_pid, 1,
+                                   spawn_sync_callback, &state);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        
+        // Serve the other core until our response arrived
+        while (!state.done) {
+            
+            void *msg;
+            size_t msg_size;
+            ump_msg_type_t msg_type;
+            err = ump_recv(ump_chan, &msg, &msg_size, &msg_type);
+            if (err_is_ok(err)) {
+                urpc_init_server_handler(ump_chan, msg, msg_size, msg_type);
+                free(msg);
+            }
+            else if (err != LIB_ERR_NO_UMP_MSG) {
+                // The response must not complete state after we returned
+                cancel_remote_spawn(&state);
+                return err;
+            }
+            
+        }
+        
+        *pid = state.pid;
+        
+        return state.err;
     
     }
     
@@ -122,11 +238,60 @@ errval_t spawn_serv_handler(char *name, coreid_t coreid,
     
 }
 
+// Image source that lets the client of a file spawn fill the frames
+static errval_t spawn_serv_file_fill(void *state, struct capref frame,
+                                     void *frame_addr, size_t frame_offset,
+                                     size_t image_offset, size_t bytes) {
+    
+    return lmp_server_spawn_file_fill((struct lmp_chan *) state, frame,
+                                      frame_offset, image_offset, bytes);
+    
+}
+
+errval_t spawn_serv_file_handler(char *cmd, domainid_t terminal_pid,
+                                 size_t file_size, uint32_t file_version,
+                                 struct lmp_chan *lc, domainid_t *pid) {
+    
+    errval_t err;
+    
+    struct spawn_image_source src = {
+        .size = file_size,
+        .version = file_version,
+        .fill = spawn_serv_file_fill,
+        .state = (void *) lc
+    };
+    
+    // Allocate spawninfo
+    struct spawninfo *si = (struct spawninfo *) malloc(sizeof(struct spawninfo));
+    if (si == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    err = spawn_load_by_source(cmd, si, terminal_pid, &src);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        free(si);
+        return err;
+    }
+    
+    // Return the new process id
+    *pid = si->pi->pid;
+    
+    free(si);
+    
+    return SYS_ERR_OK;
+    
+}
+
 errval_t spawn_serv_init(struct ump_chan *chan) {
     
     ump_chan = chan;
     
     lmp_server_spawn_register_handler(spawn_serv_handler);
+    lmp_server_spawn_register_async_handler(spawn_serv_spawn_async);
+    lmp_server_spawn_register_file_handler(spawn_serv_file_handler);
+    urpc_register_spawn_ack_handler(spawn_serv_ack_handler);
+    lmp_server_spawn_stats_register_handler(spawn_trace_snapshot);
     
     return SYS_ERR_OK;
     
@@ -16,34 +16,158 @@
 void io_buffer_init(struct io_buffer **buf) {
     *buf = (struct io_buffer *) malloc(sizeof(struct io_buffer));
     (*buf)->buf = (char *) malloc(IO_BUFFER_SIZE);
-    (*buf)->pos = 0;
-    (*buf)->next = NULL;
-    memset((*buf)->buf, 0, IO_BUFFER_SIZE);
+    (*buf)->head = 0;
+    (*buf)->tail = 0;
 }
 
-static errval_t get_next_char(struct terminal_state *st, char *c) {
-    static size_t i = 0;
+// Number of characters in the ring buffer
+size_t io_buffer_count(struct io_buffer *buf) {
+    return buf->head - buf->tail;
+}
+
+// Append a character, returns false (and drops it) if the buffer is full
+bool io_buffer_put(struct io_buffer *buf, char c) {
+    if (io_buffer_count(buf) == IO_BUFFER_SIZE) {
+        return false;
+    }
     
-    if (i >= st->buffer->pos) {
-        return TERM_ERR_BUFFER_EMPTY;
+    buf->buf[buf->head++ & (IO_BUFFER_SIZE - 1)] = c;
+    
+    return true;
+}
+
+// Take the oldest character, returns false if the buffer is empty
+bool io_buffer_get(struct io_buffer *buf, char *c) {
+    if (io_buffer_count(buf) == 0) {
+        return false;
     }
     
-    *c = st->buffer->buf[i++];
+    *c = buf->buf[buf->tail++ & (IO_BUFFER_SIZE - 1)];
     
-    if (i == IO_BUFFER_SIZE) {
-        struct io_buffer *temp = st->buffer->next;
-        free(st->buffer);
-        st->buffer = temp;
-        i = 0;
+    return true;
+}
+
+static errval_t get_next_char(struct terminal_state *st, char *c) {
+    if (!io_buffer_get(st->buffer, c)) {
+        return TERM_ERR_BUFFER_EMPTY;
     }
     
     return SYS_ERR_OK;
 }
 
+// Echo a string
+static void put_string(const char *str) {
+    while (*str) {
+        put_char(*str++);
+    }
+}
+
+// Send the data collected by a read event to its client
+static void terminal_read_reply(struct terminal_event *event, char end) {
+    
+    errval_t err;
+    
+    size_t size = sizeof(struct terminal_read_reply) + event->size;
+    struct terminal_read_reply *reply = (struct terminal_read_reply *) malloc(size);
+    if (reply == NULL) {
+        debug_printf("%s\n", err_getstring(LIB_ERR_MALLOC_FAIL));
+        return;
+    }
+    
+    reply->err = SYS_ERR_OK;
+    reply->len = event->size;
+    reply->end = end;
+    memcpy(reply + 1, event->data, event->size);
+    
+    err = urpc_send(event->chan, (void *) reply, size, event->type);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+    }
+    
+    free(reply);
+}
+
+// Move buffered characters into a bulk read, returns true once replied
+static bool terminal_read_bulk(struct terminal_state *st, struct terminal_event *event) {
+    
+    // Wait for at least one character
+    if (io_buffer_count(st->buffer) == 0) {
+        return false;
+    }
+    
+    while (event->size < event->max_size &&
+           io_buffer_get(st->buffer, &event->data[event->size])) {
+        event->size++;
+    }
+    
+    terminal_read_reply(event, 0);
+    
+    return true;
+}
+
+// Edit a line with the buffered characters, returns true once replied
+static bool terminal_read_line(struct terminal_state *st, struct terminal_event *event) {
+    
+    char c;
+    
+    // Claim the line so no other read consumes characters in between
+    st->line_reader = event;
+    
+    while (io_buffer_get(st->buffer, &c)) {
+        
+        switch (c) {
+            case 0x0A:
+            case 0x0D:
+                // End of line (the newline is part of the line)
+                put_string("\r\n");
+                if (event->size < event->max_size) {
+                    event->data[event->size++] = '\n';
+                }
+                break;
+            case 0x03:
+                // Interrupt discards the line
+                put_string("^C\r\n");
+                event->size = 0;
+                break;
+            case 0x04:
+                // End of file returns the line without a newline
+                put_string("\r\n");
+                break;
+            case 0x08:
+            case 0x7F:
+                // Erase the last character
+                if (event->size > 0) {
+                    event->size--;
+                    put_string("\b \b");
+                }
+                continue;
+            default:
+                // Keep one byte for the newline
+                if (event->size + 1 < event->max_size) {
+                    event->data[event->size++] = c;
+                    put_char(c);
+                }
+                continue;
+        }
+        
+        st->line_reader = NULL;
+        terminal_read_reply(event, c);
+        
+        return true;
+    }
+    
+    return false;
+}
+
 static int urpc_chan_list_remove(void *data, void *arg) {
     return data == arg;
 }
 
+static void terminal_event_free(struct terminal_event *event) {
+    free(event->data);
+    free(event);
+}
+
 static int terminal_event_dispatch(void *data, void *arg) {
         
     errval_t err = SYS_ERR_OK;
@@ -74,7 +198,8 @@ static int terminal_event_dispatch(void *data, void *arg) {
 #if PRINT_DEBUG
             debug_printf("EVENT: READ!\n");
 #endif
-            if (st->read_lock == NULL || st->read_lock == event->chan) {
+            if ((st->read_lock == NULL || st->read_lock == event->chan) &&
+                st->line_reader == NULL) {
                 msg.err = get_next_char(st, &msg.c);
                 if (msg.err == SYS_ERR_OK) {
                     err = urpc_send(event->chan, (void *) &msg, sizeof(struct terminal_msg), event->type);
@@ -85,6 +210,24 @@ static int terminal_event_dispatch(void *data, void *arg) {
                 }
             }
             break;
+        case URPC_MessageType_TerminalReadBulk:
+#if PRINT_DEBUG
+            debug_printf("EVENT: READ BULK!\n");
+#endif
+            if ((st->read_lock == NULL || st->read_lock == event->chan) &&
+                st->line_reader == NULL) {
+                return terminal_read_bulk(st, event);
+            }
+            break;
+        case URPC_MessageType_TerminalReadLine:
+#if PRINT_DEBUG
+            debug_printf("EVENT: READ LINE!\n");
+#endif
+            if ((st->read_lock == NULL || st->read_lock == event->chan) &&
+                (st->line_reader == NULL || st->line_reader == event)) {
+                return terminal_read_line(st, event);
+            }
+            break;
         case URPC_MessageType_TerminalReadUnlock:
 #if PRINT_DEBUG
             debug_printf("EVENT: READ UNLOCK!\n");
@@ -123,6 +266,24 @@ static int terminal_event_dispatch(void *data, void *arg) {
                 return 1;
             }
             break;
+        case URPC_MessageType_TerminalWriteString:
+#if PRINT_DEBUG
+            debug_printf("EVENT: WRITE STRING!\n");
+#endif
+            if (st->write_lock == NULL || st->write_lock == event->chan) {
+                for (size_t i = 0; i < event->size; i++) {
+                    if (event->data[i] == '\n') {
+                        put_char('\r');
+                    }
+                    put_char(event->data[i]);
+                }
+                err = urpc_send(event->chan, (void *) &msg, sizeof(struct terminal_msg), event->type);
+                if (err_is_fail(err)) {
+                    debug_printf("%s\n", err_getstring(err));
+                }
+                return 1;
+            }
+            break;
         case URPC_MessageType_TerminalWriteUnlock:
 #if PRINT_DEBUG
             debug_printf("EVENT: WRITE UNLOCK!\n");
@@ -169,7 +330,10 @@ void terminal_runloop(struct terminal_state *st) {
     
     void *chan = malloc(sizeof(struct urpc_chan));
     while (true) {
-        while (collections_list_remove_if(st->terminal_event_queue, terminal_event_dispatch, st) != NULL);
+        struct terminal_event *done;
+        while ((done = collections_list_remove_if(st->terminal_event_queue, terminal_event_dispatch, st)) != NULL) {
+            terminal_event_free(done);
+        }
         
         err = urpc_accept((struct urpc_chan *) chan);
         if (err_is_ok(err)) {
@@ -193,10 +357,33 @@ void terminal_runloop(struct terminal_state *st) {
                 struct terminal_event *event = (struct terminal_event *) malloc(sizeof(struct terminal_event));
                 event->chan = node;
                 event->type = msg_type;
-                event->msg = *msg;
-                collections_list_insert_tail(st->terminal_event_queue, event);
+                event->data = NULL;
+                event->size = 0;
+                event->max_size = 0;
                 
-                free((void *) msg);
+                if (msg_type == URPC_MessageType_TerminalWriteString) {
+                    // Keep the string until the event is dispatched
+                    struct terminal_write_req *req = (struct terminal_write_req *) msg;
+                    event->data = (char *) msg;
+                    if (size >= sizeof(struct terminal_write_req)) {
+                        event->size = MIN(req->len, size - sizeof(struct terminal_write_req));
+                        memmove(event->data, req + 1, event->size);
+                    }
+                }
+                else if (msg_type == URPC_MessageType_TerminalReadBulk ||
+                         msg_type == URPC_MessageType_TerminalReadLine) {
+                    // Allocate space for the characters to be read
+                    struct terminal_read_req *req = (struct terminal_read_req *) msg;
+                    event->max_size = MIN(req->len, TERMINAL_READ_MAX);
+                    event->data = (char *) malloc(MAX(event->max_size, 1));
+                    free((void *) msg);
+                }
+                else {
+                    event->msg = *msg;
+                    free((void *) msg);
+                }
+                
+                collections_list_insert_tail(st->terminal_event_queue, event);
             }
             else if (err != LIB_ERR_NO_URPC_MSG) {
                 debug_printf("Error in urpc_recv(): %s\n", err_getstring(err));
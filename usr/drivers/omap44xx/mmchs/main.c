@@ -12,21 +12,36 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <aos/aos_rpc.h>
 #include <driverkit/driverkit.h>
 #include "mmchs.h"
 
+// Serve the FAT image in the given boot module instead of the SD card
+#define MMCHS_RAMDISK_ARG "ramdisk="
+
 int main(int argc, char **argv)
 {
-    cm2_init();
-    ti_twl6030_init();
-    ctrlmod_init();
-    cm2_enable_hsmmc1();
-    sdmmc1_enable_power();
+    struct blockdev *dev;
+
+    if (argc > 1 && strncmp(argv[1], MMCHS_RAMDISK_ARG, strlen(MMCHS_RAMDISK_ARG)) == 0) {
+        errval_t err = blockdev_ram_create(argv[1] + strlen(MMCHS_RAMDISK_ARG), &dev);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "failed to create RAM disk");
+        }
+    } else {
+        cm2_init();
+        ti_twl6030_init();
+        ctrlmod_init();
+        cm2_enable_hsmmc1();
+        sdmmc1_enable_power();
+
+        mmchs_init();
 
-    mmchs_init();
+        dev = mmchs_get_blockdev();
+    }
 
-    init_service();
+    init_service(dev);
 
     return 0;
 }
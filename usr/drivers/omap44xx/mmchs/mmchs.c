@@ -137,7 +137,8 @@ static void wait_msec(long msec)
 /**
  * \see TRM rev Z, Section 24.5.1.2.1.7.1
  */
-static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
+static void send_command_blocks(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg,
+                                size_t nblk)
 {
     MMCHS_DEBUG("%s:%d: cmd = 0x%x arg=0x%x\n", __FUNCTION__, __LINE__, cmd, arg);
 
@@ -154,7 +155,7 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
     omap44xx_mmchs1_mmchs_csre_rawwr(&mmchs, 0x0);
 
     omap44xx_mmchs1_mmchs_blk_blen_wrf(&mmchs, 512);
-    omap44xx_mmchs1_mmchs_blk_nblk_wrf(&mmchs, 0x1);
+    omap44xx_mmchs1_mmchs_blk_nblk_wrf(&mmchs, nblk);
 
     omap44xx_mmchs1_mmchs_sysctl_dto_wrf(&mmchs, 0xE); // omapconf
 
@@ -175,6 +176,19 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
         cmdreg = omap44xx_mmchs1_mmchs_cmd_rsp_type_insert(cmdreg, 0x1);
         cmdreg = omap44xx_mmchs1_mmchs_cmd_ccce_insert(cmdreg, 0x1);
         break;
+        // R1, multi block transfers stopped by auto CMD12
+    case omap44xx_mmchs1_INDX_18:
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_ddir_insert(cmdreg, 0x1);
+        // Fallthrough desired!
+    case omap44xx_mmchs1_INDX_25:
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_msbs_insert(cmdreg, 0x1);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_bce_insert(cmdreg, 0x1);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_dp_insert(cmdreg, 0x1);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_acen_insert(cmdreg, 0x1);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_rsp_type_insert(cmdreg, 0x2);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_ccce_insert(cmdreg, 0x1);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_cice_insert(cmdreg, 0x1);
+        break;
         // R1, R6, R5, R7
     case omap44xx_mmchs1_INDX_17:
         cmdreg = omap44xx_mmchs1_mmchs_cmd_ddir_insert(cmdreg, 0x1);
@@ -255,6 +269,11 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
     }
 }
 
+static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
+{
+    send_command_blocks(cmd, arg, 1);
+}
+
 
 /**
  * \see TRM rev Z, Figure 24-38
@@ -413,6 +432,163 @@ errval_t mmchs_write_block(size_t block_nr, void *buffer)
     return complete_card_transaction();
 }
 
+/**
+ * \brief Reads consecutive 512-byte blocks on the card into multiple buffers.
+ *
+ * More than one block is read with a single CMD18 (stopped by auto CMD12).
+ *
+ * \param block_nr Index number of the first block to read.
+ * \param iov Buffers and the number of blocks to read into each of them.
+ * \param iovcnt Number of buffers.
+ *
+ * \retval SYS_ERR_OK Blocks successfully written in the buffers.
+ * \retval MMC_ERR_TRANSFER Error interrupt or no transfer complete interrupt.
+ * \retval MMC_ERR_READ_READY Card not ready to read.
+ */
+errval_t mmchs_readv(size_t block_nr, const struct blockdev_iovec *iov, size_t iovcnt)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        count += iov[i].count;
+    }
+
+    if (count == 0) {
+        return SYS_ERR_OK;
+    } else if (count == 1) {
+        return mmchs_read_block(block_nr, iov[iovcnt - 1].buffer);
+    }
+
+    MMCHS_DEBUG("%s:%d: Wait for free data lines.\n", __FUNCTION__, __LINE__);
+    while (omap44xx_mmchs1_mmchs_pstate_dati_rdf(&mmchs) != 0x0);
+
+    // Send multi block data command
+    send_command_blocks(18, block_nr, count);
+
+    size_t words = (omap44xx_mmchs1_mmchs_blk_blen_rdf(&mmchs) + 3) / 4;
+
+    for (size_t i = 0; i < iovcnt; i++) {
+        uint32_t *buffer = iov[i].buffer;
+        for (size_t b = 0; b < iov[i].count; b++) {
+
+            // Wait until the next block is in the buffer
+            size_t timeout = 1000;
+            while (omap44xx_mmchs1_mmchs_stat_brr_rdf(&mmchs) == 0x0) {
+                if (timeout-- == 0) {
+                    dat_line_reset();
+                    return MMC_ERR_READ_READY;
+                }
+                wait_msec(1);
+            }
+            omap44xx_mmchs1_mmchs_stat_rawwr(&mmchs, omap44xx_mmchs1_mmchs_stat_brr_insert(0x0, 0x1));
+
+            for (size_t w = 0; w < words; w++) {
+                *buffer++ = omap44xx_mmchs1_mmchs_data_rd(&mmchs);
+            }
+        }
+    }
+
+    return complete_card_transaction();
+}
+
+/**
+ * \brief Writes consecutive 512-byte blocks on the card from multiple buffers.
+ *
+ * More than one block is written with a single CMD25 (stopped by auto CMD12).
+ *
+ * \param block_nr Index number of the first block to write.
+ * \param iov Buffers and the number of blocks to write from each of them.
+ * \param iovcnt Number of buffers.
+ *
+ * \retval SYS_ERR_OK Blocks written to card.
+ * \retval MMC_ERR_TRANSFER Error interrupt or no transfer complete interrupt.
+ * \retval MMC_ERR_WRITE_READY Card not ready to write.
+ */
+errval_t mmchs_writev(size_t block_nr, const struct blockdev_iovec *iov, size_t iovcnt)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        count += iov[i].count;
+    }
+
+    if (count == 0) {
+        return SYS_ERR_OK;
+    } else if (count == 1) {
+        return mmchs_write_block(block_nr, iov[iovcnt - 1].buffer);
+    }
+
+    MMCHS_DEBUG("%s:%d: Wait for free data lines.\n", __FUNCTION__, __LINE__);
+    size_t timeout = 1000;
+    while (omap44xx_mmchs1_mmchs_pstate_dati_rdf(&mmchs) != 0x0 && timeout--) {
+        wait_msec(1);
+    }
+    if (timeout == 0) {
+        return MMC_ERR_WRITE_READY;
+    }
+
+    // Send multi block data command
+    send_command_blocks(25, block_nr, count);
+
+    size_t words = (omap44xx_mmchs1_mmchs_blk_blen_rdf(&mmchs) + 3) / 4;
+
+    for (size_t i = 0; i < iovcnt; i++) {
+        uint32_t *buffer = iov[i].buffer;
+        for (size_t b = 0; b < iov[i].count; b++) {
+
+            // Wait until the buffer can take the next block
+            timeout = 1000;
+            while (omap44xx_mmchs1_mmchs_stat_bwr_rdf(&mmchs) == 0x0) {
+                if (timeout-- == 0) {
+                    dat_line_reset();
+                    return MMC_ERR_WRITE_READY;
+                }
+                wait_msec(1);
+            }
+            omap44xx_mmchs1_mmchs_stat_rawwr(&mmchs, omap44xx_mmchs1_mmchs_stat_bwr_insert(0x0, 0x1));
+
+            for (size_t w = 0; w < words; w++) {
+                omap44xx_mmchs1_mmchs_data_wr(&mmchs, *buffer++);
+            }
+        }
+    }
+
+    return complete_card_transaction();
+}
+
+static errval_t mmchs_blockdev_readv(struct blockdev *dev, size_t block_nr,
+                                     const struct blockdev_iovec *iov, size_t iovcnt)
+{
+    return mmchs_readv(block_nr, iov, iovcnt);
+}
+
+static errval_t mmchs_blockdev_writev(struct blockdev *dev, size_t block_nr,
+                                      const struct blockdev_iovec *iov, size_t iovcnt)
+{
+    return mmchs_writev(block_nr, iov, iovcnt);
+}
+
+static const struct blockdev_ops mmchs_blockdev_ops = {
+    .readv = mmchs_blockdev_readv,
+    .writev = mmchs_blockdev_writev
+};
+
+static struct blockdev mmchs_blockdev = {
+    .name = "mmchs",
+    .block_size = 512,
+    // The capacity is not read from the CSD, the card rejects bad addresses
+    .block_count = SIZE_MAX,
+    .ops = &mmchs_blockdev_ops,
+    .st = NULL,
+    .queue = NULL
+};
+
+/**
+ * \brief Returns the block device of the card (after mmchs_init).
+ */
+struct blockdev *mmchs_get_blockdev(void)
+{
+    return &mmchs_blockdev;
+}
+
 /**
  * MMC Initialization
  *
@@ -11,6 +11,7 @@
 #define MMCHS2_H
 
 #include <aos/aos.h>
+#include <fs_serv/blockdev.h>
 
 #include "mmchs_debug.h"
 #include "omap44xx_cm2.h"
@@ -22,7 +23,10 @@
 void mmchs_init(void);
 errval_t mmchs_read_block(size_t block_nr, void *buffer);
 errval_t mmchs_write_block(size_t block_nr, void *buffer);
+errval_t mmchs_readv(size_t block_nr, const struct blockdev_iovec *iov, size_t iovcnt);
+errval_t mmchs_writev(size_t block_nr, const struct blockdev_iovec *iov, size_t iovcnt);
+struct blockdev *mmchs_get_blockdev(void);
 
-void init_service(void);
+void init_service(struct blockdev *dev);
 
 #endif // MMCHS2_H
@@ -43,7 +43,7 @@ static void print_block(size_t block_nr, void *buf, size_t size) {
 }
 
 
-void init_service(void)
+void init_service(struct blockdev *dev)
 {
 
     /* initialize the service setup */
@@ -52,7 +52,7 @@ void init_service(void)
     
     
     // Initialize static variables from BPB region
-    err = init_BPB();
+    err = init_BPB(dev);
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
     }
@@ -61,10 +61,22 @@ static void ump_event_handler(void *arg) {
         free(msg);
         
     }
-    else if (err != LIB_ERR_NO_UMP_MSG) {
+    else if (err == LIB_ERR_NO_UMP_MSG) {
+        
+        // Use idle time to build spawn skeletons
+        err = spawn_pool_refill();
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "in spawn_pool_refill");
+        }
+        
+    }
+    else {
         DEBUG_ERR(err, "in urpc_recv");
     }
     
+    // Propagate process registrations queued since the last poll
+    urpc_process_register_flush();
+    
     // Reregister event node
     struct event_queue_pair *pair = arg;
     event_queue_add(&pair->queue, &pair->node, MKCLOSURE(ump_event_handler, (void *) pair));
@@ -204,6 +216,9 @@ int main(int argc, char *argv[])
 
     // Initialize the spawn server
     spawn_serv_init(&init_uc);
+    
+    // Keep pre-built skeletons ready for spawning
+    spawn_pool_init(SPAWN_POOL_SIZE);
 
 
 
@@ -0,0 +1,33 @@
+//
+//  ipcbench.h
+//  DoritOS
+//
+//  Protocol shared by the IPC benchmark client and its partner server.
+//
+
+#ifndef ipcbench_h
+#define ipcbench_h
+
+#include <aos/urpc.h>
+
+#define IPCBENCH_SERVER_NAME    "ipcbench_serv"
+
+// Echo the payload back
+#define URPC_MessageType_BenchPing      URPC_MessageType_User0
+// Consume the payload without replying
+#define URPC_MessageType_BenchSink      URPC_MessageType_User1
+// Reply with the number of payloads consumed since the last sync
+#define URPC_MessageType_BenchSync      URPC_MessageType_User2
+// Close the channel and wait for the next binding
+#define URPC_MessageType_BenchDone      URPC_MessageType_User3
+// Close the channel and exit
+#define URPC_MessageType_BenchQuit      URPC_MessageType_User4
+
+// First word of raw lmp_chan_send messages (never a valid buffer message)
+#define IPCBENCH_LMP_RAW_PING   0x1000
+#define IPCBENCH_LMP_RAW_SINK   0x1001
+
+// Payload words of a raw lmp_chan_send message
+#define IPCBENCH_LMP_RAW_WORDS  (LMP_MSG_LENGTH - 1)
+
+#endif /* ipcbench_h */
@@ -0,0 +1,428 @@
+//
+//  main.c
+//  DoritOS
+//
+//  IPC microbenchmark for LMP, UMP and URPC. Spawns ipcbench_serv on the same
+//  and on the other core and reports round-trip latency percentiles, one-way
+//  latency and streaming throughput for every transport and message size.
+//
+//  Usage: ipcbench [iterations]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/lmp.h>
+#include <aos/urpc.h>
+#include <aos/aos_rpc.h>
+#include <barrelfish_kpi/asm_inlines_arch.h>
+
+#include "ipcbench.h"
+
+#define PRINT_DEBUG 0
+
+#define DEFAULT_ITERATIONS  1000
+#define MIN_ITERATIONS      8
+#define BYTES_BUDGET        (4 * 1024 * 1024)   // Bytes moved per measurement
+
+// Message sizes to benchmark
+static const size_t sizes[] = {
+    8, 64, 512, 4 * 1024, 32 * 1024, 256 * 1024, 1024 * 1024
+};
+
+#define NUM_SIZES   (sizeof(sizes) / sizeof(sizes[0]))
+
+// A transport under test
+struct bench_transport {
+    const char *name;
+    size_t max_size;
+    // Send one message and wait for its echo
+    errval_t (*ping)(struct urpc_chan *chan, void *buf, size_t size);
+    // Send one message that is consumed without reply
+    errval_t (*sink)(struct urpc_chan *chan, void *buf, size_t size);
+};
+
+// Round-trip samples in cycles
+static uint32_t *samples;
+static size_t max_iterations;
+
+
+// MARK: - Transports
+
+// Send a raw LMP message, retrying while the receive buffer is full
+static errval_t raw_lmp_send(struct lmp_chan *lc, uintptr_t marker,
+                             const uintptr_t *words) {
+
+    errval_t err;
+
+    do {
+        err = lmp_chan_send9(lc, LMP_FLAG_SYNC, NULL_CAP, marker, words[0],
+                             words[1], words[2], words[3], words[4], words[5],
+                             words[6], words[7]);
+        if (lmp_err_is_transient(err)) {
+            thread_yield();
+        }
+    } while (lmp_err_is_transient(err));
+
+    return err;
+
+}
+
+static errval_t raw_lmp_ping(struct urpc_chan *chan, void *buf, size_t size) {
+
+    errval_t err;
+
+    uintptr_t words[IPCBENCH_LMP_RAW_WORDS] = {0};
+    memcpy(words, buf, size);
+
+    err = raw_lmp_send(chan->lmp, IPCBENCH_LMP_RAW_PING, words);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Wait for the echo
+    struct capref cap;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    lmp_client_recv(chan->lmp, &cap, &msg);
+    assert(msg.words[0] == IPCBENCH_LMP_RAW_PING);
+
+    memcpy(buf, &msg.words[1], size);
+
+    return SYS_ERR_OK;
+
+}
+
+static errval_t raw_lmp_sink(struct urpc_chan *chan, void *buf, size_t size) {
+
+    uintptr_t words[IPCBENCH_LMP_RAW_WORDS] = {0};
+    memcpy(words, buf, size);
+
+    return raw_lmp_send(chan->lmp, IPCBENCH_LMP_RAW_SINK, words);
+
+}
+
+static errval_t lmp_buffer_ping(struct urpc_chan *chan, void *buf, size_t size) {
+
+    errval_t err;
+
+    err = lmp_send_buffer(chan->lmp, buf, size, URPC_MessageType_BenchPing);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    void *rx_buf;
+    size_t rx_size;
+    uint8_t msg_type;
+    err = lmp_recv_buffer(chan->lmp, &rx_buf, &rx_size, &msg_type);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    assert(msg_type == URPC_MessageType_BenchPing && rx_size == size);
+
+    free(rx_buf);
+
+    return SYS_ERR_OK;
+
+}
+
+static errval_t lmp_buffer_sink(struct urpc_chan *chan, void *buf, size_t size) {
+
+    return lmp_send_buffer(chan->lmp, buf, size, URPC_MessageType_BenchSink);
+
+}
+
+static errval_t ump_ping(struct urpc_chan *chan, void *buf, size_t size) {
+
+    errval_t err;
+
+    err = ump_send(chan->ump, buf, size, URPC_MessageType_BenchPing);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    void *rx_buf;
+    size_t rx_size;
+    ump_msg_type_t msg_type;
+    ump_recv_blocking(chan->ump, &rx_buf, &rx_size, &msg_type);
+    assert(msg_type == URPC_MessageType_BenchPing);
+
+    free(rx_buf);
+
+    return SYS_ERR_OK;
+
+}
+
+static errval_t ump_sink(struct urpc_chan *chan, void *buf, size_t size) {
+
+    return ump_send(chan->ump, buf, size, URPC_MessageType_BenchSink);
+
+}
+
+static errval_t urpc_ping(struct urpc_chan *chan, void *buf, size_t size) {
+
+    errval_t err;
+
+    err = urpc_send(chan, buf, size, URPC_MessageType_BenchPing);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    void *rx_buf;
+    size_t rx_size;
+    urpc_msg_type_t msg_type;
+    err = urpc_recv_blocking(chan, &rx_buf, &rx_size, &msg_type);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    assert(msg_type == URPC_MessageType_BenchPing);
+
+    free(rx_buf);
+
+    return SYS_ERR_OK;
+
+}
+
+static errval_t urpc_sink(struct urpc_chan *chan, void *buf, size_t size) {
+
+    return urpc_send(chan, buf, size, URPC_MessageType_BenchSink);
+
+}
+
+static const struct bench_transport lmp_transports[] = {
+    { "lmp_chan_send", IPCBENCH_LMP_RAW_WORDS * sizeof(uintptr_t),
+      raw_lmp_ping, raw_lmp_sink },
+    { "lmp_send_buffer", SIZE_MAX, lmp_buffer_ping, lmp_buffer_sink },
+    { "urpc (lmp)", SIZE_MAX, urpc_ping, urpc_sink },
+};
+
+static const struct bench_transport ump_transports[] = {
+    { "ump_send", SIZE_MAX, ump_ping, ump_sink },
+    { "urpc (ump)", SIZE_MAX, urpc_ping, urpc_sink },
+};
+
+
+// MARK: - Measurement
+
+static int compare_samples(const void *a, const void *b) {
+
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+
+}
+
+// Number of iterations for a message size
+static size_t iterations_for_size(size_t size) {
+
+    return MIN(max_iterations, MAX(MIN_ITERATIONS, BYTES_BUDGET / size));
+
+}
+
+// Exchange an URPC message with the server and wait for its reply
+static uint32_t sync_server(struct urpc_chan *chan, urpc_msg_type_t type) {
+
+    errval_t err;
+
+    uint32_t dummy = 0;
+    err = urpc_send(chan, &dummy, sizeof(uint32_t), type);
+    assert(err_is_ok(err));
+
+    void *rx_buf;
+    size_t rx_size;
+    urpc_msg_type_t msg_type;
+    err = urpc_recv_blocking(chan, &rx_buf, &rx_size, &msg_type);
+    assert(err_is_ok(err) && msg_type == type);
+
+    uint32_t count = *(uint32_t *) rx_buf;
+    free(rx_buf);
+
+    return count;
+
+}
+
+// Measure round-trip latency and throughput of one transport and size
+static void bench_run(struct urpc_chan *chan, const struct bench_transport *t,
+                      const char *placement, void *buf, size_t size) {
+
+    errval_t err;
+
+    size_t n = iterations_for_size(size);
+
+    // Warm up caches and TLBs
+    err = t->ping(chan, buf, size);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return;
+    }
+
+    // Round-trip latency
+    for (size_t i = 0; i < n; i++) {
+
+        uint32_t start = get_cycle_count();
+        err = t->ping(chan, buf, size);
+        samples[i] = get_cycle_count() - start;
+
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            return;
+        }
+
+    }
+
+    qsort(samples, n, sizeof(uint32_t), compare_samples);
+
+    // Throughput: stream sinks and wait until the server consumed all of them
+    uint32_t start = get_cycle_count();
+    for (size_t i = 0; i < n; i++) {
+        err = t->sink(chan, buf, size);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            return;
+        }
+    }
+    uint32_t consumed = sync_server(chan, URPC_MessageType_BenchSync);
+    uint32_t cycles = get_cycle_count() - start;
+    assert(consumed == n);
+
+    // Bytes per 1000 cycles
+    uint64_t throughput = ((uint64_t) size * n * 1000) / MAX(cycles, 1);
+
+    printf("%-6s %-16s %8zu %6zu %9u %9u %9u %9u %9u %9u %10llu\n",
+           placement, t->name, size, n,
+           samples[0],
+           samples[n / 2],
+           samples[(n * 90) / 100],
+           samples[(n * 99) / 100],
+           samples[n - 1],
+           samples[n / 2] / 2,
+           throughput);
+
+}
+
+// Run every transport and size over one binding
+static void bench_chan(struct urpc_chan *chan, const struct bench_transport *ts,
+                       size_t num_ts, const char *placement, void *buf) {
+
+    for (size_t i = 0; i < num_ts; i++) {
+        for (size_t j = 0; j < NUM_SIZES; j++) {
+            if (sizes[j] <= ts[i].max_size) {
+                bench_run(chan, &ts[i], placement, buf, sizes[j]);
+            }
+        }
+    }
+
+}
+
+
+// MARK: - Main
+
+// Bind to the benchmark server, run all transports and release the server
+static void bench_server(domainid_t pid, const char *placement, bool use_lmp,
+                         void *buf) {
+
+    errval_t err;
+
+    struct urpc_chan chan;
+    err = urpc_bind(pid, &chan, use_lmp);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return;
+    }
+
+    if (use_lmp) {
+        bench_chan(&chan, lmp_transports,
+                   sizeof(lmp_transports) / sizeof(lmp_transports[0]),
+                   placement, buf);
+    } else {
+        bench_chan(&chan, ump_transports,
+                   sizeof(ump_transports) / sizeof(ump_transports[0]),
+                   placement, buf);
+    }
+
+    // Let the server accept the next binding
+    sync_server(&chan, URPC_MessageType_BenchDone);
+
+}
+
+// Spawn a benchmark server on `core`
+static errval_t spawn_server(coreid_t core, domainid_t *pid) {
+
+    errval_t err;
+
+    err = aos_rpc_process_spawn(aos_rpc_get_init_channel(),
+                                IPCBENCH_SERVER_NAME, core, pid);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+#if PRINT_DEBUG
+    debug_printf("Spawned %s on core %d with PID %d\n",
+                 IPCBENCH_SERVER_NAME, core, *pid);
+#endif
+
+    return SYS_ERR_OK;
+
+}
+
+// Shut a benchmark server down
+static void quit_server(domainid_t pid) {
+
+    errval_t err;
+
+    struct urpc_chan chan;
+    err = urpc_bind(pid, &chan, false);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return;
+    }
+
+    sync_server(&chan, URPC_MessageType_BenchQuit);
+
+}
+
+int main(int argc, char *argv[]) {
+
+    errval_t err;
+
+    max_iterations = argc > 1 ? MAX(atoi(argv[1]), MIN_ITERATIONS) : DEFAULT_ITERATIONS;
+
+    samples = malloc(max_iterations * sizeof(uint32_t));
+    void *buf = malloc(sizes[NUM_SIZES - 1]);
+    assert(samples != NULL && buf != NULL);
+    memset(buf, 0xAB, sizes[NUM_SIZES - 1]);
+
+    coreid_t core = disp_get_core_id();
+
+    // Enable and reset the cycle counter
+    reset_cycle_counter();
+
+    printf("%-6s %-16s %8s %6s %9s %9s %9s %9s %9s %9s %10s\n",
+           "place", "transport", "bytes", "iters", "rtt_min", "rtt_p50",
+           "rtt_p90", "rtt_p99", "rtt_max", "one_way", "B/kcycle");
+
+    // Same-core server over LMP and UMP
+    domainid_t pid;
+    err = spawn_server(core, &pid);
+    if (err_is_ok(err)) {
+        bench_server(pid, "local", true, buf);
+        bench_server(pid, "local", false, buf);
+        quit_server(pid);
+    }
+
+    // Cross-core server (UMP only)
+    err = spawn_server(!core, &pid);
+    if (err_is_ok(err)) {
+        bench_server(pid, "remote", false, buf);
+        quit_server(pid);
+    }
+
+    free(buf);
+    free(samples);
+
+    return EXIT_SUCCESS;
+
+}
@@ -0,0 +1,214 @@
+//
+//  server.c
+//  DoritOS
+//
+//  Partner process of the IPC benchmark. Accepts one binding at a time and
+//  echoes or consumes whatever the client sends until it is told to stop.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <aos/aos.h>
+#include <aos/lmp.h>
+#include <aos/urpc.h>
+#include <aos/aos_rpc.h>
+
+#include "ipcbench.h"
+
+#define PRINT_DEBUG 0
+
+
+// Messages consumed since the last sync
+static uint32_t sink_count = 0;
+
+// Handle a buffer message, returns true if the channel should be closed
+static bool handle_buffer(struct urpc_chan *chan, void *buf, size_t size,
+                          urpc_msg_type_t msg_type, bool *quit) {
+
+    errval_t err;
+
+    switch (msg_type) {
+
+        case URPC_MessageType_BenchPing:
+
+            // Echo the payload
+            err = urpc_send(chan, buf, size, URPC_MessageType_BenchPing);
+            if (err_is_fail(err)) {
+                debug_printf("%s\n", err_getstring(err));
+            }
+            break;
+
+        case URPC_MessageType_BenchSink:
+            sink_count++;
+            break;
+
+        case URPC_MessageType_BenchSync:
+
+            // Report and reset the number of consumed messages
+            err = urpc_send(chan, &sink_count, sizeof(uint32_t),
+                            URPC_MessageType_BenchSync);
+            if (err_is_fail(err)) {
+                debug_printf("%s\n", err_getstring(err));
+            }
+            sink_count = 0;
+            break;
+
+        case URPC_MessageType_BenchDone:
+        case URPC_MessageType_BenchQuit:
+
+            // Acknowledge so the client knows the server is idle again (UMP
+            // drops empty messages, so the ack carries the sink count)
+            err = urpc_send(chan, &sink_count, sizeof(uint32_t), msg_type);
+            if (err_is_fail(err)) {
+                debug_printf("%s\n", err_getstring(err));
+            }
+            *quit = msg_type == URPC_MessageType_BenchQuit;
+            return true;
+
+        default:
+            debug_printf("Unknown benchmark message type %d\n", msg_type);
+            break;
+
+    }
+
+    return false;
+
+}
+
+// Handle a raw lmp_chan_send message, returns true if it was one
+static bool handle_raw_lmp(struct lmp_chan *lc, uintptr_t *words) {
+
+    errval_t err;
+
+    switch (words[0]) {
+
+        case IPCBENCH_LMP_RAW_PING:
+
+            // Echo the payload words
+            do {
+                err = lmp_chan_send9(lc, LMP_FLAG_SYNC, NULL_CAP,
+                                     IPCBENCH_LMP_RAW_PING, words[1], words[2],
+                                     words[3], words[4], words[5], words[6],
+                                     words[7], words[8]);
+            } while (lmp_err_is_transient(err));
+            if (err_is_fail(err)) {
+                debug_printf("%s\n", err_getstring(err));
+            }
+            return true;
+
+        case IPCBENCH_LMP_RAW_SINK:
+            sink_count++;
+            return true;
+
+        default:
+            return false;
+
+    }
+
+}
+
+// Serve a LMP binding until the client is done, returns true on quit
+static bool serve_lmp(struct urpc_chan *chan) {
+
+    errval_t err;
+
+    bool quit = false;
+
+    while (true) {
+
+        // Wait for the next message
+        struct capref cap;
+        struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+        lmp_client_recv(chan->lmp, &cap, &msg);
+
+        // Raw messages skip the buffer protocol entirely
+        if (handle_raw_lmp(chan->lmp, msg.words)) {
+            continue;
+        }
+
+        void *buf;
+        size_t size;
+        uint8_t msg_type;
+        err = lmp_recv_buffer_from_msg(chan->lmp, cap, msg.words, &buf, &size,
+                                       &msg_type);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            continue;
+        }
+
+        bool done = handle_buffer(chan, buf, size, msg_type, &quit);
+
+        free(buf);
+
+        if (done) {
+            return quit;
+        }
+
+    }
+
+}
+
+// Serve a UMP binding until the client is done, returns true on quit
+static bool serve_ump(struct urpc_chan *chan) {
+
+    errval_t err;
+
+    bool quit = false;
+
+    while (true) {
+
+        void *buf;
+        size_t size;
+        urpc_msg_type_t msg_type;
+        err = urpc_recv_blocking(chan, &buf, &size, &msg_type);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            continue;
+        }
+
+        bool done = handle_buffer(chan, buf, size, msg_type, &quit);
+
+        free(buf);
+
+        if (done) {
+            return quit;
+        }
+
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+
+    errval_t err;
+
+    bool quit = false;
+
+    while (!quit) {
+
+        // Accept a binding request from the benchmark client
+        struct urpc_chan chan;
+        err = urpc_accept_blocking(&chan);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            continue;
+        }
+
+#if PRINT_DEBUG
+        debug_printf("Accepted %s binding\n", chan.use_lmp ? "LMP" : "UMP");
+#endif
+
+        sink_count = 0;
+
+        if (chan.use_lmp) {
+            quit = serve_lmp(&chan);
+        } else {
+            quit = serve_ump(&chan);
+        }
+
+    }
+
+    return EXIT_SUCCESS;
+
+}
@@ -106,22 +106,9 @@ void terminal_runloop_dispatch(void) {
         from_addr = packet->addr;
         from_port = packet->port;
         
-        // Iterate to tail
-        struct io_buffer *current;
-        for (current = state.buffer; current->next != NULL; current = current->next);
-        
-        // Iterate all received characters
+        // Append all received characters to the ring buffer
         for (size_t i = 0; i < packet->size; i++) {
-            
-            // Set char and inc
-            current->buf[current->pos++] = packet->payload[i];
-            
-            // Alloc new list if full
-            if (current->pos == IO_BUFFER_SIZE) {
-                io_buffer_init(&current->next);
-                current = current->next;
-            }
-            
+            io_buffer_put(state.buffer, packet->payload[i]);
         }
         
         // Free the packet
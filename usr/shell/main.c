@@ -291,43 +291,27 @@ static void cmd_time(size_t argc, char *argv[], char *buf) {
 static size_t get_input(char *buf, size_t len) {
     errval_t err;
     size_t n = 0;
+    char end;
 
     struct aos_rpc *chan = aos_rpc_get_serial_channel();
 
-    err = lock_terminal(chan, Terminal_Read, 1);
+    // Let the terminal edit and echo the whole line
+    err = aos_rpc_serial_read(chan, buf, len - 1, true, &n, &end);
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
+        return 0;
     }
 
-    {
-        for (size_t i = 0; i < len; i++) {
-
-            char c;
-
-            err = aos_rpc_serial_getchar(chan, &c);
-            if (err_is_fail(err)) {
-                debug_printf("%s\n", err_getstring(err));
-            }
-
-            if (c == 0x04 || c == 0x0A || c == 0x0D) {
-                break;
-            } else if (c == 0x03) {
-                return 0;
-            }
-            n = i + 1;
-            buf[i] = c;
-
-            err = aos_rpc_serial_putchar(chan, c);
-            if (err_is_fail(err)) {
-                debug_printf("%s\n", err_getstring(err));
-            }
-        }
+    // Interrupted
+    if (end == 0x03) {
+        return 0;
     }
 
-    err = lock_terminal(chan, Terminal_Read, 0);
-    if (err_is_fail(err)) {
-        debug_printf("%s\n", err_getstring(err));
+    // Strip the newline
+    if (n > 0 && buf[n - 1] == '\n') {
+        n--;
     }
+    buf[n] = '\0';
 
     return n;
 }
@@ -368,7 +352,6 @@ int main(int argc, char *argv[]) {
         memset(buf, 0, BUF_SIZE);
 
         len = get_input((char *) buf, BUF_SIZE);
-        printf("\n");
 
 
         num_args = (len == 0) ? 0 : parse_args(args, len, buf, argstring);
@@ -431,7 +414,17 @@ int main(int argc, char *argv[]) {
 
                     // Spawn process
                     domainid_t pid;
-                    err = aos_rpc_process_spawn_with_terminal(aos_rpc_get_init_channel(), buf, 1, disp_get_terminal_pid(), &pid);
+                    if (strchr(args[0], '/') != NULL) {
+                        // Stream the binary from the filesystem (init caches
+                        // the image until the file changes)
+                        struct fs_fileinfo info;
+                        if (err_is_fail(filesystem_stat(args[0], &info))) {
+                            info.version = 0;
+                        }
+                        err = aos_rpc_process_spawn_file(aos_rpc_get_init_channel(), buf, disp_get_terminal_pid(), info.version, &pid);
+                    } else {
+                        err = aos_rpc_process_spawn_with_terminal(aos_rpc_get_init_channel(), buf, 1, disp_get_terminal_pid(), &pid);
+                    }
                     if (err_is_fail(err)) {
                         printf("%s: command not found\n", args[0]);
                     } else if (wait) {
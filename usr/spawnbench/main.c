@@ -0,0 +1,219 @@
+//
+//  main.c
+//  DoritOS
+//
+//  Spawn microbenchmark. Repeatedly spawns and reaps a trivial child on the
+//  same and on the other core, reports spawn and reap latency percentiles and
+//  prints the per-phase histograms recorded by init on each core.
+//
+//  Usage: spawnbench [iterations]
+//         spawnbench child     (exits immediately)
+//         spawnbench stats     (prints the histograms of the local init)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/aos_rpc.h>
+#include <aos/spawn_trace.h>
+#include <barrelfish_kpi/asm_inlines_arch.h>
+
+#define PRINT_DEBUG 0
+
+#define DEFAULT_ITERATIONS  1000
+#define MIN_ITERATIONS      8
+
+// Spawn and reap samples in cycles
+static uint32_t *spawn_samples;
+static uint32_t *reap_samples;
+
+
+// MARK: - Statistics
+
+static int compare_samples(const void *a, const void *b) {
+
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+
+}
+
+// Estimate a percentile from a log2 histogram (upper bound of the bucket)
+static uint32_t hist_percentile(const struct spawn_trace_hist *hist, size_t pct) {
+
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    size_t rank = MAX(1, (hist->count * pct + 99) / 100);
+    size_t seen = 0;
+
+    for (size_t i = 0; i < SPAWN_TRACE_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            uint32_t bound = i + 1 < SPAWN_TRACE_BUCKETS ? (1U << (i + 1)) - 1 : UINT32_MAX;
+            return MIN(bound, hist->max);
+        }
+    }
+
+    return hist->max;
+
+}
+
+// Print the histograms of the local init
+static errval_t print_stats(void) {
+
+    errval_t err;
+
+    struct spawn_trace_msg *msg;
+    err = aos_rpc_get_spawn_stats(aos_rpc_get_init_channel(), &msg);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+    printf("spawn phases on core %d (cycles, p50/p99 are bucket bounds)\n",
+           msg->core_id);
+
+    for (uint32_t i = 0; i < msg->count; i++) {
+
+        struct spawn_trace_stats *stats = &msg->stats[i];
+
+        printf("%s\n", stats->name);
+        printf("  %-12s %8s %10s %10s %10s %10s %10s\n", "phase", "count",
+               "min", "avg", "p50", "p99", "max");
+
+        for (size_t p = 0; p < SpawnPhase_Count; p++) {
+
+            struct spawn_trace_hist *hist = &stats->phases[p];
+            if (hist->count == 0) {
+                continue;
+            }
+
+            printf("  %-12s %8u %10u %10llu %10u %10u %10u\n",
+                   spawn_phase_name(p), hist->count, hist->min,
+                   hist->sum / hist->count,
+                   hist_percentile(hist, 50), hist_percentile(hist, 99),
+                   hist->max);
+
+        }
+
+    }
+
+    free(msg);
+
+    return SYS_ERR_OK;
+
+}
+
+
+// MARK: - Benchmark
+
+// Spawn and reap the child n times on a core
+static void bench_core(coreid_t core, size_t n) {
+
+    errval_t err;
+
+    struct aos_rpc *chan = aos_rpc_get_init_channel();
+
+    for (size_t i = 0; i < n; i++) {
+
+        domainid_t pid;
+
+        uint32_t start = get_cycle_count();
+        err = aos_rpc_process_spawn(chan, "spawnbench child", core, &pid);
+        uint32_t spawned = get_cycle_count();
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            return;
+        }
+
+        // Wait for the child to exit
+        err = aos_rpc_process_deregister_notify(pid);
+        uint32_t reaped = get_cycle_count();
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            return;
+        }
+
+        spawn_samples[i] = spawned - start;
+        reap_samples[i] = reaped - spawned;
+
+#if PRINT_DEBUG
+        debug_printf("Iteration %zu: pid %d\n", i, pid);
+#endif
+
+    }
+
+    qsort(spawn_samples, n, sizeof(uint32_t), compare_samples);
+    qsort(reap_samples, n, sizeof(uint32_t), compare_samples);
+
+    const char *placement = core == disp_get_core_id() ? "local" : "remote";
+    uint32_t *sets[] = { spawn_samples, reap_samples };
+    const char *names[] = { "spawn", "reap" };
+
+    for (size_t s = 0; s < 2; s++) {
+        printf("%-6s %-6s %6zu %9u %9u %9u %9u %9u\n", placement, names[s], n,
+               sets[s][0],
+               sets[s][n / 2],
+               sets[s][(n * 90) / 100],
+               sets[s][(n * 99) / 100],
+               sets[s][n - 1]);
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+
+    errval_t err;
+
+    // Child instance, nothing to do
+    if (argc > 1 && !strcmp(argv[1], "child")) {
+        return EXIT_SUCCESS;
+    }
+
+    // Stats instance, report the histograms of this core's init
+    if (argc > 1 && !strcmp(argv[1], "stats")) {
+        print_stats();
+        return EXIT_SUCCESS;
+    }
+
+    size_t n = argc > 1 ? MAX(atoi(argv[1]), MIN_ITERATIONS) : DEFAULT_ITERATIONS;
+
+    spawn_samples = malloc(n * sizeof(uint32_t));
+    reap_samples = malloc(n * sizeof(uint32_t));
+    assert(spawn_samples != NULL && reap_samples != NULL);
+
+    coreid_t core = disp_get_core_id();
+
+    // The cycle counter has already been enabled by init's spawn tracing
+
+    printf("%-6s %-6s %6s %9s %9s %9s %9s %9s\n", "place", "op", "iters",
+           "min", "p50", "p90", "p99", "max");
+
+    bench_core(core, n);
+    bench_core(!core, n);
+
+    free(spawn_samples);
+    free(reap_samples);
+
+    // Phase breakdown on this core
+    print_stats();
+
+    // Phase breakdown on the other core (histograms live in that core's init)
+    domainid_t pid;
+    err = aos_rpc_process_spawn(aos_rpc_get_init_channel(), "spawnbench stats",
+                                !core, &pid);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return EXIT_FAILURE;
+    }
+
+    aos_rpc_process_deregister_notify(pid);
+
+    return EXIT_SUCCESS;
+
+}
@@ -33,17 +33,8 @@ static void serial_interrupt_handler(void *arg) {
 
     char c = get_char();
 
-    // Iterate to tail
-    struct io_buffer *current;
-    for (current = st->buffer; current->next != NULL; current = current->next);
-
-    // Set char and inc
-    current->buf[current->pos++] = c;
-
-    // Alloc new list if full
-    if (current->pos == IO_BUFFER_SIZE) {
-        io_buffer_init(&current->next);
-    }
+    // Append to the ring buffer (dropped if the reader can't keep up)
+    io_buffer_put(st->buffer, c);
 }
 
 void terminal_ready(void) {